@@ -41,6 +41,12 @@
 #include "src/rules/rules.h"
 
 #include "webfunctions.h"
+#include "logbuffer.h"
+#include "serialframe.h"
+#include "pollscheduler.h"
+#include "commandqueue.h"
+#include "serialstats.h"
+#include "profiler.h"
 #include "decode.h"
 #include "commands.h"
 #include "rules.h"
@@ -68,6 +74,8 @@ void setupOTA();
 void mqtt_reconnect();
 bool readSerial();
 bool send_command(byte* command, int length);
+bool send_datagram(byte* datagram, int length);
+bool send_setting(uint8_t command, byte* datagram, int length);
 void mqttPublish(char* topic, char* subtopic, char* value);
 void mqttPublish(char* topic, char* subtopic, char* value, bool retain);
 #ifdef ESP8266
@@ -110,8 +118,7 @@ static int uploadpercentage = 0;
 
 // instead of passing array pointers between functions we just define this in the global scope
 #define MAXDATASIZE 255
-char data[MAXDATASIZE] = { '\0' };
-byte data_length = 0;
+serialFrame_t serialFrame; //receive ring of the heatpump serial line, parsed as the bytes come in
 
 #ifdef ESP32
 //for received proxied data
@@ -121,7 +128,7 @@ byte proxydata_length = 0;
 Adafruit_NeoPixel pixels(1, LEDPIN);
 //for the vTask
 QueueHandle_t pcbQueue = NULL;
-QueueHandle_t cmdQueue = NULL;
+SemaphoreHandle_t cmdMutex = NULL;
 QueueHandle_t logQueue = NULL;
 #endif
 
@@ -144,19 +151,6 @@ bool dallasMqttRestorePending = false;
 unsigned long dallasMqttRestoreStart = 0;
 #define DALLAS_MQTT_RESTORE_TIMEOUT 3000
 
-// can't have too much in buffer due to memory shortage
-#define MAXCOMMANDSINBUFFER 10
-
-// buffer for commands to send
-struct cmdbuffer_t {
-  uint8_t length;
-  byte data[128];
-} cmdbuffer[MAXCOMMANDSINBUFFER];
-
-static uint8_t cmdstart = 0;
-static uint8_t cmdend = 0;
-static uint8_t cmdnrel = 0;
-
 
 
 // mqtt
@@ -177,9 +171,6 @@ PubSubClient mqtt_client(mqtt_wifi_client);
 
 bool firstConnectSinceBoot = true; //if this is true there is no first connection made yet
 
-struct timerqueue_t **timerqueue = NULL;
-int timerqueue_size = 0;
-
 #ifdef ESP32
 #define ETH_TYPE        ETH_PHY_W5500
 #define ETH_ADDR         1
@@ -562,44 +553,209 @@ void blinkNeoPixel(bool status) {
 #endif  
 
 
+/*
+ * Log messages are queued in the log buffer and written out
+ * from loop() by log_loop(). Every sink keeps its own position,
+ * a sink that can't keep up loses the oldest messages instead
+ * of delaying the caller.
+ */
 void log_message(char* string)
 {
-#ifdef ESP32
-  if (!inSetup) blinkNeoPixel(true);
-#endif
-  time_t rawtime;
-  rawtime = time(NULL);
-  struct tm *timeinfo = localtime(&rawtime);
+  logbufferAdd(string, strlen(string), LOG_TO_ALL);
+  if (inSetup) {
+    // the main loop doesn't run yet
+    log_loop();
+  }
+}
+
+static uint16_t format_log_line(logRecord_t *rec, char *out, uint16_t size) {
   char timestring[32];
-  strftime(timestring, 32, "%c", timeinfo);
-  size_t len = strlen(string) + strlen(timestring) + 32; //+32 long enough to contain millis() and the json part later for websocket mesg
-  char* log_line = (char *) malloc(len);
-  snprintf(log_line, len, "%s (%lu): %s", timestring, millis(), string);
-
-  if (heishamonSettings.logSerial1) {
-    loggingSerial.println(log_line);
-  }
-  if (heishamonSettings.logMqtt && mqtt_client.connected())
-  {
-    char log_topic[256];
-    sprintf(log_topic, "%s/%s", heishamonSettings.mqtt_topic_base, mqtt_logtopic);
-
-    if (!mqtt_client.publish(log_topic, log_line)) {
-      if (heishamonSettings.logSerial1) {
-        loggingSerial.print(millis());
-        loggingSerial.print(F(": "));
-        loggingSerial.println(F("MQTT publish log message failed!"));
+  time_t rawtime = rec->time;
+  strftime(timestring, sizeof(timestring), "%c", localtime(&rawtime));
+  int len = snprintf_P(out, size, PSTR("%s (%lu): %s"), timestring, (unsigned long)rec->millis, LOGRECORD_TEXT(rec));
+  if (len < 0) {
+    return 0;
+  }
+  return (len < size) ? len : size - 1;
+}
+
+// appends text as json string content, returns the new length or 0 when it does not fit
+static uint16_t append_json_escaped(char *out, uint16_t pos, uint16_t size, const char *text) {
+  for (; *text != '\0'; text++) {
+    if (pos + 2 >= size) {
+      return 0;
+    }
+    switch (*text) {
+      case '"': out[pos++] = '\\'; out[pos++] = '"'; break;
+      case '\\': out[pos++] = '\\'; out[pos++] = '\\'; break;
+      case '\n': out[pos++] = '\\'; out[pos++] = 'n'; break;
+      case '\r': break;
+      default: out[pos++] = ((unsigned char)*text < 0x20) ? ' ' : *text; break;
+    }
+  }
+  return pos;
+}
+
+#define LOG_LINE_SIZE (48 + LOGBUFFER_MAX_LEN)
+#define LOG_MQTT_SIZE 768 // below the mqtt client buffer of 1024 bytes
+#define LOG_WEBSOCKET_SIZE 1024
+
+static char log_serial_line[LOG_LINE_SIZE];
+static uint16_t log_serial_len = 0;
+static uint16_t log_serial_pos = 0;
+
+static char log_payload[LOG_WEBSOCKET_SIZE];
+
+/*
+ * Only writes what fits in the serial transmit buffer,
+ * the rest of a line follows on the next loop.
+ */
+static void log_loop_serial() {
+  if (!heishamonSettings.logSerial1) {
+    logbufferSkip(LOG_SINK_SERIAL);
+    log_serial_len = log_serial_pos = 0;
+    return;
+  }
+  while (true) {
+    if (log_serial_pos == log_serial_len) {
+      uint16_t dropped = logbufferDropped(LOG_SINK_SERIAL);
+      logRecord_t *rec = NULL;
+      if (dropped > 0) {
+        log_serial_len = snprintf_P(log_serial_line, sizeof(log_serial_line), PSTR("(%u log messages dropped)\r\n"), dropped);
+      } else if ((rec = logbufferPeek(LOG_SINK_SERIAL)) != NULL) {
+        log_serial_len = format_log_line(rec, log_serial_line, sizeof(log_serial_line) - 2);
+        log_serial_line[log_serial_len++] = '\r';
+        log_serial_line[log_serial_len++] = '\n';
+        logbufferNext(LOG_SINK_SERIAL);
+      } else {
+        log_serial_len = log_serial_pos = 0;
+        return;
       }
-      mqtt_client.disconnect();
+      log_serial_pos = 0;
     }
+    int room = loggingSerial.availableForWrite();
+    if (room <= 0) {
+      return;
+    }
+    uint16_t len = log_serial_len - log_serial_pos;
+    if (len > room) {
+      len = room;
+    }
+    loggingSerial.write((const uint8_t *)&log_serial_line[log_serial_pos], len);
+    log_serial_pos += len;
   }
-  //send log message to websocket
-  snprintf(log_line, len+12, "{\"logMsg\":\"%s (%lu): %s\"}", timestring, millis(), string);
-  websocket_write_all(log_line, strlen(log_line));
-  free(log_line);
+}
+
+/*
+ * Publishes the pending lines in one message, while the client is
+ * disconnected the lines wait in the log buffer.
+ */
+static void log_loop_mqtt() {
+  if (!heishamonSettings.logMqtt) {
+    logbufferSkip(LOG_SINK_MQTT);
+    return;
+  }
+  if (!mqtt_client.connected()) {
+    return;
+  }
+  uint16_t len = 0;
+  uint16_t dropped = logbufferDropped(LOG_SINK_MQTT);
+  if (dropped > 0) {
+    len = snprintf_P(log_payload, LOG_MQTT_SIZE, PSTR("(%u log messages dropped)"), dropped);
+  }
+  logRecord_t *rec = NULL;
+  while ((rec = logbufferPeek(LOG_SINK_MQTT)) != NULL) {
+    uint16_t pos = (len > 0) ? len + 1 : 0;
+    if (pos + 64 > LOG_MQTT_SIZE) {
+      break;
+    }
+    uint16_t linelen = format_log_line(rec, &log_payload[pos], LOG_MQTT_SIZE - pos);
+    if (len > 0 && pos + linelen + 1 >= LOG_MQTT_SIZE) {
+      // truncated, it goes out on its own next time
+      break;
+    }
+    if (len > 0) {
+      log_payload[len] = '\n';
+    }
+    len = pos + linelen;
+    logbufferNext(LOG_SINK_MQTT);
+  }
+  if (len == 0) {
+    return;
+  }
+  log_payload[len] = '\0';
+
+  char log_topic[256];
+  sprintf_P(log_topic, PSTR("%s/%s"), heishamonSettings.mqtt_topic_base, mqtt_logtopic);
+  if (!mqtt_client.publish(log_topic, log_payload)) {
+    char msg[40];
+    strcpy_P(msg, PSTR("MQTT publish log message failed!"));
+    logbufferAdd(msg, strlen(msg), LOG_TO_SERIAL);
+    mqtt_client.disconnect();
+  }
+}
+
+/*
+ * Sends the pending lines as one logMsg frame,
+ * the webpage splits them on the newlines.
+ */
+static void log_loop_websocket() {
+  if (websocket_clients() == 0) {
+    logbufferSkip(LOG_SINK_WEBSOCKET);
+    return;
+  }
+  char line[LOG_LINE_SIZE];
+  uint16_t len = 0, start = 0;
+
+  len = start = snprintf_P(log_payload, sizeof(log_payload), PSTR("{\"logMsg\":\""));
+
+  uint16_t dropped = logbufferDropped(LOG_SINK_WEBSOCKET);
+  if (dropped > 0) {
+    len += snprintf_P(&log_payload[len], sizeof(log_payload) - len, PSTR("(%u log messages dropped)"), dropped);
+  }
+  logRecord_t *rec = NULL;
+  while ((rec = logbufferPeek(LOG_SINK_WEBSOCKET)) != NULL) {
+    uint16_t pos = len;
+    format_log_line(rec, line, sizeof(line));
+    if (pos > start) {
+      log_payload[pos++] = '\\';
+      log_payload[pos++] = 'n';
+    }
+    // keep room for the closing "}
+    pos = append_json_escaped(log_payload, pos, sizeof(log_payload) - 3, line);
+    if (pos == 0) {
+      if (len > start) {
+        break;
+      }
+      // a single line that does not fit is dropped
+      logbufferNext(LOG_SINK_WEBSOCKET);
+      continue;
+    }
+    len = pos;
+    logbufferNext(LOG_SINK_WEBSOCKET);
+  }
+  if (len == start) {
+    return;
+  }
+  log_payload[len++] = '"';
+  log_payload[len++] = '}';
+  log_payload[len] = '\0';
+  websocket_write_all(log_payload, len);
+}
+
+void log_loop() {
 #ifdef ESP32
-  if (!inSetup) blinkNeoPixel(false);
-#endif  
+  bool pending = logbufferPeek(LOG_SINK_SERIAL) != NULL || logbufferPeek(LOG_SINK_MQTT) != NULL || logbufferPeek(LOG_SINK_WEBSOCKET) != NULL;
+  if (pending && !inSetup) blinkNeoPixel(true);
+#endif
+  log_loop_serial();
+  log_loop_mqtt();
+  log_loop_websocket();
+  // lines the mqtt sink logged itself
+  log_loop_serial();
+#ifdef ESP32
+  if (pending && !inSetup) blinkNeoPixel(false);
+#endif
 }
 
 void logHex(char *hex, byte hex_len) {
@@ -718,133 +874,145 @@ void readProxy()
 
 bool readSerial()
 {
+  bool decoded = false;
   int len = 0;
-  while ((heatpumpSerial.available()) && ((data_length + len) < MAXDATASIZE)) {
-    data[data_length + len] = heatpumpSerial.read(); //read available data and place it after the last received data
+  while ((heatpumpSerial.available()) && (serialFrameRoom(&serialFrame) > 0)) {
+    serialFramePut(&serialFrame, heatpumpSerial.read()); //the parser resyncs on the next header itself, so nothing is thrown away here
     len++;
   }
 
-  if ((len > 0) && (data_length == 0 )) totalreads++; //this is the start of a new read
-  data_length += len;
+  if ((len > 0) && (serialFramePending(&serialFrame) == len)) totalreads++; //this is the start of a new read
+  if (len > 0) serialStatsRead(len, millis());
 
-  if (data_length > 3) { //should have received length part of header now
+  uint8_t result = SERIALFRAME_NONE;
+  while ((result = serialFrameParse(&serialFrame)) != SERIALFRAME_NONE) {
+    char *data = serialFrame.frame; //points into the receive ring, the decoders read it in place
+    byte data_length = serialFrame.len;
 
-    if (((data[0] != 0x71) && (data[0] != 0x31)) || (data[2] != 0x01))  { //wrong header received!
+    if (result == SERIALFRAME_BADHEADER) {
       if (heishamonSettings.logHexdump) {
-        log_message(_F("Received bad header. Ignoring this data!"));
-        logHex(data, len);
+        log_message(_F("Received bad header. Skipping to the next header."));
+        logHex(data, data_length);
       }
       badheaderread++;
-      data_length = 0;
-      return false;
+      continue;
     }
 
-    if ((data_length > (data[1] + 3)) || (data_length >= MAXDATASIZE) ) {
-      log_message(_F("Received more data than header suggests! Ignoring this as this is bad data."));
+    if (result == SERIALFRAME_TOOLONG) {
+      log_message(_F("Received a length in the header that is too long! Skipping to the next header."));
       if (heishamonSettings.logHexdump) logHex(data, data_length);
-      data_length = 0;
       toolongread++;
-      return false;
+      continue;
     }
 
-    if (data_length == (data[1] + 3)) { //we received all data (data[1] is header length field)
-      sprintf_P(log_msg, PSTR("Received %d bytes data"), data_length); log_message(log_msg);
-      sending = false; //we received an answer after our last command so from now on we can start a new send request again
-      if (heishamonSettings.logHexdump) logHex(data, data_length);
-      if (! isValidReceiveChecksum(data, data_length) ) {
-        log_message(_F("Checksum received false!"));
-        data_length = 0; //for next attempt
-        badcrcread++;
-        return false;
-      }
-      log_message(_F("Checksum and header received ok!"));
-      goodreads++;
-
-      if (data_length == DATASIZE)  {  //receive a full data block
-        if  (data[3] == 0x10) { //decode the normal data block
-          decode_heatpump_data(data, actData, mqtt_client, log_message, heishamonSettings.mqtt_topic_base, heishamonSettings.updateAllTime);
-          if ( (!extraDataBlockAvailable) && ((actData[0] == 0x71) && (actData[0xc7] >= 3)) ) { //do we have valid header and byte 0xc7 is more or equal 3 then assume K&L and more series
-            log_message(_F("Extra data available on this heatpump"));
-            extraDataBlockAvailable = true; //request for extra data next run
-          }
-          #ifdef RAWDEBUG
-          {
-            char mqtt_topic[256];
-            sprintf(mqtt_topic, "%s/raw/data", heishamonSettings.mqtt_topic_base);
-            mqtt_client.publish(mqtt_topic, (const uint8_t *)actData, DATASIZE, false); //do not retain this raw data
-          }
-          #endif
-          data_length = 0;
-          return true;
-        } else if (data[3] == 0x21) { //decode the new model extra data block
-          extraDataBlockAvailable = true; //set the flag to true so we know we can request this data always
-          decode_heatpump_data_extra(data, actDataExtra, mqtt_client, log_message, heishamonSettings.mqtt_topic_base, heishamonSettings.updateAllTime);
-          #ifdef RAWDEBUG
-          {
-            char mqtt_topic[256];
-            sprintf(mqtt_topic, "%s/raw/dataextra", heishamonSettings.mqtt_topic_base);
-            mqtt_client.publish(mqtt_topic, (const uint8_t *)actDataExtra, DATASIZE, false); //do not retain this raw data
-          }
-          #endif
-          data_length = 0;
-          return true;
-        } else {
+    sprintf_P(log_msg, PSTR("Received %d bytes data"), data_length); log_message(log_msg);
+    sending = false; //we received an answer after our last command so from now on we can start a new send request again
+    serialStatsFrame(millis());
+    if (heishamonSettings.logHexdump) logHex(data, data_length);
+    if (result == SERIALFRAME_BADCRC) {
+      log_message(_F("Checksum received false!"));
+      badcrcread++;
+      continue;
+    }
+    log_message(_F("Checksum and header received ok!"));
+    goodreads++;
+
+    if (heishamonSettings.coalesceRules) rules_batch_begin(); //the rules run once the datagram is decoded
+    if (data_length == DATASIZE)  {  //receive a full data block
+      if  (data[3] == 0x10) { //decode the normal data block
+        uint32_t state = heatpumpState(actData);
+        unsigned int changed = decode_heatpump_data(data, actData, mqtt_client, log_message, heishamonSettings.mqtt_topic_base, heishamonSettings.updateAllTime);
+        uint32_t newState = heatpumpState(actData);
+        pollSchedulerUpdate(POLL_MAIN, changed, newState != state, (newState & HEATPUMP_STATE_RUNNING) != 0, millis()); //poll faster while things change
+        if ( (!extraDataBlockAvailable) && ((actData[0] == 0x71) && (actData[0xc7] >= 3)) ) { //do we have valid header and byte 0xc7 is more or equal 3 then assume K&L and more series
+          log_message(_F("Extra data available on this heatpump"));
+          extraDataBlockAvailable = true; //request for extra data next run
+        }
+        #ifdef RAWDEBUG
+        {
+          char mqtt_topic[256];
+          sprintf(mqtt_topic, "%s/raw/data", heishamonSettings.mqtt_topic_base);
+          mqtt_client.publish(mqtt_topic, (const uint8_t *)actData, DATASIZE, false); //do not retain this raw data
+        }
+        #endif
+        decoded = true;
+      } else if (data[3] == 0x21) { //decode the new model extra data block
+        extraDataBlockAvailable = true; //set the flag to true so we know we can request this data always
+        unsigned int changed = decode_heatpump_data_extra(data, actDataExtra, mqtt_client, log_message, heishamonSettings.mqtt_topic_base, heishamonSettings.updateAllTime);
+        pollSchedulerUpdate(POLL_EXTRA, changed, false, (heatpumpState(actData) & HEATPUMP_STATE_RUNNING) != 0, millis());
+        #ifdef RAWDEBUG
+        {
+          char mqtt_topic[256];
+          sprintf(mqtt_topic, "%s/raw/dataextra", heishamonSettings.mqtt_topic_base);
+          mqtt_client.publish(mqtt_topic, (const uint8_t *)actDataExtra, DATASIZE, false); //do not retain this raw data
+        }
+        #endif
+        decoded = true;
+      } else {
 #ifdef ESP8266
-          log_message(_F("Received an unknown full size datagram. Can't decode this yet."));
+        log_message(_F("Received an unknown full size datagram. Can't decode this yet."));
 #else 
-          log_message(_F("Received a full size datagram but not for me. Forwarding to proxy port."));
-          proxySerial.write(data,data_length);
+        log_message(_F("Received a full size datagram but not for me. Forwarding to proxy port."));
+        proxySerial.write(data,data_length);
 #endif               
-          data_length = 0;
-          return false;
-        }
-      }
-      else if (data_length == OPTDATASIZE ) { //optional pcb acknowledge answer
-        log_message(_F("Received optional PCB ack answer. Decoding this in OPT topics."));
-        decode_optional_heatpump_data(data, actOptData, mqtt_client, log_message, heishamonSettings.mqtt_topic_base, heishamonSettings.updateAllTime);
-        data_length = 0;
-        return true;
       }
-      else {
+    }
+    else if (data_length == OPTDATASIZE ) { //optional pcb acknowledge answer
+      log_message(_F("Received optional PCB ack answer. Decoding this in OPT topics."));
+      decode_optional_heatpump_data(data, actOptData, mqtt_client, log_message, heishamonSettings.mqtt_topic_base, heishamonSettings.updateAllTime);
+      decoded = true;
+    }
+    else {
 #ifdef ESP8266
-        log_message(_F("Received a shorter datagram. Can't decode this yet."));
+      log_message(_F("Received a shorter datagram. Can't decode this yet."));
 #else
-        log_message(_F("Received a shorter datagram but not for me. Forwarding to proxy port."));
-        proxySerial.write(data,data_length);
+      log_message(_F("Received a shorter datagram but not for me. Forwarding to proxy port."));
+      proxySerial.write(data,data_length);
 #endif           
-        data_length = 0;
-        return false;
-      }
     }
+    rules_batch_end();
   }
-  return false;
+  return decoded;
 }
 
 void popCommandBuffer() {
   // to make sure we can pop a command from the buffer
-  if ((!sending) && cmdnrel > 0) {
-    send_command(cmdbuffer[cmdstart].data, cmdbuffer[cmdstart].length);
-    cmdstart = (cmdstart + 1) % (MAXCOMMANDSINBUFFER);
-    cmdnrel--;
+  if (!sending) {
+    byte datagram[COMMANDQUEUE_DATA_SIZE];
+    uint8_t length = commandQueuePop(datagram, millis());
+    if (length > 0) {
+      log_message(_F("Sending command from buffer"));
+      send_datagram(datagram, length);
+    }
   }
 }
 
-void pushCommandBuffer(byte* command, int length) {
-  if (cmdnrel + 1 > MAXCOMMANDSINBUFFER) {
+// key is 1 + the index in commands[] for set commands, 0 for anything else
+bool pushCommandBuffer(byte* command, int length, byte chk, uint8_t key, uint8_t flags) {
+  if (length >= COMMANDQUEUE_DATA_SIZE) {
+    log_message(_F("Command too long for the buffer. Ignoring this command.\n"));
+    return false;
+  }
+#ifdef ESP32
+  xSemaphoreTake(cmdMutex, portMAX_DELAY);
+#endif
+  uint8_t result = commandQueuePush(command, length, chk, key, flags, millis());
+#ifdef ESP32
+  xSemaphoreGive(cmdMutex);
+#endif
+  if (result == COMMANDQUEUE_FULL) {
     log_message(_F("Too much commands already in buffer. Ignoring this commands.\n"));
-    return;
+    return false;
+  }
+  if (result == COMMANDQUEUE_REPLACED) {
+    log_message(_F("Replaced the buffered command for this setting"));
   }
-  cmdbuffer[cmdend].length = length;
-  memcpy(&cmdbuffer[cmdend].data, command, length);
-  cmdend = (cmdend + 1) % (MAXCOMMANDSINBUFFER);
-  cmdnrel++;
+  return true;
 }
 
 #ifdef ESP32
 void serialTXTask(void *pvParameters) {
   unsigned long lastPCBSendTime = 0;
-  unsigned long lastHPSendTime = 0;
-  unsigned long lastHPExtraSendTime = 0;
   unsigned long lastPCBSaveTime = 0;
   char local_log_msg[LOG_MSG_SIZE];
 
@@ -869,6 +1037,7 @@ void serialTXTask(void *pvParameters) {
         byte chk = calcChecksum(localPCBQuery, OPTIONALPCBQUERYSIZE);
         heatpumpSerial.write(localPCBQuery, OPTIONALPCBQUERYSIZE);
         heatpumpSerial.write(chk);
+        serialStatsSent(false, now);
         sprintf_P(local_log_msg, PSTR("optional PCB datagram sent bytes: %d"), OPTIONALPCBQUERYSIZE + 1);
         xQueueSend(logQueue,local_log_msg,0);
       }
@@ -879,30 +1048,28 @@ void serialTXTask(void *pvParameters) {
       }
     }
 
-    // second priority: static heatpump query every waitTime seconds
+    // second priority: heatpump query, as often as its topics change
     if ((!sending) && (!heishamonSettings.listenonly)) {
-      if ((unsigned long)(now - lastHPSendTime) >= (1000 * heishamonSettings.waitTime)) {
+      if (pollSchedulerDue(POLL_MAIN, now)) {
         sending = true;
         sendCommandReadTime = now;
-        lastHPSendTime = now;
-        byte chk = calcChecksum(panasonicQuery, PANASONICQUERYSIZE);
         heatpumpSerial.write(panasonicQuery, PANASONICQUERYSIZE);
-        heatpumpSerial.write(chk);
+        heatpumpSerial.write(PANASONICQUERYCHK);
+        serialStatsSent(false, now);
         sprintf_P(local_log_msg, PSTR("heatpump request query sent bytes: %d"), PANASONICQUERYSIZE + 1);
         xQueueSend(logQueue,local_log_msg,0);    
       }
     }
 
-    // third priority: extra data block query every waitTime seconds (offset from basic query)
+    // third priority: extra data block query, on its own schedule (offset from basic query)
     if ((!sending) && (!heishamonSettings.listenonly) && extraDataBlockAvailable) {
-      if ((unsigned long)(now - lastHPExtraSendTime) >= (1000 * heishamonSettings.waitTime)) {
-        lastHPExtraSendTime = now;
+      if (pollSchedulerDue(POLL_EXTRA, now)) {
         sending = true;
         sendCommandReadTime = now;
         panasonicQuery[3] = 0x21;
-        byte chk = calcChecksum(panasonicQuery, PANASONICQUERYSIZE);
         heatpumpSerial.write(panasonicQuery, PANASONICQUERYSIZE);
-        heatpumpSerial.write(chk);
+        heatpumpSerial.write(PANASONICEXTRAQUERYCHK);
+        serialStatsSent(false, now);
         panasonicQuery[3] = 0x10;
         xQueueSend(logQueue, (void*)"heatpump extra query sent", 0);
       }
@@ -910,14 +1077,16 @@ void serialTXTask(void *pvParameters) {
 
     // lowest priority: user commands from queue
     if ((!sending) && (!heishamonSettings.listenonly)) {
-      struct cmdbuffer_t cmd;
-      if (xQueueReceive(cmdQueue, &cmd, 0) == pdTRUE) {
+      byte datagram[COMMANDQUEUE_DATA_SIZE];
+      xSemaphoreTake(cmdMutex, portMAX_DELAY);
+      uint8_t length = commandQueuePop(datagram, now);
+      xSemaphoreGive(cmdMutex);
+      if (length > 0) {
         sending = true;
         sendCommandReadTime = now;
-        byte chk = calcChecksum(cmd.data, cmd.length);
-        heatpumpSerial.write(cmd.data, cmd.length);
-        heatpumpSerial.write(chk);
-        sprintf_P(local_log_msg, PSTR("Command datagram sent bytes: %d"), cmd.length + 1);
+        heatpumpSerial.write(datagram, length); //already ends with the checksum
+        serialStatsSent(datagram[0] == 0xF1 && datagram[1] == 0x6C, now);
+        sprintf_P(local_log_msg, PSTR("Command datagram sent bytes: %d"), length);
         xQueueSend(logQueue,local_log_msg,0);      
       }
     }
@@ -925,35 +1094,31 @@ void serialTXTask(void *pvParameters) {
     vTaskDelay(1 / portTICK_PERIOD_MS);
   }
 }
-bool send_command(byte* command, int length) {
+static bool send_frame(byte* command, int length, byte chk) {
   if ( heishamonSettings.listenonly ) {
     log_message(_F("Not sending this command. Heishamon in listen only mode!"));
     return false;
   }
-  struct cmdbuffer_t cmd;
-  cmd.length = length;
-  memcpy(&cmd.data, command, length);
-  xQueueSend(cmdQueue, &cmd, 0);
-  return true;
+  return pushCommandBuffer(command, length, chk, 0, 0);
 }
 
 #else
 
-bool send_command(byte* command, int length) {
+static bool send_frame(byte* command, int length, byte chk) {
   if ( heishamonSettings.listenonly ) {
     log_message(_F("Not sending this command. Heishamon in listen only mode!"));
     return false;
   }
   if ( sending ) {
     log_message(_F("Already sending data. Buffering this send request"));
-    pushCommandBuffer(command, length);
+    pushCommandBuffer(command, length, chk, 0, 0);
     return false;
   }
   sending = true; //simple semaphore to only allow one send command at a time, semaphore ends when answered data is received
 
-  byte chk = calcChecksum(command, length);
   int bytesSent = heatpumpSerial.write(command, length); //first send command
   bytesSent += heatpumpSerial.write(chk); //then calculcated checksum byte afterwards
+  serialStatsSent(command[0] == 0xF1 && command[1] == 0x6C, millis()); //set commands start with the send query header
   sprintf_P(log_msg, PSTR("sent bytes: %d including checksum value: %d "), bytesSent, int(chk));
   log_message(log_msg);
 
@@ -963,6 +1128,36 @@ bool send_command(byte* command, int length) {
 }
 #endif
 
+/*
+ * Set commands always go through the buffer, so the ones that arrive
+ * within COMMANDQUEUE_WINDOW ms of each other go out as one datagram.
+ */
+static bool send_setting_frame(byte* datagram, int length, uint8_t key, uint8_t flags) {
+  if ( heishamonSettings.listenonly ) {
+    log_message(_F("Not sending this command. Heishamon in listen only mode!"));
+    return false;
+  }
+  return pushCommandBuffer(datagram, length - 1, datagram[length - 1], key, flags);
+}
+
+// for commands without a checksum, like raw and proxied commands
+bool send_command(byte* command, int length) {
+  return send_frame(command, length, calcChecksum(command, length));
+}
+
+// for datagrams that end with their checksum, like the ones the command builders return
+bool send_datagram(byte* datagram, int length) {
+  return send_frame(datagram, length - 1, datagram[length - 1]);
+}
+
+// for the datagrams of the set commands in commands[], by their index
+bool send_setting(uint8_t command, byte* datagram, int length) {
+  if (length <= 0) {
+    return false;
+  }
+  return send_setting_frame(datagram, length, command + 1, pgm_read_byte(&commands[command].flags));
+}
+
 // Callback function that is called when a message has been pushed to one of your topics.
 void mqtt_callback(char* topic, byte* payload, unsigned int length) {
   if (mqttcallbackinprogress) {
@@ -977,7 +1172,7 @@ void mqtt_callback(char* topic, byte* payload, unsigned int length) {
     msg[length] = '\0';
 
     // copy topic to the heap so a later mqtt publish can't clobber PubSubClient's buffer
-    char* topiccopy = (char*) malloc(strlen(topic) + 1);
+    char* topiccopy = (char*) MALLOC(strlen(topic) + 1);
     if (topiccopy) {
       memcpy(topiccopy, topic, strlen(topic) + 1);
       topic = topiccopy;	
@@ -987,13 +1182,13 @@ void mqtt_callback(char* topic, byte* payload, unsigned int length) {
     if (strcmp(topic_command, mqtt_send_raw_value_topic) == 0)
     { // send a raw hex string
       byte *rawcommand;
-      rawcommand = (byte *) malloc(length);
+      rawcommand = (byte *) MALLOC(length);
       memcpy(rawcommand, msg, length);
 
       sprintf_P(log_msg, PSTR("sending raw value"));
       log_message(log_msg);
       send_command(rawcommand, length);
-      free(rawcommand);
+      FREE(rawcommand);
     } else if (strncmp(topic_command, mqtt_topic_s0, strlen(mqtt_topic_s0)) == 0)  // this is a s0 topic, check for watthour topic and restore it
     {
       char* topic_s0_watthour_port = topic_command + strlen(mqtt_topic_s0) + 15; //strip the first 17 "s0/WatthourTotal/" from the topic to get the s0 port
@@ -1009,7 +1204,7 @@ void mqtt_callback(char* topic, byte* payload, unsigned int length) {
     } else if (strncmp(topic_command, mqtt_topic_commands, strlen(mqtt_topic_commands)) == 0)  // check for commands to heishamon
     {
       char* topic_sendcommand = topic_command + strlen(mqtt_topic_commands) + 1; //strip the first 9 "commands/" from the topic to get what we need
-      send_heatpump_command(topic_sendcommand, msg, send_command, log_message, heishamonSettings.optionalPCB);
+      send_heatpump_command(topic_sendcommand, msg, send_setting, log_message, heishamonSettings.optionalPCB);
     //use this to receive valid heishamon raw data from other heishamon to debug this OT code
 #ifdef RAWDEBUG
     } else if (strcmp((char*)"panasonic_heat_pump/raw/data", topic) == 0) {  // check for raw heatpump input
@@ -1030,7 +1225,7 @@ void mqtt_callback(char* topic, byte* payload, unsigned int length) {
         restoreDallasFromMqtt(topic_1wire_address, String(msg).toFloat(), log_message);
       }
     }
-    free(topiccopy);
+    FREE(topiccopy);
     mqttcallbackinprogress = false;
   }
 }
@@ -1075,6 +1270,16 @@ int8_t webserver_cb(struct webserver_t *client, void *dat) {
           client->route = 1;
         } else if (strcmp_P((char *)dat, PSTR("/json")) == 0) {
           client->route = 20;
+        } else if (strcmp_P((char *)dat, PSTR("/values.bin")) == 0) {
+          client->route = 25;
+        } else if (strcmp_P((char *)dat, PSTR("/serialstats")) == 0) {
+          client->route = 27;
+        } else if (strcmp_P((char *)dat, PSTR("/profile")) == 0) {
+          client->route = 28;
+#ifdef MEM_TRACK
+        } else if (strcmp_P((char *)dat, PSTR("/memstats")) == 0) {
+          client->route = 29;
+#endif
         } else if (strcmp_P((char *)dat, PSTR("/reboot")) == 0) {
           client->route = 30;
         } else if (strcmp_P((char *)dat, PSTR("/debug")) == 0) {
@@ -1163,6 +1368,8 @@ int8_t webserver_cb(struct webserver_t *client, void *dat) {
           client->route = 140;
         } else if (strcmp_P((char *)dat, PSTR("/rules")) == 0) {
           client->route = 160;
+        } else if (strcmp_P((char *)dat, PSTR("/rules/stats")) == 0) {
+          client->route = 161;
 #ifdef TLS_SUPPORT
         } else if (strcmp_P((char *)dat, PSTR("/cacert")) == 0) {
           client->route = 166; 
@@ -1210,7 +1417,7 @@ int8_t webserver_cb(struct webserver_t *client, void *dat) {
                   strcat((char *)client->userdata, log_msg);
                   strcat((char *)client->userdata, "\n");
                   log_message(log_msg);
-                  send_command(cmd, len);
+                  send_setting(x, cmd, len);
                 }
               }
 
@@ -1291,6 +1498,13 @@ int8_t webserver_cb(struct webserver_t *client, void *dat) {
       } break;
     case WEBSERVER_CLIENT_HEADER: {
         struct arguments_t *args = (struct arguments_t *)dat;
+        if (client->route == 25 && stricmp((char *)args->name, (char *)"If-None-Match") == 0) {
+          char etag[RAW_ETAG_LEN];
+          uint8_t len = rawETag(etag, extraDataBlockAvailable, heishamonSettings.optionalPCB);
+          if (args->len == len && memcmp(args->value, etag, len) == 0) {
+            client->route = 26;
+          }
+        }
         return 0;
       } break;
     case WEBSERVER_CLIENT_WRITE: {
@@ -1308,6 +1522,48 @@ int8_t webserver_cb(struct webserver_t *client, void *dat) {
           case 20: {
               return handleJsonOutput(client, actData, actDataExtra, actOptData, &heishamonSettings, extraDataBlockAvailable);
             } break;
+          case 25: {
+              return handleRawOutput(client, actData, actDataExtra, actOptData, &heishamonSettings, extraDataBlockAvailable);
+            } break;
+          case 26: {
+              webserver_send(client, 304, (char *)"application/octet-stream", 0);
+            } break;
+          case 27: {
+              if (client->content == 0) {
+                char json[SERIALSTATS_JSON_SIZE];
+                size_t len = serialStatsJson(json, sizeof(json));
+                webserver_send(client, 200, (char *)"application/json", len);
+                webserver_send_content(client, json, len);
+              }
+              return 0;
+            } break;
+          case 28: {
+              if (client->content == 0) {
+                char *json = (char *)MALLOC(PROFILE_JSON_SIZE);
+                if (json == NULL) {
+                  return -1;
+                }
+                size_t len = profilerJson(json, PROFILE_JSON_SIZE);
+                webserver_send(client, 200, (char *)"application/json", len);
+                webserver_send_content_nocopy(client, json, len);
+              }
+              return 0;
+            } break;
+#ifdef MEM_TRACK
+          case 29: {
+              // a call site per write, the report does not fit a single buffer
+              if (client->content == 0) {
+                webserver_send(client, 200, (char *)"application/json", 0);
+              } else {
+                char json[MEM_TRACK_JSON_SIZE];
+                size_t len = mem_track_json(client->content - 1, json, sizeof(json));
+                if (len > 0) {
+                  webserver_send_content(client, json, len);
+                }
+              }
+              return 0;
+            } break;
+#endif
           case 30: {
               return handleReboot(client);
             } break;
@@ -1432,6 +1688,19 @@ int8_t webserver_cb(struct webserver_t *client, void *dat) {
           case 160: {
               return showRules(client);
             } break;
+          case 161: {
+              // a rule per write, like /memstats
+              if (client->content == 0) {
+                webserver_send(client, 200, (char *)"application/json", 0);
+              } else {
+                char json[RULES_STATS_JSON_SIZE];
+                size_t len = rules_stats_json(client->content - 1, json, sizeof(json));
+                if (len > 0) {
+                  webserver_send_content(client, json, len);
+                }
+              }
+              return 0;
+            } break;
 #ifdef TLS_SUPPORT
         case 165: {
           if (client->userdata) {
@@ -1490,6 +1759,12 @@ int8_t webserver_cb(struct webserver_t *client, void *dat) {
               header->ptr += sprintf_P((char *)header->buffer, PSTR("Location: /rules"));
               return -1;
             } break;
+          case 25:
+          case 26: {
+              char etag[RAW_ETAG_LEN];
+              rawETag(etag, extraDataBlockAvailable, heishamonSettings.optionalPCB);
+              header->ptr += sprintf_P((char *)header->buffer, PSTR("Access-Control-Allow-Origin: *\r\nCache-Control: no-cache\r\nETag: %s\r\n"), etag);
+            } break;
           default: {
               if (client->route != 0) {
                 header->ptr += sprintf_P((char *)header->buffer, PSTR("Access-Control-Allow-Origin: *"));
@@ -1686,7 +1961,7 @@ void setupConditionals() {
 
 #ifdef ESP32
   pcbQueue = xQueueCreate(1, OPTIONALPCBQUERYSIZE);
-  cmdQueue = xQueueCreate(MAXCOMMANDSINBUFFER, sizeof(cmdbuffer_t));
+  cmdMutex = xSemaphoreCreateMutex();
   logQueue = xQueueCreate(4, LOG_MSG_SIZE);
   
   xTaskCreatePinnedToCore(
@@ -1753,6 +2028,7 @@ void timer_cb(int nr) {
             //we received an empty rules.new file which means delete all rules
             LittleFS.remove("/rules.txt");
             LittleFS.remove("/rules.new");
+            LittleFS.remove(RULES_IMAGE_FILE);
             rules_deinitialize();
           } else if (ret == -1) {
             log_message(_F("Failed to load new rules, reverting back to older rules!"));
@@ -1802,6 +2078,12 @@ void setup() {
 
   inSetup = true;
 
+#if defined(ESP8266)
+  rawBootId = RANDOM_REG32;
+#else
+  rawBootId = esp_random();
+#endif
+
   setupSerial();
 
   loggingSerial.println();
@@ -1864,6 +2146,8 @@ void setup() {
 
   loggingSerial.println(F("Loading config from flash..."));
   loadSettings(&heishamonSettings);
+  pollSchedulerBegin(heishamonSettings.waitTime, heishamonSettings.waitTimeMax);
+  commandQueueBegin(COMMANDQUEUE_WINDOW);
 
   loggingSerial.println(F("Setup wifi..."));
   setupWifi(&heishamonSettings);
@@ -1957,14 +2241,16 @@ void send_initial_query() {
 
 }
 
-void send_panasonic_query() {
-  log_message(_F("Requesting new panasonic data"));
-  send_command(panasonicQuery, PANASONICQUERYSIZE);
+void send_panasonic_query(bool main, bool extra) {
+  if (main) {
+    log_message(_F("Requesting new panasonic data"));
+    send_frame(panasonicQuery, PANASONICQUERYSIZE, PANASONICQUERYCHK);
+  }
   // rest is for the new data block on new models
-  if (extraDataBlockAvailable) {
+  if (extra && extraDataBlockAvailable) {
     log_message(_F("Requesting new panasonic extra data"));
     panasonicQuery[3] = 0x21; //setting 4th byte to 0x21 is a request for extra block
-    send_command(panasonicQuery, PANASONICQUERYSIZE);
+    send_frame(panasonicQuery, PANASONICQUERYSIZE, PANASONICEXTRAQUERYCHK);
     panasonicQuery[3] = 0x10; //setting 4th back to 0x10 for normal data request next time
   }
 }
@@ -1979,16 +2265,17 @@ void send_optionalpcb_query() {
 void readHeatpump() {
   if (sending && ((unsigned long)(millis() - sendCommandReadTime) > SERIALTIMEOUT)) {
     log_message(_F("Previous read data attempt failed due to timeout!"));
-    sprintf_P(log_msg, PSTR("Received %d bytes data"), data_length);
+    sprintf_P(log_msg, PSTR("Received %d bytes data"), serialFramePending(&serialFrame));
     log_message(log_msg);
-    if (heishamonSettings.logHexdump) logHex(data, data_length);
-    if (data_length == 0) {
+    if (heishamonSettings.logHexdump) logHex(serialFramePendingData(&serialFrame), serialFramePending(&serialFrame));
+    if (serialFramePending(&serialFrame) == 0) {
       timeoutread++;
       totalreads++; //at at timeout we didn't receive anything but did expect it so need to increase this for the stats
     } else {
       tooshortread++;
     }
-    data_length = 0; //clear any data in array
+    serialFrameDrop(&serialFrame); //clear any data in the ring
+    serialStatsTimeout();
     sending = false; //receiving the answer from the send command timed out, so we are allowed to send a new command
   }
   if ( (heishamonSettings.listenonly || sending) && (heatpumpSerial.available() > 0)) readSerial();
@@ -2006,21 +2293,28 @@ void checkBootButton() {
 }
 
 void loop() {
+  profilerLoopStart();
+
   //check boot button state
   checkBootButton();
 
   //webserver function
   webserver_loop();
+  profilerMark(PROFILE_WEBSERVER);
 
   // check wifi
   check_wifi();
+  profilerMark(PROFILE_WIFI);
   // Handle OTA first.s
   ArduinoOTA.handle();
+  profilerMark(PROFILE_OTA);
 
   mqtt_client.loop();
+  profilerMark(PROFILE_MQTT);
 
   if (heishamonSettings.opentherm) {
     HeishaOTLoop(actData, mqtt_client, heishamonSettings.mqtt_topic_base);
+    profilerMark(PROFILE_OPENTHERM);
   }
 
   readHeatpump();
@@ -2036,11 +2330,11 @@ void loop() {
 #endif
 
 #ifdef ESP8266
-  if ((!sending) && (cmdnrel > 0)) { //check if there is a send command in the buffer
-    log_message(_F("Sending command from buffer"));
+  if ((!sending) && (commandQueueCount() > 0)) { //check if there is a send command in the buffer
     popCommandBuffer();
   }
 #endif
+  profilerMark(PROFILE_HEATPUMP);
 
   if (heishamonSettings.use_1wire) dallasLoop(mqtt_client, log_message, heishamonSettings.mqtt_topic_base);
 
@@ -2050,8 +2344,12 @@ void loop() {
     dallasMqttRestorePending = false;
     log_message(_F("Done restoring 1wire sensors from mqtt"));
   }
+  if (heishamonSettings.use_1wire) profilerMark(PROFILE_DALLAS);
 
-  if (heishamonSettings.use_s0) s0Loop(mqtt_client, log_message, heishamonSettings.mqtt_topic_base, heishamonSettings.s0Settings);
+  if (heishamonSettings.use_s0) {
+    s0Loop(mqtt_client, log_message, heishamonSettings.mqtt_topic_base, heishamonSettings.s0Settings);
+    profilerMark(PROFILE_S0);
+  }
 
 #ifdef ESP8266
 //this only runs on ESP8266, the ESP32 does this in vTask
@@ -2069,7 +2367,17 @@ void loop() {
   }
 #endif
 
-  // run the data query only each WAITTIME
+#ifdef ESP8266
+  //get new data, each block as often as its topics change
+  if (!heishamonSettings.listenonly) {
+    bool main = pollSchedulerDue(POLL_MAIN, millis());
+    bool extra = extraDataBlockAvailable && pollSchedulerDue(POLL_EXTRA, millis());
+    if (main || extra) send_panasonic_query(main, extra);
+  }
+#endif
+  profilerMark(PROFILE_HEATPUMP);
+
+  // run the stats and mqtt checks only each WAITTIME
   if ((unsigned long)(millis() - lastRunTime) > (1000 * heishamonSettings.waitTime)) {
     lastRunTime = millis();
     //check mqtt
@@ -2143,7 +2451,7 @@ void loop() {
 
     String stats;
 #ifdef ESP8266
-    stats.reserve(384);
+    stats.reserve(896);
 #endif
     stats += F("{\"uptime\":");
     stats += String(millis());
@@ -2175,6 +2483,16 @@ void loop() {
     stats += toolongread;
     stats += F(",\"timeout reads\":");
     stats += timeoutread;
+    stats += F(",\"poll interval\":");
+    stats += pollSchedulerInterval(POLL_MAIN) / 1000;
+    stats += F(",\"extra poll interval\":");
+    stats += pollSchedulerInterval(POLL_EXTRA) / 1000;
+    {
+      char latency[SERIALSTATS_JSON_SIZE];
+      serialStatsJson(latency, sizeof(latency));
+      stats += F(",\"serial latency\":");
+      stats += latency;
+    }
     stats += F(",\"version\":\"");
     stats += heishamon_version;
     stats += F("\",\"board\":\"");
@@ -2218,10 +2536,25 @@ void loop() {
     
     websocket_write_all(log_msg, strlen(log_msg));        
 
-#ifdef ESP8266
-    //get new data
-    if (!heishamonSettings.listenonly) send_panasonic_query();
-#endif
+    if (websocket_clients() > 0) {
+      char *profile = (char *)MALLOC(PROFILE_JSON_SIZE + 24);
+      if (profile != NULL) {
+        size_t len = sprintf_P(profile, PSTR("{\"data\": {\"profile\": "));
+        len += profilerJson(&profile[len], PROFILE_JSON_SIZE);
+        len += sprintf_P(&profile[len], PSTR("}}"));
+        websocket_write_all(profile, len);
+        FREE(profile);
+      }
+    }
+
+    if (websocket_clients() > 0) {
+      // a summary that fits one pooled chunk, /rules/stats has every rule
+      char frame[RULES_STATS_SUMMARY_SIZE + 32];
+      size_t len = sprintf_P(frame, PSTR("{\"data\": {\"rulestats\": "));
+      len += rules_stats_summary_json(&frame[len], RULES_STATS_SUMMARY_SIZE);
+      len += sprintf_P(&frame[len], PSTR("}}"));
+      websocket_write_all(frame, len);
+    }
 
     //Make sure the LWT is set to Online, even if the broker have marked it dead.
     sprintf_P(mqtt_topic, PSTR("%s/%s"), heishamonSettings.mqtt_topic_base, mqtt_willtopic);
@@ -2232,9 +2565,16 @@ void loop() {
       MDNS.announce();
     }
 #endif
+    profilerMark(PROFILE_STATS);
   }
 
+  log_loop();
+  profilerMark(PROFILE_LOG);
+
   timerqueue_update();
+  profilerMark(PROFILE_TIMERS);
+
+  profilerLoopEnd(sending || (heatpumpSerial.available() > 0));
   #ifdef ESP32
   delay(1); // to keep watchdog happy
   #endif
@@ -0,0 +1,144 @@
+#include "commandqueue.h"
+#include "commands.h"
+
+static_assert(COMMANDQUEUE_SIZE <= 16, "command queue too large for the merge mask");
+static_assert(PANASONICQUERYSIZE == COMMANDQUEUE_QUERY_SIZE, "command queue has the wrong send query size");
+static_assert(PANASONICQUERYSIZE < COMMANDQUEUE_DATA_SIZE, "command queue entries too small for a set command");
+
+static commandEntry_t queue[COMMANDQUEUE_SIZE];
+static uint8_t count = 0;
+static uint16_t window = COMMANDQUEUE_WINDOW;
+
+/*
+ * Set commands are the send query with some of its bytes set,
+ * 0 leaves the setting in a byte as it is.
+ */
+static bool isSetCommand(const uint8_t *command, uint8_t length) {
+  return length == PANASONICQUERYSIZE && command[0] == 0xF1 && command[1] == 0x6C;
+}
+
+static bool overlaps(const uint8_t *a, const uint8_t *b) {
+  for(uint8_t i = 0; i < COMMANDQUEUE_MASK_SIZE; i++) {
+    if((a[i] & b[i]) != 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void commandQueueBegin(uint16_t ms) {
+  window = ms;
+  count = 0;
+}
+
+uint8_t commandQueuePush(const uint8_t *command, uint8_t length, uint8_t chk, uint8_t key, uint8_t flags, unsigned long now) {
+  if(length + 1 > COMMANDQUEUE_DATA_SIZE) {
+    return COMMANDQUEUE_TOOLONG;
+  }
+  if(!isSetCommand(command, length)) {
+    key = 0;
+  }
+
+  commandEntry_t *e = NULL;
+  uint8_t result = COMMANDQUEUE_ADDED;
+  if(key != 0) {
+    for(uint8_t i = 0; i < count; i++) {
+      if(queue[i].key == key) {
+        e = &queue[i];
+        result = COMMANDQUEUE_REPLACED;
+        break;
+      }
+    }
+  }
+  if(e == NULL) {
+    if(count == COMMANDQUEUE_SIZE) {
+      return COMMANDQUEUE_FULL;
+    }
+    uint8_t at = count;
+    if((flags & CMD_URGENT) != 0) {
+      at = 0;
+      while(at < count && (queue[at].flags & CMD_URGENT) != 0) {
+        at++;
+      }
+    }
+    memmove(&queue[at + 1], &queue[at], (count - at) * sizeof(commandEntry_t));
+    count++;
+    e = &queue[at];
+    // a replaced command keeps its time, so a slider still gets through
+    e->queued = now;
+  }
+
+  e->key = key;
+  e->flags = flags;
+  e->length = length + 1;
+  memcpy(e->data, command, length);
+  e->data[length] = chk;
+  memset(e->mask, 0, sizeof(e->mask));
+  if(key != 0) {
+    // the header is the same for all set commands
+    for(uint8_t i = 4; i < PANASONICQUERYSIZE; i++) {
+      if(command[i] != 0) {
+        e->mask[i / 8] |= 1 << (i % 8);
+      }
+    }
+  }
+  return result;
+}
+
+uint8_t commandQueuePop(uint8_t *out, unsigned long now) {
+  if(count == 0) {
+    return 0;
+  }
+  if(queue[0].key != 0 && (queue[0].flags & CMD_URGENT) == 0 && (unsigned long)(now - queue[0].queued) < window) {
+    return 0;
+  }
+
+  uint8_t length = queue[0].length;
+  uint16_t taken = 1;
+  memcpy(out, queue[0].data, length);
+
+  if(queue[0].key != 0) {
+    uint8_t used[COMMANDQUEUE_MASK_SIZE];
+    uint8_t skipped[COMMANDQUEUE_MASK_SIZE] = { 0 };
+    memcpy(used, queue[0].mask, sizeof(used));
+    for(uint8_t i = 1; i < count; i++) {
+      commandEntry_t *e = &queue[i];
+      if(e->key == 0) {
+        // raw commands keep their place in line
+        break;
+      }
+      if(overlaps(e->mask, used) || overlaps(e->mask, skipped)) {
+        for(uint8_t j = 0; j < COMMANDQUEUE_MASK_SIZE; j++) {
+          skipped[j] |= e->mask[j];
+        }
+        continue;
+      }
+      for(uint8_t j = 4; j < PANASONICQUERYSIZE; j++) {
+        if((e->mask[j / 8] & (1 << (j % 8))) != 0) {
+          out[PANASONICQUERYSIZE] += out[j] - e->data[j];
+          out[j] = e->data[j];
+        }
+      }
+      for(uint8_t j = 0; j < COMMANDQUEUE_MASK_SIZE; j++) {
+        used[j] |= e->mask[j];
+      }
+      taken |= 1 << i;
+    }
+  }
+
+  uint8_t left = 0;
+  for(uint8_t i = 0; i < count; i++) {
+    if((taken & (1 << i)) == 0) {
+      if(left != i) {
+        memcpy(&queue[left], &queue[i], sizeof(commandEntry_t));
+      }
+      left++;
+    }
+  }
+  count = left;
+  return length;
+}
+
+uint8_t commandQueueCount(void) {
+  return count;
+}
@@ -0,0 +1,56 @@
+#ifndef _COMMANDQUEUE_H_
+#define _COMMANDQUEUE_H_
+
+#include <Arduino.h>
+
+#define COMMANDQUEUE_SIZE 10
+#define COMMANDQUEUE_DATA_SIZE 128  // datagram with its checksum
+#define COMMANDQUEUE_QUERY_SIZE 110  // PANASONICQUERYSIZE
+#define COMMANDQUEUE_MASK_SIZE ((COMMANDQUEUE_QUERY_SIZE + 7) / 8)
+
+/*
+ * Set commands wait this many ms for others to be merged with,
+ * a scene sends its settings as separate messages.
+ */
+#define COMMANDQUEUE_WINDOW 100
+
+// results of commandQueuePush
+#define COMMANDQUEUE_ADDED 0
+#define COMMANDQUEUE_REPLACED 1
+#define COMMANDQUEUE_FULL 2
+#define COMMANDQUEUE_TOOLONG 3
+
+typedef struct commandEntry_t {
+  uint8_t key;      // 1 + index in commands[], 0 for raw datagrams
+  uint8_t flags;    // CMD_* of the command
+  uint8_t length;   // with the checksum
+  unsigned long queued;  // ms, of the first command for the setting
+  uint8_t mask[COMMANDQUEUE_MASK_SIZE];  // bytes of the send query the command sets
+  uint8_t data[COMMANDQUEUE_DATA_SIZE];
+} commandEntry_t;
+
+void commandQueueBegin(uint16_t window);
+
+/*
+ * Queues a command and its checksum. Commands with a key are set
+ * commands built from the send query: a later one with the same
+ * key replaces the pending one in place, and CMD_URGENT ones are
+ * queued ahead of the others. Raw commands, key 0, are queued in
+ * order.
+ */
+uint8_t commandQueuePush(const uint8_t *command, uint8_t length, uint8_t chk, uint8_t key, uint8_t flags, unsigned long now);
+
+/*
+ * Copies the next datagram to send into out, which holds
+ * COMMANDQUEUE_DATA_SIZE bytes, and returns its length or 0
+ * when there is nothing to send yet. A set command is sent once
+ * it waited the window, or right away when it is urgent, and
+ * the set commands queued behind it that set other bytes of the
+ * send query are merged into the same datagram, as long as no
+ * command queued in between sets the same bytes.
+ */
+uint8_t commandQueuePop(uint8_t *out, unsigned long now);
+
+uint8_t commandQueueCount(void);
+
+#endif
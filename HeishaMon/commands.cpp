@@ -1,11 +1,13 @@
 #include "commands.h"
+#include "lookup.h"
 #include <LittleFS.h>
 
 //removed checksum from default query, is calculated in send_command
+//the send query does carry its checksum, see setQueryByte
 byte initialQuery[] = {0x31, 0x05, 0x10, 0x01, 0x00, 0x00, 0x00};
 byte panasonicQuery[] = {0x71, 0x6c, 0x01, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
 byte optionalPCBQuery[] = {0xF1, 0x11, 0x01, 0x50, 0x00, 0x00, 0x40, 0xFF, 0xFF, 0xE5, 0xFF, 0xFF, 0x00, 0xFF, 0xEB, 0xFF, 0xFF, 0x00, 0x00};
-byte panasonicSendQuery[] PROGMEM = {0xf1, 0x6c, 0x01, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+byte panasonicSendQuery[] PROGMEM = {0xf1, 0x6c, 0x01, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, PANASONICSENDQUERYCHK};
 
 #ifdef ESP32
 extern QueueHandle_t pcbQueue;
@@ -24,6 +26,17 @@ const char* mqtt_iptopic PROGMEM = "ip";
 
 const char* mqtt_send_raw_value_topic PROGMEM = "SendRawValue";
 
+/*
+ * The send query ends with its checksum. Every byte a command sets
+ * moves the checksum by the same amount the other way, so the
+ * command builders keep it up to date as they fill cmd[] and the
+ * datagram is sent as is.
+ */
+static void setQueryByte(unsigned char *cmd, uint8_t pos, byte value) {
+  cmd[PANASONICQUERYSIZE] += cmd[pos] - value;
+  cmd[pos] = value;
+}
+
 static unsigned int temp2hex(float temp) {
   int hextemp = 0;
   if (temp > 120) {
@@ -60,7 +73,7 @@ unsigned int set_heatpump_state(char *msg, unsigned char *cmd, char *log_msg) {
 
   {
     memcpy_P(cmd, panasonicSendQuery, sizeof(panasonicSendQuery));
-    cmd[4] = heatpump_state;
+    setQueryByte(cmd, 4, heatpump_state);
   }
 
   return sizeof(panasonicSendQuery);
@@ -83,7 +96,7 @@ unsigned int set_pump(char *msg, unsigned char *cmd, char *log_msg) {
 
   {
     memcpy_P(cmd, panasonicSendQuery, sizeof(panasonicSendQuery));
-    cmd[4] = pump_state;
+    setQueryByte(cmd, 4, pump_state);
   }
 
   return sizeof(panasonicSendQuery);
@@ -103,7 +116,7 @@ unsigned int set_max_pump_duty(char *msg, unsigned char *cmd, char *log_msg) {
 
   {
     memcpy_P(cmd, panasonicSendQuery, sizeof(panasonicSendQuery));
-    cmd[45] = pumpduty;
+    setQueryByte(cmd, 45, pumpduty);
   }
 
   return sizeof(panasonicSendQuery);
@@ -123,7 +136,7 @@ unsigned int set_quiet_mode(char *msg, unsigned char *cmd, char *log_msg) {
 
   {
     memcpy_P(cmd, panasonicSendQuery, sizeof(panasonicSendQuery));
-    cmd[7] = quiet_mode;
+    setQueryByte(cmd, 7, quiet_mode);
   }
 
   return sizeof(panasonicSendQuery);
@@ -143,7 +156,7 @@ unsigned int set_z1_heat_request_temperature(char *msg, unsigned char *cmd, char
 
   {
     memcpy_P(cmd, panasonicSendQuery, sizeof(panasonicSendQuery));
-    cmd[38] = request_temp;
+    setQueryByte(cmd, 38, request_temp);
   }
 
   return sizeof(panasonicSendQuery);
@@ -163,7 +176,7 @@ unsigned int set_z1_cool_request_temperature(char *msg, unsigned char *cmd, char
 
   {
     memcpy_P(cmd, panasonicSendQuery, sizeof(panasonicSendQuery));
-    cmd[39] = request_temp;
+    setQueryByte(cmd, 39, request_temp);
   }
 
   return sizeof(panasonicSendQuery);
@@ -183,7 +196,7 @@ unsigned int set_z2_heat_request_temperature(char *msg, unsigned char *cmd, char
 
   {
     memcpy_P(cmd, panasonicSendQuery, sizeof(panasonicSendQuery));
-    cmd[40] = request_temp;
+    setQueryByte(cmd, 40, request_temp);
   }
 
   return sizeof(panasonicSendQuery);
@@ -203,7 +216,7 @@ unsigned int set_z2_cool_request_temperature(char *msg, unsigned char *cmd, char
 
   {
     memcpy_P(cmd, panasonicSendQuery, sizeof(panasonicSendQuery));
-    cmd[41] = request_temp;
+    setQueryByte(cmd, 41, request_temp);
   }
 
   return sizeof(panasonicSendQuery);
@@ -223,7 +236,7 @@ unsigned int set_bivalent_start_temp(char *msg, unsigned char *cmd, char *log_ms
 
   {
     memcpy_P(cmd, panasonicSendQuery, sizeof(panasonicSendQuery));
-    cmd[65] = request_temp;
+    setQueryByte(cmd, 65, request_temp);
   }
 
   return sizeof(panasonicSendQuery);
@@ -242,7 +255,7 @@ unsigned int set_bivalent_ap_start_temp(char *msg, unsigned char *cmd, char *log
 
   {
     memcpy_P(cmd, panasonicSendQuery, sizeof(panasonicSendQuery));
-    cmd[66] = request_temp;
+    setQueryByte(cmd, 66, request_temp);
   }
 
   return sizeof(panasonicSendQuery);
@@ -261,7 +274,7 @@ unsigned int set_bivalent_ap_stop_temp(char *msg, unsigned char *cmd, char *log_
 
   {
     memcpy_P(cmd, panasonicSendQuery, sizeof(panasonicSendQuery));
-    cmd[68] = request_temp;
+    setQueryByte(cmd, 68, request_temp);
   }
 
   return sizeof(panasonicSendQuery);
@@ -284,7 +297,7 @@ unsigned int set_force_DHW(char *msg, unsigned char *cmd, char *log_msg) {
 
   {
     memcpy_P(cmd, panasonicSendQuery, sizeof(panasonicSendQuery));
-    cmd[4] = force_DHW_mode;
+    setQueryByte(cmd, 4, force_DHW_mode);
   }
 
   return sizeof(panasonicSendQuery);
@@ -307,7 +320,7 @@ unsigned int set_force_defrost(char *msg, unsigned char *cmd, char *log_msg) {
 
   {
     memcpy_P(cmd, panasonicSendQuery, sizeof(panasonicSendQuery));
-    cmd[8] = force_defrost_mode;
+    setQueryByte(cmd, 8, force_defrost_mode);
   }
 
   return sizeof(panasonicSendQuery);
@@ -330,7 +343,7 @@ unsigned int set_force_sterilization(char *msg, unsigned char *cmd, char *log_ms
 
   {
     memcpy_P(cmd, panasonicSendQuery, sizeof(panasonicSendQuery));
-    cmd[8] = force_sterilization_mode;
+    setQueryByte(cmd, 8, force_sterilization_mode);
   }
 
   return sizeof(panasonicSendQuery);
@@ -353,7 +366,7 @@ unsigned int set_force_heater(char *msg, unsigned char *cmd, char *log_msg) {
 
   {
     memcpy_P(cmd, panasonicSendQuery, sizeof(panasonicSendQuery));
-    cmd[5] = force_heater_mode;
+    setQueryByte(cmd, 5, force_heater_mode);
   }
 
   return sizeof(panasonicSendQuery);
@@ -376,7 +389,7 @@ unsigned int set_holiday_mode(char *msg, unsigned char *cmd, char *log_msg) {
 
   {
     memcpy_P(cmd, panasonicSendQuery, sizeof(panasonicSendQuery));
-    cmd[5] = set_holiday;
+    setQueryByte(cmd, 5, set_holiday);
   }
 
   return sizeof(panasonicSendQuery);
@@ -396,7 +409,7 @@ unsigned int set_powerful_mode(char *msg, unsigned char *cmd, char *log_msg) {
 
   {
     memcpy_P(cmd, panasonicSendQuery, sizeof(panasonicSendQuery));
-    cmd[7] = set_powerful;
+    setQueryByte(cmd, 7, set_powerful);
   }
 
   return sizeof(panasonicSendQuery);
@@ -416,7 +429,7 @@ unsigned int set_DHW_temp(char *msg, unsigned char *cmd, char *log_msg) {
 
   {
     memcpy_P(cmd, panasonicSendQuery, sizeof(panasonicSendQuery));
-    cmd[42] = set_DHW_temp;
+    setQueryByte(cmd, 42, set_DHW_temp);
   }
 
   return sizeof(panasonicSendQuery);
@@ -446,7 +459,7 @@ unsigned int set_operation_mode(char *msg, unsigned char *cmd, char *log_msg) {
 
   {
     memcpy_P(cmd, panasonicSendQuery, sizeof(panasonicSendQuery));
-    cmd[6] = set_mode;
+    setQueryByte(cmd, 6, set_mode);
   }
 
   return sizeof(panasonicSendQuery);
@@ -470,7 +483,7 @@ unsigned int set_bivalent_control(char *msg, unsigned char *cmd, char *log_msg)
 
   {
     memcpy_P(cmd, panasonicSendQuery, sizeof(panasonicSendQuery));
-    cmd[26] = set_bcontrol;
+    setQueryByte(cmd, 26, set_bcontrol);
   }
 
   return sizeof(panasonicSendQuery);
@@ -496,7 +509,7 @@ unsigned int set_bivalent_mode(char *msg, unsigned char *cmd, char *log_msg) {
 
   {
     memcpy_P(cmd, panasonicSendQuery, sizeof(panasonicSendQuery));
-    cmd[26] = set_bmode;
+    setQueryByte(cmd, 26, set_bmode);
   }
 
   return sizeof(panasonicSendQuery);
@@ -513,22 +526,22 @@ unsigned int set_curves(char *msg, unsigned char *cmd, char *log_msg) {
     snprintf(tmpmsg, 255, "SetCurves JSON received ok");
     memcpy(log_msg, tmpmsg, sizeof(tmpmsg));
     //set correct bytes according to the values in json and if not exists keep default 0x00 value which keeps current setting for this byte
-    jsonValue = jsonDoc["zone1"]["heat"]["target"]["high"]; if (!jsonValue.isNull()) cmd[75] = jsonValue.as<int>() + 128;
-    jsonValue = jsonDoc["zone1"]["heat"]["target"]["low"]; if (!jsonValue.isNull()) cmd[76] = jsonValue.as<int>() + 128;
-    jsonValue = jsonDoc["zone1"]["heat"]["outside"]["low"]; if (!jsonValue.isNull()) cmd[77] = jsonValue.as<int>() + 128;
-    jsonValue = jsonDoc["zone1"]["heat"]["outside"]["high"]; if (!jsonValue.isNull()) cmd[78] = jsonValue.as<int>() + 128;
-    jsonValue = jsonDoc["zone2"]["heat"]["target"]["high"]; if (!jsonValue.isNull()) cmd[79] = jsonValue.as<int>() + 128;
-    jsonValue = jsonDoc["zone2"]["heat"]["target"]["low"]; if (!jsonValue.isNull()) cmd[80] = jsonValue.as<int>() + 128;
-    jsonValue = jsonDoc["zone2"]["heat"]["outside"]["low"]; if (!jsonValue.isNull()) cmd[81] = jsonValue.as<int>() + 128;
-    jsonValue = jsonDoc["zone2"]["heat"]["outside"]["high"]; if (!jsonValue.isNull()) cmd[82] = jsonValue.as<int>() + 128;
-    jsonValue = jsonDoc["zone1"]["cool"]["target"]["high"]; if (!jsonValue.isNull()) cmd[86] = jsonValue.as<int>() + 128;
-    jsonValue = jsonDoc["zone1"]["cool"]["target"]["low"]; if (!jsonValue.isNull()) cmd[87] = jsonValue.as<int>() + 128;
-    jsonValue = jsonDoc["zone1"]["cool"]["outside"]["low"]; if (!jsonValue.isNull()) cmd[88] = jsonValue.as<int>() + 128;
-    jsonValue = jsonDoc["zone1"]["cool"]["outside"]["high"]; if (!jsonValue.isNull()) cmd[89] = jsonValue.as<int>() + 128;
-    jsonValue = jsonDoc["zone2"]["cool"]["target"]["high"]; if (!jsonValue.isNull()) cmd[90] = jsonValue.as<int>() + 128;
-    jsonValue = jsonDoc["zone2"]["cool"]["target"]["low"]; if (!jsonValue.isNull()) cmd[91] = jsonValue.as<int>() + 128;
-    jsonValue = jsonDoc["zone2"]["cool"]["outside"]["low"]; if (!jsonValue.isNull()) cmd[92] = jsonValue.as<int>() + 128;
-    jsonValue = jsonDoc["zone2"]["cool"]["outside"]["high"]; if (!jsonValue.isNull()) cmd[93] = jsonValue.as<int>() + 128;
+    jsonValue = jsonDoc["zone1"]["heat"]["target"]["high"]; if (!jsonValue.isNull()) setQueryByte(cmd, 75, jsonValue.as<int>() + 128);
+    jsonValue = jsonDoc["zone1"]["heat"]["target"]["low"]; if (!jsonValue.isNull()) setQueryByte(cmd, 76, jsonValue.as<int>() + 128);
+    jsonValue = jsonDoc["zone1"]["heat"]["outside"]["low"]; if (!jsonValue.isNull()) setQueryByte(cmd, 77, jsonValue.as<int>() + 128);
+    jsonValue = jsonDoc["zone1"]["heat"]["outside"]["high"]; if (!jsonValue.isNull()) setQueryByte(cmd, 78, jsonValue.as<int>() + 128);
+    jsonValue = jsonDoc["zone2"]["heat"]["target"]["high"]; if (!jsonValue.isNull()) setQueryByte(cmd, 79, jsonValue.as<int>() + 128);
+    jsonValue = jsonDoc["zone2"]["heat"]["target"]["low"]; if (!jsonValue.isNull()) setQueryByte(cmd, 80, jsonValue.as<int>() + 128);
+    jsonValue = jsonDoc["zone2"]["heat"]["outside"]["low"]; if (!jsonValue.isNull()) setQueryByte(cmd, 81, jsonValue.as<int>() + 128);
+    jsonValue = jsonDoc["zone2"]["heat"]["outside"]["high"]; if (!jsonValue.isNull()) setQueryByte(cmd, 82, jsonValue.as<int>() + 128);
+    jsonValue = jsonDoc["zone1"]["cool"]["target"]["high"]; if (!jsonValue.isNull()) setQueryByte(cmd, 86, jsonValue.as<int>() + 128);
+    jsonValue = jsonDoc["zone1"]["cool"]["target"]["low"]; if (!jsonValue.isNull()) setQueryByte(cmd, 87, jsonValue.as<int>() + 128);
+    jsonValue = jsonDoc["zone1"]["cool"]["outside"]["low"]; if (!jsonValue.isNull()) setQueryByte(cmd, 88, jsonValue.as<int>() + 128);
+    jsonValue = jsonDoc["zone1"]["cool"]["outside"]["high"]; if (!jsonValue.isNull()) setQueryByte(cmd, 89, jsonValue.as<int>() + 128);
+    jsonValue = jsonDoc["zone2"]["cool"]["target"]["high"]; if (!jsonValue.isNull()) setQueryByte(cmd, 90, jsonValue.as<int>() + 128);
+    jsonValue = jsonDoc["zone2"]["cool"]["target"]["low"]; if (!jsonValue.isNull()) setQueryByte(cmd, 91, jsonValue.as<int>() + 128);
+    jsonValue = jsonDoc["zone2"]["cool"]["outside"]["low"]; if (!jsonValue.isNull()) setQueryByte(cmd, 92, jsonValue.as<int>() + 128);
+    jsonValue = jsonDoc["zone2"]["cool"]["outside"]["high"]; if (!jsonValue.isNull()) setQueryByte(cmd, 93, jsonValue.as<int>() + 128);
   } else {
     char tmpmsg[256] = { 0 };
     snprintf(tmpmsg, 255, "SetCurves JSON decode failed!");
@@ -558,7 +571,7 @@ unsigned int set_zones(char *msg, unsigned char *cmd, char *log_msg) {
 
   {
     memcpy_P(cmd, panasonicSendQuery, sizeof(panasonicSendQuery));
-    cmd[6] = set_mode;
+    setQueryByte(cmd, 6, set_mode);
   }
 
   return sizeof(panasonicSendQuery);
@@ -578,7 +591,7 @@ unsigned int set_floor_heat_delta(char *msg, unsigned char *cmd, char *log_msg)
 
   {
     memcpy_P(cmd, panasonicSendQuery, sizeof(panasonicSendQuery));
-    cmd[84] = request_temp;
+    setQueryByte(cmd, 84, request_temp);
   }
 
   return sizeof(panasonicSendQuery);
@@ -598,7 +611,7 @@ unsigned int set_floor_cool_delta(char *msg, unsigned char *cmd, char *log_msg)
 
   {
     memcpy_P(cmd, panasonicSendQuery, sizeof(panasonicSendQuery));
-    cmd[94] = request_temp;
+    setQueryByte(cmd, 94, request_temp);
   }
 
   return sizeof(panasonicSendQuery);
@@ -618,7 +631,7 @@ unsigned int set_dhw_heat_delta(char *msg, unsigned char *cmd, char *log_msg) {
 
   {
     memcpy_P(cmd, panasonicSendQuery, sizeof(panasonicSendQuery));
-    cmd[99] = request_temp;
+    setQueryByte(cmd, 99, request_temp);
   }
 
   return sizeof(panasonicSendQuery);
@@ -641,7 +654,7 @@ unsigned int set_reset(char *msg, unsigned char *cmd, char *log_msg) {
 
   {
     memcpy_P(cmd, panasonicSendQuery, sizeof(panasonicSendQuery));
-    cmd[8] = resetRequest;
+    setQueryByte(cmd, 8, resetRequest);
   }
 
   return sizeof(panasonicSendQuery);
@@ -661,7 +674,7 @@ unsigned int set_heater_delay_time(char *msg, unsigned char *cmd, char *log_msg)
 
   {
     memcpy_P(cmd, panasonicSendQuery, sizeof(panasonicSendQuery));
-    cmd[104] = byteValue;
+    setQueryByte(cmd, 104, byteValue);
   }
 
   return sizeof(panasonicSendQuery);
@@ -680,7 +693,7 @@ unsigned int set_heater_start_delta(char *msg, unsigned char *cmd, char *log_msg
 
   {
     memcpy_P(cmd, panasonicSendQuery, sizeof(panasonicSendQuery));
-    cmd[105] = byteValue;
+    setQueryByte(cmd, 105, byteValue);
   }
 
   return sizeof(panasonicSendQuery);
@@ -699,7 +712,7 @@ unsigned int set_heater_stop_delta(char *msg, unsigned char *cmd, char *log_msg)
 
   {
     memcpy_P(cmd, panasonicSendQuery, sizeof(panasonicSendQuery));
-    cmd[106] = byteValue;
+    setQueryByte(cmd, 106, byteValue);
   }
 
   return sizeof(panasonicSendQuery);
@@ -722,7 +735,7 @@ unsigned int set_main_schedule(char *msg, unsigned char *cmd, char *log_msg) {
 
   {
     memcpy_P(cmd, panasonicSendQuery, sizeof(panasonicSendQuery));
-    cmd[5] = byteValue;
+    setQueryByte(cmd, 5, byteValue);
   }
 
   return sizeof(panasonicSendQuery);
@@ -745,7 +758,7 @@ unsigned int set_alt_external_sensor(char *msg, unsigned char *cmd, char *log_ms
 
   {
     memcpy_P(cmd, panasonicSendQuery, sizeof(panasonicSendQuery));
-    cmd[20] = set_alt;
+    setQueryByte(cmd, 20, set_alt);
   }
 
   return sizeof(panasonicSendQuery);
@@ -770,7 +783,7 @@ unsigned int set_external_pad_heater(char *msg, unsigned char *cmd, char *log_ms
 
   {
     memcpy_P(cmd, panasonicSendQuery, sizeof(panasonicSendQuery));
-    cmd[25] = set_pad;
+    setQueryByte(cmd, 25, set_pad);
   }
 
   return sizeof(panasonicSendQuery);
@@ -790,7 +803,7 @@ unsigned int set_buffer_delta(char *msg, unsigned char *cmd, char *log_msg) {
 
   {
     memcpy_P(cmd, panasonicSendQuery, sizeof(panasonicSendQuery));
-    cmd[59] = request_temp;
+    setQueryByte(cmd, 59, request_temp);
   }
 
   return sizeof(panasonicSendQuery);
@@ -813,7 +826,7 @@ unsigned int set_buffer(char *msg, unsigned char *cmd, char *log_msg) {
 
   {
     memcpy_P(cmd, panasonicSendQuery, sizeof(panasonicSendQuery));
-    cmd[24] = set_buffer;
+    setQueryByte(cmd, 24, set_buffer);
   }
 
   return sizeof(panasonicSendQuery);
@@ -833,7 +846,7 @@ unsigned int set_heatingoffoutdoortemp(char *msg, unsigned char *cmd, char *log_
 
   {
     memcpy_P(cmd, panasonicSendQuery, sizeof(panasonicSendQuery));
-    cmd[83] = request_temp;
+    setQueryByte(cmd, 83, request_temp);
   }
 
   return sizeof(panasonicSendQuery);
@@ -854,7 +867,7 @@ unsigned int set_external_control(char *msg, unsigned char *cmd, char *log_msg){
   }
   {
     memcpy_P(cmd, panasonicSendQuery, sizeof(panasonicSendQuery));
-    cmd[address] = value;
+    setQueryByte(cmd, address, value);
   }
   return sizeof(panasonicSendQuery);
 }
@@ -873,7 +886,7 @@ unsigned int set_external_heat_cool_control(char *msg, unsigned char *cmd, char
   }
   {
     memcpy_P(cmd, panasonicSendQuery, sizeof(panasonicSendQuery));
-    cmd[address] = value;
+    setQueryByte(cmd, address, value);
   }
   return sizeof(panasonicSendQuery);
 }
@@ -892,7 +905,7 @@ unsigned int set_external_error(char *msg, unsigned char *cmd, char *log_msg){
   }
   {
     memcpy_P(cmd, panasonicSendQuery, sizeof(panasonicSendQuery));
-    cmd[address] = value;
+    setQueryByte(cmd, address, value);
   }
   return sizeof(panasonicSendQuery);
 }
@@ -914,7 +927,7 @@ unsigned int set_heatingcontrol(char *msg, unsigned char *cmd, char *log_msg) {
 
   {
     memcpy_P(cmd, panasonicSendQuery, sizeof(panasonicSendQuery));
-    cmd[address] = value << 2;
+    setQueryByte(cmd, address, value << 2);
   }
 
   return sizeof(panasonicSendQuery);
@@ -937,7 +950,7 @@ unsigned int set_smart_dhw(char *msg, unsigned char *cmd, char *log_msg) {
 
   {
     memcpy_P(cmd, panasonicSendQuery, sizeof(panasonicSendQuery));
-    cmd[address] = value << 6;
+    setQueryByte(cmd, address, value << 6);
   }
 
   return sizeof(panasonicSendQuery);
@@ -960,7 +973,7 @@ unsigned int set_quiet_mode_priority(char *msg, unsigned char *cmd, char *log_ms
 
   {
     memcpy_P(cmd, panasonicSendQuery, sizeof(panasonicSendQuery));
-    cmd[address] = value << 4;
+    setQueryByte(cmd, address, value << 4);
   }
 
   return sizeof(panasonicSendQuery);
@@ -983,7 +996,7 @@ unsigned int set_pump_flowrate_mode(char *msg, unsigned char *cmd, char *log_msg
 
   {
     memcpy_P(cmd, panasonicSendQuery, sizeof(panasonicSendQuery));
-    cmd[address] = value << 4;
+    setQueryByte(cmd, address, value << 4);
   }
 
   return sizeof(panasonicSendQuery);
@@ -1006,7 +1019,7 @@ unsigned int set_dhw_sensor_selection(char *msg, unsigned char *cmd, char *log_m
 
   {
     memcpy_P(cmd, panasonicSendQuery, sizeof(panasonicSendQuery));
-    cmd[address] = value;
+    setQueryByte(cmd, address, value);
   }
 
   return sizeof(panasonicSendQuery);
@@ -1029,7 +1042,7 @@ unsigned int set_dhw_heater_state(char *msg, unsigned char *cmd, char *log_msg)
 
   {
     memcpy_P(cmd, panasonicSendQuery, sizeof(panasonicSendQuery));
-    cmd[address] = value << 2;
+    setQueryByte(cmd, address, value << 2);
   }
 
   return sizeof(panasonicSendQuery);
@@ -1052,7 +1065,7 @@ unsigned int set_room_heater_state(char *msg, unsigned char *cmd, char *log_msg)
 
   {
     memcpy_P(cmd, panasonicSendQuery, sizeof(panasonicSendQuery));
-    cmd[address] = value;
+    setQueryByte(cmd, address, value);
   }
 
   return sizeof(panasonicSendQuery);
@@ -1072,7 +1085,7 @@ unsigned int set_heater_on_outdoor_temp(char *msg, unsigned char *cmd, char *log
 
   {
     memcpy_P(cmd, panasonicSendQuery, sizeof(panasonicSendQuery));
-    cmd[85] = byteValue;
+    setQueryByte(cmd, 85, byteValue);
   }
 
   return sizeof(panasonicSendQuery);
@@ -1092,7 +1105,7 @@ unsigned int set_external_compressor_control(char *msg, unsigned char *cmd, char
   }
   {
     memcpy_P(cmd, panasonicSendQuery, sizeof(panasonicSendQuery));
-    cmd[address] = value;
+    setQueryByte(cmd, address, value);
   }
   return sizeof(panasonicSendQuery);
 }
@@ -1245,33 +1258,32 @@ unsigned int set_solar_temp(char *msg, char *log_msg) {
 
 
 
-void send_heatpump_command(char* topic, char *msg, bool (*send_command)(byte*, int), void (*log_message)(char*), bool optionalPCB) {
+void send_heatpump_command(char* topic, char *msg, bool (*send_setting)(uint8_t, byte*, int), void (*log_message)(char*), bool optionalPCB) {
   unsigned char cmd[256] = { 0 };
   char log_msg[256] = { 0 };
   unsigned int len = 0;
 
-  for (unsigned int i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+  // the index is case insensitive, mqtt topics are matched exactly
+  int16_t i = lookupCommand(topic, strlen(topic));
+  if (i >= 0 && strcmp_P(topic, commands[i].name) == 0) {
     cmdStruct tmp;
     memcpy_P(&tmp, &commands[i], sizeof(tmp));
-    if (strcmp(topic, tmp.name) == 0) {
-      len = tmp.func(msg, cmd, log_msg);
-      log_message(log_msg);
-      if (len > 0) send_command(cmd, len);
-    }
+    len = tmp.func(msg, cmd, log_msg);
+    log_message(log_msg);
+    if (len > 0) send_setting(i, cmd, len);
   }
 
   if (optionalPCB) {
     //run for optional pcb commands
-    for (unsigned int i = 0; i < sizeof(optionalCommands) / sizeof(optionalCommands[0]); i++) {
+    i = lookupOptCommand(topic, strlen(topic));
+    if (i >= 0 && strcmp_P(topic, optionalCommands[i].name) == 0) {
       optCmdStruct tmp;
       memcpy_P(&tmp, &optionalCommands[i], sizeof(tmp));
-      if (strcmp(topic, tmp.name) == 0) {
-        len = tmp.func(msg, log_msg);
-        log_message(log_msg);
-#ifdef ESP32        
-       xQueueOverwrite(pcbQueue, optionalPCBQuery);
-#endif          
-      }
+      len = tmp.func(msg, log_msg);
+      log_message(log_msg);
+#ifdef ESP32
+      xQueueOverwrite(pcbQueue, optionalPCBQuery);
+#endif
     }
   }
 
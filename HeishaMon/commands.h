@@ -8,6 +8,10 @@
 extern byte initialQuery[INITIALQUERYSIZE];
 #define PANASONICQUERYSIZE 110
 extern byte panasonicQuery[PANASONICQUERYSIZE];
+//checksums of the query for the normal (0x10) and the extra (0x21) data block, and of the send query before a command changes it
+#define PANASONICQUERYCHK 0x12
+#define PANASONICEXTRAQUERYCHK 0x01
+#define PANASONICSENDQUERYCHK 0x92
 
 
 #define OPTDATASIZE 20
@@ -94,14 +98,18 @@ unsigned int set_byte_9(char *msg, char *log_msg);
 unsigned int set_external_compressor_control(char *msg, unsigned char *cmd, char *log_msg);
 unsigned int set_external_heat_cool_control(char *msg, unsigned char *cmd, char *log_msg);
 
+// queued ahead of the other pending commands
+#define CMD_URGENT 0x01
+
 struct cmdStruct {
   char name[29];
   unsigned int (*func)(char *msg, unsigned char *cmd, char *log_msg);
+  uint8_t flags;
 };
 
 const cmdStruct commands[] PROGMEM = {
   // set heatpump state to on by sending 1
-  { "SetHeatpump", set_heatpump_state },
+  { "SetHeatpump", set_heatpump_state, CMD_URGENT },
   // set pump state to on by sending 1
   { "SetPump", set_pump },
   // set max pump duty
@@ -117,13 +125,13 @@ const cmdStruct commands[] PROGMEM = {
   // z2 cool request temp -  set from -5 to 5 to get same temperature shift point or set direct temp
   { "SetZ2CoolRequestTemperature", set_z2_cool_request_temperature },
   // set mode to force DHW by sending 1
-  { "SetForceDHW", set_force_DHW },
+  { "SetForceDHW", set_force_DHW, CMD_URGENT },
   // set mode to force defrost  by sending 1
-  { "SetForceDefrost", set_force_defrost },
+  { "SetForceDefrost", set_force_defrost, CMD_URGENT },
   // set mode to force sterilization by sending 1
-  { "SetForceSterilization", set_force_sterilization },
+  { "SetForceSterilization", set_force_sterilization, CMD_URGENT },
   // set mode to force heater (emergency heating) by sending 1, off will be 0
-  { "SetForceHeater", set_force_heater },
+  { "SetForceHeater", set_force_heater, CMD_URGENT },
   // set Holiday mode by sending 1, off will be 0
   { "SetHolidayMode", set_holiday_mode },
   // set Powerful mode by sending 0 = off, 1 for 30min, 2 for 60min, 3 for 90 min
@@ -197,6 +205,7 @@ const optCmdStruct optionalCommands[] PROGMEM = {
   { "SetOptPCBByte9", set_byte_9 }
 };
 
-void send_heatpump_command(char* topic, char *msg, bool (*send_command)(byte*, int), void (*log_message)(char*), bool optionalPCB);
+// the command builders return a datagram that ends with its checksum
+void send_heatpump_command(char* topic, char *msg, bool (*send_setting)(uint8_t, byte*, int), void (*log_message)(char*), bool optionalPCB);
 bool saveOptionalPCB(byte* command, int length);
 bool loadOptionalPCB(byte* command, int length);
@@ -4,150 +4,374 @@
 #include "src/common/progmem.h"
 
 void websocket_write_all(char *data, uint16_t data_len);
+uint8_t websocket_clients(void);
 
 unsigned long lastalldatatime = 0;
 unsigned long lastallextradatatime = 0;
 unsigned long lastalloptdatatime = 0;
 
-String getBit1(byte input) {
-  return String(input  >> 7);
+valueCache_t topicCache[NUMBER_OF_TOPICS];
+valueCache_t xtopicCache[NUMBER_OF_TOPICS_EXTRA];
+valueCache_t optTopicCache[NUMBER_OF_OPT_TOPICS];
+
+int32_t decodeValue(const char *data, const topicDecode_t *desc) {
+  topicDecode_t dec;
+  memcpy_P(&dec, desc, sizeof(topicDecode_t));
+  uint8_t input = (uint8_t)data[dec.byte];
+
+  switch(dec.type) {
+    case DEC_BITS: {
+      return (int32_t)((input >> dec.shift) & dec.mask) - dec.offset;
+    } break;
+    case DEC_SCALE: {
+      return ((int32_t)input - dec.offset) * dec.mul / dec.div;
+    } break;
+    case DEC_FRACTION: {
+      int32_t value = ((int32_t)input - dec.offset) * 100;
+      uint8_t fractional = ((uint8_t)data[dec.frac] >> dec.fracshift) & 0b111;
+      if(fractional >= 2 && fractional <= 4) { // fractional .25, .50 or .75
+        value += (value < 0) ? -25 * (fractional - 1) : 25 * (fractional - 1);
+      }
+      return value;
+    } break;
+    case DEC_WORD: {
+      return (int32_t)(((uint8_t)data[dec.byte + 1] << 8) | input) - dec.offset;
+    } break;
+    case DEC_OPMODE: {
+      switch(input & dec.mask) {
+        case 18: return 0;
+        case 19: return 1;
+        case 25: return 2;
+        case 33: return 3;
+        case 34: return 4;
+        case 35: return 5;
+        case 41: return 6;
+        case 26: return 7;
+        case 42: return 8;
+        default: return -1;
+      }
+    } break;
+    case DEC_PUMPFLOW: {
+      // whole l/min plus (fraction byte - 1) / 256, rounded half to even to 2 decimals like printf
+      int32_t value = (int32_t)input * 100;
+      int32_t fraction = ((int32_t)(uint8_t)data[dec.frac] - 1) * 100;
+      if(fraction > 0) {
+        int32_t rest = fraction % 256;
+        value += fraction / 256;
+        if(rest > 128 || (rest == 128 && (value & 1))) {
+          value++;
+        }
+      }
+      return value;
+    } break;
+    case DEC_ERROR: {
+      return (input << 8) | (uint8_t)data[dec.byte + 1];
+    } break;
+    case DEC_MODEL: {
+      // only used to detect changes, the model is formatted from the datagram itself
+      uint32_t hash = 2166136261UL;
+      for(uint8_t i = 0; i < 10; i++) {
+        hash = (hash ^ (uint8_t)data[dec.byte + i]) * 16777619UL;
+      }
+      return (int32_t)hash;
+    } break;
+  }
+  return -1;
 }
 
-String getBit1and2(byte input) {
-  return String((input  >> 6) - 1);
+void decodeValues(const char *data, const topicDecode_t *table, unsigned int count, int32_t *values) {
+  for(unsigned int i = 0; i < count; i++) {
+    values[i] = decodeValue(data, &table[i]);
+  }
 }
 
-String getBit3and4(byte input) {
-  return String(((input >> 4) & 0b11) - 1);
-}
+uint8_t valueType(const topicDecode_t *desc) {
+  topicDecode_t dec;
+  memcpy_P(&dec, desc, sizeof(topicDecode_t));
 
-String getBit5and6(byte input) {
-  return String(((input >> 2) & 0b11) - 1);
+  if(dec.type == DEC_ERROR || dec.type == DEC_MODEL) {
+    return VALUE_STRING;
+  }
+  return (dec.decimals > 0) ? VALUE_FLOAT : VALUE_INTEGER;
 }
 
-String getBit7and8(byte input) {
-  return String((input & 0b11) - 1);
-}
+float valueToFloat(const topicDecode_t *desc, int32_t value) {
+  topicDecode_t dec;
+  memcpy_P(&dec, desc, sizeof(topicDecode_t));
 
-String getBit3and4and5(byte input) {
-  return String(((input >> 3) & 0b111) - 1);
+  switch(dec.decimals) {
+    case 1: return (float)value / 10;
+    case 2: return (float)value / 100;
+  }
+  return (float)value;
 }
 
-String getLeft5bits(byte input) {
-  return String((input >> 3) - 1);
+static void updateValueCache(valueCache_t *cache, int32_t value, bool changed) {
+  cache->value = value;
+  if(changed || cache->version == 0) {
+    if(++cache->version == 0) { // 0 is reserved for no value yet
+      cache->version = 1;
+    }
+  }
 }
 
-String getRight3bits(byte input) {
-  return String((input & 0b111) - 1);
-}
+uint8_t formatValue(char *out, const char *data, const topicDecode_t *desc, int32_t value) {
+  topicDecode_t dec;
+  memcpy_P(&dec, desc, sizeof(topicDecode_t));
+
+  switch(dec.type) {
+    case DEC_ERROR: {
+      int number = (value & 0xFF) - 17;
+      switch(value >> 8) {
+        case 177: // B1=F type error
+          return sprintf_P(out, PSTR("F%02X"), number);
+        case 161: // A1=H type error
+          return sprintf_P(out, PSTR("H%02X"), number);
+        default:
+          strcpy_P(out, PSTR("No error"));
+          return strlen(out);
+      }
+    } break;
+    case DEC_MODEL: {
+      for(uint8_t i = 0; i < 10; i++) {
+        sprintf_P(&out[i*3], PSTR("%02X "), (uint8_t)data[dec.byte + i]);
+      }
+      out[29] = '\0';
+      return 29;
+    } break;
+    case DEC_FRACTION: {
+      // whole degrees are printed without decimals
+      if((value % 100) == 0) {
+        return sprintf_P(out, PSTR("%ld"), (long)(value / 100));
+      }
+    } break;
+  }
 
-String getIntMinus1(byte input) {
-  int value = (int)input - 1;
-  return (String)value;
-}
+  if(dec.decimals == 0) {
+    return sprintf_P(out, PSTR("%ld"), (long)value);
+  }
 
-String getIntMinus128(byte input) {
-  int value = (int)input - 128;
-  return (String)value;
+  uint32_t div = (dec.decimals == 1) ? 10 : 100;
+  uint32_t absvalue = (value < 0) ? -value : value;
+  return sprintf_P(out, PSTR("%s%lu.%0*lu"), (value < 0) ? "-" : "", (unsigned long)(absvalue / div), dec.decimals, (unsigned long)(absvalue % div));
 }
 
-String getIntMinus1Div5(byte input) {
-  return String((((float)input - 1) / 5), 1);
+/*
+ * Items of the /json topic arrays, every topic is one
+ * item and so is the opening and closing of an array.
+ */
+#define JSON_ITEM_HEATPUMP 0
+#define JSON_ITEM_TOPICS (JSON_ITEM_HEATPUMP + 1)
+#define JSON_ITEM_EXTRA (JSON_ITEM_TOPICS + NUMBER_OF_TOPICS)
+#define JSON_ITEM_XTOPICS (JSON_ITEM_EXTRA + 1)
+#define JSON_ITEM_OPTIONAL (JSON_ITEM_XTOPICS + NUMBER_OF_TOPICS_EXTRA)
+#define JSON_ITEM_OPTTOPICS (JSON_ITEM_OPTIONAL + 1)
+#define JSON_ITEM_END (JSON_ITEM_OPTTOPICS + NUMBER_OF_OPT_TOPICS)
+
+static_assert(JSON_TOPICS_DONE == JSON_ITEM_END + 1, "JSON_TOPICS_DONE out of sync");
+
+static const char jsonHeatpump[] PROGMEM = "{\"heatpump\":[";
+static const char jsonExtra[] PROGMEM = "],\"heatpump extra\":[";
+static const char jsonOptional[] PROGMEM = "],\"heatpump optional\":[";
+static const char jsonEnd[] PROGMEM = "]";
+static const char jsonTopic[] PROGMEM = "{\"Topic\":\"";
+static const char jsonName[] PROGMEM = "\",\"Name\":\"";
+static const char jsonValue[] PROGMEM = "\",\"Value\":";
+static const char jsonDescription[] PROGMEM = ",\"Description\":\"";
+static const char jsonClose[] PROGMEM = "\"}";
+
+/*
+ * Number of modes of each description, the first
+ * entry of the description as number.
+ */
+static uint8_t topicModes[NUMBER_OF_TOPICS];
+static uint8_t xtopicModes[NUMBER_OF_TOPICS_EXTRA];
+static uint8_t optTopicModes[NUMBER_OF_OPT_TOPICS];
+static bool topicModesBuild = false;
+
+static void buildTopicModes(void) {
+  for(uint8_t i = 0; i < NUMBER_OF_TOPICS; i++) {
+    topicModes[i] = atoi(topicDescription[i][0]);
+  }
+  for(uint8_t i = 0; i < NUMBER_OF_TOPICS_EXTRA; i++) {
+    xtopicModes[i] = atoi(xtopicDescription[i][0]);
+  }
+  for(uint8_t i = 0; i < NUMBER_OF_OPT_TOPICS; i++) {
+    optTopicModes[i] = atoi(opttopicDescription[i][0]);
+  }
+  topicModesBuild = true;
 }
 
-String getIntMinus1Div50(byte input) {
-  return String((((float)input - 1) / 50), 2);
+typedef struct jsonWriter_t {
+  char *buf;
+  uint16_t size;
+  uint16_t len;
+  bool full;
+} jsonWriter_t;
+
+static void jsonAppend(jsonWriter_t *w, const char *str, uint16_t len) {
+  if(w->full || w->len + len > w->size) {
+    w->full = true;
+    return;
+  }
+  memcpy(&w->buf[w->len], str, len);
+  w->len += len;
 }
 
-String getIntMinus1Times10(byte input) {
-  int value = (int)input - 1;
-  return (String)(value * 10);
+static void jsonAppend_P(jsonWriter_t *w, PGM_P str) {
+  uint16_t len = strlen_P(str);
+  if(w->full || w->len + len > w->size) {
+    w->full = true;
+    return;
+  }
+  memcpy_P(&w->buf[w->len], str, len);
+  w->len += len;
 }
 
-String getIntMinus1Times50(byte input) {
-  int value = (int)input - 1;
-  return (String)(value * 50);
+static void jsonTopicItem(jsonWriter_t *w, const char *prefix, uint8_t nr, PGM_P name, const char *data, const topicDecode_t *decode, const valueCache_t *cache, const char **description, uint8_t modes, bool quoted) {
+  char str[MAX_VALUE_LEN];
+  uint8_t len = 0;
+
+  jsonAppend_P(w, jsonTopic);
+  len = sprintf_P(str, PSTR("%s%u"), prefix, nr);
+  jsonAppend(w, str, len);
+  jsonAppend_P(w, jsonName);
+  jsonAppend_P(w, name);
+  jsonAppend_P(w, jsonValue);
+  if(quoted) {
+    jsonAppend(w, "\"", 1);
+  }
+  len = formatValue(str, data, decode, cache->value);
+  jsonAppend(w, str, len);
+  if(quoted) {
+    jsonAppend(w, "\"", 1);
+  }
+  jsonAppend_P(w, jsonDescription);
+
+  int value = (data[0] == '\0' || modes == 0) ? 0 : cache->value; //modes 0 is a real value description instead of a mode, so take the first index
+  if((value < 0) || (value > modes)) {
+    jsonAppend_P(w, _unknown);
+  } else {
+    jsonAppend_P(w, description[value + 1]);
+  }
+  jsonAppend_P(w, jsonClose);
 }
 
+uint16_t jsonTopics(char *buf, uint16_t size, uint16_t *item, const char *actData, const char *actDataExtra, const char *actOptData, bool extra, bool optional) {
+  jsonWriter_t w = { buf, size, 0, false };
 
-String unknown(byte input) {
-  return "-1";
-}
+  if(!topicModesBuild) {
+    buildTopicModes();
+  }
 
-String getValvePID(byte input) {
-  return String((((float)input - 1) / 2), 1);
-}
+  while(*item < JSON_TOPICS_DONE) {
+    uint16_t i = *item, mark = w.len;
 
-String getOpMode(byte input) {
-  switch ((int)(input & 0b111111)) {
-    case 18:
-      return "0";
-    case 19:
-      return "1";
-    case 25:
-      return "2";
-    case 33:
-      return "3";
-    case 34:
-      return "4";
-    case 35:
-      return "5";
-    case 41:
-      return "6";
-    case 26:
-      return "7";
-    case 42:
-      return "8";
-    default:
-      return "-1";
+    if(i == JSON_ITEM_HEATPUMP) {
+      jsonAppend_P(&w, jsonHeatpump);
+    } else if(i < JSON_ITEM_EXTRA) {
+      uint8_t nr = i - JSON_ITEM_TOPICS;
+      if(nr > 0) {
+        jsonAppend(&w, ",", 1);
+      }
+      jsonTopicItem(&w, "TOP", nr, topics[nr], actData, &topicDecode[nr], &topicCache[nr], topicDescription[nr], topicModes[nr], valueType(&topicDecode[nr]) == VALUE_STRING);
+    } else if(i == JSON_ITEM_EXTRA) {
+      if(!extra) {
+        *item = JSON_ITEM_OPTIONAL;
+        continue;
+      }
+      jsonAppend_P(&w, jsonExtra);
+    } else if(i < JSON_ITEM_OPTIONAL) {
+      uint8_t nr = i - JSON_ITEM_XTOPICS;
+      if(nr > 0) {
+        jsonAppend(&w, ",", 1);
+      }
+      jsonTopicItem(&w, "XTOP", nr, xtopics[nr], actDataExtra, &xtopicDecode[nr], &xtopicCache[nr], xtopicDescription[nr], xtopicModes[nr], true);
+    } else if(i == JSON_ITEM_OPTIONAL) {
+      if(!optional) {
+        *item = JSON_ITEM_END;
+        continue;
+      }
+      jsonAppend_P(&w, jsonOptional);
+    } else if(i < JSON_ITEM_END) {
+      uint8_t nr = i - JSON_ITEM_OPTTOPICS;
+      if(nr > 0) {
+        jsonAppend(&w, ",", 1);
+      }
+      jsonTopicItem(&w, "OPT", nr, optTopics[nr], actOptData, &optTopicDecode[nr], &optTopicCache[nr], opttopicDescription[nr], optTopicModes[nr], true);
+    } else {
+      jsonAppend_P(&w, jsonEnd);
+    }
+
+    if(w.full) {
+      // the item goes first in the next buffer
+      w.len = mark;
+      break;
+    }
+    *item = i + 1;
   }
+  return w.len;
 }
 
-String getModel(char* data) { // TOP92 //
-  byte model[10] = { data[129], data[130], data[131], data[132], data[133], data[134], data[135], data[136], data[137], data[138]};
-  char modelResult[31];
-  for (size_t i = 0; i < 10; ++i) {
-    sprintf(&modelResult[i*3], "%02X ", model[i]);
-  }
-  modelResult[29] = '\0';
-  return String(modelResult);
+uint32_t rawBootId = 0;
+uint32_t rawSequence = 0;
+
+static uint8_t rawFlags(bool extra, bool optional) {
+  return (extra ? RAW_FLAG_EXTRA : 0) | (optional ? RAW_FLAG_OPTIONAL : 0);
 }
 
-String getPower(byte input) {
-  int value = ((int)input - 1) * 200;
-  return (String)value;
+static void rawPut16(uint8_t *buf, uint16_t value) {
+  buf[0] = value & 0xFF;
+  buf[1] = value >> 8;
 }
 
-String getUintt16(char* data, byte addr) {
-  uint16_t value = static_cast<uint16_t>((data[addr + 1] << 8) | data[addr]);
-  return (String)(value - 1);
+static void rawPut32(uint8_t *buf, uint32_t value) {
+  rawPut16(buf, value & 0xFFFF);
+  rawPut16(&buf[2], value >> 16);
 }
 
-String getPumpFlow(char* data) {  // TOP1 //
-  int PumpFlow1 = (int)data[170];
-  float PumpFlow2 = (((float)data[169] - 1) / 256);
-  float PumpFlow = PumpFlow1 + PumpFlow2;
-  return String(PumpFlow, 2);
+uint16_t rawValuesSize(bool extra, bool optional) {
+  return RAW_HEADER_SIZE + DATASIZE + (extra ? DATASIZE : 0) + (optional ? OPTDATASIZE : 0);
 }
 
-String getErrorInfo(char* data) { // TOP44 //
-  int Error_type = (int)(data[113]);
-  int Error_number = ((int)(data[114])) - 17;
-  char Error_string[10];
-  switch (Error_type) {
-    case 177:                  //B1=F type error
-      sprintf(Error_string, "F%02X", Error_number);
-      break;
-    case 161:                  //A1=H type error
-      sprintf(Error_string, "H%02X", Error_number);
-      break;
-    default:
-      sprintf(Error_string, "No error");
-      break;
+/*
+ * Fills buf, of at least rawValuesSize() bytes, with the
+ * snapshot and returns its length.
+ */
+uint16_t rawValues(uint8_t *buf, const char *actData, const char *actDataExtra, const char *actOptData, bool extra, bool optional) {
+  uint16_t len = RAW_HEADER_SIZE;
+
+  buf[0] = 'H';
+  buf[1] = 'M';
+  buf[2] = RAW_SCHEMA_VERSION;
+  buf[3] = rawFlags(extra, optional);
+  rawPut32(&buf[4], rawBootId);
+  rawPut32(&buf[8], rawSequence);
+  rawPut16(&buf[12], DATASIZE);
+  rawPut16(&buf[14], extra ? DATASIZE : 0);
+  rawPut16(&buf[16], optional ? OPTDATASIZE : 0);
+  rawPut16(&buf[18], 0);
+
+  memcpy(&buf[len], actData, DATASIZE);
+  len += DATASIZE;
+  if(extra) {
+    memcpy(&buf[len], actDataExtra, DATASIZE);
+    len += DATASIZE;
+  }
+  if(optional) {
+    memcpy(&buf[len], actOptData, OPTDATASIZE);
+    len += OPTDATASIZE;
   }
-  return String(Error_string);
+  return len;
 }
 
+/*
+ * The quoted entity tag of the current snapshot, which
+ * only changes together with its content.
+ */
+uint8_t rawETag(char *out, bool extra, bool optional) {
+  return snprintf_P(out, RAW_ETAG_LEN, PSTR("\"%u-%x-%08x-%08x\""), RAW_SCHEMA_VERSION, rawFlags(extra, optional), (unsigned int)rawBootId, (unsigned int)rawSequence);
+}
 
 void resetlastalldatatime() {
   lastalldatatime = 0;
@@ -155,141 +379,185 @@ void resetlastalldatatime() {
   lastalloptdatatime = 0;
 }
 
-String getDataValue(char* data, unsigned int Topic_Number) {
-  String Topic_Value;
-  byte Input_Byte;
-  switch (Topic_Number) { //switch on topic numbers, some have special needs
-    case 1:
-      Topic_Value = getPumpFlow(data);
-      break;
-    case 5: {
-        byte cpy;
-        memcpy_P(&cpy, &topicBytes[Topic_Number], sizeof(byte));
-        Input_Byte = data[cpy];
-        Topic_Value = topicFunctions[Topic_Number](Input_Byte);
-        int fractional = (int)(data[118] & 0b111);
-        switch (fractional) {
-          case 1: // fractional .00
-            break;
-          case 2: // fractional .25
-            Topic_Value = Topic_Value + ".25";
-            break;
-          case 3: // fractional .50
-            Topic_Value = Topic_Value + ".50";
-            break;
-          case 4: // fractional .75
-            Topic_Value = Topic_Value + ".75";
-            break;
-          default:
-            break;
-        }
+/*
+ * Reverse index from datagram byte to the topics reading that byte,
+ * so a changed byte directly points to the topics to decode.
+ */
+#define MAX_TOPIC_INDEX 255
+
+static uint8_t topicIndexStart[DATASIZE + 1];
+static uint8_t topicIndex[MAX_TOPIC_INDEX];
+static bool topicIndexBuild = false;
+
+static uint8_t topicBytes(const topicDecode_t *desc, uint8_t *bytes) {
+  topicDecode_t dec;
+  memcpy_P(&dec, desc, sizeof(topicDecode_t));
+  uint8_t nr = 0;
+
+  bytes[nr++] = dec.byte;
+  switch(dec.type) {
+    case DEC_FRACTION:
+    case DEC_PUMPFLOW: {
+      bytes[nr++] = dec.frac;
+    } break;
+    case DEC_WORD:
+    case DEC_ERROR: {
+      bytes[nr++] = dec.byte + 1;
+    } break;
+    case DEC_MODEL: {
+      for(uint8_t i = 1; i < 10; i++) {
+        bytes[nr++] = dec.byte + i;
       }
-      break;
-    case 6: {
-        byte cpy;
-        memcpy_P(&cpy, &topicBytes[Topic_Number], sizeof(byte));
-        Input_Byte = data[cpy];
-        Topic_Value = topicFunctions[Topic_Number](Input_Byte);
-        int fractional = (int)((data[118] >> 3) & 0b111) ;
-        switch (fractional) {
-          case 1: // fractional .00
-            break;
-          case 2: // fractional .25
-            Topic_Value = Topic_Value + ".25";
-            break;
-          case 3: // fractional .50
-            Topic_Value = Topic_Value + ".50";
-            break;
-          case 4: // fractional .75
-            Topic_Value = Topic_Value + ".75";
-            break;
-          default:
-            break;
-        }
-      }
-      break;
-    case 11:
-      Topic_Value = String(word(data[183], data[182]) - 1);
-      break;
-    case 12:
-      Topic_Value = String(word(data[180], data[179]) - 1);
-      break;
-    case 90:
-      Topic_Value = String(word(data[186], data[185]) - 1);
-      break;
-    case 91:
-      Topic_Value = String(word(data[189], data[188]) - 1);
-      break;
-    case 44:
-      Topic_Value = getErrorInfo(data);
-      break;
-    case 92:
-      Topic_Value = getModel(data);
-      break;
-    default:
-      byte cpy;
-      memcpy_P(&cpy, &topicBytes[Topic_Number], sizeof(byte));
-      Input_Byte = data[cpy];
-      Topic_Value = topicFunctions[Topic_Number](Input_Byte);
-      break;
+    } break;
   }
-  return Topic_Value;
+  return nr;
 }
 
-String getDataValueExtra(char* data, unsigned int Topic_Number) {
-  String Topic_Value;
-  switch (Topic_Number) { //switch on topic numbers, some have special needs
-    default:
-      byte addr;
-      memcpy_P(&addr, &xtopicBytes[Topic_Number], sizeof(byte));
-      Topic_Value = xtopicFunctions[Topic_Number](data, addr);
-      break;
+static void buildTopicIndex(void) {
+  uint8_t count[DATASIZE] = { 0 };
+  uint8_t bytes[10];
+
+  for(unsigned int Topic_Number = 0 ; Topic_Number < NUMBER_OF_TOPICS ; Topic_Number++) {
+    uint8_t nr = topicBytes(&topicDecode[Topic_Number], bytes);
+    for(uint8_t i = 0; i < nr; i++) {
+      count[bytes[i]]++;
+    }
+  }
+
+  unsigned int total = 0;
+  for(unsigned int i = 0; i < DATASIZE; i++) {
+    topicIndexStart[i] = total;
+    total += count[i];
+    count[i] = 0;
   }
-  return Topic_Value;
+  topicIndexStart[DATASIZE] = total;
+
+  if(total > MAX_TOPIC_INDEX) {
+    return;
+  }
+
+  for(unsigned int Topic_Number = 0 ; Topic_Number < NUMBER_OF_TOPICS ; Topic_Number++) {
+    uint8_t nr = topicBytes(&topicDecode[Topic_Number], bytes);
+    for(uint8_t i = 0; i < nr; i++) {
+      topicIndex[topicIndexStart[bytes[i]] + count[bytes[i]]++] = Topic_Number;
+    }
+  }
+  topicIndexBuild = true;
 }
 
-String getOptDataValue(char* data, unsigned int Topic_Number) {
-  String Topic_Value;
-  switch (Topic_Number) { //switch on topic numbers, some have special needs
-    case 0:
-      Topic_Value = String(data[4] >> 7);
-      break;
-    case 1:
-      Topic_Value = String((data[4] >> 5) & 0b11);
-      break;
-    case 2:
-      Topic_Value = String((data[4] >> 4) & 0b1);
-      break;
-    case 3:
-      Topic_Value = String((data[4] >> 2) & 0b11);
-      break;
-    case 4:
-      Topic_Value = String((data[4] >> 1) & 0b1);
-      break;
-    case 5:
-      Topic_Value = String((data[4] >> 0) & 0b1);
-      break;
-    case 6:
-      Topic_Value = String((data[5] >> 0) & 0b1);
-      break;
-    default:
-      break;
+/*
+ * Marks the topics that read a byte that differs between both
+ * datagrams. These are candidates, a change in a bit field that
+ * a topic does not use still marks it.
+ */
+void markChangedTopics(const char *data, const char *actData, bool *changed) {
+  if(topicIndexBuild == false) {
+    buildTopicIndex();
+  }
+  if(topicIndexBuild == false) {
+    for(unsigned int Topic_Number = 0 ; Topic_Number < NUMBER_OF_TOPICS ; Topic_Number++) {
+      changed[Topic_Number] = true;
+    }
+    return;
+  }
+  if(memcmp(data, actData, DATASIZE) == 0) {
+    return;
+  }
+  for(unsigned int i = 0; i < DATASIZE; i++) {
+    if((data[i] ^ actData[i]) != 0) {
+      for(uint8_t x = topicIndexStart[i]; x < topicIndexStart[i + 1]; x++) {
+        changed[topicIndex[x]] = true;
+      }
+    }
   }
-  return Topic_Value;
 }
 
-String getFirstByte(byte input) {
-  return String((input >> 4) - 1);
+String getDataValue(char* data, unsigned int Topic_Number) {
+  char value[MAX_VALUE_LEN];
+  formatValue(value, data, &topicDecode[Topic_Number], decodeValue(data, &topicDecode[Topic_Number]));
+  return String(value);
 }
 
-String getSecondByte(byte input) {
-  return String((input & 0b1111) - 1);
+String getDataValueExtra(char* data, unsigned int Topic_Number) {
+  char value[MAX_VALUE_LEN];
+  formatValue(value, data, &xtopicDecode[Topic_Number], decodeValue(data, &xtopicDecode[Topic_Number]));
+  return String(value);
 }
 
+String getOptDataValue(char* data, unsigned int Topic_Number) {
+  char value[MAX_VALUE_LEN];
+  formatValue(value, data, &optTopicDecode[Topic_Number], decodeValue(data, &optTopicDecode[Topic_Number]));
+  return String(value);
+}
+
+/*
+ * Sends the changed topics of a datagram to the websocket clients as
+ * a heishavalues array, usually in one frame. A new frame is only
+ * started when the previous one reached WEBSOCKET_BATCH_SIZE.
+ */
+#define WEBSOCKET_BATCH_SIZE 1024
+
+static void websocketChangedTopics(const char *prefix, const char *data, const topicDecode_t *decode, const valueCache_t *cache, const char ***description, const bool *updateTopic, unsigned int count) {
+  static const char header[] PROGMEM = "{\"data\":{\"heishavalues\":[";
+  char frame[WEBSOCKET_BATCH_SIZE];
+  uint16_t len = 0;
 
+  if (websocket_clients() == 0) {
+    return;
+  }
+
+  len = strlen_P(header);
+  memcpy_P(frame, header, len);
+
+  for (unsigned int Topic_Number = 0 ; Topic_Number < count ; Topic_Number++) {
+    if (!updateTopic[Topic_Number]) {
+      continue;
+    }
+    char item[256];
+    char value[MAX_VALUE_LEN];
+    int maxvalue = atoi(description[Topic_Number][0]);
+    int32_t dataValue = cache[Topic_Number].value;
+    const char *desc = (maxvalue == 0) ? description[Topic_Number][1] : description[Topic_Number][dataValue + 1]; //maxvalue 0 is a real value description instead of a mode
+    formatValue(value, data, &decode[Topic_Number], dataValue);
+    if (valueType(&decode[Topic_Number]) == VALUE_STRING) {
+      sprintf_P(item, PSTR("{\"topic\":\"%s%u\",\"value\":\"%s\",\"description\":\"%s\"}"), prefix, Topic_Number, value, desc);
+    } else {
+      sprintf_P(item, PSTR("{\"topic\":\"%s%u\",\"value\":%s,\"description\":\"%s\"}"), prefix, Topic_Number, value, desc);
+    }
+    uint16_t itemlen = strlen(item);
+    // keep room for the separator and the closing ]}}
+    if (len + itemlen + 4 > (int)sizeof(frame)) {
+      frame[len - 1] = ']';
+      memcpy(&frame[len], "}}", 2);
+      websocket_write_all(frame, len + 2);
+      len = strlen_P(header);
+    }
+    memcpy(&frame[len], item, itemlen);
+    len += itemlen;
+    frame[len++] = ',';
+  }
+  if (len > strlen_P(header)) {
+    frame[len - 1] = ']';
+    memcpy(&frame[len], "}}", 2);
+    websocket_write_all(frame, len + 2);
+  }
+}
+
+/*
+ * Operating mode (TOP4), compressor running (TOP8), three way
+ * valve (TOP20) and defrost (TOP26) in one word. When it changes
+ * between two datagrams the heat pump is in a transition.
+ */
+uint32_t heatpumpState(const char *data) {
+  uint32_t state = decodeValue(data, &topicDecode[4]) & 0xFF;
+  state |= (decodeValue(data, &topicDecode[8]) > 0) << 8;
+  state |= (decodeValue(data, &topicDecode[20]) & 0xFF) << 9;
+  state |= (decodeValue(data, &topicDecode[26]) & 0xFF) << 17;
+  return state;
+}
 
 // Decode ////////////////////////////////////////////////////////////////////////////
-void decode_heatpump_data(char* data, char* actData, PubSubClient &mqtt_client, void (*log_message)(char*), char* mqtt_topic_base, unsigned int updateAllTime) {
+unsigned int decode_heatpump_data(char* data, char* actData, PubSubClient &mqtt_client, void (*log_message)(char*), char* mqtt_topic_base, unsigned int updateAllTime) {
   bool updateTime = false;
   bool updateTopic[NUMBER_OF_TOPICS] = { false };
 
@@ -297,45 +565,46 @@ void decode_heatpump_data(char* data, char* actData, PubSubClient &mqtt_client,
     updateTime = true;
     lastalldatatime = millis();
   }
+  markChangedTopics(data, actData, updateTopic);
   for (unsigned int Topic_Number = 0 ; Topic_Number < NUMBER_OF_TOPICS ; Topic_Number++) {
-    String Topic_Value;
-    Topic_Value = getDataValue(data, Topic_Number);
+    if (!updateTime && !updateTopic[Topic_Number]) {
+      continue;
+    }
+    int32_t Topic_Value = decodeValue(data, &topicDecode[Topic_Number]);
 
-    if(getDataValue(actData, Topic_Number) != Topic_Value) {
-      updateTopic[Topic_Number] = true;
+    if(updateTopic[Topic_Number] && decodeValue(actData, &topicDecode[Topic_Number]) == Topic_Value) {
+      updateTopic[Topic_Number] = false;
     }
 
+    updateValueCache(&topicCache[Topic_Number], Topic_Value, updateTopic[Topic_Number]);
+
     if (updateTime || updateTopic[Topic_Number]) {
       char log_msg[256];
       char mqtt_topic[256];
-      sprintf_P(log_msg, PSTR("received TOP%d %s: %s"), Topic_Number, topics[Topic_Number], Topic_Value.c_str());
+      char value[MAX_VALUE_LEN];
+      formatValue(value, data, &topicDecode[Topic_Number], Topic_Value);
+      sprintf_P(log_msg, PSTR("received TOP%d %s: %s"), Topic_Number, topics[Topic_Number], value);
       log_message(log_msg);
       sprintf_P(mqtt_topic, PSTR("%s/%s/%s"), mqtt_topic_base, mqtt_topic_values, topics[Topic_Number]);
-      mqtt_client.publish(mqtt_topic, Topic_Value.c_str(), MQTT_RETAIN_VALUES);
+      mqtt_client.publish(mqtt_topic, value, MQTT_RETAIN_VALUES);
     }
   }
+  if(memcmp(actData, data, DATASIZE) != 0) {
+    rawSequence++;
+  }
   memcpy(actData, data, DATASIZE);
+  websocketChangedTopics("TOP", actData, topicDecode, topicCache, topicDescription, updateTopic, NUMBER_OF_TOPICS);
+  unsigned int changed = 0;
   for (unsigned int Topic_Number = 0 ; Topic_Number < NUMBER_OF_TOPICS ; Topic_Number++) {
     if(updateTopic[Topic_Number]) {
-      char log_msg[256];
-      int maxvalue = atoi(topicDescription[Topic_Number][0]);
-      String dataValue = getDataValue(actData, Topic_Number);
-      if (maxvalue == 0) { //this takes the special case where the description is a real value description instead of a mode, so get description index 1
-        if ((Topic_Number != 44) && (Topic_Number != 92)) {
-          sprintf_P(log_msg, PSTR("{\"data\": {\"heishavalues\": {\"topic\": \"TOP%u\", \"value\": %s, \"description\": \"%s\"}}}"), Topic_Number, dataValue.c_str(),topicDescription[Topic_Number][1]);
-        } else {
-          sprintf_P(log_msg, PSTR("{\"data\": {\"heishavalues\": {\"topic\": \"TOP%u\", \"value\": \"%s\", \"description\": \"%s\"}}}"), Topic_Number, dataValue.c_str(),topicDescription[Topic_Number][1]);
-        }
-      } else {
-        sprintf_P(log_msg, PSTR("{\"data\": {\"heishavalues\": {\"topic\": \"TOP%u\", \"value\": %s, \"description\": \"%s\"}}}"), Topic_Number, dataValue.c_str(),topicDescription[Topic_Number][dataValue.toInt() + 1]);
-      }
-      websocket_write_all(log_msg, strlen(log_msg));          
-      rules_event_cb(_F("@"), topics[Topic_Number]);
+      rules_topic_cb(RULES_TOPIC, Topic_Number);
+      changed++;
     }
   }
+  return changed;
 }
 
-void decode_heatpump_data_extra(char* data, char* actDataExtra, PubSubClient &mqtt_client, void (*log_message)(char*), char* mqtt_topic_base, unsigned int updateAllTime) {
+unsigned int decode_heatpump_data_extra(char* data, char* actDataExtra, PubSubClient &mqtt_client, void (*log_message)(char*), char* mqtt_topic_base, unsigned int updateAllTime) {
   bool updateTime = false;
   bool updateTopic[NUMBER_OF_TOPICS_EXTRA] = { false };
 
@@ -344,37 +613,38 @@ void decode_heatpump_data_extra(char* data, char* actDataExtra, PubSubClient &mq
     lastallextradatatime = millis();
   }
   for (unsigned int Topic_Number = 0 ; Topic_Number < NUMBER_OF_TOPICS_EXTRA ; Topic_Number++) {
-    String Topic_Value;
-    Topic_Value = getDataValueExtra(data, Topic_Number);
+    int32_t Topic_Value = decodeValue(data, &xtopicDecode[Topic_Number]);
 
-    if(getDataValueExtra(actDataExtra, Topic_Number) != Topic_Value) {
+    if(decodeValue(actDataExtra, &xtopicDecode[Topic_Number]) != Topic_Value) {
       updateTopic[Topic_Number] = true;
     }
 
+    updateValueCache(&xtopicCache[Topic_Number], Topic_Value, updateTopic[Topic_Number]);
+
     if (updateTime || updateTopic[Topic_Number]) {
       char log_msg[256];
       char mqtt_topic[256];
-      sprintf_P(log_msg, PSTR("received XTOP%d %s: %s"), Topic_Number, xtopics[Topic_Number], Topic_Value.c_str());
+      char value[MAX_VALUE_LEN];
+      formatValue(value, data, &xtopicDecode[Topic_Number], Topic_Value);
+      sprintf_P(log_msg, PSTR("received XTOP%d %s: %s"), Topic_Number, xtopics[Topic_Number], value);
       log_message(log_msg);
       sprintf_P(mqtt_topic, PSTR("%s/%s/%s"), mqtt_topic_base, mqtt_topic_xvalues, xtopics[Topic_Number]);
-      mqtt_client.publish(mqtt_topic, Topic_Value.c_str(), MQTT_RETAIN_VALUES);
+      mqtt_client.publish(mqtt_topic, value, MQTT_RETAIN_VALUES);
     }
   }
+  if(memcmp(actDataExtra, data, DATASIZE) != 0) {
+    rawSequence++;
+  }
   memcpy(actDataExtra, data, DATASIZE);
+  websocketChangedTopics("XTOP", actDataExtra, xtopicDecode, xtopicCache, xtopicDescription, updateTopic, NUMBER_OF_TOPICS_EXTRA);
+  unsigned int changed = 0;
   for (unsigned int Topic_Number = 0 ; Topic_Number < NUMBER_OF_TOPICS_EXTRA ; Topic_Number++) {
     if(updateTopic[Topic_Number]) {
-      char log_msg[256];
-      int maxvalue = atoi(xtopicDescription[Topic_Number][0]);
-      String dataValue = getDataValueExtra(actDataExtra, Topic_Number);
-      if (maxvalue == 0) { //this takes the special case where the description is a real value description instead of a mode, so get description index 1
-        sprintf_P(log_msg, PSTR("{\"data\": {\"heishavalues\": {\"topic\": \"XTOP%u\", \"value\": %s, \"description\": \"%s\"}}}"), Topic_Number, dataValue.c_str(),xtopicDescription[Topic_Number][1]);
-      } else {
-        sprintf_P(log_msg, PSTR("{\"data\": {\"heishavalues\": {\"topic\": \"XTOP%u\", \"value\": %s, \"description\": \"%s\"}}}"), Topic_Number, dataValue.c_str(),xtopicDescription[Topic_Number][dataValue.toInt() + 1]);
-      }
-      websocket_write_all(log_msg, strlen(log_msg));         
-      rules_event_cb(_F("@"), xtopics[Topic_Number]);
+      rules_topic_cb(RULES_XTOPIC, Topic_Number);
+      changed++;
     }
   }
+  return changed;
 }
 
 void decode_optional_heatpump_data(char* data, char* actOptData, PubSubClient & mqtt_client, void (*log_message)(char*), char* mqtt_topic_base, unsigned int updateAllTime) {
@@ -386,20 +656,23 @@ void decode_optional_heatpump_data(char* data, char* actOptData, PubSubClient &
     lastalloptdatatime = millis();
   }
   for (unsigned int Topic_Number = 0 ; Topic_Number < NUMBER_OF_OPT_TOPICS ; Topic_Number++) {
-    String Topic_Value;
-    Topic_Value = getOptDataValue(data, Topic_Number);
+    int32_t Topic_Value = decodeValue(data, &optTopicDecode[Topic_Number]);
 
-    if(getOptDataValue(actOptData, Topic_Number) != Topic_Value) {
+    if(decodeValue(actOptData, &optTopicDecode[Topic_Number]) != Topic_Value) {
       updateTopic[Topic_Number] = true;
     }
 
+    updateValueCache(&optTopicCache[Topic_Number], Topic_Value, updateTopic[Topic_Number]);
+
     if (updateTime || updateTopic[Topic_Number]) {
       char log_msg[256];
       char mqtt_topic[256];
-      sprintf_P(log_msg, PSTR("received OPT%d %s: %s"), Topic_Number, optTopics[Topic_Number], Topic_Value.c_str());
+      char value[MAX_VALUE_LEN];
+      formatValue(value, data, &optTopicDecode[Topic_Number], Topic_Value);
+      sprintf_P(log_msg, PSTR("received OPT%d %s: %s"), Topic_Number, optTopics[Topic_Number], value);
       log_message(log_msg);
       sprintf_P(mqtt_topic, PSTR("%s/%s/%s"), mqtt_topic_base, mqtt_topic_pcbvalues, optTopics[Topic_Number]);
-      mqtt_client.publish(mqtt_topic, Topic_Value.c_str(), MQTT_RETAIN_VALUES);
+      mqtt_client.publish(mqtt_topic, value, MQTT_RETAIN_VALUES);
 
     }
   }
@@ -409,19 +682,14 @@ void decode_optional_heatpump_data(char* data, char* actOptData, PubSubClient &
   byte valueByte5 = data[5];
   optionalPCBQuery[5] = valueByte5;
 
+  if(memcmp(actOptData, data, OPTDATASIZE) != 0) {
+    rawSequence++;
+  }
   memcpy(actOptData, data, OPTDATASIZE);
+  websocketChangedTopics("OPT", actOptData, optTopicDecode, optTopicCache, opttopicDescription, updateTopic, NUMBER_OF_OPT_TOPICS);
   for (unsigned int Topic_Number = 0 ; Topic_Number < NUMBER_OF_OPT_TOPICS ; Topic_Number++) {
     if(updateTopic[Topic_Number]) {
-      char log_msg[256];
-      int maxvalue = atoi(opttopicDescription[Topic_Number][0]);
-      String dataValue = getOptDataValue(actOptData, Topic_Number);
-      if (maxvalue == 0) { //this takes the special case where the description is a real value description instead of a mode, so get description index 1
-        sprintf_P(log_msg, PSTR("{\"data\": {\"heishavalues\": {\"topic\": \"OPT%u\", \"value\": %s, \"description\": \"%s\"}}}"), Topic_Number, dataValue.c_str(),opttopicDescription[Topic_Number][1]);
-      } else {
-        sprintf_P(log_msg, PSTR("{\"data\": {\"heishavalues\": {\"topic\": \"OPT%u\", \"value\": %s, \"description\": \"%s\"}}}"), Topic_Number, dataValue.c_str(),opttopicDescription[Topic_Number][dataValue.toInt() + 1]);
-      }      
-      websocket_write_all(log_msg, strlen(log_msg));
-      rules_event_cb(_F("@"), optTopics[Topic_Number]);
+      rules_topic_cb(RULES_OPTTOPIC, Topic_Number);
     }
   }
 
@@ -10,33 +10,63 @@ void websocket_write_all(char *data, uint16_t data_len);
 String getDataValue(char* data, unsigned int Topic_Number);
 String getDataValueExtra(char* data, unsigned int Topic_Number);
 String getOptDataValue(char* data, unsigned int Topic_Number);
-void decode_heatpump_data(char* data, char* actData, PubSubClient &mqtt_client, void (*log_message)(char*), char* mqtt_topic_base, unsigned int updateAllTime);
-void decode_heatpump_data_extra(char* data, char* actDataExtra, PubSubClient &mqtt_client, void (*log_message)(char*), char* mqtt_topic_base, unsigned int updateAllTime);
+// the main and extra decoders return the number of topics that changed
+unsigned int decode_heatpump_data(char* data, char* actData, PubSubClient &mqtt_client, void (*log_message)(char*), char* mqtt_topic_base, unsigned int updateAllTime);
+unsigned int decode_heatpump_data_extra(char* data, char* actDataExtra, PubSubClient &mqtt_client, void (*log_message)(char*), char* mqtt_topic_base, unsigned int updateAllTime);
 void decode_optional_heatpump_data(char* data, char* actOptDat, PubSubClient &mqtt_client, void (*log_message)(char*), char* mqtt_topic_base, unsigned int updateAllTime);
+// operating mode, compressor, three way valve and defrost state of a datagram
+uint32_t heatpumpState(const char *data);
+#define HEATPUMP_STATE_RUNNING 0x100 // the compressor bit of heatpumpState
 
-String unknown(byte input);
-String getBit1(byte input);
-String getBit1and2(byte input);
-String getBit3and4(byte input);
-String getBit5and6(byte input);
-String getBit7and8(byte input);
-String getBit3and4and5(byte input);
-String getLeft5bits(byte input);
-String getRight3bits(byte input);
-String getIntMinus1(byte input);
-String getIntMinus128(byte input);
-String getIntMinus1Div5(byte input);
-String getIntMinus1Div50(byte input);
-String getIntMinus1Times10(byte input);
-String getIntMinus1Times50(byte input);
-String getValvePID(byte input);
-String getOpMode(byte input);
-String getPower(byte input);
-String getHeatMode(byte input);
-String getModel(byte input);
-String getFirstByte(byte input);
-String getSecondByte(byte input);
-String getUintt16(char * data, byte input);
+#define DEC_BITS     0 // ((byte >> shift) & mask) - offset
+#define DEC_SCALE    1 // (byte - offset) * mul / div
+#define DEC_FRACTION 2 // byte - offset with a quarter fraction from another byte
+#define DEC_WORD     3 // little endian 16-bit value - 1
+#define DEC_OPMODE   4 // operating mode lookup
+#define DEC_PUMPFLOW 5 // byte + (fraction byte - 1) / 256
+#define DEC_ERROR    6 // error type and number
+#define DEC_MODEL    7 // 10 byte model code
+
+#define MAX_VALUE_LEN 32 // max formatted value length + 1
+
+/*
+ * Describes how a single topic is decoded from a datagram. Values are
+ * decoded into a fixed point int32_t with 'decimals' decimals, so a
+ * value of 215 with 1 decimal means 21.5.
+ */
+typedef struct topicDecode_t {
+  uint8_t type;
+  uint8_t byte;     // offset of the (first) byte in the datagram
+  uint8_t shift;
+  uint8_t mask;
+  int16_t offset;
+  int16_t mul;
+  uint8_t div;
+  uint8_t decimals;
+  uint8_t frac;     // offset of the fraction byte
+  uint8_t fracshift;
+} topicDecode_t;
+
+#define DECODE_BITS(b, s, m, o) { DEC_BITS, b, s, m, o, 1, 1, 0, 0, 0 }
+#define DECODE_SCALE(b, o, m, d, dec) { DEC_SCALE, b, 0, 0xFF, o, m, d, dec, 0, 0 }
+#define DECODE_FRACTION(b, o, f, fs) { DEC_FRACTION, b, 0, 0xFF, o, 1, 1, 2, f, fs }
+#define DECODE_WORD(b) { DEC_WORD, b, 0, 0, 1, 1, 1, 0, 0, 0 }
+#define DECODE_OPMODE(b) { DEC_OPMODE, b, 0, 0b111111, 0, 1, 1, 0, 0, 0 }
+#define DECODE_PUMPFLOW(b, f) { DEC_PUMPFLOW, b, 0, 0xFF, 0, 1, 1, 2, f, 0 }
+#define DECODE_ERROR(b) { DEC_ERROR, b, 0, 0, 0, 1, 1, 0, 0, 0 }
+#define DECODE_MODEL(b) { DEC_MODEL, b, 0, 0, 0, 1, 1, 0, 0, 0 }
+
+int32_t decodeValue(const char *data, const topicDecode_t *desc);
+void decodeValues(const char *data, const topicDecode_t *table, unsigned int count, int32_t *values);
+uint8_t formatValue(char *out, const char *data, const topicDecode_t *desc, int32_t value);
+void markChangedTopics(const char *data, const char *actData, bool *changed);
+
+#define VALUE_INTEGER 0
+#define VALUE_FLOAT   1
+#define VALUE_STRING  2
+
+uint8_t valueType(const topicDecode_t *desc);
+float valueToFloat(const topicDecode_t *desc, int32_t value);
 
 static const char _unknown[] PROGMEM = "unknown";
 
@@ -47,6 +77,61 @@ static const char _unknown[] PROGMEM = "unknown";
 #define NUMBER_OF_OPT_TOPICS 7 //last topic number + 1
 #define MAX_TOPIC_LEN 42 // max length + 1
 
+/*
+ * Decoded values of the last received datagrams. Filled once per
+ * datagram by the decode functions, the version is increased each
+ * time the value changes and stays 0 until the first datagram.
+ */
+typedef struct valueCache_t {
+  int32_t value;
+  uint16_t version;
+} valueCache_t;
+
+extern valueCache_t topicCache[NUMBER_OF_TOPICS];
+extern valueCache_t xtopicCache[NUMBER_OF_TOPICS_EXTRA];
+extern valueCache_t optTopicCache[NUMBER_OF_OPT_TOPICS];
+
+/*
+ * Streams the heatpump, extra and optional topic arrays of /json.
+ * Fills buf with as many whole topics as fit, starting at *item,
+ * and advances *item to the next topic to write. Returns the bytes
+ * written, *item is JSON_TOPICS_DONE once the arrays are closed.
+ * Start with *item at 0.
+ */
+#define JSON_TOPICS_DONE (NUMBER_OF_TOPICS + NUMBER_OF_TOPICS_EXTRA + NUMBER_OF_OPT_TOPICS + 4)
+
+uint16_t jsonTopics(char *buf, uint16_t size, uint16_t *item, const char *actData, const char *actDataExtra, const char *actOptData, bool extra, bool optional);
+
+/*
+ * Binary snapshot of /values.bin, all fields little endian:
+ *
+ *  0 'H' 'M'
+ *  2 uint8_t  schema version
+ *  3 uint8_t  flags, RAW_FLAG_*
+ *  4 uint32_t boot id, changes on every boot
+ *  8 uint32_t sequence, increased when a datagram changes
+ * 12 uint16_t length of the main datagram
+ * 14 uint16_t length of the extra datagram, 0 when not available
+ * 16 uint16_t length of the optional pcb datagram, 0 when not used
+ * 18 uint16_t reserved
+ * 20 the datagrams as received from the heatpump
+ *
+ * The datagrams are decoded by the collector as described by the
+ * topic tables. Increase the schema version when the layout changes.
+ */
+#define RAW_SCHEMA_VERSION 1
+#define RAW_HEADER_SIZE 20
+#define RAW_FLAG_EXTRA 0x01
+#define RAW_FLAG_OPTIONAL 0x02
+#define RAW_ETAG_LEN 28 // max length + 1
+
+extern uint32_t rawBootId;
+extern uint32_t rawSequence;
+
+uint16_t rawValuesSize(bool extra, bool optional);
+uint16_t rawValues(uint8_t *buf, const char *actData, const char *actDataExtra, const char *actOptData, bool extra, bool optional);
+uint8_t rawETag(char *out, bool extra, bool optional);
+
 static const char optTopics[][20] PROGMEM = {
   "Z1_Water_Pump", // OPT0
   "Z1_Mixing_Valve", // OPT1
@@ -57,6 +142,16 @@ static const char optTopics[][20] PROGMEM = {
   "Alarm_State", // OPT6
 };
 
+static const topicDecode_t optTopicDecode[] PROGMEM = {
+  DECODE_BITS(4, 7, 0b1, 0),         //OPT0
+  DECODE_BITS(4, 5, 0b11, 0),        //OPT1
+  DECODE_BITS(4, 4, 0b1, 0),         //OPT2
+  DECODE_BITS(4, 2, 0b11, 0),        //OPT3
+  DECODE_BITS(4, 1, 0b1, 0),         //OPT4
+  DECODE_BITS(4, 0, 0b1, 0),         //OPT5
+  DECODE_BITS(5, 0, 0b1, 0),         //OPT6
+};
+
 static const char xtopics[][MAX_TOPIC_LEN] PROGMEM = {
   "Heat_Power_Consumption_Extra", //XTOP0
   "Cool_Power_Consumption_Extra", //XTOP1
@@ -66,13 +161,13 @@ static const char xtopics[][MAX_TOPIC_LEN] PROGMEM = {
   "DHW_Power_Production_Extra",  //XTOP5
 };
 
-static const byte xtopicBytes[] PROGMEM = { //can store the index as byte (8-bit unsigned humber) as there aren't more then 255 bytes (actually only 203 bytes) to decode
-  14,      //XTOP0
-  16,      //XTOP1
-  18,      //XTOP2
-  20,      //XTOP3
-  22,      //XTOP4
-  24,      //XTOP5
+static const topicDecode_t xtopicDecode[] PROGMEM = {
+  DECODE_WORD(14),                   //XTOP0
+  DECODE_WORD(16),                   //XTOP1
+  DECODE_WORD(18),                   //XTOP2
+  DECODE_WORD(20),                   //XTOP3
+  DECODE_WORD(22),                   //XTOP4
+  DECODE_WORD(24),                   //XTOP5
 };
 
 static const char topics[][MAX_TOPIC_LEN] PROGMEM = {
@@ -222,310 +317,151 @@ static const char topics[][MAX_TOPIC_LEN] PROGMEM = {
   "DHW_Sensor_Selection",    //TOP143
 };
 
-static const byte topicBytes[] PROGMEM = { //can store the index as byte (8-bit unsigned humber) as there aren't more then 255 bytes (actually only 203 bytes) to decode
-  4,      //TOP0
-  0,      //TOP1
-  4,      //TOP2
-  7,      //TOP3
-  6,      //TOP4
-  143,    //TOP5
-  144,    //TOP6
-  153,    //TOP7
-  166,    //TOP8
-  42,     //TOP9
-  141,    //TOP10
-  0,      //TOP11
-  0,      //TOP12
-  5,      //TOP13
-  142,    //TOP14
-  194,    //TOP15
-  193,    //TOP16
-  7,      //TOP17
-  7,      //TOP18
-  5,      //TOP19
-  111,    //TOP20
-  158,    //TOP21
-  99,     //TOP22
-  84,     //TOP23
-  94,     //TOP24
-  44,     //TOP25
-  111,    //TOP26
-  38,     //TOP27
-  39,     //TOP28
-  75,     //TOP29
-  76,     //TOP30
-  78,     //TOP31
-  77,     //TOP32
-  156,    //TOP33
-  40,     //TOP34
-  41,     //TOP35
-  145,    //TOP36
-  146,    //TOP37
-  196,    //TOP38
-  195,    //TOP39
-  198,    //TOP40
-  197,    //TOP41
-  147,    //TOP42
-  148,    //TOP43
-  0,      //TOP44
-  43,     //TOP45
-  149,    //TOP46
-  150,    //TOP47
-  151,    //TOP48
-  154,    //TOP49
-  155,    //TOP50
-  157,    //TOP51
-  159,    //TOP52
-  160,    //TOP53
-  161,    //TOP54
-  162,    //TOP55
-  139,    //TOP56
-  140,    //TOP57
-  9,      //TOP58
-  9,      //TOP59
-  112,    //TOP60
-  112,    //TOP61
-  173,    //TOP62
-  174,    //TOP63
-  163,    //TOP64
-  171,    //TOP65
-  164,    //TOP66
-  165,    //TOP67
-  5,      //TOP68
-  117,    //TOP69
-  100,    //TOP70
-  101,    //TOP71
-  86,     //TOP72
-  87,     //TOP73
-  89,     //TOP74
-  88,     //TOP75
-  28,     //TOP76
-  83,     //TOP77
-  85,     //TOP78
-  95,     //TOP79
-  96,     //TOP80
-  28,     //TOP81
-  79,     //TOP82
-  80,     //TOP83
-  82,     //TOP84
-  81,     //TOP85
-  90,     //TOP86
-  91,     //TOP87
-  93,     //TOP88
-  92,     //TOP89
-  0,      //TOP90
-  0,      //TOP91
-  0,      //TOP92
-  172,    //TOP93
-  6,      //TOP94
-  45,     //TOP95
-  104,    //TOP96
-  105,    //TOP97
-  106,    //TOP98
-  24,     //TOP99
-  24,     //TOP100
-  24,     //TOP101
-  61,     //TOP102
-  62,     //TOP103
-  63,     //TOP104
-  64,     //TOP105
-  29,     //TOP106
-  20,     //TOP107
-  20,     //TOP108
-  20,     //TOP109
-  20,     //TOP110
-  22,     //TOP111
-  22,     //TOP112
-  59,     //TOP113
-  25,     //TOP114
-  125,    //TOP115
-  126,    //TOP116
-  127,    //TOP117
-  128,    //TOP118
-  23,     //TOP119
-  23,     //TOP120
-  23,     //TOP121
-  23,     //TOP122
-  116,    //TOP123
-  116,    //TOP124
-  116,    //TOP125
-  116,    //TOP126
-  177,    //TOP127
-  178,    //TOP128
-  26,    //TOP129
-  26,    //TOP130
-  65,    //TOP131
-  26,    //TOP132
-  26,    //TOP133
-  66,    //TOP134
-  68,    //TOP135
-  67,    //TOP136
-  69,    //TOP137
-  70,    //TOP138
-  30,    //TOP139
-  24,    //TOP140
-  11,    //TOP141
-  175,   //TOP142
-  11,    //TOP143
-};
-
-
-typedef String (*xtopicFP)(char*, byte);
-static const xtopicFP xtopicFunctions[] PROGMEM = {
-  getUintt16,         //XTOP0
-  getUintt16,         //XTOP1
-  getUintt16,         //XTOP2
-  getUintt16,         //XTOP3
-  getUintt16,         //XTOP4
-  getUintt16,         //XTOP5
-};
-
-typedef String (*topicFP)(byte);
-static const topicFP topicFunctions[] PROGMEM = {
-  getBit7and8,         //TOP0
-  unknown,             //TOP1
-  getBit1and2,         //TOP2
-  getBit1and2,         //TOP3
-  getOpMode,           //TOP4
-  getIntMinus128,      //TOP5
-  getIntMinus128,      //TOP6
-  getIntMinus128,      //TOP7
-  getIntMinus1,        //TOP8
-  getIntMinus128,      //TOP9
-  getIntMinus128,      //TOP10
-  unknown,             //TOP11
-  unknown,             //TOP12
-  getBit1and2,         //TOP13
-  getIntMinus128,      //TOP14
-  getPower,            //TOP15
-  getPower,            //TOP16
-  getRight3bits,       //TOP17
-  getBit3and4and5,     //TOP18
-  getBit3and4,         //TOP19
-  getBit7and8,         //TOP20
-  getIntMinus128,      //TOP21
-  getIntMinus128,      //TOP22
-  getIntMinus128,      //TOP23
-  getIntMinus128,      //TOP24
-  getIntMinus128,      //TOP25
-  getBit5and6,         //TOP26
-  getIntMinus128,      //TOP27
-  getIntMinus128,      //TOP28
-  getIntMinus128,      //TOP29
-  getIntMinus128,      //TOP30
-  getIntMinus128,      //TOP31
-  getIntMinus128,      //TOP32
-  getIntMinus128,      //TOP33
-  getIntMinus128,      //TOP34
-  getIntMinus128,      //TOP35
-  getIntMinus128,      //TOP36
-  getIntMinus128,      //TOP37
-  getPower,            //TOP38
-  getPower,            //TOP39
-  getPower,            //TOP40
-  getPower,            //TOP41
-  getIntMinus128,      //TOP42
-  getIntMinus128,      //TOP43
-  unknown,             //TOP44
-  getIntMinus128,      //TOP45
-  getIntMinus128,      //TOP46
-  getIntMinus128,      //TOP47
-  getIntMinus128,      //TOP48
-  getIntMinus128,      //TOP49
-  getIntMinus128,      //TOP50
-  getIntMinus128,      //TOP51
-  getIntMinus128,      //TOP52
-  getIntMinus128,      //TOP53
-  getIntMinus128,      //TOP54
-  getIntMinus128,      //TOP55
-  getIntMinus128,      //TOP56
-  getIntMinus128,      //TOP57
-  getBit5and6,         //TOP58
-  getBit7and8,         //TOP59
-  getBit7and8,         //TOP60
-  getBit5and6,         //TOP61
-  getIntMinus1Times10, //TOP62
-  getIntMinus1Times10, //TOP63
-  getIntMinus1Div5,    //TOP64
-  getIntMinus1Times50, //TOP65
-  getIntMinus1Times50, //TOP66
-  getIntMinus1Div5,    //TOP67
-  getBit5and6,         //TOP68
-  getBit5and6,         //TOP69
-  getIntMinus128,      //TOP70
-  getIntMinus1,        //TOP71
-  getIntMinus128,      //TOP72
-  getIntMinus128,      //TOP73
-  getIntMinus128,      //TOP74
-  getIntMinus128,      //TOP75
-  getBit7and8,         //TOP76
-  getIntMinus128,      //TOP77
-  getIntMinus128,      //TOP78
-  getIntMinus128,      //TOP79
-  getIntMinus128,      //TOP80
-  getBit5and6,         //TOP81
-  getIntMinus128,      //TOP82
-  getIntMinus128,      //TOP83
-  getIntMinus128,      //TOP84
-  getIntMinus128,      //TOP85
-  getIntMinus128,      //TOP86
-  getIntMinus128,      //TOP87
-  getIntMinus128,      //TOP88
-  getIntMinus128,      //TOP89
-  unknown,             //TOP90
-  unknown,             //TOP91
-  unknown,			       //TOP92
-  getIntMinus1,        //TOP93
-  getBit1and2,         //TOP94
-  getIntMinus1,        //TOP95
-  getIntMinus1,        //TOP96
-  getIntMinus128,      //TOP97
-  getIntMinus128,      //TOP98
-  getBit5and6,         //TOP99
-  getBit7and8,         //TOP100
-  getBit3and4,         //TOP101
-  getIntMinus128,      //TOP102
-  getIntMinus128,      //TOP103
-  getIntMinus128,      //TOP104
-  getIntMinus128,      //TOP105
-  getBit3and4,         //TOP106
-  getBit1,             //TOP107
-  getBit3and4,         //TOP108
-  getBit5and6,         //TOP109
-  getBit7and8,         //TOP110  
-  getSecondByte,       //TOP111
-  getFirstByte,        //TOP112 
-  getIntMinus128,      //TOP113
-  getBit3and4,         //TOP114
-  getIntMinus1Div50,   //TOP115
-  getIntMinus128,      //TOP116
-  getIntMinus128,      //TOP117
-  getIntMinus128,      //TOP118
-  getBit7and8,         //TOP119
-  getBit5and6,         //TOP120
-  getBit3and4,         //TOP121
-  getBit1and2,         //TOP122
-  getBit1and2,         //TOP123
-  getBit3and4,         //TOP124
-  getBit5and6,         //TOP125
-  getBit7and8,         //TOP126
-  getValvePID,        //TOP127
-  getValvePID,        //TOP128
-  getBit7and8,      //TOP129
-  getBit5and6,      //TOP130
-  getIntMinus128,      //TOP131
-  getBit3and4,      //TOP132
-  getBit1and2,      //TOP133
-  getIntMinus128,      //TOP134
-  getIntMinus128,      //TOP135
-  getIntMinus1,      //TOP136
-  getIntMinus1,      //TOP137
-  getIntMinus1,      //TOP138
-  getBit5and6,       //TOP139
-  getBit1and2,       //TOP140
-  getBit3and4,       //TOP141
-  getIntMinus1,      //TOP142
-  getBit7and8,       //TOP143
+static const topicDecode_t topicDecode[] PROGMEM = {
+  DECODE_BITS(4, 0, 0b11, 1),        //TOP0
+  DECODE_PUMPFLOW(170, 169),         //TOP1
+  DECODE_BITS(4, 6, 0b11, 1),        //TOP2
+  DECODE_BITS(7, 6, 0b11, 1),        //TOP3
+  DECODE_OPMODE(6),                  //TOP4
+  DECODE_FRACTION(143, 128, 118, 0), //TOP5
+  DECODE_FRACTION(144, 128, 118, 3), //TOP6
+  DECODE_BITS(153, 0, 0xFF, 128),    //TOP7
+  DECODE_BITS(166, 0, 0xFF, 1),      //TOP8
+  DECODE_BITS(42, 0, 0xFF, 128),     //TOP9
+  DECODE_BITS(141, 0, 0xFF, 128),    //TOP10
+  DECODE_WORD(182),                  //TOP11
+  DECODE_WORD(179),                  //TOP12
+  DECODE_BITS(5, 6, 0b11, 1),        //TOP13
+  DECODE_BITS(142, 0, 0xFF, 128),    //TOP14
+  DECODE_SCALE(194, 1, 200, 1, 0),   //TOP15
+  DECODE_SCALE(193, 1, 200, 1, 0),   //TOP16
+  DECODE_BITS(7, 0, 0b111, 1),       //TOP17
+  DECODE_BITS(7, 3, 0b111, 1),       //TOP18
+  DECODE_BITS(5, 4, 0b11, 1),        //TOP19
+  DECODE_BITS(111, 0, 0b11, 1),      //TOP20
+  DECODE_BITS(158, 0, 0xFF, 128),    //TOP21
+  DECODE_BITS(99, 0, 0xFF, 128),     //TOP22
+  DECODE_BITS(84, 0, 0xFF, 128),     //TOP23
+  DECODE_BITS(94, 0, 0xFF, 128),     //TOP24
+  DECODE_BITS(44, 0, 0xFF, 128),     //TOP25
+  DECODE_BITS(111, 2, 0b11, 1),      //TOP26
+  DECODE_BITS(38, 0, 0xFF, 128),     //TOP27
+  DECODE_BITS(39, 0, 0xFF, 128),     //TOP28
+  DECODE_BITS(75, 0, 0xFF, 128),     //TOP29
+  DECODE_BITS(76, 0, 0xFF, 128),     //TOP30
+  DECODE_BITS(78, 0, 0xFF, 128),     //TOP31
+  DECODE_BITS(77, 0, 0xFF, 128),     //TOP32
+  DECODE_BITS(156, 0, 0xFF, 128),    //TOP33
+  DECODE_BITS(40, 0, 0xFF, 128),     //TOP34
+  DECODE_BITS(41, 0, 0xFF, 128),     //TOP35
+  DECODE_BITS(145, 0, 0xFF, 128),    //TOP36
+  DECODE_BITS(146, 0, 0xFF, 128),    //TOP37
+  DECODE_SCALE(196, 1, 200, 1, 0),   //TOP38
+  DECODE_SCALE(195, 1, 200, 1, 0),   //TOP39
+  DECODE_SCALE(198, 1, 200, 1, 0),   //TOP40
+  DECODE_SCALE(197, 1, 200, 1, 0),   //TOP41
+  DECODE_BITS(147, 0, 0xFF, 128),    //TOP42
+  DECODE_BITS(148, 0, 0xFF, 128),    //TOP43
+  DECODE_ERROR(113),                 //TOP44
+  DECODE_BITS(43, 0, 0xFF, 128),     //TOP45
+  DECODE_BITS(149, 0, 0xFF, 128),    //TOP46
+  DECODE_BITS(150, 0, 0xFF, 128),    //TOP47
+  DECODE_BITS(151, 0, 0xFF, 128),    //TOP48
+  DECODE_BITS(154, 0, 0xFF, 128),    //TOP49
+  DECODE_BITS(155, 0, 0xFF, 128),    //TOP50
+  DECODE_BITS(157, 0, 0xFF, 128),    //TOP51
+  DECODE_BITS(159, 0, 0xFF, 128),    //TOP52
+  DECODE_BITS(160, 0, 0xFF, 128),    //TOP53
+  DECODE_BITS(161, 0, 0xFF, 128),    //TOP54
+  DECODE_BITS(162, 0, 0xFF, 128),    //TOP55
+  DECODE_BITS(139, 0, 0xFF, 128),    //TOP56
+  DECODE_BITS(140, 0, 0xFF, 128),    //TOP57
+  DECODE_BITS(9, 2, 0b11, 1),        //TOP58
+  DECODE_BITS(9, 0, 0b11, 1),        //TOP59
+  DECODE_BITS(112, 0, 0b11, 1),      //TOP60
+  DECODE_BITS(112, 2, 0b11, 1),      //TOP61
+  DECODE_SCALE(173, 1, 10, 1, 0),    //TOP62
+  DECODE_SCALE(174, 1, 10, 1, 0),    //TOP63
+  DECODE_SCALE(163, 1, 10, 5, 1),    //TOP64
+  DECODE_SCALE(171, 1, 50, 1, 0),    //TOP65
+  DECODE_SCALE(164, 1, 50, 1, 0),    //TOP66
+  DECODE_SCALE(165, 1, 10, 5, 1),    //TOP67
+  DECODE_BITS(5, 2, 0b11, 1),        //TOP68
+  DECODE_BITS(117, 2, 0b11, 1),      //TOP69
+  DECODE_BITS(100, 0, 0xFF, 128),    //TOP70
+  DECODE_BITS(101, 0, 0xFF, 1),      //TOP71
+  DECODE_BITS(86, 0, 0xFF, 128),     //TOP72
+  DECODE_BITS(87, 0, 0xFF, 128),     //TOP73
+  DECODE_BITS(89, 0, 0xFF, 128),     //TOP74
+  DECODE_BITS(88, 0, 0xFF, 128),     //TOP75
+  DECODE_BITS(28, 0, 0b11, 1),       //TOP76
+  DECODE_BITS(83, 0, 0xFF, 128),     //TOP77
+  DECODE_BITS(85, 0, 0xFF, 128),     //TOP78
+  DECODE_BITS(95, 0, 0xFF, 128),     //TOP79
+  DECODE_BITS(96, 0, 0xFF, 128),     //TOP80
+  DECODE_BITS(28, 2, 0b11, 1),       //TOP81
+  DECODE_BITS(79, 0, 0xFF, 128),     //TOP82
+  DECODE_BITS(80, 0, 0xFF, 128),     //TOP83
+  DECODE_BITS(82, 0, 0xFF, 128),     //TOP84
+  DECODE_BITS(81, 0, 0xFF, 128),     //TOP85
+  DECODE_BITS(90, 0, 0xFF, 128),     //TOP86
+  DECODE_BITS(91, 0, 0xFF, 128),     //TOP87
+  DECODE_BITS(93, 0, 0xFF, 128),     //TOP88
+  DECODE_BITS(92, 0, 0xFF, 128),     //TOP89
+  DECODE_WORD(185),                  //TOP90
+  DECODE_WORD(188),                  //TOP91
+  DECODE_MODEL(129),                 //TOP92
+  DECODE_BITS(172, 0, 0xFF, 1),      //TOP93
+  DECODE_BITS(6, 6, 0b11, 1),        //TOP94
+  DECODE_BITS(45, 0, 0xFF, 1),       //TOP95
+  DECODE_BITS(104, 0, 0xFF, 1),      //TOP96
+  DECODE_BITS(105, 0, 0xFF, 128),    //TOP97
+  DECODE_BITS(106, 0, 0xFF, 128),    //TOP98
+  DECODE_BITS(24, 2, 0b11, 1),       //TOP99
+  DECODE_BITS(24, 0, 0b11, 1),       //TOP100
+  DECODE_BITS(24, 4, 0b11, 1),       //TOP101
+  DECODE_BITS(61, 0, 0xFF, 128),     //TOP102
+  DECODE_BITS(62, 0, 0xFF, 128),     //TOP103
+  DECODE_BITS(63, 0, 0xFF, 128),     //TOP104
+  DECODE_BITS(64, 0, 0xFF, 128),     //TOP105
+  DECODE_BITS(29, 4, 0b11, 1),       //TOP106
+  DECODE_BITS(20, 7, 0b1, 0),        //TOP107
+  DECODE_BITS(20, 4, 0b11, 1),       //TOP108
+  DECODE_BITS(20, 2, 0b11, 1),       //TOP109
+  DECODE_BITS(20, 0, 0b11, 1),       //TOP110
+  DECODE_BITS(22, 0, 0b1111, 1),     //TOP111
+  DECODE_BITS(22, 4, 0b1111, 1),     //TOP112
+  DECODE_BITS(59, 0, 0xFF, 128),     //TOP113
+  DECODE_BITS(25, 4, 0b11, 1),       //TOP114
+  DECODE_SCALE(125, 1, 100, 50, 2),  //TOP115
+  DECODE_BITS(126, 0, 0xFF, 128),    //TOP116
+  DECODE_BITS(127, 0, 0xFF, 128),    //TOP117
+  DECODE_BITS(128, 0, 0xFF, 128),    //TOP118
+  DECODE_BITS(23, 0, 0b11, 1),       //TOP119
+  DECODE_BITS(23, 2, 0b11, 1),       //TOP120
+  DECODE_BITS(23, 4, 0b11, 1),       //TOP121
+  DECODE_BITS(23, 6, 0b11, 1),       //TOP122
+  DECODE_BITS(116, 6, 0b11, 1),      //TOP123
+  DECODE_BITS(116, 4, 0b11, 1),      //TOP124
+  DECODE_BITS(116, 2, 0b11, 1),      //TOP125
+  DECODE_BITS(116, 0, 0b11, 1),      //TOP126
+  DECODE_SCALE(177, 1, 10, 2, 1),    //TOP127
+  DECODE_SCALE(178, 1, 10, 2, 1),    //TOP128
+  DECODE_BITS(26, 0, 0b11, 1),       //TOP129
+  DECODE_BITS(26, 2, 0b11, 1),       //TOP130
+  DECODE_BITS(65, 0, 0xFF, 128),     //TOP131
+  DECODE_BITS(26, 4, 0b11, 1),       //TOP132
+  DECODE_BITS(26, 6, 0b11, 1),       //TOP133
+  DECODE_BITS(66, 0, 0xFF, 128),     //TOP134
+  DECODE_BITS(68, 0, 0xFF, 128),     //TOP135
+  DECODE_BITS(67, 0, 0xFF, 1),       //TOP136
+  DECODE_BITS(69, 0, 0xFF, 1),       //TOP137
+  DECODE_BITS(70, 0, 0xFF, 1),       //TOP138
+  DECODE_BITS(30, 2, 0b11, 1),       //TOP139
+  DECODE_BITS(24, 6, 0b11, 1),       //TOP140
+  DECODE_BITS(11, 4, 0b11, 1),       //TOP141
+  DECODE_BITS(175, 0, 0xFF, 1),      //TOP142
+  DECODE_BITS(11, 0, 0b11, 1),       //TOP143
 };
 
 static const char *DisabledEnabled[] PROGMEM = {"2", "Disabled", "Enabled"};
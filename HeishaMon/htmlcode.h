@@ -878,8 +878,8 @@ function startWebsockets(){
             updStat('uptime',j.data.stats.uptime);
             updStat('rules',j.data.stats.rules);
           } else if(j.data.heishavalues){
-            updCell(j.data.heishavalues.topic+'-Value',j.data.heishavalues.value);
-            updCell(j.data.heishavalues.topic+'-Description',j.data.heishavalues.description);
+            var hv=Array.isArray(j.data.heishavalues)?j.data.heishavalues:[j.data.heishavalues];
+            hv.forEach(function(v){updCell(v.topic+'-Value',v.value);updCell(v.topic+'-Description',v.description);});
           } else if(j.data.dallasvalues){
             var dID=j.data.dallasvalues.sensorID;
             if(j.data.dallasvalues.value!==undefined)updCell('SensorID-'+dID+'-Temperature',j.data.dallasvalues.value);
@@ -1586,6 +1586,13 @@ static const char settingsForm2[] FLASHPROG = R"====(
         <span class='setting-hint'>seconds (min 5)</span>
       </div>
     </div>
+    <div class='setting-row'>
+      <label class='setting-label'>Heatpump poll interval when idle</label>
+      <div style='display:flex;align-items:center;gap:8px'>
+        <input type='number' name='waitTimeMax' class='setting-input' value='' style='width:80px'>
+        <span class='setting-hint'>seconds, a compressor start may be seen this late (0 always polls at the interval above)</span>
+      </div>
+    </div>
     <div class='setting-row'>
       <label class='setting-label'>MQTT retransmit interval</label>
       <div style='display:flex;align-items:center;gap:8px'>
@@ -1604,6 +1611,7 @@ static const char settingsForm2[] FLASHPROG = R"====(
     <div class='setting-row'><label class='setting-label'>Emulate optional PCB</label><div class='checkbox-wrap'><input type='checkbox' name='optionalPCB' value='enabled'></div></div>
     <div class='setting-row'><label class='setting-label'>Enable Opentherm processing</label><div class='checkbox-wrap'><input type='checkbox' name='opentherm' value='enabled'></div></div>
     <div class='setting-row'><label class='setting-label'>Force load rules on boot</label><div style='display:flex;align-items:center;gap:10px'><div class='checkbox-wrap'><input type='checkbox' name='force_rules' value='enabled'></div><span class='setting-hint' style='display:block;margin-top:4px'>Rules load normally, but skip after crashes to prevent boot loops. Enable to override.</span></div></div>
+    <div class='setting-row'><label class='setting-label'>Run rules once per datagram</label><div style='display:flex;align-items:center;gap:10px'><div class='checkbox-wrap'><input type='checkbox' name='coalesceRules' value='enabled'></div><span class='setting-hint' style='display:block;margin-top:4px'>Run the rules of all topics a datagram changed together, after it is decoded.</span></div></div>
   </div></div>
   <div class='panel' style='margin-bottom:16px'>
   <div class='panel-header'><h3>Listen Only</h3></div>
@@ -1687,6 +1695,13 @@ static const char settingsForm2[] FLASHPROG = R"====(
         <span class='setting-hint'>seconds (min 5)</span>
       </div>
     </div>
+    <div class='setting-row'>
+      <label class='setting-label'>Heatpump poll interval when idle</label>
+      <div style='display:flex;align-items:center;gap:8px'>
+        <input type='number' name='waitTimeMax' class='setting-input' value='' style='width:80px'>
+        <span class='setting-hint'>seconds, a compressor start may be seen this late (0 always polls at the interval above)</span>
+      </div>
+    </div>
     <div class='setting-row'>
       <label class='setting-label'>MQTT retransmit interval</label>
       <div style='display:flex;align-items:center;gap:8px'>
@@ -1706,6 +1721,7 @@ static const char settingsForm2[] FLASHPROG = R"====(
     <div class='setting-row'><label class='setting-label'>Enable Opentherm processing</label><div class='checkbox-wrap'><input type='checkbox' name='opentherm' value='enabled'></div></div>
     <div class='setting-row'><label class='setting-label'>Enable CZ-TAW1 proxy port</label><div class='checkbox-wrap'><input type='checkbox' name='proxy' value='enabled'></div></div>
     <div class='setting-row'><label class='setting-label'>Force rules on boot</label><div class='checkbox-wrap'><input type='checkbox' name='force_rules' value='enabled'></div></div>
+    <div class='setting-row'><label class='setting-label'>Run rules once per datagram</label><div class='checkbox-wrap'><input type='checkbox' name='coalesceRules' value='enabled'></div></div>
   </div></div>
   <div class='panel' style='margin-bottom:16px'>
   <div class='panel-header'><h3>Listen Only</h3></div>
@@ -0,0 +1,129 @@
+#include <time.h>
+
+#include "logbuffer.h"
+
+static_assert((LOGBUFFER_SIZE & (LOGBUFFER_SIZE - 1)) == 0, "log buffer size must be a power of 2");
+static_assert(LOGBUFFER_SIZE >= 4 * (sizeof(logRecord_t) + LOGBUFFER_MAX_LEN + 1), "log buffer too small");
+
+#define LOGBUFFER_MASK (LOGBUFFER_SIZE - 1)
+
+// record that only marks the unused end of the buffer
+#define LOGRECORD_WRAP 0xFFFF
+
+/*
+ * Records are stored contiguous and 4 byte aligned. The offsets
+ * only grow, their lower bits are the position in the buffer.
+ */
+static uint32_t ring32[LOGBUFFER_SIZE / 4];
+static uint8_t *ring = (uint8_t *)ring32;
+
+static uint32_t head = 0;
+static uint32_t tail = 0;
+static uint32_t cursor[LOG_SINK_NR] = { 0 };
+static uint16_t dropped[LOG_SINK_NR] = { 0 };
+
+static uint16_t recordSize(uint16_t len) {
+  return (sizeof(logRecord_t) + len + 1 + 3) & ~3;
+}
+
+/*
+ * Offset of the record following the one at off, when
+ * there is no room for a record header left at the
+ * end of the buffer the next record starts at 0.
+ */
+static uint32_t nextRecord(uint32_t off) {
+  uint32_t pos = off & LOGBUFFER_MASK;
+  if(LOGBUFFER_SIZE - pos < sizeof(logRecord_t)) {
+    return off + (LOGBUFFER_SIZE - pos);
+  }
+  logRecord_t *rec = (logRecord_t *)&ring[pos];
+  if(rec->len == LOGRECORD_WRAP) {
+    return off + (LOGBUFFER_SIZE - pos);
+  }
+  return off + recordSize(rec->len);
+}
+
+static bool isRecord(uint32_t off) {
+  uint32_t pos = off & LOGBUFFER_MASK;
+  return LOGBUFFER_SIZE - pos >= sizeof(logRecord_t) && ((logRecord_t *)&ring[pos])->len != LOGRECORD_WRAP;
+}
+
+/*
+ * Overwrites the oldest records until size bytes are free,
+ * sinks that did not consume them yet skip them as well.
+ */
+static void makeRoom(uint32_t size) {
+  while(head + size - tail > LOGBUFFER_SIZE) {
+    uint32_t next = nextRecord(tail);
+    uint8_t sinks = isRecord(tail) ? ((logRecord_t *)&ring[tail & LOGBUFFER_MASK])->sinks : 0;
+    for(uint8_t i = 0; i < LOG_SINK_NR; i++) {
+      if(cursor[i] == tail) {
+        cursor[i] = next;
+        if((sinks & (1 << i)) && dropped[i] < 0xFFFF) {
+          dropped[i]++;
+        }
+      }
+    }
+    tail = next;
+  }
+}
+
+void logbufferAdd(const char *msg, uint16_t len, uint8_t sinks) {
+  if(len > LOGBUFFER_MAX_LEN) {
+    len = LOGBUFFER_MAX_LEN;
+  }
+  uint16_t size = recordSize(len);
+  uint32_t pos = head & LOGBUFFER_MASK;
+
+  if(LOGBUFFER_SIZE - pos < size) {
+    uint32_t skip = LOGBUFFER_SIZE - pos;
+    makeRoom(skip);
+    if(skip >= sizeof(logRecord_t)) {
+      ((logRecord_t *)&ring[pos])->len = LOGRECORD_WRAP;
+    }
+    head += skip;
+    pos = 0;
+  }
+  makeRoom(size);
+
+  logRecord_t *rec = (logRecord_t *)&ring[pos];
+  rec->millis = millis();
+  rec->time = time(NULL);
+  rec->len = len;
+  rec->sinks = sinks;
+  rec->reserved = 0;
+  memcpy(LOGRECORD_TEXT(rec), msg, len);
+  LOGRECORD_TEXT(rec)[len] = '\0';
+
+  head += size;
+}
+
+logRecord_t *logbufferPeek(uint8_t sink) {
+  while(cursor[sink] != head) {
+    uint32_t off = cursor[sink];
+    if(isRecord(off)) {
+      logRecord_t *rec = (logRecord_t *)&ring[off & LOGBUFFER_MASK];
+      if(rec->sinks & (1 << sink)) {
+        return rec;
+      }
+    }
+    cursor[sink] = nextRecord(off);
+  }
+  return NULL;
+}
+
+void logbufferNext(uint8_t sink) {
+  if(cursor[sink] != head) {
+    cursor[sink] = nextRecord(cursor[sink]);
+  }
+}
+
+void logbufferSkip(uint8_t sink) {
+  cursor[sink] = head;
+}
+
+uint16_t logbufferDropped(uint8_t sink) {
+  uint16_t nr = dropped[sink];
+  dropped[sink] = 0;
+  return nr;
+}
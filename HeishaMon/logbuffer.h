@@ -0,0 +1,67 @@
+#ifndef _LOGBUFFER_H_
+#define _LOGBUFFER_H_
+
+#include <Arduino.h>
+
+/*
+ * Bytes reserved for log records, must be a power of 2.
+ * When full the oldest records are overwritten, so logging
+ * never blocks and never allocates.
+ */
+#ifndef LOGBUFFER_SIZE
+  #if defined(ESP32)
+    #define LOGBUFFER_SIZE 8192
+  #else
+    #define LOGBUFFER_SIZE 4096
+  #endif
+#endif
+
+// longer messages are truncated
+#define LOGBUFFER_MAX_LEN 255
+
+#define LOG_SINK_SERIAL 0
+#define LOG_SINK_MQTT 1
+#define LOG_SINK_WEBSOCKET 2
+#define LOG_SINK_NR 3
+
+#define LOG_TO_SERIAL (1 << LOG_SINK_SERIAL)
+#define LOG_TO_MQTT (1 << LOG_SINK_MQTT)
+#define LOG_TO_WEBSOCKET (1 << LOG_SINK_WEBSOCKET)
+#define LOG_TO_ALL (LOG_TO_SERIAL | LOG_TO_MQTT | LOG_TO_WEBSOCKET)
+
+typedef struct logRecord_t {
+  uint32_t millis;
+  uint32_t time;  // epoch seconds
+  uint16_t len;   // without the trailing \0
+  uint8_t sinks;  // LOG_TO_* mask
+  uint8_t reserved;
+} logRecord_t;
+
+// the message follows the record header
+#define LOGRECORD_TEXT(a) ((char *)((logRecord_t *)(a) + 1))
+
+/*
+ * Copies a message into the ring buffer. There is a single producer,
+ * everything logging from the main loop, and the consumers drain the
+ * buffer later from the same loop.
+ */
+void logbufferAdd(const char *msg, uint16_t len, uint8_t sinks);
+
+/*
+ * Returns the oldest record the sink did not consume yet,
+ * or NULL when it is up to date. The record stays valid
+ * until the next call to logbufferAdd.
+ */
+logRecord_t *logbufferPeek(uint8_t sink);
+void logbufferNext(uint8_t sink);
+
+// drops everything pending for a sink that is not in use
+void logbufferSkip(uint8_t sink);
+
+/*
+ * Number of records overwritten before the sink consumed
+ * them since the last call.
+ */
+uint16_t logbufferDropped(uint8_t sink);
+
+#endif
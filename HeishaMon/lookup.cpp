@@ -0,0 +1,100 @@
+#include <ctype.h>
+
+#include "lookup.h"
+#include "decode.h"
+#include "commands.h"
+
+#define NAMEINDEX_EMPTY 0xFF
+
+typedef struct nameIndex_t {
+  const char *names; // first name in flash
+  uint16_t stride;   // bytes between two names
+  uint8_t nr;
+  uint16_t mask;     // number of slots - 1, slots are a power of 2
+  uint8_t *slots;
+  bool build;
+} nameIndex_t;
+
+#define NUMBER_OF_COMMANDS (sizeof(commands) / sizeof(commands[0]))
+#define NUMBER_OF_OPT_COMMANDS (sizeof(optionalCommands) / sizeof(optionalCommands[0]))
+
+// keep the load below 50% so most lookups need a single compare
+static_assert(NUMBER_OF_TOPICS <= 256, "topic index too small");
+static_assert(NUMBER_OF_TOPICS_EXTRA <= 8, "extra topic index too small");
+static_assert(NUMBER_OF_OPT_TOPICS <= 8, "optional topic index too small");
+static_assert(NUMBER_OF_COMMANDS <= 64, "command index too small");
+static_assert(NUMBER_OF_OPT_COMMANDS <= 16, "optional command index too small");
+
+static uint8_t topicSlots[512];
+static uint8_t xtopicSlots[16];
+static uint8_t optTopicSlots[16];
+static uint8_t commandSlots[128];
+static uint8_t optCommandSlots[32];
+
+static nameIndex_t topicIndex = { topics[0], MAX_TOPIC_LEN, NUMBER_OF_TOPICS, sizeof(topicSlots) - 1, topicSlots, false };
+static nameIndex_t xtopicIndex = { xtopics[0], MAX_TOPIC_LEN, NUMBER_OF_TOPICS_EXTRA, sizeof(xtopicSlots) - 1, xtopicSlots, false };
+static nameIndex_t optTopicIndex = { optTopics[0], sizeof(optTopics[0]), NUMBER_OF_OPT_TOPICS, sizeof(optTopicSlots) - 1, optTopicSlots, false };
+static nameIndex_t commandIndex = { commands[0].name, sizeof(commands[0]), NUMBER_OF_COMMANDS, sizeof(commandSlots) - 1, commandSlots, false };
+static nameIndex_t optCommandIndex = { optionalCommands[0].name, sizeof(optionalCommands[0]), NUMBER_OF_OPT_COMMANDS, sizeof(optCommandSlots) - 1, optCommandSlots, false };
+
+// FNV-1a over the lower case name
+static uint32_t nameHash(const char *name, uint16_t len) {
+  uint32_t hash = 2166136261UL;
+  for(uint16_t i = 0; i < len; i++) {
+    hash = (hash ^ (uint8_t)tolower(name[i])) * 16777619UL;
+  }
+  return hash;
+}
+
+static void nameIndexBuild(nameIndex_t *idx) {
+  memset(idx->slots, NAMEINDEX_EMPTY, idx->mask + 1);
+
+  for(uint8_t i = 0; i < idx->nr; i++) {
+    char name[MAX_TOPIC_LEN];
+    strncpy_P(name, &idx->names[i * idx->stride], sizeof(name) - 1);
+    name[sizeof(name) - 1] = '\0';
+
+    uint16_t slot = nameHash(name, strlen(name)) & idx->mask;
+    while(idx->slots[slot] != NAMEINDEX_EMPTY) {
+      slot = (slot + 1) & idx->mask;
+    }
+    idx->slots[slot] = i;
+  }
+  idx->build = true;
+}
+
+static int16_t nameIndexFind(nameIndex_t *idx, const char *name, uint16_t len) {
+  if(idx->build == false) {
+    nameIndexBuild(idx);
+  }
+
+  uint16_t slot = nameHash(name, len) & idx->mask;
+  while(idx->slots[slot] != NAMEINDEX_EMPTY) {
+    const char *candidate = &idx->names[idx->slots[slot] * idx->stride];
+    if(strncasecmp_P(name, candidate, len) == 0 && pgm_read_byte(&candidate[len]) == '\0') {
+      return idx->slots[slot];
+    }
+    slot = (slot + 1) & idx->mask;
+  }
+  return -1;
+}
+
+int16_t lookupTopic(const char *name, uint16_t len) {
+  return nameIndexFind(&topicIndex, name, len);
+}
+
+int16_t lookupXTopic(const char *name, uint16_t len) {
+  return nameIndexFind(&xtopicIndex, name, len);
+}
+
+int16_t lookupOptTopic(const char *name, uint16_t len) {
+  return nameIndexFind(&optTopicIndex, name, len);
+}
+
+int16_t lookupCommand(const char *name, uint16_t len) {
+  return nameIndexFind(&commandIndex, name, len);
+}
+
+int16_t lookupOptCommand(const char *name, uint16_t len) {
+  return nameIndexFind(&optCommandIndex, name, len);
+}
@@ -0,0 +1,18 @@
+#ifndef _LOOKUP_H_
+#define _LOOKUP_H_
+
+#include <Arduino.h>
+
+/*
+ * Case insensitive lookup of topic and command names through hash
+ * tables over the names in flash. The tables are build on first use.
+ * All functions return the index in the corresponding table or -1
+ * when the name is unknown. The name does not have to be terminated.
+ */
+int16_t lookupTopic(const char *name, uint16_t len);
+int16_t lookupXTopic(const char *name, uint16_t len);
+int16_t lookupOptTopic(const char *name, uint16_t len);
+int16_t lookupCommand(const char *name, uint16_t len);
+int16_t lookupOptCommand(const char *name, uint16_t len);
+
+#endif
@@ -0,0 +1,69 @@
+#include "pollscheduler.h"
+
+static pollSchedule_t schedule[POLL_NR];
+static unsigned long minInterval = 5000;
+static unsigned long maxInterval = 5000;
+
+void pollSchedulerBegin(uint16_t minSeconds, uint16_t maxSeconds) {
+  minInterval = 1000UL * minSeconds;
+  maxInterval = (maxSeconds > minSeconds) ? 1000UL * maxSeconds : minInterval;
+  for(uint8_t i = 0; i < POLL_NR; i++) {
+    memset(&schedule[i], 0, sizeof(pollSchedule_t));
+    schedule[i].interval = minInterval;
+    schedule[i].hold = POLL_HOLD;
+  }
+}
+
+bool pollSchedulerDue(uint8_t type, unsigned long now) {
+  pollSchedule_t *s = &schedule[type];
+  if(s->lastSent != 0 && (unsigned long)(now - s->lastSent) < s->interval) {
+    return false;
+  }
+  // 0 means never sent
+  s->lastSent = (now == 0) ? 1 : now;
+  return true;
+}
+
+void pollSchedulerUpdate(uint8_t type, unsigned int changed, bool transition, bool running, unsigned long now) {
+  pollSchedule_t *s = &schedule[type];
+  unsigned long elapsed = (s->lastDecoded == 0) ? s->interval : (unsigned long)(now - s->lastDecoded);
+  s->lastDecoded = (now == 0) ? 1 : now;
+  if(elapsed < 1000) {
+    // an extra answer, like the one to a command
+    elapsed = 1000;
+  }
+
+  uint32_t sample = (uint32_t)changed * 1000000UL / elapsed;
+  s->rate = s->rate - s->rate / 4 + sample / 4;
+
+  if(transition) {
+    s->hold = POLL_HOLD;
+  }
+  if(s->hold > 0) {
+    s->hold--;
+    s->interval = minInterval;
+    return;
+  }
+
+  unsigned long interval = maxInterval, max = maxInterval;
+  if(running && max > POLL_RUNNING_FACTOR * minInterval) {
+    max = POLL_RUNNING_FACTOR * minInterval;
+  }
+  if(s->rate > 0) {
+    interval = (unsigned long)POLL_TARGET_CHANGES * 1000000UL / s->rate;
+  }
+  // back off gradually, speed up right away
+  if(interval > s->interval + s->interval / 2) {
+    interval = s->interval + s->interval / 2;
+  }
+  if(interval < minInterval) {
+    interval = minInterval;
+  } else if(interval > max) {
+    interval = max;
+  }
+  s->interval = interval;
+}
+
+unsigned long pollSchedulerInterval(uint8_t type) {
+  return schedule[type].interval;
+}
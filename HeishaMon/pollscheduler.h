@@ -0,0 +1,61 @@
+#ifndef _POLLSCHEDULER_H_
+#define _POLLSCHEDULER_H_
+
+#include <Arduino.h>
+
+#define POLL_MAIN 0
+#define POLL_EXTRA 1
+#define POLL_NR 2
+
+/*
+ * Changed topics a poll should bring in, the interval is
+ * set so that at the observed change rate a poll sees
+ * about this many.
+ */
+#define POLL_TARGET_CHANGES 2
+
+// polls kept at the minimum interval after a transition
+#define POLL_HOLD 12
+
+/*
+ * While the compressor runs a defrost, a switch of the three way
+ * valve or the compressor stopping can come any moment, so the
+ * interval backs off to at most this many times the minimum.
+ */
+#define POLL_RUNNING_FACTOR 2
+
+typedef struct pollSchedule_t {
+  unsigned long interval;   // ms until the next poll
+  unsigned long lastSent;
+  unsigned long lastDecoded;
+  uint32_t rate;            // changed topics per 1000 seconds, averaged
+  uint8_t hold;
+} pollSchedule_t;
+
+/*
+ * Each datagram type is polled between every minSeconds and
+ * every maxSeconds, depending on how many of its topics changed
+ * lately. With maxSeconds at or below minSeconds the interval
+ * stays fixed at minSeconds.
+ */
+void pollSchedulerBegin(uint16_t minSeconds, uint16_t maxSeconds);
+
+/*
+ * Returns true when the datagram type should be polled now,
+ * and counts it as sent.
+ */
+bool pollSchedulerDue(uint8_t type, unsigned long now);
+
+/*
+ * Feeds the outcome of decoding a datagram of the type, the
+ * number of topics that changed, whether the heat pump went
+ * through a transition like a compressor start, defrost or a
+ * switch of the three way valve and whether its compressor is
+ * running. A transition out of idle is only seen at the next
+ * poll, so up to maxSeconds late.
+ */
+void pollSchedulerUpdate(uint8_t type, unsigned int changed, bool transition, bool running, unsigned long now);
+
+unsigned long pollSchedulerInterval(uint8_t type);
+
+#endif
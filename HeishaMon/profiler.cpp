@@ -0,0 +1,150 @@
+#include "profiler.h"
+
+static const char names[PROFILE_NR + 1][10] PROGMEM = {
+  "webserver", "wifi", "ota", "mqtt", "opentherm", "heatpump", "dallas", "s0", "stats", "timers", "log", "loop"
+};
+
+static profileSection_t current[PROFILE_NR + 1];
+static profileSummary_t last[PROFILE_NR + 1];
+static uint32_t spent[PROFILE_NR];
+static uint16_t marked = 0;
+
+static unsigned long loopStart = 0;
+static unsigned long lastMark = 0;
+static unsigned long windowStart = 0;
+
+static uint32_t overBudget = 0;
+static uint32_t serialStalls = 0;
+static uint32_t lastOverBudget = 0;
+static uint32_t lastSerialStalls = 0;
+
+static_assert(PROFILE_NR <= 16, "too many profiler sections for the marked mask");
+
+static uint8_t bucket(uint32_t us) {
+  uint8_t b = 0;
+  us >>= 4;
+  while(us > 0 && b < PROFILE_BUCKETS - 1) {
+    us >>= 1;
+    b++;
+  }
+  return b;
+}
+
+static void add(profileSection_t *s, uint32_t us) {
+  uint8_t b = bucket(us);
+  if(s->buckets[b] == UINT16_MAX) {
+    // keep the shape, the percentile only needs the proportions
+    for(uint8_t i = 0; i < PROFILE_BUCKETS; i++) {
+      s->buckets[i] /= 2;
+    }
+  }
+  s->buckets[b]++;
+  if(s->count == 0 || us < s->min) {
+    s->min = us;
+  }
+  if(us > s->max) {
+    s->max = us;
+  }
+  s->count++;
+  s->sum += us;
+}
+
+static void summarize(profileSummary_t *out, profileSection_t *s) {
+  uint32_t total = 0;
+  for(uint8_t i = 0; i < PROFILE_BUCKETS; i++) {
+    total += s->buckets[i];
+  }
+
+  out->count = s->count;
+  out->min = s->min;
+  out->avg = (s->count > 0) ? s->sum / s->count : 0;
+  out->max = s->max;
+  out->blamed = s->blamed;
+  out->p99 = 0;
+
+  uint32_t seen = 0;
+  for(uint8_t i = 0; i < PROFILE_BUCKETS && total > 0; i++) {
+    seen += s->buckets[i];
+    if(seen * 100 >= total * 99) {
+      // the upper bound of the bucket, the largest sample bounds the last one
+      uint32_t upper = (i < PROFILE_BUCKETS - 1) ? (16UL << i) - 1 : s->max;
+      out->p99 = (upper < s->max) ? upper : s->max;
+      break;
+    }
+  }
+}
+
+void profilerLoopStart(void) {
+  loopStart = lastMark = micros();
+  marked = 0;
+  memset(spent, 0, sizeof(spent));
+}
+
+void profilerMark(uint8_t section) {
+  unsigned long now = micros();
+  spent[section] += now - lastMark;
+  lastMark = now;
+  marked |= 1 << section;
+}
+
+void profilerLoopEnd(bool serialBusy) {
+  uint32_t took = micros() - loopStart;
+  uint8_t worst = PROFILE_NR;
+
+  add(&current[PROFILE_LOOP], took);
+  for(uint8_t i = 0; i < PROFILE_NR; i++) {
+    if((marked & (1 << i)) != 0) {
+      add(&current[i], spent[i]);
+      if(worst == PROFILE_NR || spent[i] > spent[worst]) {
+        worst = i;
+      }
+    }
+  }
+
+  if(took > PROFILE_BUDGET_US) {
+    overBudget++;
+    if(worst < PROFILE_NR && current[worst].blamed < UINT16_MAX) {
+      current[worst].blamed++;
+    }
+  }
+  if(serialBusy && took > PROFILE_SERIAL_STALL_US) {
+    serialStalls++;
+  }
+
+  if((unsigned long)(millis() - windowStart) >= PROFILE_WINDOW_MS) {
+    windowStart = millis();
+    for(uint8_t i = 0; i <= PROFILE_NR; i++) {
+      summarize(&last[i], &current[i]);
+    }
+    memset(current, 0, sizeof(current));
+    lastOverBudget = overBudget;
+    lastSerialStalls = serialStalls;
+    overBudget = serialStalls = 0;
+  }
+}
+
+const profileSummary_t *profilerSummary(uint8_t section) {
+  return &last[section];
+}
+
+size_t profilerJson(char *out, size_t len) {
+  size_t n = snprintf_P(out, len, PSTR("{\"window\":%lu,\"iterations\":%lu,\"over budget\":%lu,\"serial stalls\":%lu"),
+    PROFILE_WINDOW_MS / 1000, (unsigned long)last[PROFILE_LOOP].count, (unsigned long)lastOverBudget, (unsigned long)lastSerialStalls);
+  for(uint8_t i = 0; i <= PROFILE_NR && n < len; i++) {
+    profileSummary_t *s = &last[i];
+    char name[sizeof(names[0])];
+    strcpy_P(name, names[i]);
+    n += snprintf_P(&out[n], len - n, PSTR(",\"%s\":{\"min\":%lu,\"avg\":%lu,\"max\":%lu,\"p99\":%lu"), name,
+      (unsigned long)s->min, (unsigned long)s->avg, (unsigned long)s->max, (unsigned long)s->p99);
+    if(n < len && i < PROFILE_NR) {
+      n += snprintf_P(&out[n], len - n, PSTR(",\"runs\":%lu,\"blamed\":%u"), (unsigned long)s->count, s->blamed);
+    }
+    if(n < len) {
+      n += snprintf_P(&out[n], len - n, PSTR("}"));
+    }
+  }
+  if(n < len) {
+    n += snprintf_P(&out[n], len - n, PSTR("}"));
+  }
+  return (n < len) ? n : len - 1;
+}
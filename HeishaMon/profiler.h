@@ -0,0 +1,79 @@
+#ifndef _PROFILER_H_
+#define _PROFILER_H_
+
+#include <Arduino.h>
+
+#define PROFILE_WEBSERVER 0
+#define PROFILE_WIFI 1
+#define PROFILE_OTA 2
+#define PROFILE_MQTT 3
+#define PROFILE_OPENTHERM 4
+#define PROFILE_HEATPUMP 5
+#define PROFILE_DALLAS 6
+#define PROFILE_S0 7
+#define PROFILE_STATS 8
+#define PROFILE_TIMERS 9
+#define PROFILE_LOG 10
+#define PROFILE_NR 11
+
+#define PROFILE_LOOP PROFILE_NR  // the whole iteration
+
+// a loop iteration taking longer than this is over budget
+#define PROFILE_BUDGET_US 50000UL
+
+/*
+ * Time to fill the 256 byte UART receive buffer at 9600 baud 8E1,
+ * an iteration this long while waiting for the heat pump may cost
+ * the answer.
+ */
+#define PROFILE_SERIAL_STALL_US (256UL * 1146UL)
+
+// the figures reported are of the last complete window
+#define PROFILE_WINDOW_MS 60000UL
+
+/*
+ * Durations are counted in buckets of powers of 2 from 16 us,
+ * the last one takes everything from about 0.26 s.
+ */
+#define PROFILE_BUCKETS 16
+
+#define PROFILE_JSON_SIZE 1536
+
+typedef struct profileSection_t {
+  uint32_t count;
+  uint32_t sum;   // us
+  uint32_t min;
+  uint32_t max;
+  uint16_t buckets[PROFILE_BUCKETS];
+  uint16_t blamed;  // over budget iterations this section took the most of
+} profileSection_t;
+
+typedef struct profileSummary_t {
+  uint32_t count;
+  uint32_t min;
+  uint32_t avg;
+  uint32_t max;
+  uint32_t p99;
+  uint16_t blamed;
+} profileSummary_t;
+
+void profilerLoopStart(void);
+
+/*
+ * Books the time since the previous mark, or the start of the
+ * iteration, on a section. A section can be marked more than
+ * once in an iteration, it counts as one sample.
+ */
+void profilerMark(uint8_t section);
+
+/*
+ * Ends the iteration, serialBusy tells whether an answer of the
+ * heat pump was expected or arriving.
+ */
+void profilerLoopEnd(bool serialBusy);
+
+const profileSummary_t *profilerSummary(uint8_t section);
+
+size_t profilerJson(char *out, size_t len);
+
+#endif
@@ -7,6 +7,7 @@
 */
 
 #include <stdlib.h>
+#include <ctype.h>
 #include <sys/time.h>
 #include <time.h>
 
@@ -21,17 +22,19 @@
 #include "src/common/timerqueue.h"
 #include "src/common/progmem.h"
 #include "src/rules/rules.h"
+#include "rules.h"
 
 #include "dallas.h"
 #include "webfunctions.h"
 #include "decode.h"
 #include "HeishaOT.h"
 #include "commands.h"
+#include "lookup.h"
 
 #define MAXCOMMANDSINBUFFER 10
 #define OPTDATASIZE 20
 
-bool send_command(byte* command, int length);
+bool send_setting(uint8_t command, byte* datagram, int length);
 #ifdef ESP32
 extern QueueHandle_t pcbQueue;
 #endif
@@ -60,6 +63,28 @@ typedef struct rule_timer_t {
 
 static struct rule_timer_t timestamp;
 
+/*
+ * Every run of a rule is counted on the rule, its time in buckets
+ * of powers of 2 from 16 us for the p95, the last one takes all
+ * from about 32 ms. They are kept until the rules are parsed or
+ * loaded again.
+ */
+#define RULES_STATS_BUCKETS 12
+
+typedef struct rules_stats_t {
+  uint32_t runs;
+  uint32_t total;  // us
+  uint32_t min;
+  uint32_t max;
+  uint32_t steps;
+  uint16_t stack;  // the most bytes on the value stack
+  uint16_t commands;
+  uint16_t buckets[RULES_STATS_BUCKETS];
+} rules_stats_t;
+
+static struct rules_stats_t *ruleStats = NULL;
+static uint16_t commandsSent = 0;  // by the rule running now
+
 typedef struct array_t {
   const char *key;
   union {
@@ -82,44 +107,14 @@ static struct varstack_t global_varstack = { .array = NULL, .nr = 0 };
 unsigned char *mempool = (unsigned char *)MMU_SEC_HEAP;
 #elif defined(ESP32)
 unsigned char *mempool; //malloc in runtime
+#else
+static unsigned char hostpool[MEMPOOL_SIZE] __attribute__((aligned(4)));
+unsigned char *mempool = hostpool;
 #endif
 unsigned int memptr = 0;
 
-// static int readRuleFromFS(int i) {
-  // char fname[24];
-  // memset(&fname, 0, sizeof(fname));
-  // sprintf_P((char *)&fname, PSTR("/rule%d.bc"), i);
-  // File f = LittleFS.open(fname, "r");
-  // if(!f) {
-    // logprintf_P(F("failed to open file: %s"), fname);
-    // return -1;
-  // }
-  // FREE(rules[i]->ast.buffer);
-  // if((rules[i]->ast.buffer = (unsigned char *)MALLOC(rules[i]->ast.bufsize)) == NULL) {
-    // OUT_OF_MEMORY
-  // }
-  // memset(rules[i]->ast.buffer, 0, rules[i]->ast.bufsize);
-  // f.readBytes((char *)rules[i]->ast.buffer, rules[i]->ast.bufsize);
-  // f.close();
-  // return 0;
-// }
-
-// static int writeRuleToFS(int i) {
-  // char fname[24];
-  // memset(&fname, 0, sizeof(fname));
-  // sprintf_P((char *)&fname, PSTR("/rule%d.bc"), i);
-  // File f = LittleFS.open(fname, "w");
-  // if(!f) {
-    // logprintf_P(F("failed to open file: %s"), fname);
-    // return -1;
-  // }
-  // f.write((char *)rules[i]->ast.buffer, rules[i]->ast.bufsize);
-  // f.close();
-  // return 0;
-// }
-
 static int8_t is_variable(char *text, uint16_t size) {
-  uint16_t i = 1, x = 0, match = 0;
+  uint16_t i = 1, match = 0;
 
   if(size == strlen_P(PSTR("ds18b20#2800000000000000")) && strncmp_P(text, PSTR("ds18b20#"), 8) == 0) {
     return 24;
@@ -157,67 +152,13 @@ static int8_t is_variable(char *text, uint16_t size) {
     }
 
     if(text[0] == '@') {
-      int nrcommands = sizeof(commands)/sizeof(commands[0]);
-      for(x=0;x<nrcommands;x++) {
-        cmdStruct cmd;
-        memcpy_P(&cmd, &commands[x], sizeof(cmd));
-        size_t len = strlen(cmd.name);
-        if(size-1 == len && strnicmp(&text[1], cmd.name, len) == 0) {
-          i = len+1;
-          match = 1;
-          break;
-        }
-      }
-
-      int nroptcommands = sizeof(optionalCommands)/sizeof(optionalCommands[0]);
-      for(x=0;x<nroptcommands;x++) {
-        optCmdStruct cmd;
-        memcpy_P(&cmd, &optionalCommands[x], sizeof(cmd));
-        size_t len = strlen(cmd.name);
-        if(size-1 == len && strnicmp(&text[1], cmd.name, len) == 0) {
-          i = len+1;
-          match = 1;
-          break;
-        }
-      }
-      if(match == 0) {
-        int nrtopics = sizeof(topics)/sizeof(topics[0]);
-        for(x=0;x<nrtopics;x++) {
-          char cpy[MAX_TOPIC_LEN];
-          memcpy_P(&cpy, topics[x], MAX_TOPIC_LEN);
-          size_t len = strlen(cpy);
-          if(size-1 == len && strnicmp(&text[1], cpy, len) == 0) {
-            i = len+1;
-            match = 1;
-            break;
-          }
-        }
-      }
-      if(match == 0) {
-        int nrtopics = sizeof(optTopics)/sizeof(optTopics[0]);
-        for(x=0;x<nrtopics;x++) {
-          char cpy[MAX_TOPIC_LEN];
-          memcpy_P(&cpy, optTopics[x], MAX_TOPIC_LEN);
-          size_t len = strlen(cpy);
-          if(size-1 == len && strnicmp(&text[1], cpy, len) == 0) {
-            i = len+1;
-            match = 1;
-            break;
-          }
-        }
-      }
-      if(match == 0) {
-        int nrtopics = sizeof(xtopics)/sizeof(xtopics[0]);
-        for(x=0;x<nrtopics;x++) {
-          char cpy[MAX_TOPIC_LEN];
-          memcpy_P(&cpy, xtopics[x], MAX_TOPIC_LEN);
-          size_t len = strlen(cpy);
-          if(size-1 == len && strnicmp(&text[1], cpy, len) == 0) {
-            i = len+1;
-            match = 1;
-            break;
-          }
-        }
+      if(lookupCommand(&text[1], size-1) >= 0 ||
+         lookupOptCommand(&text[1], size-1) >= 0 ||
+         lookupTopic(&text[1], size-1) >= 0 ||
+         lookupOptTopic(&text[1], size-1) >= 0 ||
+         lookupXTopic(&text[1], size-1) >= 0) {
+        i = size;
+        match = 1;
       }
       if(match == 0) {
         return -1;
@@ -247,71 +188,15 @@ static int8_t is_variable(char *text, uint16_t size) {
 
 
 static int8_t is_event(char *text, uint16_t size) {
-  int i = 1, x = 0, match = 0;
+  int i = 1, match = 0;
   if(text[0] == '@') {
-    int nrcommands = sizeof(commands)/sizeof(commands[0]);
-    for(x=0;x<nrcommands;x++) {
-      cmdStruct cmd;
-      memcpy_P(&cmd, &commands[x], sizeof(cmd));
-      size_t len = strlen(cmd.name);
-      if(size-1 == len && strnicmp(&text[1], cmd.name, len) == 0) {
-        i = len+1;
-        match = 1;
-        break;
-      }
-    }
-
-    if(match == 0) {
-      int nroptcommands = sizeof(optionalCommands)/sizeof(optionalCommands[0]);
-      for(x=0;x<nroptcommands;x++) {
-        optCmdStruct cmd;
-        memcpy_P(&cmd, &optionalCommands[x], sizeof(cmd));
-        size_t len = strlen(cmd.name);
-        if(size-1 == len && strnicmp(&text[1], cmd.name, len) == 0) {
-          i = len+1;
-          match = 1;
-          break;
-        }
-      }
-    }
-    if(match == 0) {
-      int nrtopics = sizeof(topics)/sizeof(topics[0]);
-      for(x=0;x<nrtopics;x++) {
-        size_t len = strlen_P(topics[x]);
-        char cpy[len];
-        memcpy_P(&cpy, &topics[x], len);
-        if(size-1 == len && strnicmp(&text[1], cpy, len) == 0) {
-          i = len+1;
-          match = 1;
-          break;
-        }
-      }
-    }
-    if(match == 0) {
-      int nrtopics = sizeof(optTopics)/sizeof(optTopics[0]);
-      for(x=0;x<nrtopics;x++) {
-        size_t len = strlen_P(optTopics[x]);
-        char cpy[len];
-        memcpy_P(&cpy, &optTopics[x], len);
-        if(size-1 == len && strnicmp(&text[1], cpy, len) == 0) {
-          i = len+1;
-          match = 1;
-          break;
-        }
-      }
-    }
-    if(match == 0) {
-      int nrtopics = sizeof(xtopics)/sizeof(xtopics[0]);
-      for(x=0;x<nrtopics;x++) {
-        size_t len = strlen_P(xtopics[x]);
-        char cpy[len];
-        memcpy_P(&cpy, &xtopics[x], len);
-        if(size-1 == len && strnicmp(&text[1], cpy, len) == 0) {
-          i = len+1;
-          match = 1;
-          break;
-        }
-      }
+    if(lookupCommand(&text[1], size-1) >= 0 ||
+       lookupOptCommand(&text[1], size-1) >= 0 ||
+       lookupTopic(&text[1], size-1) >= 0 ||
+       lookupOptTopic(&text[1], size-1) >= 0 ||
+       lookupXTopic(&text[1], size-1) >= 0) {
+      i = size;
+      match = 1;
     }
     if(match == 0) {
       return -1;
@@ -382,35 +267,134 @@ static int8_t event_cb(struct rules_t *obj, char *name) {
   return 1;
 }
 
-static int8_t check_is_number(const char *str) {
-  uint16_t pos = 0, nrdot = 0;
-  size_t len = strlen(str);
-
-  if (len == 0) {
-    return -1;  // Empty string is not a number.
-  }
-
-  // Check the first character (optional '-' or a digit).
-  if (str[0] != '-' && !isdigit((unsigned char)str[0])) {
+/*
+ * Variables referring to heat pump, opentherm, s0, ds18b20
+ * or time values are bound to a slot when the rules are
+ * parsed. The slot holds the kind of value in the upper
+ * bits and the index in the corresponding table in the
+ * lower bits, so the values can be read and written
+ * without comparing names while the rules run.
+ */
+#define SLOT_TOPIC      1
+#define SLOT_XTOPIC     2
+#define SLOT_OPTTOPIC   3
+#define SLOT_COMMAND    4
+#define SLOT_OPTCOMMAND 5
+#define SLOT_OT         6
+#define SLOT_TIME       7
+#define SLOT_S0         8
+#define SLOT_DS18B20    9
+#define SLOT_TIMER      10
+
+#define SLOT(a, b) (((a) << 10) | (b))
+#define SLOT_TYPE(a) ((a) >> 10)
+#define SLOT_INDEX(a) ((a) & 0x3FF)
+// ds18b20 sensor not found (yet) while binding
+#define SLOT_UNKNOWN 0x3FF
+
+#define TIME_HOUR   0
+#define TIME_MINUTE 1
+#define TIME_MONTH  2
+#define TIME_DAY    3
+
+#define S0_WATT          0
+#define S0_WATTHOUR      1
+#define S0_WATTHOURTOTAL 2
+
+static int16_t vm_value_bind(char *text, uint16_t size) {
+  int16_t i = 0;
+
+  if(size < 2) {
     return -1;
   }
 
-  // Traverse the rest of the string.
-  for (pos = 1; pos < len; pos++) {
-    char current = str[pos];
-
-    if (current == '.') {
-      nrdot++;
-      if (nrdot > 1) {
-        return -1;  // More than one dot.
+  if(text[0] == '@') {
+    if((i = lookupTopic(&text[1], size-1)) >= 0) {
+      return SLOT(SLOT_TOPIC, i);
+    }
+    if((i = lookupOptTopic(&text[1], size-1)) >= 0) {
+      return SLOT(SLOT_OPTTOPIC, i);
+    }
+    if((i = lookupXTopic(&text[1], size-1)) >= 0) {
+      return SLOT(SLOT_XTOPIC, i);
+    }
+    if((i = lookupCommand(&text[1], size-1)) >= 0) {
+      return SLOT(SLOT_COMMAND, i);
+    }
+    if((i = lookupOptCommand(&text[1], size-1)) >= 0) {
+      return SLOT(SLOT_OPTCOMMAND, i);
+    }
+  } else if(text[0] == '?') {
+    for(i=0;heishaOTDataStruct[i].name != NULL;i++) {
+      if(strlen(heishaOTDataStruct[i].name) == size-1U &&
+         strnicmp(&text[1], heishaOTDataStruct[i].name, size-1) == 0) {
+        return SLOT(SLOT_OT, i);
       }
-    } else if (!isdigit((unsigned char)current)) {
-      return -1;  // Non-digit, non-dot character.
+    }
+  } else if(text[0] == '%') {
+    if(size == 5 && strnicmp(&text[1], "hour", 4) == 0) {
+      return SLOT(SLOT_TIME, TIME_HOUR);
+    }
+    if(size == 7 && strnicmp(&text[1], "minute", 6) == 0) {
+      return SLOT(SLOT_TIME, TIME_MINUTE);
+    }
+    if(size == 6 && strnicmp(&text[1], "month", 5) == 0) {
+      return SLOT(SLOT_TIME, TIME_MONTH);
+    }
+    if(size == 4 && strnicmp(&text[1], "day", 3) == 0) {
+      return SLOT(SLOT_TIME, TIME_DAY);
+    }
+  } else if(size >= 8 && strnicmp(text, "ds18b20#", 8) == 0) {
+    for(i=0;i<dallasDevicecount;i++) {
+      if(strncmp(actDallasData[i].address, &text[8], 16) == 0) {
+        return SLOT(SLOT_DS18B20, i);
+      }
+    }
+    return SLOT(SLOT_DS18B20, SLOT_UNKNOWN);
+  } else if(size >= 9 && strnicmp(text, "s0#", 3) == 0) {
+    // port digit is the last character
+    char port = text[size-1];
+    if(port != '1' && port != '2') {
+      return -1;
+    }
+    if(size == 9 && strnicmp(&text[3], "watt_", 5) == 0) {
+      return SLOT(SLOT_S0, S0_WATT*2 + (port - '1'));
+    }
+    if(size == 13 && strnicmp(&text[3], "watthour_", 9) == 0) {
+      return SLOT(SLOT_S0, S0_WATTHOUR*2 + (port - '1'));
+    }
+    if(size == 18 && strnicmp(&text[3], "watthourtotal_", 14) == 0) {
+      return SLOT(SLOT_S0, S0_WATTHOURTOTAL*2 + (port - '1'));
     }
   }
+  return -1;
+}
 
-  // Valid number if all checks pass.
-  return 0;
+static void vm_push_topic_value(const topicDecode_t *desc, valueCache_t *cache, char *data) {
+  if(data[0] == '\0') {
+    rules_pushnil();
+    return;
+  }
+  switch(valueType(desc)) {
+    case VALUE_INTEGER: {
+      rules_pushinteger(cache->value);
+    } break;
+    case VALUE_FLOAT: {
+      float var = valueToFloat(desc, cache->value);
+      float nr = 0;
+
+      if(modff(var, &nr) == 0) {
+        rules_pushinteger((int)var);
+      } else {
+        rules_pushfloat(var);
+      }
+    } break;
+    case VALUE_STRING: {
+      char str[MAX_VALUE_LEN];
+      formatValue(str, data, desc, cache->value);
+      rules_pushstring(str);
+    } break;
+  }
 }
 
 static int8_t vm_value_get(struct rules_t *obj) {
@@ -424,154 +408,93 @@ static int8_t vm_value_get(struct rules_t *obj) {
   }
 
   const char *key = rules_tostring(-1);
+  int16_t slot = rules_toslot(-1);
 
-  if(key[0] == '?') {
-    int x = 0;
-    while(heishaOTDataStruct[x].name != NULL) {
-      if(heishaOTDataStruct[x].rw >= 2 &&
-         stricmp((char *)&key[1], heishaOTDataStruct[x].name) == 0) {
-        if(heishaOTDataStruct[x].type == TBOOL) {
-          rules_pushinteger((int)heishaOTDataStruct[x].value.b);
-          return 0;
-        }
-        if(heishaOTDataStruct[x].type == TFLOAT) {
-          rules_pushfloat(heishaOTDataStruct[x].value.f);
-          return 0;
-        }
-        break;
-      }
-      x++;
-    }
-    logprintf_P(F("err: %s %d"), __FUNCTION__, __LINE__);
-  } else if(key[0] == '%') {
-    time_t now = time(NULL);
-    struct tm *tm_struct = localtime(&now);
-    if(stricmp((char *)&key[1], "hour") == 0) {
-      rules_pushinteger((int)tm_struct->tm_hour);
-      return 0;
-    } else if(stricmp((char *)&key[1], "minute") == 0) {
-      rules_pushinteger((int)tm_struct->tm_min);
-      return 0;
-    } else if(stricmp((char *)&key[1], "month") == 0) {
-      rules_pushinteger((int)tm_struct->tm_mon);
-      return 0;
-    } else if(stricmp((char *)&key[1], "day") == 0) {
-      rules_pushinteger((int)tm_struct->tm_wday+1);
-      return 0;
-    }
-  } else if(strnicmp((const char *)key, _F("ds18b20#"), 8) == 0) {
-    uint8_t i = 0;
-    for(i=0;i<dallasDevicecount;i++) {
-      if(strncmp(actDallasData[i].address, (const char *)&key[8], 16) == 0) {
-        rules_pushfloat(actDallasData[i].temperature);
-        return 0;
-      }
-    }
-    rules_pushnil();
-    return 0;
-} else if(strnicmp((const char *)key, "s0#", 3) == 0) {
-    // Port digit is last character; valid sizes are 9, 13, 18
-    size_t klen = strlen(key);
-    if(klen != 9 && klen != 13 && klen != 18) { rules_pushnil(); return 0; }
-
-    char portChar = key[klen - 1];
-    if(portChar != '1' && portChar != '2') { rules_pushnil(); return 0; }
-    uint8_t idx = portChar - '1';  // '1'->0, '2'->1
-
-    if(klen == 9 && strnicmp(&key[3], "watt_", 5) == 0) {
+  /*
+   * Strings created while running aren't bound
+   */
+  if(slot == -1) {
+    slot = vm_value_bind((char *)key, strlen(key));
+  }
 
-        rules_pushfloat((float)actS0Data[idx].watt);
-        return 0;
-    }
-    if(klen == 13 && strnicmp(&key[3], "watthour_", 9) == 0) {
-        rules_pushfloat(actS0Data[idx].pulses * (1000.0 / actS0Settings[idx].ppkwh));
-        return 0;
-    }
-    if(klen == 18 && strnicmp(&key[3], "watthourtotal_", 14) == 0) {
-        rules_pushfloat(actS0Data[idx].pulsesTotal * (1000.0 / actS0Settings[idx].ppkwh));
-        return 0;
-    }
-    rules_pushnil();
-    return 0;
-  } else if(key[0] == '@') {
-    uint16_t i = 0;
-    for(i=0;i<NUMBER_OF_TOPICS;i++) {
-      char cpy[MAX_TOPIC_LEN];
-      memcpy_P(&cpy, topics[i], MAX_TOPIC_LEN);
-      if(stricmp(cpy, (char *)&key[1]) == 0) {
-        String dataValue = actData[0] == '\0' ? "" : getDataValue(actData, i);
-        char *str = (char *)dataValue.c_str();
-        if(strlen(str) == 0) {
-          rules_pushnil();
-          return 0;
-        } else if(check_is_number(str) == 0) {
-          float var = atof(str);
-          float nr = 0;
+  if(slot >= 0) {
+    uint16_t i = SLOT_INDEX(slot);
 
-          if(modff(var, &nr) == 0) {
-            rules_pushinteger((int)var);
-            return 0;
-          } else {
-            rules_pushfloat(var);
+    switch(SLOT_TYPE(slot)) {
+      case SLOT_TOPIC: {
+        vm_push_topic_value(&topicDecode[i], &topicCache[i], actData);
+      } break;
+      case SLOT_OPTTOPIC: {
+        vm_push_topic_value(&optTopicDecode[i], &optTopicCache[i], actOptData);
+      } break;
+      case SLOT_XTOPIC: {
+        vm_push_topic_value(&xtopicDecode[i], &xtopicCache[i], actDataExtra);
+      } break;
+      case SLOT_OT: {
+        if(heishaOTDataStruct[i].rw >= 2) {
+          if(heishaOTDataStruct[i].type == TBOOL) {
+            rules_pushinteger((int)heishaOTDataStruct[i].value.b);
             return 0;
           }
-        } else {
-          rules_pushstring(str);
-          return 0;
-        }
-      }
-    }
-    for(i=0;i<NUMBER_OF_OPT_TOPICS;i++) {
-      char cpy[MAX_TOPIC_LEN];
-      memcpy_P(&cpy, topics[i], MAX_TOPIC_LEN);
-      if(stricmp(cpy, (char *)&key[1]) == 0) {
-        String dataValue = actOptData[0] == '\0' ? "" : getOptDataValue(actOptData, i);
-        char *str = (char *)dataValue.c_str();
-        if(strlen(str) == 0) {
-          rules_pushnil();
-          return 0;
-        } else if(check_is_number(str) == 0) {
-          float var = atof(str);
-          float nr = 0;
-
-          if(modff(var, &nr) == 0) {
-            rules_pushinteger((int)var);
-            return 0;
-          } else {
-            rules_pushfloat(var);
+          if(heishaOTDataStruct[i].type == TFLOAT) {
+            rules_pushfloat(heishaOTDataStruct[i].value.f);
             return 0;
           }
-        } else {
-          rules_pushstring(str);
-          return 0;
         }
-      }
-    }
-    for(i=0;i<NUMBER_OF_TOPICS_EXTRA;i++) {
-      char cpy[MAX_TOPIC_LEN];
-      memcpy_P(&cpy, xtopics[i], MAX_TOPIC_LEN);
-      if(stricmp(cpy, (char *)&key[1]) == 0) {
-        String dataValue = actDataExtra[0] == '\0' ? "" : getDataValueExtra(actDataExtra, i);
-        char *str = (char *)dataValue.c_str();
-        if(strlen(str) == 0) {
-          rules_pushnil();
-          return 0;
-        } else if(check_is_number(str) == 0) {
-          float var = atof(str);
-          float nr = 0;
-
-          if(modff(var, &nr) == 0) {
-            rules_pushinteger((int)var);
-            return 0;
-          } else {
-            rules_pushfloat(var);
-            return 0;
+        logprintf_P(F("err: %s %d"), __FUNCTION__, __LINE__);
+      } break;
+      case SLOT_TIME: {
+        time_t now = time(NULL);
+        struct tm *tm_struct = localtime(&now);
+        switch(i) {
+          case TIME_HOUR: {
+            rules_pushinteger((int)tm_struct->tm_hour);
+          } break;
+          case TIME_MINUTE: {
+            rules_pushinteger((int)tm_struct->tm_min);
+          } break;
+          case TIME_MONTH: {
+            rules_pushinteger((int)tm_struct->tm_mon);
+          } break;
+          case TIME_DAY: {
+            rules_pushinteger((int)tm_struct->tm_wday+1);
+          } break;
+        }
+      } break;
+      case SLOT_DS18B20: {
+        /*
+         * Sensors can be found after the rules were parsed,
+         * so only trust the bound index when the address
+         * still matches.
+         */
+        int x = i;
+        if(x >= dallasDevicecount || strncmp(actDallasData[x].address, &key[8], 16) != 0) {
+          for(x=0;x<dallasDevicecount;x++) {
+            if(strncmp(actDallasData[x].address, &key[8], 16) == 0) {
+              break;
+            }
           }
+        }
+        if(x < dallasDevicecount) {
+          rules_pushfloat(actDallasData[x].temperature);
         } else {
-          rules_pushstring(str);
-          return 0;
+          rules_pushnil();
         }
-      }
+      } break;
+      case SLOT_S0: {
+        uint8_t port = i % 2;
+        switch(i / 2) {
+          case S0_WATT: {
+            rules_pushfloat((float)actS0Data[port].watt);
+          } break;
+          case S0_WATTHOUR: {
+            rules_pushfloat(actS0Data[port].pulses * (1000.0 / actS0Settings[port].ppkwh));
+          } break;
+          case S0_WATTHOURTOTAL: {
+            rules_pushfloat(actS0Data[port].pulsesTotal * (1000.0 / actS0Settings[port].ppkwh));
+          } break;
+        }
+      } break;
     }
   } else {
     struct varstack_t *table = NULL;
@@ -636,8 +559,13 @@ static int8_t vm_value_set(struct rules_t *obj) {
   }
 
   const char *key = rules_tostring(-2);
+  int16_t slot = rules_toslot(-2);
 
-  if(key[0] == '@') {
+  if(slot == -1) {
+    slot = vm_value_bind((char *)key, strlen(key));
+  }
+
+  if(SLOT_TYPE(slot) == SLOT_COMMAND || SLOT_TYPE(slot) == SLOT_OPTCOMMAND) {
     char *payload = NULL;
     unsigned int len = 0;
 
@@ -671,65 +599,52 @@ static int8_t vm_value_set(struct rules_t *obj) {
       unsigned char cmd[256] = { 0 };
       char log_msg[256] = { 0 };
 
-      for(uint8_t x = 0; x < sizeof(commands) / sizeof(commands[0]); x++) {
-        cmdStruct tmp;
-        memcpy_P(&tmp, &commands[x], sizeof(tmp));
-        if(stricmp((char *)&key[1], tmp.name) == 0) {
-          uint16_t len = tmp.func(payload, cmd, log_msg);
-          log_message(log_msg);
-          send_command(cmd, len);
-          break;
-        }
-      }
-
-      memset(&cmd, 0, sizeof(cmd));
-      memset(&log_msg, 0, sizeof(log_msg));
+      uint16_t i = SLOT_INDEX(slot);
 
-      if(heishamonSettings.optionalPCB) {
+      if(SLOT_TYPE(slot) == SLOT_COMMAND) {
+        cmdStruct tmp;
+        memcpy_P(&tmp, &commands[i], sizeof(tmp));
+        uint16_t len = tmp.func(payload, cmd, log_msg);
+        log_message(log_msg);
+        send_setting(i, cmd, len);
+        commandsSent++;
+      } else if(heishamonSettings.optionalPCB) {
         //optional commands
-        for(uint8_t x = 0; x < sizeof(optionalCommands) / sizeof(optionalCommands[0]); x++) {
-          optCmdStruct tmp;
-          memcpy_P(&tmp, &optionalCommands[x], sizeof(tmp));
-          if(stricmp((char *)&key[1], tmp.name) == 0) {
-            uint16_t len = tmp.func(payload, log_msg);
-            log_message(log_msg);
+        optCmdStruct tmp;
+        memcpy_P(&tmp, &optionalCommands[i], sizeof(tmp));
+        tmp.func(payload, log_msg);
+        log_message(log_msg);
+        commandsSent++;
 #ifdef ESP32
-            xQueueOverwrite(pcbQueue, optionalPCBQuery);
+        xQueueOverwrite(pcbQueue, optionalPCBQuery);
 #endif
-            break;
-          }
-        }
       }
     }
     FREE(payload);
-  } else if(key[0] == '?') {
-    int x = 0;
-    while(heishaOTDataStruct[x].name != NULL) {
-      if(heishaOTDataStruct[x].rw <= 2 && stricmp((char *)&key[1], heishaOTDataStruct[x].name) == 0) {
-        if(heishaOTDataStruct[x].type == TBOOL) {
-          switch(type) {
-            case VINTEGER: {
-              heishaOTDataStruct[x].value.b = (bool)rules_tointeger(-1);
-            } break;
-            case VFLOAT: {
-              heishaOTDataStruct[x].value.b = (bool)rules_tofloat(-1);
-            } break;
-          }
-        } else if(heishaOTDataStruct[x].type == TFLOAT) {
-          switch(type) {
-            case VINTEGER: {
-              heishaOTDataStruct[x].value.f = (float)rules_tointeger(-1);
-            } break;
-            case VFLOAT: {
-              heishaOTDataStruct[x].value.f = rules_tofloat(-1);
-            } break;
-          }
+  } else if(SLOT_TYPE(slot) == SLOT_OT) {
+    uint16_t i = SLOT_INDEX(slot);
+    if(heishaOTDataStruct[i].rw <= 2) {
+      if(heishaOTDataStruct[i].type == TBOOL) {
+        switch(type) {
+          case VINTEGER: {
+            heishaOTDataStruct[i].value.b = (bool)rules_tointeger(-1);
+          } break;
+          case VFLOAT: {
+            heishaOTDataStruct[i].value.b = (bool)rules_tofloat(-1);
+          } break;
+        }
+      } else if(heishaOTDataStruct[i].type == TFLOAT) {
+        switch(type) {
+          case VINTEGER: {
+            heishaOTDataStruct[i].value.f = (float)rules_tointeger(-1);
+          } break;
+          case VFLOAT: {
+            heishaOTDataStruct[i].value.f = rules_tofloat(-1);
+          } break;
         }
-        break;
       }
-      x++;
     }
-  } else {
+  } else if(key[0] == '$' || key[0] == '#') {
     if(key[0] == '$') {
       table = (struct varstack_t *)obj->userdata;
       if(table == NULL) {
@@ -870,39 +785,340 @@ static void rules_print_local_stacks(void) {
   }
 }
 
-void rules_timer_cb(int nr) {
-  char *name = NULL;
-  int x = 0, i = 0;
+/*
+ * The rule each event runs is looked up once, when the rules are
+ * parsed or loaded, by the slot of its name. An event then needs
+ * no name to be formatted and compared with that of every rule.
+ * The topic tables also get a bit per topic that is set when a
+ * rule runs on it, so a topic no rule uses costs a bit test.
+ */
+typedef struct rules_dispatch_t {
+  uint16_t slot;
+  uint8_t rule;
+} rules_dispatch_t;
+
+static struct rules_dispatch_t *dispatch = NULL;
+static uint8_t nrdispatch = 0;
+static uint16_t unbound = 0;  // the slot types of events that could not be bound
+
+static uint8_t topicRules[(NUMBER_OF_TOPICS + 7) / 8];
+static uint8_t xtopicRules[(NUMBER_OF_TOPICS_EXTRA + 7) / 8];
+static uint8_t optTopicRules[(NUMBER_OF_OPT_TOPICS + 7) / 8];
+
+static uint8_t *const dispatchTopics[] = { topicRules, xtopicRules, optTopicRules };
+static const uint8_t dispatchTypes[] = { SLOT_TOPIC, SLOT_XTOPIC, SLOT_OPTTOPIC };
+
+static void rulesDispatchClear(void) {
+  FREE(dispatch);
+  FREE(ruleStats);
+  nrdispatch = 0;
+  unbound = 0;
+  memset(topicRules, 0, sizeof(topicRules));
+  memset(xtopicRules, 0, sizeof(xtopicRules));
+  memset(optTopicRules, 0, sizeof(optTopicRules));
+}
+
+static int8_t rulesDispatchFind(uint16_t slot) {
+  int16_t a = 0, b = nrdispatch - 1;
+  while(a <= b) {
+    int16_t m = (a + b) / 2;
+    if(dispatch[m].slot == slot) {
+      return dispatch[m].rule;
+    } else if(dispatch[m].slot < slot) {
+      a = m + 1;
+    } else {
+      b = m - 1;
+    }
+  }
+  return -1;
+}
+
+/*
+ * The table stays sorted by slot. When more rules run on the same
+ * event only the first is kept, like rule_by_name finds it.
+ */
+static void rulesDispatchAdd(uint16_t slot, uint8_t rule) {
+  uint8_t i = nrdispatch, x = 0;
+  if(rulesDispatchFind(slot) > -1 || nrdispatch >= nrrules) {
+    return;
+  }
+  while(i > 0 && dispatch[i-1].slot > slot) {
+    dispatch[i] = dispatch[i-1];
+    i--;
+  }
+  dispatch[i].slot = slot;
+  dispatch[i].rule = rule;
+  nrdispatch++;
+
+  for(x=0;x<sizeof(dispatchTypes);x++) {
+    if(SLOT_TYPE(slot) == dispatchTypes[x]) {
+      dispatchTopics[x][SLOT_INDEX(slot) >> 3] |= 1 << (SLOT_INDEX(slot) & 7);
+    }
+  }
+}
 
-  i = snprintf_P(NULL, 0, PSTR("timer=%d"), nr);
-  if((name = (char *)MALLOC(i+2)) == NULL) {
+static int16_t rulesEventSlot(const char *name) {
+  uint16_t len = strlen(name);
+  if(len > 6 && strnicmp(name, "timer=", 6) == 0) {
+    int nr = atoi(&name[6]);
+    return SLOT(SLOT_TIMER, (nr > 0 && nr < SLOT_UNKNOWN) ? nr : SLOT_UNKNOWN);
+  }
+  return vm_value_bind((char *)name, len);
+}
+
+static void rulesDispatchBuild(void) {
+  uint8_t i = 0;
+  rulesDispatchClear();
+  if(nrrules == 0) {
+    return;
+  }
+  if((dispatch = (struct rules_dispatch_t *)MALLOC(sizeof(struct rules_dispatch_t)*nrrules)) == NULL) {
+    OUT_OF_MEMORY
+  }
+  if((ruleStats = (struct rules_stats_t *)CALLOC(nrrules, sizeof(struct rules_stats_t))) == NULL) {
     OUT_OF_MEMORY
   }
-  memset(name, 0, i+2);
-  snprintf_P(name, i+1, PSTR("timer=%d"), nr);
+  for(i=0;i<nrrules;i++) {
+    if(rules[i]->name == NULL) {
+      continue;
+    }
+    int16_t slot = rulesEventSlot(rules[i]->name);
+    if(slot == -1) {
+      continue;
+    }
+    if(SLOT_INDEX(slot) == SLOT_UNKNOWN) {
+      unbound |= 1 << SLOT_TYPE(slot);
+    } else {
+      rulesDispatchAdd(slot, i);
+    }
+  }
+}
 
-  // logprintf_P(F("_______ %s %s"), __FUNCTION__, name);
+/*
+ * While a datagram is decoded the rules its topics trigger can be
+ * marked instead of run, a bit per rule, and then run once each
+ * when the datagram is done.
+ */
+static bool batching = false;
+static uint8_t batched[(UINT8_MAX + 1) / 8];
+
+static void rulesStatsAdd(int8_t nr, uint32_t us) {
+  struct rules_stats_t *s = NULL;
+  uint8_t b = 0;
+  uint32_t v = us >> 4;
+
+  if(ruleStats == NULL) {
+    return;
+  }
+  s = &ruleStats[nr];
+  while(v > 0 && b < RULES_STATS_BUCKETS - 1) {
+    v >>= 1;
+    b++;
+  }
+  if(s->buckets[b] == UINT16_MAX) {
+    // the p95 only needs the proportions
+    for(v=0;v<RULES_STATS_BUCKETS;v++) {
+      s->buckets[v] /= 2;
+    }
+  }
+  s->buckets[b]++;
+  if(s->runs == 0 || us < s->min) {
+    s->min = us;
+  }
+  if(us > s->max) {
+    s->max = us;
+  }
+  s->runs++;
+  s->total += us;
+  s->steps += rule_run_stats.steps;
+  if(rule_run_stats.stack > s->stack) {
+    s->stack = rule_run_stats.stack;
+  }
+  s->commands += commandsSent;
+}
 
-  nr = rule_by_name(rules, nrrules, name);
-  if(nr > -1) {
-    logprintf_P(F("%s %s %s"), F("===="), name, F("===="));
+static uint32_t rulesStatsP95(struct rules_stats_t *s) {
+  uint32_t total = 0, seen = 0;
+  uint8_t i = 0;
 
-    timestamp.first = micros();
+  for(i=0;i<RULES_STATS_BUCKETS;i++) {
+    total += s->buckets[i];
+  }
+  for(i=0;i<RULES_STATS_BUCKETS && total > 0;i++) {
+    seen += s->buckets[i];
+    if(seen * 100 >= total * 95) {
+      // the upper bound of the bucket, the largest run bounds the last one
+      uint32_t upper = (i < RULES_STATS_BUCKETS - 1) ? (16UL << i) - 1 : s->max;
+      return (upper < s->max) ? upper : s->max;
+    }
+  }
+  return 0;
+}
+
+size_t rules_stats_json(uint16_t part, char *out, size_t len) {
+  uint8_t nr = (ruleStats != NULL) ? nrrules : 0;
+  size_t n = 0;
+
+  if(part == 0) {
+    n = snprintf_P(out, len, PSTR("["));
+  } else if(part <= nr) {
+    struct rules_stats_t *s = &ruleStats[part - 1];
+    n = snprintf_P(out, len, PSTR("%s{\"rule\":\"%.48s\",\"nr\":%u,\"runs\":%lu,\"total\":%lu,\"min\":%lu,\"avg\":%lu,\"max\":%lu,\"p95\":%lu,\"steps\":%lu,\"stack\":%u,\"commands\":%u}"),
+      (part > 1) ? "," : "", (rules[part - 1]->name != NULL) ? rules[part - 1]->name : "", part,
+      (unsigned long)s->runs, (unsigned long)s->total, (unsigned long)s->min,
+      (unsigned long)((s->runs > 0) ? s->total / s->runs : 0), (unsigned long)s->max,
+      (unsigned long)rulesStatsP95(s), (unsigned long)s->steps, s->stack, s->commands);
+  } else if(part == nr + 1) {
+    n = snprintf_P(out, len, PSTR("]"));
+  } else {
+    return 0;
+  }
+  return (n < len) ? n : len - 1;
+}
+
+size_t rules_stats_summary_json(char *out, size_t len) {
+  uint8_t nr = (ruleStats != NULL) ? nrrules : 0;
+  uint8_t busiest[RULES_STATS_BUSIEST], nrbusiest = 0;
+  uint32_t runs = 0, total = 0, max = 0;
+  size_t n = 0;
+  uint8_t i = 0, x = 0;
+
+  for(i=0;i<nr;i++) {
+    struct rules_stats_t *s = &ruleStats[i];
+    runs += s->runs;
+    total += s->total;
+    if(s->max > max) {
+      max = s->max;
+    }
+    if(s->total == 0) {
+      continue;
+    }
+    // kept sorted, the most time first
+    for(x=nrbusiest;x>0 && ruleStats[busiest[x-1]].total < s->total;x--) {
+      if(x < RULES_STATS_BUSIEST) {
+        busiest[x] = busiest[x-1];
+      }
+    }
+    if(x < RULES_STATS_BUSIEST) {
+      busiest[x] = i;
+      if(nrbusiest < RULES_STATS_BUSIEST) {
+        nrbusiest++;
+      }
+    }
+  }
+
+  n = snprintf_P(out, len, PSTR("{\"rules\":%u,\"runs\":%lu,\"total\":%lu,\"max\":%lu,\"busiest\":["),
+    nr, (unsigned long)runs, (unsigned long)total, (unsigned long)max);
+  for(i=0;i<nrbusiest && n < len;i++) {
+    struct rules_stats_t *s = &ruleStats[busiest[i]];
+    n += snprintf_P(&out[n], len - n, PSTR("%s{\"rule\":\"%.48s\",\"nr\":%u,\"runs\":%lu,\"total\":%lu,\"max\":%lu,\"p95\":%lu}"),
+      (i > 0) ? "," : "", (rules[busiest[i]]->name != NULL) ? rules[busiest[i]]->name : "", busiest[i] + 1,
+      (unsigned long)s->runs, (unsigned long)s->total, (unsigned long)s->max, (unsigned long)rulesStatsP95(s));
+  }
+  if(n < len) {
+    n += snprintf_P(&out[n], len - n, PSTR("]}"));
+  }
+  return (n < len) ? n : len - 1;
+}
 
-    int ret = rule_run(rules[nr], 0);
+static int rulesExecute(int8_t nr) {
+  logprintf_P(F("%s %s %s"), F("===="), rules[nr]->name, F("===="));
 
-    timestamp.second = micros();
+  commandsSent = 0;
+  timestamp.first = micros();
 
-    if(ret == 0) {
-      logprintf_P(F("%s%d %s %d %s"), F("rule #"), rules[nr]->nr, F("was executed in"), timestamp.second - timestamp.first, F("microseconds"));
+  int ret = rule_run(rules[nr], 0);
 
-      rules_print_local_stacks();
-      logprintf_P(F("\n>>> global variables\n"));
-      rules_print_stack(&global_varstack);
-      rules_free_stack();
+  timestamp.second = micros();
+  rulesStatsAdd(nr, timestamp.second - timestamp.first);
+
+  if(ret == 0) {
+    logprintf_P(F("%s%d %s %d %s"), F("rule #"), rules[nr]->nr, F("was executed in"), timestamp.second - timestamp.first, F("microseconds"));
+  }
+  return ret;
+}
+
+static void rulesDone(void) {
+  rules_print_local_stacks();
+  logprintf_P(F("\n>>> global variables\n"));
+  rules_print_stack(&global_varstack);
+  rules_free_stack();
+}
+
+static void rulesRun(int8_t nr) {
+  if(nr < 0) {
+    return;
+  }
+  if(batching) {
+    batched[nr >> 3] |= 1 << (nr & 7);
+    return;
+  }
+  if(rulesExecute(nr) == 0) {
+    rulesDone();
+  }
+}
+
+void rules_batch_begin(void) {
+  batching = true;
+}
+
+void rules_batch_end(void) {
+  uint8_t ran = 0;
+  int i = 0;
+
+  if(!batching) {
+    return;
+  }
+  batching = false;
+  for(i=0;i<nrrules;i++) {
+    if((batched[i >> 3] & (1 << (i & 7))) != 0 && rulesExecute(i) == 0) {
+      ran++;
     }
   }
-  FREE(name);
+  memset(batched, 0, sizeof(batched));
+  if(ran > 0) {
+    rulesDone();
+  }
+}
+
+void rules_timer_cb(int nr) {
+  if(nr > 0 && nr < SLOT_UNKNOWN) {
+    rulesRun(rulesDispatchFind(SLOT(SLOT_TIMER, nr)));
+  } else if((unbound & (1 << SLOT_TIMER)) != 0) {
+    char name[16];
+    snprintf_P(name, sizeof(name), PSTR("timer=%d"), nr);
+    rulesRun(rule_by_name(rules, nrrules, name));
+  }
+}
+
+void rules_topic_cb(uint8_t table, uint16_t nr) {
+  if((dispatchTopics[table][nr >> 3] & (1 << (nr & 7))) == 0) {
+    return;
+  }
+  rulesRun(rulesDispatchFind(SLOT(dispatchTypes[table], nr)));
+}
+
+/*
+ * The sensors are only known once the 1wire bus is scanned, which
+ * can be after the rules are parsed. A rule of a sensor that was
+ * not known then is found by name and bound the first time.
+ */
+void rules_dallas_cb(int nr) {
+  int8_t rule = rulesDispatchFind(SLOT(SLOT_DS18B20, nr));
+  if(rule == -1 && (unbound & (1 << SLOT_DS18B20)) != 0) {
+    char name[8 + 17];
+    snprintf_P(name, sizeof(name), PSTR("ds18b20#%s"), actDallasData[nr].address);
+    if((rule = rule_by_name(rules, nrrules, name)) > -1) {
+      rulesDispatchAdd(SLOT(SLOT_DS18B20, nr), rule);
+    }
+  }
+  rulesRun(rule);
+}
+
+void rules_s0_cb(int port) {
+  rulesRun(rulesDispatchFind(SLOT(SLOT_S0, S0_WATT*2 + port)));
+  rulesRun(rulesDispatchFind(SLOT(SLOT_S0, S0_WATTHOUR*2 + port)));
+  rulesRun(rulesDispatchFind(SLOT(SLOT_S0, S0_WATTHOURTOTAL*2 + port)));
 }
 
 void rules_setup(void) {
@@ -935,6 +1151,7 @@ void rules_setup(void) {
     rule_options.done_cb = rule_done_cb;
     rule_options.vm_value_set = vm_value_set;
     rule_options.vm_value_get = vm_value_get;
+    rule_options.vm_value_bind = vm_value_bind;
     rule_options.event_cb = event_cb;
 
   }
@@ -951,6 +1168,128 @@ bool existsRulesFile(char *file) {
   return false;
 }
 
+static int rulesImageRead(void *arg, void *buf, uint16_t len) {
+  return ((File *)arg)->read((uint8_t *)buf, len);
+}
+
+static int rulesImageWrite(void *arg, void *buf, uint16_t len) {
+  return ((File *)arg)->write((const uint8_t *)buf, len);
+}
+
+/*
+ * The compiled rules are kept next to the source, so the next
+ * boot only has to parse them again when the source changed.
+ */
+static int8_t rulesImageLoad(struct pbuf *mem, uint32_t hash) {
+  File f = LittleFS.open(RULES_IMAGE_FILE, "r");
+  if(!f) {
+    return -1;
+  }
+  int8_t ret = rules_image_read(&rules, &nrrules, mem, hash, rulesImageRead, &f);
+  f.close();
+  if(ret == -1) {
+    logprintf_P(F("%s is outdated, parsing the rules"), RULES_IMAGE_FILE);
+  }
+  return ret;
+}
+
+static void rulesImageSave(struct pbuf *mem, uint32_t hash) {
+  File f = LittleFS.open(RULES_IMAGE_FILE, "w");
+  if(!f) {
+    logprintf_P(F("failed to open file: %s"), RULES_IMAGE_FILE);
+    return;
+  }
+  int8_t ret = rules_image_write(rules, nrrules, mem, hash, rulesImageWrite, &f);
+  f.close();
+  if(ret == -1) {
+    logprintf_P(F("failed to write %s"), RULES_IMAGE_FILE);
+    LittleFS.remove(RULES_IMAGE_FILE);
+  }
+}
+
+#define BUFFER_SIZE 128
+
+static bool isRulesSpace(char c) {
+  return c == ' ' || c == '\n' || c == '\t' || c == '\r';
+}
+
+static bool isRulesDelimiter(char c) {
+  return isRulesSpace(c) || c == '(' || c == ')' || c == ',' || c == ';';
+}
+
+/*
+ * Counts a whole token: 'on' and 'if' open a block, 'end' closes
+ * one. Returns true when it closed the outermost block.
+ */
+static bool rulesBlockToken(const char *token, uint8_t nrtoken, uint16_t *depth) {
+  if(nrtoken == 2 && ((token[0] == 'o' && token[1] == 'n') || (token[0] == 'i' && token[1] == 'f'))) {
+    (*depth)++;
+  } else if(nrtoken == 3 && token[0] == 'e' && token[1] == 'n' && token[2] == 'd') {
+    if(*depth > 0 && --(*depth) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+ * Finds the next rule block in the source from *start on, reading
+ * it in chunks. A block runs from its 'on' up to the 'end' that
+ * closes it. Only whole tokens outside a string count, so with a
+ * space, a parenthesis, a comma or a semicolon before and after
+ * them, and names like 'Ontime' or 'endOfDay' are left alone. A
+ * block left open runs up to the end of the file for the parser
+ * to complain about.
+ */
+static int8_t rulesNextBlock(File &f, uint32_t *start, uint32_t *end) {
+  char content[BUFFER_SIZE];
+  char token[4] = { 0 }, quote = 0;
+  uint32_t pos = *start, size = f.size();
+  uint16_t depth = 0;
+  uint8_t nrtoken = 0;
+  bool escaped = false, found = false;
+  int len = 0, i = 0;
+
+  f.seek(pos, SeekSet);
+  while(pos < size && (len = f.readBytes(content, BUFFER_SIZE)) > 0) {
+    for(i=0;i<len;i++, pos++) {
+      char c = content[i];
+      if(quote != 0) {
+        if(escaped) {
+          escaped = false;
+        } else if(c == '\\') {
+          escaped = true;
+        } else if(c == quote) {
+          quote = 0;
+        }
+        continue;
+      }
+      if(isRulesDelimiter(c) || c == '"' || c == '\'') {
+        if(rulesBlockToken(token, nrtoken, &depth)) {
+          *end = pos;
+          return 0;
+        }
+        nrtoken = 0;
+        if(c == '"' || c == '\'') {
+          quote = c;
+        }
+      } else if(nrtoken < sizeof(token)) {
+        // a longer token is never a keyword
+        token[nrtoken++] = tolower(c);
+      }
+      if(!found && !isRulesSpace(c)) {
+        *start = pos;
+        found = true;
+      }
+    }
+  }
+  if(found) {
+    *end = size;
+    return 0;
+  }
+  return -1;
+}
+
 int rules_parse(char *file) {
   if (existsRulesFile(file)) { //only parse an existing and not empty, file
     rules_setup(); //check there if done already
@@ -961,6 +1300,7 @@ int rules_parse(char *file) {
 
     File frules = LittleFS.open(file, "r");
     parsing = 1;
+    rulesDispatchClear();
 
     if(nrrules > 0) {
       rules_free_stack();
@@ -974,50 +1314,75 @@ int rules_parse(char *file) {
     }
     memset(mempool, 0, MEMPOOL_SIZE);
 
-#define BUFFER_SIZE 128
+    struct pbuf mem;
+    memset(&mem, 0, sizeof(struct pbuf));
+    mem.payload = mempool;
+    mem.len = 0;
+    mem.tot_len = MEMPOOL_SIZE;
+
     char content[BUFFER_SIZE];
     memset(content, 0, BUFFER_SIZE);
     int len = frules.size();
     int chunk = 0, len1 = 0;
+    uint32_t hash = 2166136261UL;
 
-    unsigned int txtoffset = alignedbuffer(MEMPOOL_SIZE-len-5);
-	
-    while(chunk*BUFFER_SIZE < len) {
-      memset(content, 0, BUFFER_SIZE);
-      frules.seek(chunk*BUFFER_SIZE, SeekSet);
-      len1 = frules.readBytes(content, BUFFER_SIZE);
-      memcpy(&mempool[txtoffset+(chunk*BUFFER_SIZE)], &content, alignedbuffer(len1));
-      chunk++;
+    while((len1 = frules.readBytes(content, BUFFER_SIZE)) > 0) {
+      hash = rules_hash(hash, content, len1);
+    }
+
+    if(rulesImageLoad(&mem, hash) == 0) {
+      frules.close();
+      logprintf_P(F("rules loaded from %s, memory used: %d / %d"), RULES_IMAGE_FILE, mem.len, mem.tot_len);
+      timerqueue_clear();
+      rulesDispatchBuild();
+      parsing = 0;
+      return 0;
     }
-    frules.close();
 
-    struct pbuf mem;
     struct pbuf input;
-    memset(&mem, 0, sizeof(struct pbuf));
     memset(&input, 0, sizeof(struct pbuf));
 
-    mem.payload = mempool;
-    mem.len = 0;
-    mem.tot_len = MEMPOOL_SIZE;
+    uint32_t start = 0, end = 0;
+    int ret = 0;
+    while(ret == 0 && rulesNextBlock(frules, &start, &end) == 0) {
+      /*
+       * Only this block is staged, at the end of the mempool, and
+       * the bytecode grows towards it from the start.
+       */
+      len = end - start;
+      unsigned int txtoffset = 0;
+      if(len+8 >= MEMPOOL_SIZE || (txtoffset = alignedbuffer(MEMPOOL_SIZE-len-5)) <= mem.len) {
+        logprintf_P(F("FATAL: ruleset too large, out of memory"));
+        ret = -1;
+        break;
+      }
+      memset(&mempool[txtoffset], 0, MEMPOOL_SIZE-txtoffset);
+
+      chunk = 0;
+      while(chunk*BUFFER_SIZE < len) {
+        memset(content, 0, BUFFER_SIZE);
+        frules.seek(start+(chunk*BUFFER_SIZE), SeekSet);
+        len1 = len-(chunk*BUFFER_SIZE);
+        len1 = frules.readBytes(content, (len1 < BUFFER_SIZE) ? len1 : BUFFER_SIZE);
+        memcpy(&mempool[txtoffset+(chunk*BUFFER_SIZE)], &content, alignedbuffer(len1));
+        chunk++;
+      }
 
-    input.payload = &mempool[txtoffset];
-    input.len = txtoffset;
-    input.tot_len = len;
+      input.payload = &mempool[txtoffset];
+      input.len = txtoffset;
+      input.tot_len = len;
 
-    int ret = 0;
-    while((ret = rule_initialize(&input, &rules, &nrrules, &mem, NULL)) == 0) {
-      input.payload = &mempool[input.len];
+      ret = rule_initialize(&input, &rules, &nrrules, &mem, NULL);
+      start = end;
     }
+    frules.close();
 
     logprintf_P(F("rules memory used: %d / %d"), mem.len, mem.tot_len);
 
     /*
      * Clear all timers
      */
-    struct timerqueue_t *node = NULL;
-    while((node = timerqueue_pop()) != NULL) {
-      FREE(node);
-    }
+    timerqueue_clear();
 
     struct varstack_t *table = (struct varstack_t *)&global_varstack;
     if(table->array != NULL) {
@@ -1033,6 +1398,9 @@ int rules_parse(char *file) {
       return -1;
     }
 
+    rulesImageSave(&mem, hash);
+    rulesDispatchBuild();
+
     parsing = 0;
     return 0;
   } else {
@@ -1041,52 +1409,13 @@ int rules_parse(char *file) {
 }
 
 void rules_event_cb(const char *prefix, const char *name) {
-  uint8_t len = strlen(name), len1 = strlen(prefix), tlen = 0;
   char buf[100] = { '\0' };
   snprintf_P((char *)&buf, sizeof(buf), PSTR("%s%s"), prefix, name);
-  int8_t nr = rule_by_name(rules, nrrules, (char *)buf);
-  if(nr > -1) {
-    logprintf_P(F("%s %s %s"), F("===="), name, F("===="));
-
-    timestamp.first = micros();
-
-    int ret = rule_run(rules[nr], 0);
-
-    timestamp.second = micros();
-
-    if(ret == 0) {
-      logprintf_P(F("%s%d %s %d %s"), F("rule #"), rules[nr]->nr, F("was executed in"), timestamp.second - timestamp.first, F("microseconds"));
-
-      rules_print_local_stacks();
-      logprintf_P(F("\n>>> global variables\n"));
-      rules_print_stack(&global_varstack);
-      rules_free_stack();
-    }
-
-    return;
-  }
+  rulesRun(rule_by_name(rules, nrrules, (char *)buf));
 }
 
 void rules_boot(void) {
-  int8_t nr = rule_by_name(rules, nrrules, (char *)"System#Boot");
-  if(nr > -1) {
-    logprintf_P(F("%s %s %s"), F("===="), F("System#Boot"), F("===="));
-
-    timestamp.first = micros();
-
-    int ret = rule_run(rules[nr], 0);
-
-    timestamp.second = micros();
-
-    if(ret == 0) {
-      logprintf_P(F("%s%d %s %d %s"), F("rule #"), rules[nr]->nr, F("was executed in"), timestamp.second - timestamp.first, F("microseconds"));
-
-      rules_print_local_stacks();
-      logprintf_P(F("\n>>> global variables\n"));
-      rules_print_stack(&global_varstack);
-      rules_free_stack();
-    }
-  }
+  rulesRun(rule_by_name(rules, nrrules, (char *)"System#Boot"));
 }
 
 void rules_deinitialize() {
@@ -1104,6 +1433,7 @@ void rules_deinitialize() {
       rules_gc(&rules, &nrrules);
 	  rules_free_stack();
     }
+    rulesDispatchClear();
 
 
     // set this to NULL so a new initialize can start if necessary. 
@@ -17,6 +17,9 @@
 
 #include "src/common/mem.h"
 
+// the compiled rules, written when the rules are parsed
+#define RULES_IMAGE_FILE "/rules.bc"
+
 extern uint8_t nrrules;
 
 void rules_boot(void);
@@ -25,6 +28,50 @@ int rules_parse(char *file);
 void rules_setup(void);
 void rules_timer_cb(int nr);
 void rules_event_cb(const char *prefix, const char *name);
+
+// the topic tables of rules_topic_cb
+#define RULES_TOPIC    0
+#define RULES_XTOPIC   1
+#define RULES_OPTTOPIC 2
+
+/*
+ * The events of a changed topic, a 1wire sensor by its index in
+ * actDallasData and the three values of an s0 port, looked up by
+ * number instead of by name.
+ */
+void rules_topic_cb(uint8_t table, uint16_t nr);
+void rules_dallas_cb(int nr);
+void rules_s0_cb(int port);
+
+/*
+ * Between these the rules triggered by the topics of a datagram
+ * are collected, and run once each, in the order of the rules
+ * file, when the datagram is done.
+ */
+void rules_batch_begin(void);
+void rules_batch_end(void);
+
+// a rule in the stats, its name cut at 48 characters
+#define RULES_STATS_JSON_SIZE 256
+
+/*
+ * Writes the runs, times, bytecode steps, stack use and commands
+ * of every rule as JSON in parts: part 0 opens the list, the next
+ * ones hold a rule each and the last closes it. Returns 0 past
+ * the last part.
+ */
+size_t rules_stats_json(uint16_t part, char *out, size_t len);
 void rules_execute(void);
 
+// the rules taking the most time in the summary
+#define RULES_STATS_BUSIEST 3
+#define RULES_STATS_SUMMARY_SIZE 512
+
+/*
+ * Writes the runs and time of all rules together, and of the
+ * few that took the most time, small enough for a single
+ * websocket frame. /rules/stats has every rule.
+ */
+size_t rules_stats_summary_json(char *out, size_t len);
+
 #endif
@@ -184,13 +184,7 @@ void s0Loop(PubSubClient &mqtt_client, void (*log_message)(char*), char* mqtt_to
       sprintf_P(log_msg, PSTR("{\"data\": {\"s0values\": {\"s0port\": %d, \"Watt\": %u, \"Watthour\": %.2f, \"WatthourTotal\": %.2f}}}"), i+1, actS0Data[i].watt,Watthour,WatthourTotal);
       websocket_write_all(log_msg, strlen(log_msg));         
       //send rules events
-      char s0_event[32];
-      snprintf_P(s0_event, sizeof(s0_event), PSTR("s0#watt_%d"), i + 1);
-      rules_event_cb("", s0_event);
-      snprintf_P(s0_event, sizeof(s0_event), PSTR("s0#watthour_%d"), i + 1);
-      rules_event_cb("", s0_event);
-      snprintf_P(s0_event, sizeof(s0_event), PSTR("s0#watthourtotal_%d"), i + 1);
-      rules_event_cb("", s0_event);
+      rules_s0_cb(i);
     }
   }
 }
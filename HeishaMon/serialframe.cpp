@@ -0,0 +1,122 @@
+#include "serialframe.h"
+
+static_assert((SERIALFRAME_SIZE & (SERIALFRAME_SIZE - 1)) == 0, "serial frame ring size must be a power of 2");
+static_assert(SERIALFRAME_SIZE >= SERIALFRAME_MAX_LEN, "serial frame ring too small");
+
+#define SERIALFRAME_MASK (SERIALFRAME_SIZE - 1)
+
+void serialFrameReset(serialFrame_t *p) {
+  memset(p, 0, sizeof(serialFrame_t));
+}
+
+uint16_t serialFrameRoom(serialFrame_t *p) {
+  return SERIALFRAME_SIZE - (p->head - p->tail);
+}
+
+void serialFramePut(serialFrame_t *p, uint8_t b) {
+  uint32_t at = p->head & SERIALFRAME_MASK;
+  p->ring[at] = b;
+  p->ring[at + SERIALFRAME_SIZE] = b;
+  p->head++;
+}
+
+static uint8_t found(serialFrame_t *p, uint8_t result) {
+  p->frame = &p->ring[p->start & SERIALFRAME_MASK];
+  p->len = p->pos - p->start;
+  return result;
+}
+
+/*
+ * The candidate at start is no frame, look for
+ * the next header from the byte after it.
+ */
+static uint8_t resync(serialFrame_t *p, uint8_t result) {
+  found(p, result);
+  p->start++;
+  p->pos = p->start;
+  if(p->skipping) {
+    return SERIALFRAME_NONE;
+  }
+  p->skipping = true;
+  return result;
+}
+
+uint8_t serialFrameParse(serialFrame_t *p) {
+  p->tail = p->start;
+  for(;;) {
+    uint32_t n = p->pos - p->start;
+    if(n > 2) {
+      /*
+       * The header is fine, sum what arrived of the rest in one
+       * go, the mirror keeps it contiguous.
+       */
+      uint32_t end = p->start + (uint8_t)p->ring[(p->start + 1) & SERIALFRAME_MASK] + 3;
+      uint32_t stop = (p->head - p->pos < end - p->pos) ? p->head : end;
+      const uint8_t *data = (const uint8_t *)&p->ring[p->pos & SERIALFRAME_MASK];
+      uint8_t sum = p->sum;
+      for(uint32_t i = 0; i < stop - p->pos; i++) {
+        sum += data[i];
+      }
+      p->sum = sum;
+      p->pos = stop;
+      if(p->pos != end) {
+        break;
+      }
+      if(p->sum != 0) {
+        // a payload byte may look like a header, so keep quiet until the next frame
+        p->skipping = false;
+        return resync(p, SERIALFRAME_BADCRC);
+      }
+      found(p, SERIALFRAME_OK);
+      p->start = p->pos;
+      return SERIALFRAME_OK;
+    }
+
+    if(p->pos == p->head) {
+      break;
+    }
+    uint8_t b = p->ring[p->pos & SERIALFRAME_MASK];
+    p->pos++;
+
+    if(n == 0) {
+      if(b != 0x71 && b != 0x31) {
+        if(resync(p, SERIALFRAME_BADHEADER) != SERIALFRAME_NONE) {
+          return SERIALFRAME_BADHEADER;
+        }
+        continue;
+      }
+      p->sum = 0;
+    } else if(n == 1) {
+      if(b + 3 > SERIALFRAME_MAX_LEN) {
+        if(resync(p, SERIALFRAME_TOOLONG) != SERIALFRAME_NONE) {
+          return SERIALFRAME_TOOLONG;
+        }
+        continue;
+      }
+    } else if(n == 2) {
+      if(b != 0x01) {
+        if(resync(p, SERIALFRAME_BADHEADER) != SERIALFRAME_NONE) {
+          return SERIALFRAME_BADHEADER;
+        }
+        continue;
+      }
+      p->skipping = false;
+    }
+    p->sum += b;
+  }
+  return SERIALFRAME_NONE;
+}
+
+uint16_t serialFramePending(serialFrame_t *p) {
+  return p->head - p->start;
+}
+
+char *serialFramePendingData(serialFrame_t *p) {
+  return &p->ring[p->start & SERIALFRAME_MASK];
+}
+
+void serialFrameDrop(serialFrame_t *p) {
+  p->tail = p->start = p->pos = p->head;
+  p->sum = 0;
+  p->skipping = false;
+}
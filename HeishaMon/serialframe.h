@@ -0,0 +1,69 @@
+#ifndef _SERIALFRAME_H_
+#define _SERIALFRAME_H_
+
+#include <Arduino.h>
+
+/*
+ * Bytes kept of the serial stream, must be a power of 2 and
+ * hold the longest frame. Every byte is stored twice, at its
+ * position and SERIALFRAME_SIZE further, so any frame starting
+ * in the ring can be read as one contiguous array.
+ */
+#define SERIALFRAME_SIZE 256
+#define SERIALFRAME_MAX_LEN 255
+
+// results of serialFrameParse
+#define SERIALFRAME_NONE 0
+#define SERIALFRAME_OK 1
+#define SERIALFRAME_BADHEADER 2
+#define SERIALFRAME_TOOLONG 3
+#define SERIALFRAME_BADCRC 4
+
+typedef struct serialFrame_t {
+  char ring[SERIALFRAME_SIZE * 2];
+  /*
+   * The offsets only grow, their lower bits are the position
+   * in the ring. tail is the oldest byte still in use, start
+   * the header of the frame being received, pos the next byte
+   * to check and head the next byte to store.
+   */
+  uint32_t tail;
+  uint32_t start;
+  uint32_t pos;
+  uint32_t head;
+  uint8_t sum;    // running checksum of start up to pos
+  bool skipping;  // inside a run of bytes that are no frame
+  char *frame;
+  uint16_t len;
+} serialFrame_t;
+
+void serialFrameReset(serialFrame_t *p);
+
+// free bytes, serialFramePut may be called this often
+uint16_t serialFrameRoom(serialFrame_t *p);
+void serialFramePut(serialFrame_t *p, uint8_t b);
+
+/*
+ * Checks the bytes stored since the last call as they come in:
+ * the 0x71 or 0x31 header, the length byte, the 0x01 third byte
+ * and the checksum. On a bad header or checksum the parser
+ * resyncs on the next header within the bytes already received,
+ * so a frame following noise is not lost.
+ *
+ * Returns SERIALFRAME_OK with frame and len pointing at a
+ * complete frame inside the ring, or an error with frame and
+ * len pointing at the bytes that were skipped. Errors are only
+ * reported once for a run of bytes that are no frame. Call
+ * again until it returns SERIALFRAME_NONE, the frame stays
+ * valid until then.
+ */
+uint8_t serialFrameParse(serialFrame_t *p);
+
+// bytes received of a frame that is not complete yet
+uint16_t serialFramePending(serialFrame_t *p);
+char *serialFramePendingData(serialFrame_t *p);
+
+// drops everything received, e.g. after a timeout
+void serialFrameDrop(serialFrame_t *p);
+
+#endif
@@ -0,0 +1,109 @@
+#include "serialstats.h"
+
+// upper bound in ms of each bucket, the last one takes the rest
+static const uint16_t bounds[SERIALSTATS_BUCKETS - 1] PROGMEM = { 5, 10, 20, 50, 100, 200, 500, 1000, 2000 };
+
+static const char names[SERIALSTATS_NR][9] PROGMEM = { "response", "frame", "command", "backlog" };
+
+static histogram_t histograms[SERIALSTATS_NR];
+
+static unsigned long sentAt = 0;
+static unsigned long firstAt = 0;
+static unsigned long response = 0;
+static uint32_t stalled = 0;
+static uint16_t reads = 0;
+static bool waiting = false;
+static bool command = false;
+static bool receiving = false;
+
+void serialStatsAdd(uint8_t type, uint32_t ms) {
+  histogram_t *h = &histograms[type];
+  uint8_t i = 0;
+  while(i < SERIALSTATS_BUCKETS - 1 && ms > pgm_read_word(&bounds[i])) {
+    i++;
+  }
+  h->buckets[i]++;
+  h->count++;
+  h->sum += ms;
+  if(ms > h->max) {
+    h->max = ms;
+  }
+}
+
+void serialStatsSent(bool isCommand, unsigned long now) {
+  sentAt = now;
+  waiting = true;
+  command = isCommand;
+  receiving = false;
+}
+
+void serialStatsRead(uint16_t bytes, unsigned long now) {
+  if(receiving) {
+    reads++;
+    return;
+  }
+  unsigned long backlog = (unsigned long)bytes * SERIALSTATS_BYTE_US / 1000;
+  unsigned long arrived = now - backlog;
+  serialStatsAdd(SERIALSTATS_BACKLOG, backlog);
+  // the estimate can not be before the request
+  response = ((long)(arrived - sentAt) > 0) ? arrived - sentAt : 0;
+  firstAt = arrived;
+  reads = 1;
+  receiving = true;
+}
+
+void serialStatsFrame(unsigned long now) {
+  if(receiving) {
+    serialStatsAdd(SERIALSTATS_FRAME, now - firstAt);
+    if(waiting && reads > 1) {
+      serialStatsAdd(SERIALSTATS_RESPONSE, response);
+    } else if(waiting) {
+      stalled++;
+    }
+  }
+  if(waiting && command) {
+    serialStatsAdd(SERIALSTATS_COMMAND, now - sentAt);
+  }
+  waiting = false;
+  receiving = false;
+}
+
+void serialStatsTimeout(void) {
+  waiting = false;
+  receiving = false;
+}
+
+uint32_t serialStatsStalled(void) {
+  return stalled;
+}
+
+const histogram_t *serialStatsGet(uint8_t type) {
+  return &histograms[type];
+}
+
+size_t serialStatsJson(char *out, size_t len) {
+  size_t n = snprintf_P(out, len, PSTR("{\"bounds\":["));
+  for(uint8_t i = 0; i < SERIALSTATS_BUCKETS - 1 && n < len; i++) {
+    n += snprintf_P(&out[n], len - n, PSTR("%s%u"), (i > 0) ? "," : "", pgm_read_word(&bounds[i]));
+  }
+  if(n < len) {
+    n += snprintf_P(&out[n], len - n, PSTR("]"));
+  }
+  for(uint8_t t = 0; t < SERIALSTATS_NR && n < len; t++) {
+    histogram_t *h = &histograms[t];
+    char name[sizeof(names[0])];
+    strcpy_P(name, names[t]);
+    n += snprintf_P(&out[n], len - n, PSTR(",\"%s\":{\"n\":%lu,\"avg\":%lu,\"max\":%lu,\"buckets\":["), name,
+      (unsigned long)h->count, (unsigned long)(h->count ? h->sum / h->count : 0), (unsigned long)h->max);
+    for(uint8_t i = 0; i < SERIALSTATS_BUCKETS && n < len; i++) {
+      n += snprintf_P(&out[n], len - n, PSTR("%s%lu"), (i > 0) ? "," : "", (unsigned long)h->buckets[i]);
+    }
+    if(n < len) {
+      n += snprintf_P(&out[n], len - n, PSTR("]}"));
+    }
+  }
+  if(n < len) {
+    n += snprintf_P(&out[n], len - n, PSTR(",\"stalled\":%lu}"), (unsigned long)stalled);
+  }
+  return (n < len) ? n : len - 1;
+}
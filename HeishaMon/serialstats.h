@@ -0,0 +1,60 @@
+#ifndef _SERIALSTATS_H_
+#define _SERIALSTATS_H_
+
+#include <Arduino.h>
+
+#define SERIALSTATS_RESPONSE 0  // request sent to the first byte of the answer
+#define SERIALSTATS_FRAME 1     // first byte to the complete frame
+#define SERIALSTATS_COMMAND 2   // set command sent to its answer
+#define SERIALSTATS_BACKLOG 3   // time bytes waited in the UART buffer before the loop read them
+#define SERIALSTATS_NR 4
+
+#define SERIALSTATS_BUCKETS 10
+
+// 9600 baud, 8 data bits, even parity and a stop bit
+#define SERIALSTATS_BYTE_US 1146
+
+#define SERIALSTATS_JSON_SIZE 896
+
+typedef struct histogram_t {
+  uint32_t buckets[SERIALSTATS_BUCKETS];
+  uint32_t count;
+  uint32_t sum;  // ms
+  uint32_t max;  // ms
+} histogram_t;
+
+void serialStatsAdd(uint8_t type, uint32_t ms);
+
+/*
+ * A request went out on the bus, command tells whether it
+ * is a set command.
+ */
+void serialStatsSent(bool command, unsigned long now);
+
+/*
+ * Bytes were read from the UART in one go. The time the first
+ * bytes of an answer arrived is estimated from how many there
+ * were, which tells the heat pump response apart from the time
+ * the loop took to get to them.
+ */
+void serialStatsRead(uint16_t bytes, unsigned long now);
+
+/*
+ * A frame is complete. When it was read in one go the loop was
+ * too late to tell when the answer started, that counts as a
+ * stall instead of a response time.
+ */
+void serialStatsFrame(unsigned long now);
+void serialStatsTimeout(void);
+
+uint32_t serialStatsStalled(void);
+
+const histogram_t *serialStatsGet(uint8_t type);
+
+/*
+ * Writes the histograms as a JSON object, with the upper bound
+ * of each bucket in ms, and returns the length.
+ */
+size_t serialStatsJson(char *out, size_t len);
+
+#endif
@@ -9,3 +9,295 @@
 unsigned int alignedbuffer(int v) {
   return (v + 3) & ~0x3;
 }
+
+#ifdef MEM_TRACK
+
+#include <Arduino.h>
+
+#include "mem.h"
+
+struct mem_track_live_t {
+  void *ptr;
+  uint32_t at;
+  uint16_t size;
+  uint8_t site;
+};
+
+static const uint16_t sizes[MEM_TRACK_SIZES - 1] PROGMEM = { 16, 32, 64, 128, 256, 512, 1024 };
+static const uint16_t lifetimes[MEM_TRACK_LIFETIMES - 1] PROGMEM = { 1, 10, 100, 1000, 10000 };
+
+static struct mem_track_site_t sites[MEM_TRACK_SITES];
+static struct mem_track_live_t live[MEM_TRACK_LIVE];
+static uint8_t nrsites = 0;
+static uint8_t reported = 0;
+static uint16_t nrlive = 0;
+static uint32_t untracked = 0;  // allocations that did not fit the live table
+static uint32_t unknown = 0;    // frees of pointers not in the live table
+
+#ifdef ESP32
+/*
+ * The webserver runs its callbacks in the lwip task, the lock
+ * only guards the tables, never the allocation itself.
+ */
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+  #define MEM_TRACK_LOCK() portENTER_CRITICAL(&lock)
+  #define MEM_TRACK_UNLOCK() portEXIT_CRITICAL(&lock)
+#else
+  #define MEM_TRACK_LOCK()
+  #define MEM_TRACK_UNLOCK()
+#endif
+
+static_assert((MEM_TRACK_LIVE & (MEM_TRACK_LIVE - 1)) == 0, "MEM_TRACK_LIVE has to be a power of 2");
+static_assert(MEM_TRACK_SITES <= 255, "too many sites for the live table");
+
+static uint8_t bucket(const uint16_t *bounds, uint8_t nr, uint32_t v) {
+  uint8_t i = 0;
+  while(i < nr - 1 && v > pgm_read_word(&bounds[i])) {
+    i++;
+  }
+  return i;
+}
+
+static uint16_t slot(uintptr_t addr) {
+  return (uint16_t)(((addr >> 3) * 2654435761UL) & (MEM_TRACK_LIVE - 1));
+}
+
+static uint8_t site(const char *file, int line) {
+  uint8_t i = 0;
+  for(i=0;i<nrsites;i++) {
+    if(sites[i].line == line && sites[i].file == file) {
+      return i;
+    }
+  }
+  if(nrsites < MEM_TRACK_SITES - 1) {
+    sites[nrsites].file = file;
+    sites[nrsites].line = line;
+    return nrsites++;
+  }
+  // the last one takes the sites that did not fit
+  nrsites = MEM_TRACK_SITES;
+  return MEM_TRACK_SITES - 1;
+}
+
+static void release(struct mem_track_live_t *node, bool freed) {
+  struct mem_track_site_t *s = &sites[node->site];
+  s->live--;
+  s->live_bytes -= node->size;
+  if(freed) {
+    s->frees++;
+    s->lifetimes[bucket(lifetimes, MEM_TRACK_LIFETIMES, millis() - node->at)]++;
+  }
+}
+
+/*
+ * Linear probing, a removed entry is filled by moving the entries
+ * after it that probed past it, so no tombstones are needed.
+ */
+static void drop(uint16_t i) {
+  uint16_t j = i;
+  live[i].ptr = NULL;
+  while(1) {
+    j = (j + 1) & (MEM_TRACK_LIVE - 1);
+    if(live[j].ptr == NULL) {
+      break;
+    }
+    uint16_t k = slot((uintptr_t)live[j].ptr);
+    if((j > i && (k <= i || k > j)) || (j < i && (k <= i && k > j))) {
+      live[i] = live[j];
+      live[j].ptr = NULL;
+      i = j;
+    }
+  }
+  nrlive--;
+}
+
+static int find(uintptr_t addr) {
+  uint16_t i = slot(addr);
+  while(live[i].ptr != NULL) {
+    if((uintptr_t)live[i].ptr == addr) {
+      return i;
+    }
+    i = (i + 1) & (MEM_TRACK_LIVE - 1);
+  }
+  return -1;
+}
+
+static void add(void *ptr, size_t size, const char *file, int line) {
+  MEM_TRACK_LOCK();
+  uint8_t s = site(file, line);
+  struct mem_track_site_t *p = &sites[s];
+  p->allocs++;
+  p->bytes += size;
+  p->sizes[bucket(sizes, MEM_TRACK_SIZES, size)]++;
+
+  int i = find((uintptr_t)ptr);
+  if(i >= 0) {
+    // it was given back with a plain free, the address is reused
+    release(&live[i], false);
+    drop(i);
+  }
+  if(nrlive < MEM_TRACK_LIVE - 1) {
+    i = slot((uintptr_t)ptr);
+    while(live[i].ptr != NULL) {
+      i = (i + 1) & (MEM_TRACK_LIVE - 1);
+    }
+    live[i].ptr = ptr;
+    live[i].at = millis();
+    live[i].size = (size < UINT16_MAX) ? size : UINT16_MAX;
+    live[i].site = s;
+    nrlive++;
+    p->live++;
+    p->live_bytes += live[i].size;
+    if(p->live_bytes > p->peak_bytes) {
+      p->peak_bytes = p->live_bytes;
+    }
+  } else {
+    untracked++;
+  }
+  MEM_TRACK_UNLOCK();
+}
+
+static void forget(uintptr_t addr) {
+  MEM_TRACK_LOCK();
+  int i = find(addr);
+  if(i >= 0) {
+    release(&live[i], true);
+    drop(i);
+  } else {
+    unknown++;
+  }
+  MEM_TRACK_UNLOCK();
+}
+
+void *mem_track_malloc(size_t size, const char *file, int line) {
+  void *ptr = malloc(size);
+  if(ptr != NULL) {
+    add(ptr, size, file, line);
+  }
+  return ptr;
+}
+
+void *mem_track_calloc(size_t nr, size_t size, const char *file, int line) {
+  void *ptr = calloc(nr, size);
+  if(ptr != NULL) {
+    add(ptr, nr * size, file, line);
+  }
+  return ptr;
+}
+
+/*
+ * A block that moves or grows is a new block for the heap, so
+ * the old one counts as freed and the new one is booked on the
+ * site of the realloc.
+ */
+void *mem_track_realloc(void *ptr, size_t size, const char *file, int line) {
+  void *tmp = NULL;
+  /*
+   * Forgotten before, the block can not be looked up once it is
+   * given back. A failed realloc leaves the old block untracked,
+   * which ends up as an unknown free.
+   */
+  if(ptr != NULL) {
+    forget((uintptr_t)ptr);
+  }
+  if((tmp = realloc(ptr, size)) != NULL) {
+    add(tmp, size, file, line);
+  }
+  return tmp;
+}
+
+char *mem_track_strdup(const char *str, const char *file, int line) {
+  char *ptr = strdup(str);
+  if(ptr != NULL) {
+    add(ptr, strlen(ptr) + 1, file, line);
+  }
+  return ptr;
+}
+
+void mem_track_free(void *ptr) {
+  if(ptr != NULL) {
+    forget((uintptr_t)ptr);
+  }
+  free(ptr);
+}
+
+uint8_t mem_track_nrsites(void) {
+  return nrsites;
+}
+
+const struct mem_track_site_t *mem_track_site(uint8_t i) {
+  return &sites[i];
+}
+
+/*
+ * The file is reported with its directory, the sketch and the
+ * rules library both have a rules.cpp.
+ */
+static const char *shorten(const char *file) {
+  const char *a = strrchr(file, '/');
+  if(a == NULL) {
+    return file;
+  }
+  while(a > file && *(a - 1) != '/') {
+    a--;
+  }
+  return a;
+}
+
+static size_t array(char *out, size_t len, const uint32_t *values, uint8_t nr) {
+  size_t n = 0;
+  uint8_t i = 0;
+  for(i=0;i<nr && n < len;i++) {
+    n += snprintf_P(&out[n], len - n, PSTR("%s%lu"), (i > 0) ? "," : "", (unsigned long)values[i]);
+  }
+  return n;
+}
+
+size_t mem_track_json(uint8_t part, char *out, size_t len) {
+  size_t n = 0;
+  uint8_t i = 0;
+
+  if(part == 0) {
+    // the parts that follow stick to the sites there are now
+    reported = nrsites;
+    n = snprintf_P(out, len, PSTR("{\"live\":%u,\"untracked\":%lu,\"unknown frees\":%lu,\"sizes\":["),
+      nrlive, (unsigned long)untracked, (unsigned long)unknown);
+    for(i=0;i<MEM_TRACK_SIZES-1 && n < len;i++) {
+      n += snprintf_P(&out[n], len - n, PSTR("%s%u"), (i > 0) ? "," : "", pgm_read_word(&sizes[i]));
+    }
+    if(n < len) {
+      n += snprintf_P(&out[n], len - n, PSTR("],\"lifetimes\":["));
+    }
+    for(i=0;i<MEM_TRACK_LIFETIMES-1 && n < len;i++) {
+      n += snprintf_P(&out[n], len - n, PSTR("%s%u"), (i > 0) ? "," : "", pgm_read_word(&lifetimes[i]));
+    }
+    if(n < len) {
+      n += snprintf_P(&out[n], len - n, PSTR("],\"sites\":["));
+    }
+  } else if(part <= reported) {
+    struct mem_track_site_t *s = &sites[part - 1];
+    n = snprintf_P(out, len, PSTR("%s{\"site\":\"%s:%u\",\"allocs\":%lu,\"frees\":%lu,\"bytes\":%lu,\"live\":%u,\"live bytes\":%lu,\"peak bytes\":%lu,\"sizes\":["),
+      (part > 1) ? "," : "", (s->file != NULL) ? shorten(s->file) : "other", (s->file != NULL) ? s->line : 0,
+      (unsigned long)s->allocs, (unsigned long)s->frees, (unsigned long)s->bytes, s->live,
+      (unsigned long)s->live_bytes, (unsigned long)s->peak_bytes);
+    if(n < len) {
+      n += array(&out[n], len - n, s->sizes, MEM_TRACK_SIZES);
+    }
+    if(n < len) {
+      n += snprintf_P(&out[n], len - n, PSTR("],\"lifetimes\":["));
+    }
+    if(n < len) {
+      n += array(&out[n], len - n, s->lifetimes, MEM_TRACK_LIFETIMES);
+    }
+    if(n < len) {
+      n += snprintf_P(&out[n], len - n, PSTR("]}"));
+    }
+  } else if(part == reported + 1) {
+    n = snprintf_P(out, len, PSTR("]}"));
+  } else {
+    return 0;
+  }
+  return (n < len) ? n : len - 1;
+}
+
+#endif
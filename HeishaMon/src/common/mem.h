@@ -14,6 +14,70 @@ unsigned int alignedbuffer(int v);
 
 #define OUT_OF_MEMORY while(0) { }
 
+#ifdef MEM_TRACK
+
+/*
+ * Opt-in allocation tracking, build with -DMEM_TRACK. Every
+ * allocation made through these macros is counted by the call
+ * site it came from, by size class and, once freed, by how long
+ * it lived. Freeing a pointer that was not allocated through
+ * them is allowed, it is only passed on.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef MEM_TRACK_SITES
+  #define MEM_TRACK_SITES 40
+#endif
+
+// allocations alive at the same time whose lifetime can be followed
+#ifndef MEM_TRACK_LIVE
+  #define MEM_TRACK_LIVE 256
+#endif
+
+#define MEM_TRACK_SIZES 8      // up to 16, 32, 64, 128, 256, 512, 1024 bytes and larger
+#define MEM_TRACK_LIFETIMES 6  // up to 1, 10, 100, 1000, 10000 ms and longer
+
+#define MEM_TRACK_JSON_SIZE 384
+
+struct mem_track_site_t {
+  const char *file;  // NULL for the allocations of sites that did not fit
+  uint16_t line;
+  uint16_t live;
+  uint32_t allocs;
+  uint32_t frees;
+  uint32_t bytes;
+  uint32_t live_bytes;
+  uint32_t peak_bytes;
+  uint32_t sizes[MEM_TRACK_SIZES];
+  uint32_t lifetimes[MEM_TRACK_LIFETIMES];
+};
+
+void *mem_track_malloc(size_t size, const char *file, int line);
+void *mem_track_calloc(size_t nr, size_t size, const char *file, int line);
+void *mem_track_realloc(void *ptr, size_t size, const char *file, int line);
+char *mem_track_strdup(const char *str, const char *file, int line);
+void mem_track_free(void *ptr);
+
+uint8_t mem_track_nrsites(void);
+const struct mem_track_site_t *mem_track_site(uint8_t i);
+
+/*
+ * Writes the report as JSON in parts small enough to send one
+ * at a time: part 0 opens it, the next ones hold a call site
+ * each and the last closes it. Returns 0 past the last part.
+ */
+size_t mem_track_json(uint8_t part, char *out, size_t len);
+
+#define STRDUP(a) mem_track_strdup((a), __FILE__, __LINE__)
+#define REALLOC(a, b) mem_track_realloc((a), (b), __FILE__, __LINE__)
+#define CALLOC(a, b) mem_track_calloc((a), (b), __FILE__, __LINE__)
+#define MALLOC(a) mem_track_malloc((a), __FILE__, __LINE__)
+#define FREE(a) do { mem_track_free(a); (a) = NULL; } while(0)
+
+#else
+
 #define STRDUP strdup
 #define REALLOC realloc
 #define CALLOC calloc
@@ -21,3 +85,5 @@ unsigned int alignedbuffer(int v);
 #define FREE(a) do { free(a); (a) = NULL; } while(0)
 
 #endif
+
+#endif
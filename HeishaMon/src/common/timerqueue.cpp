@@ -17,217 +17,186 @@
 #include <unistd.h>
 #include <sys/time.h>
 
-#include "mem.h"
 #include "timerqueue.h"
 
-static unsigned int lasttime = 0;
-static unsigned int *calls = NULL;
-static unsigned int nrcalls = 0;
+/*
+ * Binary min-heap on the absolute deadline,
+ * the first timer to expire is always at 0.
+ */
+static struct timerqueue_t heap[TIMERQUEUE_SIZE];
+static uint8_t nrnodes = 0;
+
+/*
+ * Timers that expired in the current update
+ * and still have to be called.
+ */
+static int calls[TIMERQUEUE_SIZE];
+static uint8_t nrcalls = 0;
+static uint8_t callpos = 0;
+
+static unsigned long lasttime = 0;
+static uint64_t elapsed = 0;
 
 #if !defined(ESP8266) && !defined(ESP32)
-static unsigned int micros() {
+unsigned long __attribute__((weak)) micros(void) {
   struct timeval tv;
   gettimeofday(&tv,NULL);
 
-  return 1000000 * tv.tv_sec + tv.tv_usec;;
+  return 1000000 * tv.tv_sec + tv.tv_usec;
 }
 #endif
 
-static void timerqueue_sort() {
-  int matched = 1;
-  while(matched) {
-    int a = 0;
-    matched = 0;
-    for(a=0;a<timerqueue_size-1;a++) {
-      if(timerqueue[a]->remove < timerqueue[a+1]->remove ||
-         (timerqueue[a]->remove == timerqueue[a+1]->remove && timerqueue[a]->sec > timerqueue[a+1]->sec) ||
-         (timerqueue[a]->remove == timerqueue[a+1]->remove && timerqueue[a]->sec == timerqueue[a+1]->sec && timerqueue[a]->usec > timerqueue[a+1]->usec)) {
-        struct timerqueue_t *node = timerqueue[a+1];
-        timerqueue[a+1] = timerqueue[a];
-        timerqueue[a] = node;
-        matched = 1;
-        break;
-      }
+/*
+ * micros() wraps every 71 minutes, so keep
+ * our own 64 bit clock from its increments.
+ */
+static uint64_t timerqueue_now(void) {
+  unsigned long curtime = micros();
+  elapsed += (uint32_t)(curtime - lasttime);
+  lasttime = curtime;
+  return elapsed;
+}
+
+static void timerqueue_swap(uint8_t a, uint8_t b) {
+  struct timerqueue_t node = heap[a];
+  heap[a] = heap[b];
+  heap[b] = node;
+}
+
+static void timerqueue_sift_up(uint8_t i) {
+  while(i > 0) {
+    uint8_t parent = (i - 1) / 2;
+    if(heap[parent].deadline <= heap[i].deadline) {
+      break;
     }
+    timerqueue_swap(i, parent);
+    i = parent;
   }
 }
 
-struct timerqueue_t *timerqueue_pop() {
-  if(timerqueue_size == 0) {
-    return NULL;
-  }
-  struct timerqueue_t *x = timerqueue[0];
-  timerqueue[0] = timerqueue[timerqueue_size-1];
-
-  timerqueue_size--;
-
-  if(timerqueue_size == 0) {
-    free(timerqueue);
-    timerqueue = NULL;
-  } else {
-    if((timerqueue = (struct timerqueue_t **)realloc(timerqueue, sizeof(struct timerqueue_t *)*timerqueue_size)) == NULL) {
-  #if defined(ESP8266) || defined(ESP32)
-      //loggingSerial.printf("Out of memory %s:#%d\n", __FUNCTION__, __LINE__);
-      ESP.restart();
-      exit(-1);
-  #else
-      fprintf(stderr, "Out of memory %s:#%d\n", __FUNCTION__, __LINE__);
-      exit(-1);
-  #endif
+static void timerqueue_sift_down(uint8_t i) {
+  while(1) {
+    uint8_t left = 2 * i + 1, right = left + 1, min = i;
+    if(left < nrnodes && heap[left].deadline < heap[min].deadline) {
+      min = left;
     }
+    if(right < nrnodes && heap[right].deadline < heap[min].deadline) {
+      min = right;
+    }
+    if(min == i) {
+      break;
+    }
+    timerqueue_swap(i, min);
+    i = min;
+  }
+}
+
+static void timerqueue_remove(uint8_t i) {
+  nrnodes--;
+  if(i < nrnodes) {
+    heap[i] = heap[nrnodes];
+    timerqueue_sift_down(i);
+    timerqueue_sift_up(i);
   }
+}
 
-  int a = 0;
-  for(a=0;a<timerqueue_size;a++) {
-    timerqueue[a]->sec -= x->sec;
-    timerqueue[a]->usec -= x->usec;
-    if(timerqueue[a]->usec < 0) {
-      timerqueue[a]->sec -= 1;
-      timerqueue[a]->usec += 1000000;
+static int16_t timerqueue_find(int nr) {
+  uint8_t i = 0;
+  for(i=0;i<nrnodes;i++) {
+    if(heap[i].nr == nr) {
+      return i;
     }
   }
+  return -1;
+}
 
-  timerqueue_sort();
-
-  return x;
+int8_t timerqueue_pop(struct timerqueue_t *node) {
+  if(nrnodes == 0) {
+    return -1;
+  }
+  if(node != NULL) {
+    memcpy(node, &heap[0], sizeof(struct timerqueue_t));
+  }
+  timerqueue_remove(0);
+  return 0;
 }
 
-struct timerqueue_t *timerqueue_peek() {
-  if(timerqueue_size == 0) {
+struct timerqueue_t *timerqueue_peek(void) {
+  if(nrnodes == 0) {
     return NULL;
   }
-  return timerqueue[0];
+  return &heap[0];
 }
 
-void timerqueue_insert(int sec, int usec, int nr) {
-  struct timerqueue_t *node = NULL;
-  int a = 0, matched = 0, x = 0, y = 0;
-
-  for(a=0;a<timerqueue_size;a++) {
-    if(timerqueue[a]->nr == nr) {
-      timerqueue[a]->sec = sec;
-      timerqueue[a]->usec = usec;
-      if(sec <= 0 && usec <= 0) {
-        timerqueue[a]->remove = 1;
-        for(x=0;x<nrcalls;x++) {
-          if(calls[x] == timerqueue[a]->nr) {
-            if(nrcalls > 0) {
-              for(y=x;y<nrcalls-1;y++) {
-                calls[y] = calls[y+1];
-              }
-              nrcalls--;
-            }
-            break;
-          }
-        }
-      }
-      timerqueue_sort();
-      matched = 1;
-      break;
-    }
-  }
+uint8_t timerqueue_count(void) {
+  return nrnodes;
+}
+
+void timerqueue_clear(void) {
+  nrnodes = 0;
+}
+
+int8_t timerqueue_insert(int sec, int usec, int nr) {
+  int16_t i = timerqueue_find(nr);
 
-  if(matched == 1) {
-    while((node = timerqueue_peek()) != NULL) {
-      if(node->remove == 1) {
-        struct timerqueue_t *node = timerqueue_pop();
-        free(node);
-      } else {
+  if(sec <= 0 && usec <= 0) {
+    if(i > -1) {
+      timerqueue_remove(i);
+    }
+    /*
+     * Also cancel the timer when it expired
+     * but wasn't called yet.
+     */
+    uint8_t x = 0;
+    for(x=callpos;x<nrcalls;x++) {
+      if(calls[x] == nr) {
+        memmove(&calls[x], &calls[x+1], (nrcalls-x-1)*sizeof(calls[0]));
+        nrcalls--;
         break;
       }
     }
-
-    return;
-  } else if(sec == 0 && usec == 0) {
-    return;
+    return 0;
   }
 
-  if((timerqueue = (struct timerqueue_t **)realloc(timerqueue, sizeof(struct timerqueue_t *)*(timerqueue_size+1))) == NULL) {
-#if defined(ESP8266) || defined(ESP32)
-    //loggingSerial.printf("Out of memory %s:#%d\n", __FUNCTION__, __LINE__);
-    ESP.restart();
-    exit(-1);
-#else
-    fprintf(stderr, "Out of memory %s:#%d\n", __FUNCTION__, __LINE__);
-    exit(-1);
-#endif
+  uint64_t deadline = timerqueue_now() + (int64_t)sec * 1000000 + usec;
+
+  if(i > -1) {
+    heap[i].deadline = deadline;
+    timerqueue_sift_down(i);
+    timerqueue_sift_up(i);
+    return 0;
   }
 
-  node = (struct timerqueue_t *)malloc(sizeof(struct timerqueue_t));
-  if(node == NULL) {
-#if defined(ESP8266) || defined(ESP32)
-    //loggingSerial.printf("Out of memory %s:#%d\n", __FUNCTION__, __LINE__);
-    ESP.restart();
-    exit(-1);
-#else
-    fprintf(stderr, "Out of memory %s:#%d\n", __FUNCTION__, __LINE__);
-    exit(-1);
-#endif
+  if(nrnodes >= TIMERQUEUE_SIZE) {
+    return -1;
   }
-  memset(node, 0, sizeof(struct timerqueue_t));
-  node->sec = sec;
-  node->usec = usec;
-  node->nr = nr;
 
-  timerqueue[timerqueue_size++] = node;
-  timerqueue_sort();
+  heap[nrnodes].deadline = deadline;
+  heap[nrnodes].nr = nr;
+  timerqueue_sift_up(nrnodes++);
+
+  return 0;
 }
 
 void timerqueue_update(void) {
-  struct timeval tv;
-  unsigned int curtime = 0;
-
-  curtime = micros();
-
-  unsigned int diff = curtime - lasttime;
-  unsigned int sec = diff / 1000000;
-  unsigned int usec = diff - ((diff / 1000000) * 1000000);
-  int a = 0, x = 0;
+  uint64_t now = timerqueue_now();
 
-  lasttime = curtime;
-
-  for(a=0;a<timerqueue_size;a++) {
-    timerqueue[a]->sec -= sec;
-    timerqueue[a]->usec -= usec;
-    if(timerqueue[a]->usec < 0) {
-      timerqueue[a]->usec = 1000000 + timerqueue[a]->usec;
-      timerqueue[a]->sec -= 1;
-    }
+  nrcalls = 0;
+  callpos = 0;
 
-    if(timerqueue[a]->sec < 0 || (timerqueue[a]->sec == 0 && timerqueue[a]->usec <= 0)) {
-      int nr = timerqueue[a]->nr;
-      if((calls = (unsigned int *)realloc(calls, (nrcalls+1)*sizeof(unsigned int))) == NULL) {
-#if defined(ESP8266) || defined(ESP32)
-        ///loggingSerial.printf("Out of memory %s:#%d\n", __FUNCTION__, __LINE__);
-        ESP.restart();
-        exit(-1);
-#else
-        fprintf(stderr, "Out of memory %s:#%d\n", __FUNCTION__, __LINE__);
-        exit(-1);
-#endif
-      }
-      calls[nrcalls++] = nr;
-    }
+  while(nrnodes > 0 && heap[0].deadline <= now) {
+    calls[nrcalls++] = heap[0].nr;
+    timerqueue_remove(0);
   }
-  for(a=0;a<timerqueue_size;a++) {
-    if(timerqueue[a]->sec < 0 || (timerqueue[a]->sec == 0 && timerqueue[a]->usec == 0)) {
-      struct timerqueue_t *node = timerqueue_pop();
-      free(node);
-      a--;
-    }
-  }
-  while(nrcalls > 0) {
-    timer_cb(calls[0]);
-    if(nrcalls > 0) {
-      for(a=0;a<nrcalls-1;a++) {
-        calls[a] = calls[a+1];
-      }
-      nrcalls--;
-    }
-  }
-  if(calls != NULL) {
-    free(calls);
-    calls = NULL;
+
+  /*
+   * Timers can be restarted or cancelled
+   * from within the callbacks.
+   */
+  while(callpos < nrcalls) {
+    timer_cb(calls[callpos++]);
   }
+
   nrcalls = 0;
+  callpos = 0;
 }
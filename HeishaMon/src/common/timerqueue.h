@@ -11,21 +11,42 @@
 
 #include <stdint.h>
 
+/*
+ * Maximum number of timers running at the same time,
+ * rule timers and internal timers together.
+ */
+#define TIMERQUEUE_SIZE 32
+
 typedef struct timerqueue_t {
-	int sec;
-	int usec;
+  /*
+   * Absolute deadline in microseconds since the
+   * first call to the timerqueue.
+   */
+  uint64_t deadline;
   int nr;
-  int remove;
 } timerqueue_t;
 
-extern struct timerqueue_t **timerqueue;
-extern int timerqueue_size;
 extern void timer_cb(int nr);
 
-struct timerqueue_t *timerqueue_pop();
-struct timerqueue_t *timerqueue_peek();
-void timerqueue_update(void);
-void timerqueue_insert(int sec, int usec, int nr);
+/*
+ * (Re)starts timer nr to fire after sec seconds and usec
+ * microseconds. A running timer is cancelled when both are
+ * zero or negative. Returns -1 when the queue is full.
+ */
+int8_t timerqueue_insert(int sec, int usec, int nr);
 
+/*
+ * Removes the first timer to expire from the queue
+ * and copies it to node. Returns -1 when empty.
+ */
+int8_t timerqueue_pop(struct timerqueue_t *node);
+struct timerqueue_t *timerqueue_peek(void);
+uint8_t timerqueue_count(void);
+void timerqueue_clear(void);
+
+/*
+ * Calls timer_cb for all expired timers.
+ */
+void timerqueue_update(void);
 
-#endif
\ No newline at end of file
+#endif
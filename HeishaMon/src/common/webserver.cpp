@@ -23,12 +23,13 @@
   #include <sys/time.h>
   #include <time.h>
 
+  #include "unittest.h"
   #include "webserver.h"
   #include "strncasestr.h"
   #include "strnstr.h"
-  #include "unittest.h"
   #include "base64.h"
   #include "sha1.h"
+  #include "mem.h"
 #else
   #define LWIP_INTERNAL
 
@@ -53,6 +54,7 @@
   #include "webserver.h"
   #include "base64.h"
   #include "sha1.h"
+  #include "mem.h"
 
   #include <errno.h>
 #endif
@@ -112,21 +114,33 @@ static int16_t safe_write_P(struct webserver_t *client, PGM_P buf, uint16_t len)
   return client->client->write_P((char *)buf, len);
 }
 
-#if defined(ESP8266) || defined(ESP32)
+/*
+ * tcp_write copies what it is given, so flash data is passed
+ * through a small buffer on the stack a piece at a time.
+ */
+#define WEBSERVER_COPY_SIZE 64
+
 static uint16_t tcp_write_P(tcp_pcb *pcb, PGM_P buf, uint16_t len, uint8_t flags) {
-  char *str = (char *)malloc(len+1);
-  if(str == NULL) {
-    loggingSerial.printf("Out of memory %s:#%d\n", __FUNCTION__, __LINE__);
-    ESP.restart();
-    exit(-1);
+  unsigned char copy[WEBSERVER_COPY_SIZE];
+  uint16_t i = 0, n = 0, ret = 0;
+
+  while(i < len) {
+    n = MIN(len - i, WEBSERVER_COPY_SIZE);
+#if (!defined(NON32XFER_HANDLER) && defined(MMU_SEC_HEAP))
+    uint16_t x = 0;
+    for(x=0;x<n;x++) {
+      copy[x] = pgm_read_byte(&buf[i+x]);
+    }
+#else
+    memcpy_P(copy, &buf[i], n);
+#endif
+    if((ret = tcp_write(pcb, copy, n, flags | TCP_WRITE_FLAG_COPY | ((i + n < len) ? TCP_WRITE_FLAG_MORE : 0))) != ERR_OK) {
+      break;
+    }
+    i += n;
   }
-  memset(str, 0, len+1);
-  strncpy_P(str, buf, len);
-  uint16_t ret = tcp_write(pcb, str, len, flags);
-  free(str);
   return ret;
 }
-#endif
 
 int16_t urldecode(const unsigned char *src, int src_len, unsigned char *dst, int dst_len, int is_form_url_encoded) {
   int i, j, a, b;
@@ -1362,11 +1376,202 @@ static uint16_t webserver_create_header(struct webserver_t *client, uint16_t cod
   return i;
 }
 
+/*
+ * Shared data is preceded by its reference count
+ */
+#define WEBSERVER_SHARED_OFFSET 4
+
+/*
+ * Send list nodes and the buffers content is copied into come from
+ * fixed pools, so serving pages does not fragment the heap. Copies
+ * of a few bytes take a slot, larger ones and webserver_chunk a
+ * chunk of MTU_SIZE. A client takes at most its quota of each,
+ * beyond that or when a pool runs out they come from the heap as
+ * before. The pools are not locked, the webserver has to be run
+ * from a single task.
+ */
+#if WEBSERVER_MAX_SENDLIST == 0
+static struct sendlist_t pool_nodes[WEBSERVER_POOL_NODES];
+static struct sendlist_t *free_nodes = NULL;
+static uint8_t pool_ready = 0;
+#endif
+static uint8_t pool_slots[WEBSERVER_POOL_SLOTS][WEBSERVER_SLOT_SIZE] __attribute__((aligned(4)));
+static uint8_t pool_chunks[WEBSERVER_POOL_CHUNKS][MTU_SIZE] __attribute__((aligned(4)));
+static uint32_t pool_misses = 0;
+
+#define WEBSERVER_SLOTS 0
+#define WEBSERVER_CHUNKS 1
+
+struct webserver_slab_t {
+  uint8_t *mem;
+  uint16_t size;
+  uint8_t nr;
+  uint8_t quota;
+  uint32_t used;
+};
+
+static struct webserver_slab_t slabs[2] = {
+  { &pool_slots[0][0], WEBSERVER_SLOT_SIZE, WEBSERVER_POOL_SLOTS, WEBSERVER_CLIENT_SLOTS, 0 },
+  { &pool_chunks[0][0], MTU_SIZE, WEBSERVER_POOL_CHUNKS, WEBSERVER_CLIENT_CHUNKS, 0 }
+};
+
+static_assert(WEBSERVER_POOL_SLOTS <= 32 && WEBSERVER_POOL_CHUNKS <= 32, "too many buffers for the used mask");
+static_assert(WEBSERVER_SLOT_SIZE < MTU_SIZE, "slots have to be smaller than chunks");
+
+#if WEBSERVER_MAX_SENDLIST == 0
+static struct sendlist_t *webserver_node(struct webserver_t *client) {
+  struct sendlist_t *node = NULL;
+  uint8_t i = 0;
+
+  if(pool_ready == 0) {
+    for(i=0;i<WEBSERVER_POOL_NODES;i++) {
+      pool_nodes[i].next = free_nodes;
+      free_nodes = &pool_nodes[i];
+    }
+    pool_ready = 1;
+  }
+  if(free_nodes != NULL && client->nodes < WEBSERVER_CLIENT_NODES) {
+    node = free_nodes;
+    free_nodes = node->next;
+    client->nodes++;
+    return node;
+  }
+  pool_misses++;
+  return (struct sendlist_t *)MALLOC(sizeof(struct sendlist_t));
+}
+
+static void webserver_node_free(struct webserver_t *client, struct sendlist_t *node) {
+  if(node >= &pool_nodes[0] && node < &pool_nodes[WEBSERVER_POOL_NODES]) {
+    node->next = free_nodes;
+    free_nodes = node;
+    client->nodes--;
+  } else {
+    FREE(node);
+  }
+}
+#endif
+
+/*
+ * Buffers of the shared frames are not charged to a client
+ */
+static char *webserver_slab_take(struct webserver_t *client, uint8_t s) {
+  struct webserver_slab_t *slab = &slabs[s];
+  uint8_t i = 0;
+  if(client == NULL || client->pooled[s] < slab->quota) {
+    for(i=0;i<slab->nr;i++) {
+      if((slab->used & (1UL << i)) == 0) {
+        slab->used |= (1UL << i);
+        if(client != NULL) {
+          client->pooled[s]++;
+        }
+        return (char *)&slab->mem[i * slab->size];
+      }
+    }
+  }
+  return NULL;
+}
+
+/*
+ * The slab of the buffer a pointer is the start of, or -1
+ */
+static int8_t webserver_slab_find(void *ptr, uint8_t *nr) {
+  uint8_t *p = (uint8_t *)ptr;
+  uint8_t s = 0;
+  for(s=0;s<2;s++) {
+    struct webserver_slab_t *slab = &slabs[s];
+    if(p >= slab->mem && p < slab->mem + slab->nr * slab->size && (p - slab->mem) % slab->size == 0) {
+      *nr = (p - slab->mem) / slab->size;
+      return s;
+    }
+  }
+  return -1;
+}
+
+static char *webserver_buffer(struct webserver_t *client, uint16_t size) {
+  char *buf = NULL;
+  if(size <= WEBSERVER_SLOT_SIZE) {
+    buf = webserver_slab_take(client, WEBSERVER_SLOTS);
+  }
+  if(buf == NULL && size <= MTU_SIZE) {
+    buf = webserver_slab_take(client, WEBSERVER_CHUNKS);
+  }
+  if(buf == NULL) {
+    pool_misses++;
+    buf = (char *)MALLOC(size);
+  }
+  return buf;
+}
+
+static void webserver_buffer_free(struct webserver_t *client, void *ptr) {
+  uint8_t nr = 0;
+  int8_t s = webserver_slab_find(ptr, &nr);
+  if(s >= 0) {
+    slabs[s].used &= ~(1UL << nr);
+    if(client != NULL) {
+      client->pooled[s]--;
+    }
+  } else {
+    FREE(ptr);
+  }
+}
+
+char *webserver_chunk(struct webserver_t *client) {
+  char *buf = webserver_slab_take(client, WEBSERVER_CHUNKS);
+  if(buf == NULL) {
+    pool_misses++;
+    buf = (char *)MALLOC(MTU_SIZE);
+  }
+  return buf;
+}
+
+uint32_t webserver_pool_misses(void) {
+  return pool_misses;
+}
+
+static void webserver_release(struct webserver_t *client, struct sendlist_t *node) {
+  if(node->type == 0 && node->data.ptr != NULL) {
+    if(node->shared == 1) {
+      uint8_t *refs = (uint8_t *)node->data.ptr - WEBSERVER_SHARED_OFFSET;
+      if(--(*refs) == 0) {
+        webserver_buffer_free(NULL, refs);
+      }
+    } else {
+      webserver_buffer_free(client, node->data.ptr);
+    }
+    node->data.ptr = NULL;
+  }
+}
+
+/*
+ * Writes len bytes of a node from where the client is in it
+ */
+static void webserver_write_node(struct webserver_t *client, struct sendlist_t *node, uint16_t len) {
+  if(node->type == 1) {
+    if(client->async == 1) {
+      tcp_write_P(client->pcb, &((PGM_P)node->data.ptr)[client->ptr], len, TCP_WRITE_FLAG_COPY | TCP_WRITE_FLAG_MORE);
+    } else {
+      if(safe_write_P(client, &((PGM_P)node->data.ptr)[client->ptr], len) > 0) {
+        if(client->is_websocket == 0) {
+          client->lastseen = millis();
+        }
+      }
+    }
+  } else {
+    if(client->async == 1) {
+      tcp_write(client->pcb, &((unsigned char *)node->data.ptr)[client->ptr], len, TCP_WRITE_FLAG_COPY | TCP_WRITE_FLAG_MORE);
+    } else {
+      if(safe_write(client, &((unsigned char *)node->data.ptr)[client->ptr], len) > 0) {
+        if(client->is_websocket == 0) {
+          client->lastseen = millis();
+        }
+      }
+    }
+  }
+}
+
 static int webserver_process_send(struct webserver_t *client) {
   struct sendlist_t *tmp = NULL;
   uint16_t cpylen = client->totallen, i = 0, cpyptr = client->ptr;
-  unsigned char cpy[client->totallen+1];
-  memset(&cpy, 0, client->totallen+1);
 
 #if WEBSERVER_MAX_SENDLIST == 0
   tmp = client->sendlist;
@@ -1454,47 +1659,17 @@ static int webserver_process_send(struct webserver_t *client) {
     while(tmp != NULL && client->totallen > 0) {
       if(client->ptr == 0) {
         if(client->totallen >= tmp->size) {
-          if(tmp->type == 1) {
-#if (!defined(NON32XFER_HANDLER) && defined(MMU_SEC_HEAP))
-            uint16_t x = 0;
-            for(x=0;x<tmp->size;x++) {
-              cpy[x] = pgm_read_byte(&((PGM_P)tmp->data.ptr)[client->ptr+x]);
-            }
-#else
-             memcpy_P(cpy, &((PGM_P)tmp->data.ptr)[client->ptr], tmp->size);
-#endif
-            if(client->async == 1) {
-              tcp_write(client->pcb, cpy, tmp->size, TCP_WRITE_FLAG_COPY | TCP_WRITE_FLAG_MORE);
-            } else {
-              if(safe_write(client,cpy, tmp->size) > 0) {
-                if(client->is_websocket == 0) {
-                  client->lastseen = millis();
-                }
-              }
-            }
-          } else {
-            if(client->async == 1) {
-              tcp_write(client->pcb, &((unsigned char *)tmp->data.ptr)[client->ptr], tmp->size, TCP_WRITE_FLAG_COPY | TCP_WRITE_FLAG_MORE);
-            } else {
-              if(safe_write(client,&((unsigned char *)tmp->data.ptr)[client->ptr], tmp->size) > 0) {
-                if(client->is_websocket == 0) {
-                  client->lastseen = millis();
-                }
-              }
-            }
-          }
+          webserver_write_node(client, tmp, tmp->size);
           i += tmp->size;
           client->ptr += tmp->size;
           client->totallen -= tmp->size;
 
-          if(tmp->type == 0) {
-            free(tmp->data.ptr);
-          }
+          webserver_release(client, tmp);
 
           tmp->data.ptr = NULL;
 #if WEBSERVER_MAX_SENDLIST == 0
           client->sendlist = client->sendlist->next;
-          free(tmp);
+          webserver_node_free(client, tmp);
           tmp = client->sendlist;
 #else
           tmp = NULL;
@@ -1508,80 +1683,22 @@ static int webserver_process_send(struct webserver_t *client) {
 #endif
           client->ptr = 0;
         } else {
-          if(tmp->type == 1) {
-#if (!defined(NON32XFER_HANDLER) && defined(MMU_SEC_HEAP))
-            uint16_t x = 0;
-            for(x=0;x<client->totallen;x++) {
-              cpy[x] = pgm_read_byte(&((PGM_P)tmp->data.ptr)[client->ptr+x]);
-            }
-#else
-             memcpy_P(cpy, &((PGM_P)tmp->data.ptr)[client->ptr], client->totallen);
-#endif
-            if(client->async == 1) {
-              tcp_write(client->pcb, cpy, client->totallen, TCP_WRITE_FLAG_COPY | TCP_WRITE_FLAG_MORE);
-            } else {
-              if(safe_write(client,cpy, client->totallen) > 0) {
-                if(client->is_websocket == 0) {
-                  client->lastseen = millis();
-                }
-              }
-            }
-          } else {
-            if(client->async == 1) {
-              tcp_write(client->pcb, &((unsigned char *)tmp->data.ptr)[client->ptr], client->totallen, TCP_WRITE_FLAG_COPY | TCP_WRITE_FLAG_MORE);
-            } else {
-              if(safe_write(client,&((unsigned char *)tmp->data.ptr)[client->ptr], client->totallen) > 0) {
-                if(client->is_websocket == 0) {
-                  client->lastseen = millis();
-                }
-              }
-            }
-          }
+          webserver_write_node(client, tmp, client->totallen);
           i += client->totallen;
           client->ptr += client->totallen;
           client->totallen = 0;
         }
       } else if(client->ptr+client->totallen >= tmp->size) {
-        if(tmp->type == 1) {
-#if (!defined(NON32XFER_HANDLER) && defined(MMU_SEC_HEAP))
-          uint16_t x = 0;
-          for(x=0;x<(tmp->size-client->ptr);x++) {
-            cpy[x] = pgm_read_byte(&((PGM_P)tmp->data.ptr)[client->ptr+x]);
-          }
-#else
-           memcpy_P(cpy, &((PGM_P)tmp->data.ptr)[client->ptr], (tmp->size-client->ptr));
-#endif
-          if(client->async == 1) {
-            tcp_write(client->pcb, cpy, (tmp->size-client->ptr), TCP_WRITE_FLAG_COPY | TCP_WRITE_FLAG_MORE);
-          } else {
-            if(safe_write(client,cpy, (tmp->size-client->ptr)) > 0) {
-              if(client->is_websocket == 0) {
-                client->lastseen = millis();
-              }
-            }
-          }
-        } else {
-          if(client->async == 1) {
-            tcp_write(client->pcb, &((unsigned char *)tmp->data.ptr)[client->ptr], (tmp->size-client->ptr), TCP_WRITE_FLAG_COPY | TCP_WRITE_FLAG_MORE);
-          } else {
-            if(safe_write(client,&((unsigned char *)tmp->data.ptr)[client->ptr], (tmp->size-client->ptr)) > 0) {
-              if(client->is_websocket == 0) {
-                client->lastseen = millis();
-              }
-            }
-          }
-        }
+        webserver_write_node(client, tmp, (tmp->size-client->ptr));
         i += (tmp->size-client->ptr);
         client->totallen -= (tmp->size-client->ptr);
 
-        if(tmp->type == 0) {
-          free(tmp->data.ptr);
-        }
+        webserver_release(client, tmp);
 
         tmp->data.ptr = NULL;
 #if WEBSERVER_MAX_SENDLIST == 0
         client->sendlist = client->sendlist->next;
-        free(tmp);
+        webserver_node_free(client, tmp);
         tmp = client->sendlist;
 #else
         tmp = NULL;
@@ -1595,35 +1712,7 @@ static int webserver_process_send(struct webserver_t *client) {
 #endif
         client->ptr = 0;
       } else {
-        if(tmp->type == 1) {
-#if (!defined(NON32XFER_HANDLER) && defined(MMU_SEC_HEAP))
-          uint16_t x = 0;
-          for(x=0;x<client->totallen;x++) {
-            cpy[x] = pgm_read_byte(&((PGM_P)tmp->data.ptr)[client->ptr+x]);
-          }
-#else
-           memcpy_P(cpy, &((PGM_P)tmp->data.ptr)[client->ptr], client->totallen);
-#endif
-          if(client->async == 1) {
-            tcp_write(client->pcb, cpy, client->totallen, TCP_WRITE_FLAG_COPY | TCP_WRITE_FLAG_MORE);
-          } else {
-            if(safe_write(client,cpy, client->totallen) > 0) {
-              if(client->is_websocket == 0) {
-                client->lastseen = millis();
-              }
-            }
-          }
-        } else {
-          if(client->async == 1) {
-            tcp_write(client->pcb, &((unsigned char *)tmp->data.ptr)[client->ptr], client->totallen, TCP_WRITE_FLAG_COPY | TCP_WRITE_FLAG_MORE);
-          } else {
-            if(safe_write(client,&((unsigned char *)tmp->data.ptr)[client->ptr], client->totallen) > 0) {
-              if(client->is_websocket == 0) {
-                client->lastseen = millis();
-              }
-            }
-          }
-        }
+        webserver_write_node(client, tmp, client->totallen);
         client->ptr += client->totallen;
         client->totallen = 0;
       }
@@ -1715,7 +1804,7 @@ void webserver_send_content_P(struct webserver_t *client, PGM_P buf, uint16_t si
   struct sendlist_t *node = NULL;
 
 #if WEBSERVER_MAX_SENDLIST == 0
-  node = (struct sendlist_t *)malloc(sizeof(struct sendlist_t));
+  node = webserver_node(client);
   /*LCOV_EXCL_START*/
   if(node == NULL) {
   #if defined(ESP8266) || defined(ESP32)
@@ -1759,11 +1848,15 @@ void webserver_send_content_P(struct webserver_t *client, PGM_P buf, uint16_t si
 #endif
 }
 
-void webserver_send_content(struct webserver_t *client, char *buf, uint16_t size) {
+/*
+ * Queues a buffer allocated with malloc or webserver_chunk without
+ * copying it, the webserver gives it back once it is sent.
+ */
+void webserver_send_content_nocopy(struct webserver_t *client, char *buf, uint16_t size) {
   struct sendlist_t *node = NULL;
 
 #if WEBSERVER_MAX_SENDLIST == 0
-  node = (struct sendlist_t *)malloc(sizeof(struct sendlist_t));
+  node = webserver_node(client);
   /*LCOV_EXCL_START*/
   if(node == NULL) {
   #if defined(ESP8266) || defined(ESP32)
@@ -1786,21 +1879,92 @@ void webserver_send_content(struct webserver_t *client, char *buf, uint16_t size
   #else
     printf("Sendlist queue is full\n");
   #endif
+    webserver_buffer_free(client, buf);
     return;
   }
 #endif
   memset(node, 0, sizeof(struct sendlist_t));
-  if((node->data.ptr = malloc(size+1)) == NULL) {
+  node->data.ptr = buf;
+
+  node->size = size;
+  node->type = 0;
+
+#if WEBSERVER_MAX_SENDLIST == 0
+  if(client->sendlist == NULL) {
+    client->sendlist = node;
+    client->sendlist_head = node;
+  } else {
+    client->sendlist_head->next = node;
+    client->sendlist_head = node;
+  }
+#endif
+}
+
+void webserver_send_content(struct webserver_t *client, char *buf, uint16_t size) {
+  char *cpy = NULL;
+#if WEBSERVER_MAX_SENDLIST == 0
+  /*
+   * Copies are packed into the slot or chunk at the tail of the
+   * send list as long as it has room.
+   */
+  struct sendlist_t *tail = client->sendlist_head;
+  uint8_t nr = 0;
+  int8_t s = -1;
+  if(client->sendlist != NULL && tail->type == 0 && tail->shared == 0 &&
+     (s = webserver_slab_find(tail->data.ptr, &nr)) >= 0 && tail->size + size <= slabs[s].size) {
+    memcpy(&((char *)tail->data.ptr)[tail->size], buf, size);
+    tail->size += size;
+    return;
+  }
+#endif
+  cpy = webserver_buffer(client, size);
+  if(cpy == NULL) {
   #if defined(ESP8266) || defined(ESP32)
     loggingSerial.printf("Out of memory %s:#%d\n", __FUNCTION__, __LINE__);
     ESP.restart();
     exit(-1);
   #endif
   }
-  memcpy(node->data.ptr, buf, size);
+  memcpy(cpy, buf, size);
+  webserver_send_content_nocopy(client, cpy, size);
+}
+
+static int8_t webserver_send_shared(struct webserver_t *client, uint8_t *buf, uint16_t size) {
+  struct sendlist_t *node = NULL;
 
+#if WEBSERVER_MAX_SENDLIST == 0
+  node = webserver_node(client);
+  /*LCOV_EXCL_START*/
+  if(node == NULL) {
+  #if defined(ESP8266) || defined(ESP32)
+    loggingSerial.printf("Out of memory %s:#%d\n", __FUNCTION__, __LINE__);
+    ESP.restart();
+    exit(-1);
+  #endif
+  }
+#else
+  uint8_t i = 0;
+  for(i=0;i<WEBSERVER_MAX_SENDLIST;i++) {
+    if(client->sendlist[i].data.ptr == NULL) {
+      node = &client->sendlist[i];
+      break;
+    }
+  }
+  if(node == NULL) {
+  #if defined(ESP8266) || defined(ESP32)
+    loggingSerial.printf("Sendlist queue is full\n");
+  #else
+    printf("Sendlist queue is full\n");
+  #endif
+    return -1;
+  }
+#endif
+  memset(node, 0, sizeof(struct sendlist_t));
+  buf[0]++;
+  node->data.ptr = &buf[WEBSERVER_SHARED_OFFSET];
   node->size = size;
   node->type = 0;
+  node->shared = 1;
 
 #if WEBSERVER_MAX_SENDLIST == 0
   if(client->sendlist == NULL) {
@@ -1811,6 +1975,7 @@ void webserver_send_content(struct webserver_t *client, char *buf, uint16_t size
     client->sendlist_head = node;
   }
 #endif
+  return 0;
 }
 
 int8_t webserver_send(struct webserver_t *client, uint16_t code, char *mimetype, uint16_t data_len) {
@@ -1987,28 +2152,9 @@ void websocket_write(struct webserver_t *client, char *data, uint16_t data_len)
   client->step = WEBSERVER_CLIENT_SENDING;
 }
 
-void websocket_write_all(char *data, uint16_t data_len) {
-  uint8_t i = 0;
-  for(i=0;i<WEBSERVER_MAX_CLIENTS;i++) {
-    if(clients[i].data.is_websocket == 1 && clients[i].data.step != WEBSERVER_CLIENT_CLOSE) {
-      websocket_write(&clients[i].data, data, data_len);
-    }
-  }
-}
-
-void websocket_write_all_P(PGM_P data, uint16_t data_len) {
-  uint8_t i = 0;
-  for(i=0;i<WEBSERVER_MAX_CLIENTS;i++) {
-    if(clients[i].data.is_websocket == 1 && clients[i].data.step != WEBSERVER_CLIENT_CLOSE) {
-      websocket_write_P(&clients[i].data, data, data_len);
-    }
-  }
-}
-
-void websocket_send_header(struct webserver_t *client, uint8_t opcode, uint16_t data_len) {
-  unsigned char copy[10];
-  int index = 2;
-  memset(&copy, 0, 10);
+static uint8_t websocket_header(unsigned char *copy, uint8_t opcode, uint16_t data_len) {
+  uint8_t index = 2;
+  memset(copy, 0, 10);
 
   copy[0] = 0x80 + (opcode & 0x0f);
   if(data_len <= 125) {
@@ -2035,6 +2181,69 @@ void websocket_send_header(struct webserver_t *client, uint8_t opcode, uint16_t
       index = 10;
      */
   }
+  return index;
+}
+
+/*
+ * The frame is the same for all clients, so it is
+ * build once and shared by their sendlists.
+ */
+void websocket_write_all(char *data, uint16_t data_len) {
+  unsigned char header[10];
+  uint8_t i = 0, index = 0;
+  uint8_t *frame = NULL;
+
+  if(websocket_clients() == 0) {
+    return;
+  }
+
+  index = websocket_header(header, WEBSOCKET_OPCODE_TEXT, data_len);
+  frame = (uint8_t *)webserver_buffer(NULL, WEBSERVER_SHARED_OFFSET+index+data_len);
+  if(frame == NULL) {
+#if defined(ESP8266) || defined(ESP32)
+    loggingSerial.printf("Out of memory %s:#%d\n", __FUNCTION__, __LINE__);
+    ESP.restart();
+    exit(-1);
+#endif
+  }
+  frame[0] = 0;
+  memcpy(&frame[WEBSERVER_SHARED_OFFSET], header, index);
+  memcpy(&frame[WEBSERVER_SHARED_OFFSET+index], data, data_len);
+
+  for(i=0;i<WEBSERVER_MAX_CLIENTS;i++) {
+    if(clients[i].data.is_websocket == 1 && clients[i].data.step != WEBSERVER_CLIENT_CLOSE) {
+      if(webserver_send_shared(&clients[i].data, frame, index+data_len) == 0) {
+        clients[i].data.step = WEBSERVER_CLIENT_SENDING;
+      }
+    }
+  }
+  if(frame[0] == 0) {
+    webserver_buffer_free(NULL, frame);
+  }
+}
+
+uint8_t websocket_clients(void) {
+  uint8_t i = 0, nr = 0;
+  for(i=0;i<WEBSERVER_MAX_CLIENTS;i++) {
+    if(clients[i].data.is_websocket == 1 && clients[i].data.step != WEBSERVER_CLIENT_CLOSE) {
+      nr++;
+    }
+  }
+  return nr;
+}
+
+void websocket_write_all_P(PGM_P data, uint16_t data_len) {
+  uint8_t i = 0;
+  for(i=0;i<WEBSERVER_MAX_CLIENTS;i++) {
+    if(clients[i].data.is_websocket == 1 && clients[i].data.step != WEBSERVER_CLIENT_CLOSE) {
+      websocket_write_P(&clients[i].data, data, data_len);
+    }
+  }
+}
+
+void websocket_send_header(struct webserver_t *client, uint8_t opcode, uint16_t data_len) {
+  unsigned char copy[10];
+  uint8_t index = websocket_header(copy, opcode, data_len);
   webserver_send_content(client, (char *)copy, index);
 }
 
@@ -2275,19 +2484,15 @@ void webserver_reset_client(struct webserver_t *client) {
   while(client->sendlist) {
     tmp = client->sendlist;
     client->sendlist = client->sendlist->next;
-    if(tmp->type == 0) {
-      free(tmp->data.ptr);
-    }
+    webserver_release(client, tmp);
     tmp->data.ptr = NULL;
-    free(tmp);
+    webserver_node_free(client, tmp);
   }
 #else
   uint8_t i = 0;
   for(i=0;i<WEBSERVER_MAX_SENDLIST;i++) {
     tmp = &client->sendlist[i];
-    if(tmp->type == 0) {
-      free(tmp->data.ptr);
-    }
+    webserver_release(client, tmp);
     tmp->data.ptr = NULL;
     memset(tmp, 0, sizeof(struct sendlist_t));
   }
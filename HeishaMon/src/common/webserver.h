@@ -33,6 +33,55 @@
 #define WEBSERVER_MAX_SENDLIST 0
 #endif
 
+/*
+ * Send list nodes, slots for small copies and MTU_SIZE chunks for
+ * larger ones are taken from fixed pools, each client at most its
+ * quota of them.
+ */
+#ifndef WEBSERVER_POOL_NODES
+  #ifdef ESP8266
+    #define WEBSERVER_POOL_NODES 40
+  #else
+    #define WEBSERVER_POOL_NODES 80
+  #endif
+#endif
+
+#ifndef WEBSERVER_SLOT_SIZE
+  #define WEBSERVER_SLOT_SIZE 64
+#endif
+
+#ifndef WEBSERVER_POOL_SLOTS
+  #ifdef ESP8266
+    #define WEBSERVER_POOL_SLOTS 24
+  #else
+    #define WEBSERVER_POOL_SLOTS 32
+  #endif
+#endif
+
+#ifndef WEBSERVER_POOL_CHUNKS
+  #ifdef ESP8266
+    #define WEBSERVER_POOL_CHUNKS 3
+  #else
+    #define WEBSERVER_POOL_CHUNKS 10
+  #endif
+#endif
+
+#ifndef WEBSERVER_CLIENT_NODES
+  #define WEBSERVER_CLIENT_NODES 16
+#endif
+
+#ifndef WEBSERVER_CLIENT_SLOTS
+  #define WEBSERVER_CLIENT_SLOTS 8
+#endif
+
+#ifndef WEBSERVER_CLIENT_CHUNKS
+  #ifdef ESP8266
+    #define WEBSERVER_CLIENT_CHUNKS 1
+  #else
+    #define WEBSERVER_CLIENT_CHUNKS 2
+  #endif
+#endif
+
 #ifndef WEBSERVER_CLIENT_TIMEOUT
   #define WEBSERVER_CLIENT_TIMEOUT 30000
 #endif
@@ -62,6 +111,12 @@
 typedef struct tcp_pcb {
 } tcp_pcb;
 
+#endif
+
+/*
+ * The host build of the rules engine brings its own pbuf
+ */
+#if !defined(ESP8266) && !defined(ESP32) && !defined(_RULES_H_)
 typedef struct pbuf {
   unsigned int len;
   void *payload;
@@ -91,6 +146,11 @@ typedef struct sendlist_t {
   } data;
   uint16_t type:1;
   uint16_t size:15;
+  /*
+   * Heap data shared by several clients, it
+   * is freed when the last client sent it.
+   */
+  uint8_t shared:1;
 #if WEBSERVER_MAX_SENDLIST == 0
   struct sendlist_t *next;
 #endif
@@ -98,14 +158,16 @@ typedef struct sendlist_t {
 
 #if !defined(ESP8266) && !defined(ESP32)
 struct WiFiClient {
-  int (*write)(unsigned char *, int i);
+  int (*write)(const unsigned char *, int i);
   int (*write_P)(const char *, int i);
   int (*available)();
   int (*connected)();
   void (*stop)();
   int (*read)(uint8_t *buffer, int size);
 };
-  #define PGM_P unsigned char *
+  #ifndef PGM_P
+    #define PGM_P unsigned char *
+  #endif
 #endif
 
 typedef struct webserver_t {
@@ -125,6 +187,8 @@ typedef struct webserver_t {
   uint32_t readlen;
   uint16_t content;
   uint8_t route;
+  uint8_t nodes;      // taken from the pools
+  uint8_t pooled[2];  // slots and chunks
 #if WEBSERVER_MAX_SENDLIST == 0
   struct sendlist_t *sendlist;
   struct sendlist_t *sendlist_head;
@@ -172,11 +236,20 @@ int8_t webserver_start(int port, webserver_cb_t *callback, uint8_t async);
 void webserver_loop(void);
 void websocket_write_all_P(PGM_P data, uint16_t data_len);
 void websocket_write_all(char *data, uint16_t data_len);
+uint8_t websocket_clients(void);
 void websocket_write_P(struct webserver_t *client, PGM_P data, uint16_t data_len);
 void websocket_write(struct webserver_t *client, char *data, uint16_t data_len);
 void websocket_send_header(struct webserver_t *client, uint8_t opcode, uint16_t data_len);
 void webserver_send_content(struct webserver_t *client, char *buf, uint16_t len);
+void webserver_send_content_nocopy(struct webserver_t *client, char *buf, uint16_t len);
 void webserver_send_content_P(struct webserver_t *client, PGM_P buf, uint16_t len);
+/*
+ * A buffer of MTU_SIZE bytes to fill and queue with
+ * webserver_send_content_nocopy, which gives it back.
+ */
+char *webserver_chunk(struct webserver_t *client);
+// nodes and buffers that had to come from the heap
+uint32_t webserver_pool_misses(void);
 err_t webserver_async_receive(void *arg, tcp_pcb *pcb, struct pbuf *data, err_t err);
 uint8_t webserver_sync_receive(struct webserver_t *client, uint8_t *rbuffer, uint16_t size);
 void webserver_loop(void);
@@ -21,7 +21,6 @@
 #include "../../common/timerqueue.h"
 
 int8_t rule_function_set_timer_callback(void) {
-  struct timerqueue_t *node = NULL;
   struct itimerval it_val;
   uint16_t sec = 0, nr = 0;
   uint8_t x = rules_gettop();
@@ -58,7 +57,10 @@ int8_t rule_function_set_timer_callback(void) {
     } break;
   }
 
-  timerqueue_insert(sec, 0, nr);
+  if(timerqueue_insert(sec, 0, nr) == -1) {
+    logprintf_P(F("timer #%d not set, too many timers running"), nr);
+    return 0;
+  }
 
   logprintf_P(F("timer #%d set to %d seconds"), nr, sec);
 
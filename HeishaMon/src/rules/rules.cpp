@@ -72,6 +72,11 @@ typedef struct vm_vchar_t {
   uint8_t len;
   uint8_t ref;
   char *value;
+  /*
+   * Slot the variable is bound to by the
+   * vm_value_bind callback, -1 when unbound.
+   */
+  int16_t slot;
 #if defined(ESP8266) || defined(ESP32)
 } __attribute__((packed, aligned(4))) vm_vchar_t;
 #else
@@ -206,6 +211,8 @@ typedef struct rule_timer_t {
 
 static struct rule_stack_t *varstack = NULL;
 static struct rule_stack_t *stack = NULL;
+
+struct rule_run_stats_t rule_run_stats;
 static struct rule_timer_t timestamp;
 
 static uint8_t group = 1;
@@ -609,6 +616,10 @@ static uint16_t varstack_add(char **text, uint16_t start, uint16_t len, uint8_t
   setval(value->len, len);
   setval(value->ref, 0);
   setval(value->fixed, fixed);
+  setval(value->slot, -1);
+  if(fixed == 1 && rule_options.vm_value_bind != NULL) {
+    setval(value->slot, rule_options.vm_value_bind(value->value, len));
+  }
   if(i == -1) {
     setval(varstack->nrbytes, a+sizeof(struct vm_vchar_t));
   }
@@ -1425,6 +1436,9 @@ static uint32_t vm_stack_push(uint16_t pos, unsigned char *in) {
   size = ret+rule_max_var_bytes();
   setval(stack->nrbytes, size);
   setval(stack->bufsize, MAX(getval(stack->bufsize), size));
+  if(size > rule_run_stats.stack) {
+    rule_run_stats.stack = size;
+  }
 
   if(type == VCHAR) {
     struct vm_vptr_t *value = (struct vm_vptr_t *)&stack->buffer[ret];
@@ -1606,6 +1620,23 @@ const char *rules_tostring(int8_t pos) {
   return NULL;
 }
 
+int16_t rules_toslot(int8_t pos) {
+  int16_t offset = vm_val_pos(pos);
+  if(pos < 0) {
+    offset = getval(stack->nrbytes)-offset;
+  }
+  if(offset >= 4) {
+    if(getval(stack->buffer[offset]) == VPTR) {
+      struct vm_vptr_t *node = (struct vm_vptr_t *)&stack->buffer[offset];
+      uint16_t pos = getval(node->value)*sizeof(struct vm_top_t);
+      struct vm_vchar_t *var = (struct vm_vchar_t *)&varstack->buffer[pos];
+
+      return (int16_t)getval(var->slot);
+    }
+  }
+  return -1;
+}
+
 int rules_tointeger(int8_t pos) {
   int16_t offset = vm_val_pos(pos);
   if(pos < 0) {
@@ -4336,8 +4367,12 @@ int8_t rule_run(struct rules_t *obj, uint8_t validate) {
   memset(stack->buffer, 0, getval(stack->bufsize));
   setval(stack->nrbytes, 4);
 
+  rule_run_stats.steps = 0;
+  rule_run_stats.stack = 4;
+
 /*****************/
   BEGIN:
+    rule_run_stats.steps++;
     uint8_t type = gettype(obj->bc.buffer[pos]);
 #ifdef DEBUG
     printf("rule #%d, pos: %lu, op_id: %d, op: %s\n", obj->nr, pos/sizeof(struct vm_top_t), type, op_names[type].name);
@@ -5313,6 +5348,334 @@ void rules_gc(struct rules_t ***rules, uint8_t *nrrules) {
 #endif
 }
 
+/*
+ * The image starts with this header and is followed by the
+ * mempool up to the end of the stack, the varstack buffer, the
+ * names of the variables, the offset in the mempool and the name
+ * of every rule and at last the checksum of all that comes before.
+ */
+#define RULES_IMAGE_MAGIC 0x42524d48 // HMRB
+
+typedef struct rules_image_t {
+  uint32_t magic;
+  uint16_t version;
+  uint8_t nrrules;
+  uint8_t ptrsize;
+  uint32_t engine;
+  uint32_t source;
+  uint64_t base;
+  uint16_t poolbytes;
+  uint16_t stack;
+  uint16_t varbytes;
+  uint16_t varsize;
+} __attribute__((aligned(4))) rules_image_t;
+
+typedef struct rules_image_rule_t {
+  uint16_t offset;
+  uint16_t name;
+} rules_image_rule_t;
+
+#define RULES_IMAGE_NONAME 0xFFFF
+#define RULES_IMAGE_CHUNK 64
+
+uint32_t rules_hash(uint32_t hash, const void *buf, uint16_t len) {
+  const uint8_t *p = (const uint8_t *)buf;
+  uint16_t i = 0;
+  for(i=0;i<len;i++) {
+    hash = (hash ^ p[i]) * 16777619UL;
+  }
+  return hash;
+}
+
+/*
+ * Bytecode refers to functions and operators by their index and
+ * the image holds the structs as they are, so an image is only
+ * valid for the engine it was written by.
+ */
+static uint32_t rules_image_engine(void) {
+  uint32_t hash = 2166136261UL;
+  uint16_t sizes[4] = { sizeof(struct rules_t), sizeof(struct vm_vchar_t), sizeof(struct rule_stack_t), JMPSIZE };
+  uint16_t i = 0;
+
+  hash = rules_hash(hash, sizes, sizeof(sizes));
+  for(i=0;i<nr_rule_functions;i++) {
+    hash = rules_hash(hash, rule_functions[i].name, strlen(rule_functions[i].name) + 1);
+  }
+  for(i=0;i<nr_rule_operators;i++) {
+    hash = rules_hash(hash, rule_operators[i].name, strlen(rule_operators[i].name) + 1);
+  }
+  return hash;
+}
+
+typedef struct rules_image_io_t {
+  int (*cb)(void *arg, void *buf, uint16_t len);
+  void *arg;
+  uint32_t checksum;
+} rules_image_io_t;
+
+/*
+ * Clears the bytes of a pointer at ptr in the pool that fall
+ * in the chunk at offset, it can straddle two of them.
+ */
+static void rules_image_clear(unsigned char *chunk, uint16_t offset, uint16_t len, uint16_t ptr, uint16_t size) {
+  uint16_t from = MAX(ptr, offset);
+  uint16_t to = MIN(ptr + size, offset + len);
+  if(from < to) {
+    memset(&chunk[from - offset], 0, to - from);
+  }
+}
+
+static int8_t rules_image_io(struct rules_image_io_t *io, void *buf, uint16_t len, uint8_t reading) {
+  if(reading == 0) {
+    io->checksum = rules_hash(io->checksum, buf, len);
+  }
+  if(io->cb(io->arg, buf, len) != len) {
+    return -1;
+  }
+  if(reading == 1) {
+    io->checksum = rules_hash(io->checksum, buf, len);
+  }
+  return 0;
+}
+
+int8_t rules_image_write(struct rules_t **rules, uint8_t nrrules, struct pbuf *mempool, uint32_t source, int (*write)(void *arg, void *buf, uint16_t len), void *arg) {
+  struct rules_image_io_t io = { write, arg, 2166136261UL };
+  struct rules_image_t header;
+  unsigned char *payload = (unsigned char *)mempool->payload;
+  unsigned char chunk[RULES_IMAGE_CHUNK] __attribute__((aligned(4)));
+  uint16_t i = 0, x = 0;
+
+  if(nrrules == 0 || stack == NULL || varstack == NULL || mempool->next != NULL) {
+    return -1;
+  }
+
+  memset(&header, 0, sizeof(struct rules_image_t));
+  header.magic = RULES_IMAGE_MAGIC;
+  header.version = RULES_IMAGE_VERSION;
+  header.nrrules = nrrules;
+  header.ptrsize = sizeof(void *);
+  header.engine = rules_image_engine();
+  header.source = source;
+  header.base = (uintptr_t)payload;
+  header.stack = (unsigned char *)stack - payload;
+  header.poolbytes = (stack->buffer - payload) + getval(stack->bufsize);
+  header.varbytes = varstack->nrbytes;
+  header.varsize = varstack->bufsize;
+
+  if((header.poolbytes % 4) != 0 || header.poolbytes > getval(mempool->tot_len)) {
+    return -1;
+  }
+
+  if(rules_image_io(&io, &header, sizeof(struct rules_image_t), 0) == -1) {
+    return -1;
+  }
+
+  /*
+   * The mempool can be in memory that only allows 32 bit
+   * access, so it is copied out in aligned chunks.
+   */
+  for(i=0;i<header.poolbytes;i+=RULES_IMAGE_CHUNK) {
+    uint16_t len = MIN(RULES_IMAGE_CHUNK, header.poolbytes - i);
+    memcpy(chunk, &payload[i], len);
+    /*
+     * The names and the userdata live on the heap, the names
+     * are written with the varstack below.
+     */
+    for(x=0;x<nrrules;x++) {
+      rules_image_clear(chunk, i, len, (unsigned char *)&rules[x]->name - payload, sizeof(char *));
+      rules_image_clear(chunk, i, len, (unsigned char *)&rules[x]->userdata - payload, sizeof(void *));
+    }
+    if(rules_image_io(&io, chunk, len, 0) == -1) {
+      return -1;
+    }
+  }
+
+  /*
+   * Their pointers are left out so the same
+   * rules always give the same image.
+   */
+  for(i=0;i<header.varbytes;i+=sizeof(struct vm_vchar_t)) {
+    struct vm_vchar_t node;
+    memcpy(&node, &varstack->buffer[i], sizeof(struct vm_vchar_t));
+    if(node.type != VCHAR || node.value == NULL) {
+      return -1;
+    }
+    node.value = NULL;
+    if(rules_image_io(&io, &node, sizeof(struct vm_vchar_t), 0) == -1) {
+      return -1;
+    }
+  }
+  for(i=0;i<header.varbytes;i+=sizeof(struct vm_vchar_t)) {
+    struct vm_vchar_t *node = (struct vm_vchar_t *)&varstack->buffer[i];
+    if(rules_image_io(&io, node->value, node->len + 1, 0) == -1) {
+      return -1;
+    }
+  }
+
+  for(i=0;i<nrrules;i++) {
+    struct rules_image_rule_t rule = { (uint16_t)((unsigned char *)rules[i] - payload), RULES_IMAGE_NONAME };
+    for(x=0;x<header.varbytes;x+=sizeof(struct vm_vchar_t)) {
+      if(((struct vm_vchar_t *)&varstack->buffer[x])->value == rules[i]->name) {
+        rule.name = x;
+        break;
+      }
+    }
+    if(rules_image_io(&io, &rule, sizeof(struct rules_image_rule_t), 0) == -1) {
+      return -1;
+    }
+  }
+
+  uint32_t checksum = io.checksum;
+  if(write(arg, &checksum, sizeof(checksum)) != sizeof(checksum)) {
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Pointers into the mempool are moved to where it is now,
+ * returns NULL when they point outside of the image.
+ */
+static void *rules_image_relocate(struct rules_image_t *header, unsigned char *payload, void *ptr, uint16_t size) {
+  uint64_t offset = (uintptr_t)ptr - header->base;
+  if((uintptr_t)ptr < header->base || offset + size > header->poolbytes) {
+    return NULL;
+  }
+  return &payload[offset];
+}
+
+static void rules_image_free(struct rules_t ***rules, uint8_t *nrrules, struct pbuf *mempool) {
+  uint16_t i = 0;
+  if(varstack != NULL) {
+    for(i=0;i<varstack->nrbytes;i+=sizeof(struct vm_vchar_t)) {
+      FREE(((struct vm_vchar_t *)&varstack->buffer[i])->value);
+    }
+    FREE(varstack->buffer);
+    FREE(varstack);
+  }
+  FREE(*rules);
+  *nrrules = 0;
+  stack = NULL;
+  memset(mempool->payload, 0, getval(mempool->tot_len));
+  mempool->len = 0;
+}
+
+int8_t rules_image_read(struct rules_t ***rules, uint8_t *nrrules, struct pbuf *mempool, uint32_t source, int (*read)(void *arg, void *buf, uint16_t len), void *arg) {
+  struct rules_image_io_t io = { read, arg, 2166136261UL };
+  struct rules_image_t header;
+  unsigned char *payload = (unsigned char *)mempool->payload;
+  unsigned char chunk[RULES_IMAGE_CHUNK] __attribute__((aligned(4)));
+  uint32_t checksum = 0;
+  uint16_t i = 0;
+
+  if(*nrrules > 0 || varstack != NULL || mempool->next != NULL) {
+    return -1;
+  }
+
+  if(rules_image_io(&io, &header, sizeof(struct rules_image_t), 1) == -1 ||
+     header.magic != RULES_IMAGE_MAGIC || header.version != RULES_IMAGE_VERSION ||
+     header.ptrsize != sizeof(void *) || header.engine != rules_image_engine() || header.source != source ||
+     header.nrrules == 0 || (header.poolbytes % 4) != 0 || header.poolbytes > getval(mempool->tot_len) ||
+     header.stack + sizeof(struct rule_stack_t) > header.poolbytes ||
+     (header.varbytes % sizeof(struct vm_vchar_t)) != 0 || header.varbytes > header.varsize) {
+    return -1;
+  }
+
+  for(i=0;i<header.poolbytes;i+=RULES_IMAGE_CHUNK) {
+    uint16_t len = MIN(RULES_IMAGE_CHUNK, header.poolbytes - i);
+    if(rules_image_io(&io, chunk, len, 1) == -1) {
+      rules_image_free(rules, nrrules, mempool);
+      return -1;
+    }
+    memcpy(&payload[i], chunk, len);
+  }
+  mempool->len = header.stack;
+
+  if((varstack = (struct rule_stack_t *)MALLOC(sizeof(struct rule_stack_t))) == NULL) {
+    OUT_OF_MEMORY
+  }
+  memset(varstack, 0, sizeof(struct rule_stack_t));
+  if(header.varsize > 0) {
+    if((varstack->buffer = (unsigned char *)MALLOC(header.varsize)) == NULL) {
+      OUT_OF_MEMORY
+    }
+    memset(varstack->buffer, 0, header.varsize);
+    varstack->bufsize = header.varsize;
+  }
+  if(header.varbytes > 0 && rules_image_io(&io, varstack->buffer, header.varbytes, 1) == -1) {
+    rules_image_free(rules, nrrules, mempool);
+    return -1;
+  }
+  /*
+   * Nothing vouches for the file until the checksum at the end,
+   * so a node holds no pointer until its value is allocated here
+   * and a failure below only frees those.
+   */
+  for(i=0;i<header.varbytes;i+=sizeof(struct vm_vchar_t)) {
+    ((struct vm_vchar_t *)&varstack->buffer[i])->value = NULL;
+  }
+  varstack->nrbytes = header.varbytes;
+
+  for(i=0;i<header.varbytes;i+=sizeof(struct vm_vchar_t)) {
+    struct vm_vchar_t *node = (struct vm_vchar_t *)&varstack->buffer[i];
+    if(node->type != VCHAR) {
+      rules_image_free(rules, nrrules, mempool);
+      return -1;
+    }
+    if((node->value = (char *)MALLOC(node->len + 1)) == NULL) {
+      OUT_OF_MEMORY
+    }
+    if(rules_image_io(&io, node->value, node->len + 1, 1) == -1 || node->value[node->len] != '\0') {
+      rules_image_free(rules, nrrules, mempool);
+      return -1;
+    }
+    node->ref = 0;
+    if(node->fixed == 1 && rule_options.vm_value_bind != NULL) {
+      // the tables of the sketch may have changed since
+      node->slot = rule_options.vm_value_bind(node->value, node->len);
+    }
+  }
+
+  if((*rules = (struct rules_t **)MALLOC(sizeof(struct rules_t *)*header.nrrules)) == NULL) {
+    OUT_OF_MEMORY
+  }
+  for(i=0;i<header.nrrules;i++) {
+    struct rules_image_rule_t rule;
+    struct rules_t *obj = NULL;
+
+    if(rules_image_io(&io, &rule, sizeof(struct rules_image_rule_t), 1) == -1 ||
+       rule.offset + sizeof(struct rules_t) > header.poolbytes ||
+       (rule.name != RULES_IMAGE_NONAME && rule.name >= header.varbytes)) {
+      rules_image_free(rules, nrrules, mempool);
+      return -1;
+    }
+    obj = (*rules)[i] = (struct rules_t *)&payload[rule.offset];
+    (*nrrules)++;
+
+    obj->ctx.go = NULL;
+    obj->ctx.ret = NULL;
+    obj->userdata = NULL;
+    setval(obj->cont, 0);
+    obj->name = (rule.name == RULES_IMAGE_NONAME) ? NULL : ((struct vm_vchar_t *)&varstack->buffer[rule.name])->value;
+    obj->bc.buffer = (unsigned char *)rules_image_relocate(&header, payload, obj->bc.buffer, getval(obj->bc.bufsize));
+    obj->heap = (struct rule_stack_t *)rules_image_relocate(&header, payload, obj->heap, sizeof(struct rule_stack_t));
+    if(obj->bc.buffer == NULL || obj->heap == NULL ||
+       (obj->heap->buffer = (unsigned char *)rules_image_relocate(&header, payload, obj->heap->buffer, getval(obj->heap->bufsize))) == NULL) {
+      rules_image_free(rules, nrrules, mempool);
+      return -1;
+    }
+  }
+
+  stack = (struct rule_stack_t *)&payload[header.stack];
+  if((stack->buffer = (unsigned char *)rules_image_relocate(&header, payload, stack->buffer, getval(stack->bufsize))) == NULL ||
+     read(arg, &checksum, sizeof(checksum)) != sizeof(checksum) || checksum != io.checksum) {
+    rules_image_free(rules, nrrules, mempool);
+    return -1;
+  }
+
+  return 0;
+}
+
 int8_t rule_initialize(struct pbuf *input, struct rules_t ***rules, uint8_t *nrrules, struct pbuf *mempool, void *userdata) {
   struct pbuf *mempool_rule = NULL;
   uint16_t newlen = getval(input->tot_len), max_varstack_size = 4;
@@ -161,6 +161,13 @@ typedef struct rule_options_t {
   int8_t (*is_variable_cb)(char *text, uint16_t size);
   int8_t (*is_event_cb)(char *text, uint16_t size);
 
+  /*
+   * Binds a variable to a numeric slot when
+   * the rule is parsed, returns -1 if the
+   * variable can't be bound.
+   */
+  int16_t (*vm_value_bind)(char *text, uint16_t size);
+
   int8_t (*vm_value_set)(struct rules_t *obj);
   int8_t (*vm_value_get)(struct rules_t *obj);
 
@@ -173,12 +180,38 @@ typedef struct rule_options_t {
 
 extern struct rule_options_t rule_options;
 
+/*
+ * Counted by rule_run for the last rule it ran, the rules that
+ * one called included: the bytecode steps executed and the most
+ * bytes the value stack held.
+ */
+typedef struct rule_run_stats_t {
+  uint32_t steps;
+  uint16_t stack;
+} rule_run_stats_t;
+
+extern struct rule_run_stats_t rule_run_stats;
+
 const char *rule_by_nr(struct rules_t **rule, uint8_t nrrules, uint8_t nr);
 int8_t rule_by_name(struct rules_t **rule, uint8_t nrrules, char *name);
 int8_t rule_initialize(struct pbuf *input, struct rules_t ***rules, uint8_t *nrrules, struct pbuf *mempool, void *userdata);
 int8_t rule_run(struct rules_t *rule, uint8_t validate);
 void rules_gc(struct rules_t ***rules, uint8_t *nrrules);
 
+/*
+ * A compiled rule set can be written as an image and read back
+ * later without parsing the rules again. The image is only read
+ * when its version, the engine that wrote it and the hash of the
+ * source it was compiled from match and its checksum is right,
+ * otherwise nothing is loaded. The callbacks return the number of
+ * bytes they wrote or read.
+ */
+#define RULES_IMAGE_VERSION 1
+
+uint32_t rules_hash(uint32_t hash, const void *buf, uint16_t len);
+int8_t rules_image_write(struct rules_t **rules, uint8_t nrrules, struct pbuf *mempool, uint32_t source, int (*write)(void *arg, void *buf, uint16_t len), void *arg);
+int8_t rules_image_read(struct rules_t ***rules, uint8_t *nrrules, struct pbuf *mempool, uint32_t source, int (*read)(void *arg, void *buf, uint16_t len), void *arg);
+
 void rules_pushnil(void);
 void rules_pushfloat(float nr);
 void rules_pushinteger(int nr);
@@ -190,6 +223,7 @@ void rules_unref(const char *str);
 int rules_tointeger(int8_t pos);
 float rules_tofloat(int8_t pos);
 const char *rules_tostring(int8_t pos);
+int16_t rules_toslot(int8_t pos);
 
 void rules_remove(int8_t pos);
 uint8_t rules_gettop(void);
@@ -4,6 +4,7 @@
 #include "htmlcode.h"
 #include "commands.h"
 #include "src/common/progmem.h"
+#include "src/common/mem.h"
 #include "src/common/webserver.h"
 #include "src/common/timerqueue.h"
 
@@ -247,6 +248,7 @@ void loadSettings(settingsStruct *heishamonSettings) {
           heishamonSettings->mqtt_tls_enabled = ( jsonDoc[F("mqtt_tls_enabled")] == "enabled" ) ? true : false; 
 #endif
           heishamonSettings->force_rules = ( jsonDoc[F("force_rules")] == "enabled" ) ? true : false;
+          heishamonSettings->coalesceRules = ( jsonDoc[F("coalesceRules")] == "enabled" ) ? true : false;
           heishamonSettings->use_1wire = ( jsonDoc[F("use_1wire")] == "enabled" ) ? true : false;
           heishamonSettings->use_s0 = ( jsonDoc[F("use_s0")] == "enabled" ) ? true : false;
           heishamonSettings->hotspot = ( jsonDoc[F("hotspot")] == "disabled" ) ? false : true; //default to true if not found in settings
@@ -261,6 +263,8 @@ void loadSettings(settingsStruct *heishamonSettings) {
 #endif          
           if ( jsonDoc[F("waitTime")]) heishamonSettings->waitTime = jsonDoc[F("waitTime")];
           if (heishamonSettings->waitTime < 5) heishamonSettings->waitTime = 5;
+          if ( jsonDoc[F("waitTimeMax")]) heishamonSettings->waitTimeMax = jsonDoc[F("waitTimeMax")];
+          if ((heishamonSettings->waitTimeMax > 0) && (heishamonSettings->waitTimeMax < heishamonSettings->waitTime)) heishamonSettings->waitTimeMax = heishamonSettings->waitTime;
           if ( jsonDoc[F("waitDallasTime")]) heishamonSettings->waitDallasTime = jsonDoc[F("waitDallasTime")];
           if (heishamonSettings->waitDallasTime < 5) heishamonSettings->waitDallasTime = 5;
           if ( jsonDoc[F("dallasResolution")]) heishamonSettings->dallasResolution = jsonDoc[F("dallasResolution")];
@@ -458,6 +462,11 @@ void settingsToJson(JsonDocument &jsonDoc, settingsStruct *heishamonSettings) {
   } else {
     jsonDoc[F("force_rules")] = "disabled";
   }
+  if (heishamonSettings->coalesceRules) {
+    jsonDoc[F("coalesceRules")] = "enabled";
+  } else {
+    jsonDoc[F("coalesceRules")] = "disabled";
+  }
   if (heishamonSettings->logMqtt) {
     jsonDoc[F("logMqtt")] = "enabled";
   } else {
@@ -491,6 +500,7 @@ void settingsToJson(JsonDocument &jsonDoc, settingsStruct *heishamonSettings) {
   }
 #endif 
   jsonDoc[F("waitTime")] = heishamonSettings->waitTime;
+  jsonDoc[F("waitTimeMax")] = heishamonSettings->waitTimeMax;
   jsonDoc[F("waitDallasTime")] = heishamonSettings->waitDallasTime;
   jsonDoc[F("dallasResolution")] = heishamonSettings->dallasResolution;
   jsonDoc[F("updateAllTime")] = heishamonSettings->updateAllTime;
@@ -620,6 +630,7 @@ int saveSettings(struct webserver_t *client, settingsStruct *heishamonSettings)
   settingsToJson(jsonDoc, heishamonSettings); //stores current settings in a json document
 
   jsonDoc[F("force_rules")] = String("disabled");
+  jsonDoc[F("coalesceRules")] = String("disabled");
   jsonDoc[F("hotspot")] = String("disabled");
   jsonDoc[F("listenonly")] = String("disabled");
   jsonDoc[F("logMqtt")] = String("disabled");
@@ -666,6 +677,8 @@ int saveSettings(struct webserver_t *client, settingsStruct *heishamonSettings)
       jsonDoc[F("listenonly")] = tmp->value;
     } else if (strcmp(tmp->name.c_str(), "force_rules") == 0) {
       jsonDoc[F("force_rules")] = tmp->value;
+    } else if (strcmp(tmp->name.c_str(), "coalesceRules") == 0) {
+      jsonDoc[F("coalesceRules")] = tmp->value;
     } else if (strcmp(tmp->name.c_str(), "logMqtt") == 0) {
       jsonDoc[F("logMqtt")] = tmp->value;
     } else if (strcmp(tmp->name.c_str(), "logHexdump") == 0) {
@@ -686,6 +699,8 @@ int saveSettings(struct webserver_t *client, settingsStruct *heishamonSettings)
       jsonDoc[F("timezone")] = tmp->value;
     } else if (strcmp(tmp->name.c_str(), "waitTime") == 0) {
       jsonDoc[F("waitTime")] = tmp->value;
+    } else if (strcmp(tmp->name.c_str(), "waitTimeMax") == 0) {
+      jsonDoc[F("waitTimeMax")] = tmp->value;
     } else if (strcmp(tmp->name.c_str(), "waitDallasTime") == 0) {
       jsonDoc[F("waitDallasTime")] = tmp->value;
     } else if (strcmp(tmp->name.c_str(), "updateAllTime") == 0) {
@@ -1069,166 +1084,27 @@ int handleRoot(struct webserver_t *client, float readpercentage, int mqttReconne
   return 0;
 }
 
+/*
+ * The topics are written in whole chunks of what the webserver
+ * sends per loop, client->content - 1 is the next topic to write.
+ * The header goes out alone, so a client never holds more than
+ * one chunk of the webserver pool.
+ */
+#define JSON_CHUNK_SIZE (MTU_SIZE - 16)
+
 int handleJsonOutput(struct webserver_t *client, char* actData, char* actDataExtra, char* actOptData, settingsStruct *heishamonSettings, bool extraDataBlockAvailable) {
-  int extraTopics = extraDataBlockAvailable ? NUMBER_OF_TOPICS_EXTRA : 0; //set to 0 if there is no datablock so we don't run json data for it
-  int numOptTopics = heishamonSettings->optionalPCB ? NUMBER_OF_OPT_TOPICS : 0; //set to 0 if there is no optionalPCB emulation so we don't run json data for it
   if (client->content == 0) {
     webserver_send(client, 200, (char *)"application/json", 0);
-    webserver_send_content_P(client, PSTR("{\"heatpump\":["), 13);
-  } else if ((client->content - 1) < NUMBER_OF_TOPICS) {
-    uint8_t maxTopics =  client->content + 4; //limit the amount of topic sent per webloop
-    for (uint8_t topic = client->content - 1; topic < NUMBER_OF_TOPICS && topic < maxTopics ; topic++) {  
-
-      webserver_send_content_P(client, PSTR("{\"Topic\":\"TOP"), 13);
-
-      {
-        char str[12];
-        itoa(topic, str, 10);
-        webserver_send_content(client, str, strlen(str));
-      }
-
-      webserver_send_content_P(client, PSTR("\",\"Name\":\""), 10);
-
-      webserver_send_content_P(client, topics[topic], strlen_P(topics[topic]));
-
-      if ((topic != 44) && (topic != 92)) { //ERROR topic #44 and #92 are the only one to be a string value
-        webserver_send_content_P(client, PSTR("\",\"Value\":"), 10);
-      }
-      else {
-        webserver_send_content_P(client, PSTR("\",\"Value\":\""), 11);
-      }
-
-      {
-        String dataValue = getDataValue(actData, topic);
-        char* str = (char *)dataValue.c_str();
-        webserver_send_content(client, str, strlen(str));
-      }
-
-      if ((topic != 44) && (topic != 92)) { //ERROR topic #44 and #92 are the only one to be a string value
-        webserver_send_content_P(client, PSTR(",\"Description\":\""), 16);
-      } else {
-        webserver_send_content_P(client, PSTR("\",\"Description\":\""), 17);
-      }
-
-      int maxvalue = atoi(topicDescription[topic][0]);
-      int value = actData[0] == '\0' ? 0 : getDataValue(actData, topic).toInt();
-      if (maxvalue == 0) { //this takes the special case where the description is a real value description instead of a mode, so value should take first index (= 0 + 1)
-        value = 0;
-      }
-      if ((value < 0) || (value > maxvalue)) {
-        webserver_send_content_P(client, _unknown, strlen_P(_unknown));
-      }
-      else {
-        webserver_send_content_P(client, topicDescription[topic][value + 1], strlen_P(topicDescription[topic][value + 1]));
-      }
-
-      webserver_send_content_P(client, PSTR("\"}"), 2);
-
-      if (topic < NUMBER_OF_TOPICS - 1) {
-        webserver_send_content_P(client, PSTR(","), 1);
-      }
-      client->content++;
-    }
-    client->content--; // The webserver also increases by 1
-  } else if ((client->content - NUMBER_OF_TOPICS - 1) < extraTopics) {
-    if (client->content == NUMBER_OF_TOPICS + 1) {
-      webserver_send_content_P(client, PSTR("],\"heatpump extra\":["), 20);
-    }
-    uint8_t maxTopics =  client->content - NUMBER_OF_TOPICS + 4; //limit the amount of topic sent per webloop
-    for (uint8_t topic = (client->content - NUMBER_OF_TOPICS - 1); topic < extraTopics && topic < maxTopics ; topic++) {
-
-      webserver_send_content_P(client, PSTR("{\"Topic\":\"XTOP"), 14);
-
-      {
-        char str[12];
-        itoa(topic, str, 10);
-        webserver_send_content(client, str, strlen(str));
-      }
-
-      webserver_send_content_P(client, PSTR("\",\"Name\":\""), 10);
-
-      webserver_send_content_P(client, xtopics[topic], strlen_P(xtopics[topic]));
-
-      webserver_send_content_P(client, PSTR("\",\"Value\":\""), 11);
-
-      {
-        String dataValue = getDataValueExtra(actDataExtra, topic);
-        char* str = (char *)dataValue.c_str();
-        webserver_send_content(client, str, strlen(str));
-      }
-
-      webserver_send_content_P(client, PSTR("\",\"Description\":\""), 17);
-
-      int maxvalue = atoi(xtopicDescription[topic][0]);
-      int value = actDataExtra[0] == '\0' ? 0 : getDataValueExtra(actDataExtra, topic).toInt();
-      if (maxvalue == 0) { //this takes the special case where the description is a real value description instead of a mode, so value should take first index (= 0 + 1)
-        value = 0;
-      }
-      if ((value < 0) || (value > maxvalue)) {
-        webserver_send_content_P(client, _unknown, strlen_P(_unknown));
-      }
-      else {
-        webserver_send_content_P(client, xtopicDescription[topic][value + 1], strlen_P(xtopicDescription[topic][value + 1]));
-      }
-
-      webserver_send_content_P(client, PSTR("\"}"), 2);
-
-      if (topic < (extraTopics - 1)) {
-        webserver_send_content_P(client, PSTR(","), 1);
-      }
-      client->content++;
-    }
-    client->content--; // The webserver also increases by 1
-  } else if ((client->content - NUMBER_OF_TOPICS - extraTopics - 1) < numOptTopics) {
-    if (client->content == NUMBER_OF_TOPICS + extraTopics + 1) {
-      webserver_send_content_P(client, PSTR("],\"heatpump optional\":["), 23);
-    }
-    uint8_t maxTopics =  client->content - NUMBER_OF_TOPICS + extraTopics + 4; //limit the amount of topic sent per webloop
-    for (uint8_t topic = (client->content - NUMBER_OF_TOPICS - extraTopics - 1); topic < numOptTopics && topic < maxTopics ; topic++) {
-
-      webserver_send_content_P(client, PSTR("{\"Topic\":\"OPT"), 13);
-
-      {
-        char str[12];
-        itoa(topic, str, 10);
-        webserver_send_content(client, str, strlen(str));
-      }
-
-      webserver_send_content_P(client, PSTR("\",\"Name\":\""), 10);
-      webserver_send_content_P(client, optTopics[topic], strlen_P(optTopics[topic]));
-
-      webserver_send_content_P(client, PSTR("\",\"Value\":\""), 11);
-
-      {
-        String dataValue = getOptDataValue(actOptData, topic);
-        char* str = (char *)dataValue.c_str();
-        webserver_send_content(client, str, strlen(str));
-      }
-
-      webserver_send_content_P(client, PSTR("\",\"Description\":\""), 17);
-
-      int maxvalue = atoi(opttopicDescription[topic][0]);
-      int value = actOptData[0] == '\0' ? 0 : getOptDataValue(actOptData, topic).toInt();
-      if (maxvalue == 0) { //this takes the special case where the description is a real value description instead of a mode, so value should take first index (= 0 + 1)
-        value = 0;
-      }
-      if ((value < 0) || (value > maxvalue)) {
-        webserver_send_content_P(client, _unknown, strlen_P(_unknown));
-      }
-      else {
-        webserver_send_content_P(client, opttopicDescription[topic][value + 1], strlen_P(opttopicDescription[topic][value + 1]));
-      }
-
-      webserver_send_content_P(client, PSTR("\"}"), 2);
-
-      if (topic < (numOptTopics - 1)) {
-        webserver_send_content_P(client, PSTR(","), 1);
-      }
-      client->content++;
+  } else if (client->content <= JSON_TOPICS_DONE) {
+    uint16_t item = client->content - 1;
+    char *chunk = webserver_chunk(client);
+    if (chunk == NULL) {
+      return -1;
     }
-    client->content--; // The webserver also increases by 1
-  } else if (client->content == (NUMBER_OF_TOPICS + extraTopics + numOptTopics + 1)) {
-    webserver_send_content_P(client, PSTR("]"), 1);
+    uint16_t len = jsonTopics(chunk, JSON_CHUNK_SIZE, &item, actData, actDataExtra, actOptData, extraDataBlockAvailable, heishamonSettings->optionalPCB);
+    webserver_send_content_nocopy(client, chunk, len);
+    client->content = item; // The webserver also increases by 1
+  } else if (client->content == JSON_TOPICS_DONE + 1) {
     if (heishamonSettings->use_1wire) {
       webserver_send_content_P(client, PSTR(",\"1wire\":"), 9);
       dallasJsonOutput(client);
@@ -1247,6 +1123,20 @@ int handleJsonOutput(struct webserver_t *client, char* actData, char* actDataExt
 }
 
 
+int handleRawOutput(struct webserver_t *client, char* actData, char* actDataExtra, char* actOptData, settingsStruct *heishamonSettings, bool extraDataBlockAvailable) {
+  if (client->content == 0) {
+    uint16_t size = rawValuesSize(extraDataBlockAvailable, heishamonSettings->optionalPCB);
+    uint8_t *buf = (uint8_t *)MALLOC(size);
+    if (buf == NULL) {
+      return -1;
+    }
+    rawValues(buf, actData, actDataExtra, actOptData, extraDataBlockAvailable, heishamonSettings->optionalPCB);
+    webserver_send(client, 200, (char *)"application/octet-stream", size);
+    webserver_send_content_nocopy(client, (char *)buf, size);
+  }
+  return 0;
+}
+
 int showRules(struct webserver_t *client) {
   uint16_t len = 0, len1 = 0;
 
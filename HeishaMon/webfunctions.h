@@ -27,11 +27,13 @@
 #endif
 
 void log_message(char* string);
+void log_loop();
 
 static IPAddress apIP(192, 168, 4, 1);
 
 struct settingsStruct {
   uint16_t waitTime = 5; // how often data is read from heatpump
+  uint16_t waitTimeMax = 0; // read less often, up to this, while nothing changes (0 keeps waitTime)
   uint16_t waitDallasTime = 5; // how often temps are read from 1wire
   uint16_t dallasResolution = 12; // dallas temp resolution (9 to 12)
   uint16_t updateAllTime = 300; // how often all data is resend to mqtt
@@ -57,6 +59,7 @@ struct settingsStruct {
 #endif
 
   bool force_rules = false; //force rules on boot, even after a crash
+  bool coalesceRules = false; //run the rules triggered by a datagram once each after decoding it
   bool listenonly = false; //listen only so heishamon can be installed parallel to cz-taw1, set commands will not work though
   bool optionalPCB = false; //do we emulate an optional PCB?
   bool use_1wire = false; //1wire enabled?
@@ -92,6 +95,7 @@ int8_t webserver_cb(struct webserver_t *client, void *data);
 void getWifiScanResults(int numSsid);
 int handleRoot(struct webserver_t *client, float readpercentage, int mqttReconnects, settingsStruct *heishamonSettings);
 int handleJsonOutput(struct webserver_t *client, char* actData, char* actDataExtra, char* actOptData, settingsStruct *heishamonSettings, bool extraDataBlockAvailable);
+int handleRawOutput(struct webserver_t *client, char* actData, char* actDataExtra, char* actOptData, settingsStruct *heishamonSettings, bool extraDataBlockAvailable);
 int handleFactoryReset(struct webserver_t *client);
 int handleReboot(struct webserver_t *client);
 int handleDebug(struct webserver_t *client, char *hex, byte hex_len);
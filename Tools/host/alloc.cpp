@@ -0,0 +1,43 @@
+/*
+  Counts heap allocations on the host by wrapping the glibc allocator.
+*/
+
+#include <stdlib.h>
+
+#include "alloc.h"
+
+extern "C" {
+  void *__libc_malloc(size_t size);
+  void *__libc_calloc(size_t nmemb, size_t size);
+  void *__libc_realloc(void *ptr, size_t size);
+  void __libc_free(void *ptr);
+}
+
+struct host_alloc_t host_alloc = { 0, 0 };
+
+void host_alloc_reset(void) {
+  host_alloc.count = 0;
+  host_alloc.bytes = 0;
+}
+
+extern "C" void *malloc(size_t size) {
+  host_alloc.count++;
+  host_alloc.bytes += size;
+  return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t nmemb, size_t size) {
+  host_alloc.count++;
+  host_alloc.bytes += nmemb * size;
+  return __libc_calloc(nmemb, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size) {
+  host_alloc.count++;
+  host_alloc.bytes += size;
+  return __libc_realloc(ptr, size);
+}
+
+extern "C" void free(void *ptr) {
+  __libc_free(ptr);
+}
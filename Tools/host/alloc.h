@@ -0,0 +1,20 @@
+/*
+  Counts heap allocations on the host so benchmarks can report
+  how many allocations a code path does.
+*/
+
+#ifndef _HOST_ALLOC_H_
+#define _HOST_ALLOC_H_
+
+#include <stddef.h>
+
+struct host_alloc_t {
+  unsigned long count;
+  unsigned long bytes;
+};
+
+extern struct host_alloc_t host_alloc;
+
+void host_alloc_reset(void);
+
+#endif
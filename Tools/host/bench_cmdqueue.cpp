@@ -0,0 +1,260 @@
+/*
+  Simulates the set commands Home Assistant and the rules send while
+  the heat pump is polled, through the previous first in first out
+  command buffer that dropped commands when full and through the
+  keyed command queue of commandqueue.cpp, once sending set commands
+  right away and once holding them for the merge window.
+
+  Every minute a slider is dragged over the z1 heat request
+  temperature and later over the DHW temperature, sending a command
+  per step, and a scene sets six settings in a quick series of
+  messages. A forced defrost and the heat pump state follow right
+  behind them. The bus takes a
+  datagram at a time and the heat pump polls have priority over the
+  commands, as in the serial task of the ESP32.
+
+  Every datagram sent is checked to sum to zero and applied to the
+  settings of a simulated heat pump, which must end up with the last
+  value asked for each setting.
+
+  Usage: ./bench_cmdqueue [minutes]
+*/
+
+#include "Arduino.h"
+
+#include "commands.h"
+#include "commandqueue.h"
+
+#define STEP 10         // ms
+#define BUS_TIME 250    // ms a datagram and its answer take
+#define POLL_TIME 5000  // ms between polls
+
+typedef struct request_t {
+  uint8_t key;
+  uint8_t flags;
+  uint8_t length;
+  unsigned long at;
+  uint8_t data[COMMANDQUEUE_DATA_SIZE];
+} request_t;
+
+typedef struct result_t {
+  unsigned long requested;
+  unsigned long dropped;
+  unsigned long sent;
+  unsigned long badchk;
+  unsigned long urgent;
+  unsigned long long urgentDelay;
+  unsigned long urgentMax;
+  unsigned long mismatches;
+  unsigned long scene;  // datagrams sent while the scene was pending
+} result_t;
+
+static uint8_t calcChecksum(uint8_t *command, int length) {
+  uint8_t chk = 0;
+  for(int i = 0; i < length; i++) {
+    chk += command[i];
+  }
+  return (chk ^ 0xFF) + 01;
+}
+
+/*
+ * The previous buffer.
+ */
+static request_t fifo[COMMANDQUEUE_SIZE];
+static uint8_t fifoStart = 0;
+static uint8_t fifoNr = 0;
+
+static int8_t findCommand(const char *name) {
+  for(uint8_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+    if(strcmp(commands[i].name, name) == 0) {
+      return i;
+    }
+  }
+  fprintf(stderr, "unknown command %s\n", name);
+  exit(-1);
+}
+
+static void build(request_t *r, const char *name, int value, unsigned long at) {
+  char msg[16], log_msg[256];
+  unsigned char cmd[256] = { 0 };
+  int8_t i = findCommand(name);
+  snprintf(msg, sizeof(msg), "%d", value);
+  r->length = commands[i].func(msg, cmd, log_msg);
+  memcpy(r->data, cmd, r->length);
+  r->key = i + 1;
+  r->flags = commands[i].flags;
+  r->at = at;
+}
+
+static void apply(uint8_t *state, const uint8_t *data, uint8_t length) {
+  if(length != PANASONICQUERYSIZE + 1) {
+    return;
+  }
+  for(uint8_t j = 4; j < PANASONICQUERYSIZE; j++) {
+    if(data[j] != 0) {
+      state[j] = data[j];
+    }
+  }
+}
+
+// whether the datagram carries the settings of the request
+static bool sends(const uint8_t *data, uint8_t length, const request_t *r) {
+  if(length != r->length) {
+    return false;
+  }
+  for(uint8_t j = 4; j < PANASONICQUERYSIZE; j++) {
+    if(r->data[j] != 0 && data[j] != r->data[j]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+ * Requests of the minute starting at t, in the order they are made.
+ */
+static uint8_t load(request_t *out, unsigned long t) {
+  static const char *scene[] = { "SetZ1HeatRequestTemperature", "SetZ2HeatRequestTemperature", "SetDHWTemp", "SetQuietMode", "SetMaxPumpDuty", "SetOperationMode" };
+  static const int sceneMin[] = { 25, 25, 40, 0, 60, 0 };
+  static const int sceneRange[] = { 15, 15, 15, 4, 40, 3 };
+  uint8_t n = 0;
+
+  for(uint8_t s = 0; s < 20; s++) {
+    build(&out[n++], "SetZ1HeatRequestTemperature", 30 + rand() % 10, t + s * 50);
+  }
+  for(uint8_t s = 0; s < 6; s++) {
+    build(&out[n++], scene[s], sceneMin[s] + rand() % sceneRange[s], t + 21500 + s * 15);
+  }
+  build(&out[n++], "SetForceDefrost", 1, t + 22500);
+  for(uint8_t s = 0; s < 20; s++) {
+    build(&out[n++], "SetDHWTemp", 40 + rand() % 10, t + 40000 + s * 50);
+  }
+  build(&out[n++], "SetHeatpump", 1 + rand() % 2, t + 40300);
+  return n;
+}
+
+static void run(result_t *r, bool keyed, uint16_t window, unsigned long minutes) {
+  static request_t requests[64];
+  uint8_t state[PANASONICQUERYSIZE] = { 0 };
+  uint8_t wanted[PANASONICQUERYSIZE] = { 0 };
+  request_t *urgent = NULL;
+  uint8_t datagram[COMMANDQUEUE_DATA_SIZE];
+  unsigned long busyUntil = 0, lastPoll = 0;
+  uint8_t nr = 0, next = 0;
+
+  memset(r, 0, sizeof(result_t));
+  fifoStart = fifoNr = 0;
+  commandQueueBegin(window);
+
+  srand(11);
+  // a few quiet minutes at the end to drain the queue
+  for(unsigned long t = 0; t < (minutes + 2) * 60000; t += STEP) {
+    if(t % 60000 == 0 && t / 60000 < minutes) {
+      nr = load(requests, t);
+      next = 0;
+    }
+    while(next < nr && requests[next].at <= t) {
+      request_t *q = &requests[next++];
+      r->requested++;
+      apply(wanted, q->data, q->length);
+      if(keyed) {
+        if(commandQueuePush(q->data, q->length - 1, q->data[q->length - 1], q->key, q->flags, t) == COMMANDQUEUE_FULL) {
+          r->dropped++;
+        }
+      } else if(fifoNr == COMMANDQUEUE_SIZE) {
+        r->dropped++;
+      } else {
+        memcpy(&fifo[(fifoStart + fifoNr++) % COMMANDQUEUE_SIZE], q, sizeof(request_t));
+      }
+      if(q->flags & CMD_URGENT) {
+        urgent = q;
+      }
+    }
+
+    if(t < busyUntil) {
+      continue;
+    }
+    if(t - lastPoll >= POLL_TIME) {
+      lastPoll = t;
+      busyUntil = t + BUS_TIME;
+      continue;
+    }
+
+    uint8_t length = 0;
+    if(keyed) {
+      length = commandQueuePop(datagram, t);
+    } else if(fifoNr > 0) {
+      request_t *q = &fifo[fifoStart];
+      memcpy(datagram, q->data, q->length);
+      length = q->length;
+      fifoStart = (fifoStart + 1) % COMMANDQUEUE_SIZE;
+      fifoNr--;
+    }
+    if(length == 0) {
+      continue;
+    }
+    r->sent++;
+    if(t % 60000 >= 21500 && t % 60000 < 22500) {
+      r->scene++;
+    }
+    busyUntil = t + BUS_TIME;
+    if(calcChecksum(datagram, length - 1) != datagram[length - 1]) {
+      r->badchk++;
+    }
+    apply(state, datagram, length);
+    if(urgent != NULL && sends(datagram, length, urgent)) {
+      unsigned long delay = t - urgent->at;
+      r->urgent++;
+      r->urgentDelay += delay;
+      if(delay > r->urgentMax) {
+        r->urgentMax = delay;
+      }
+      urgent = NULL;
+    }
+  }
+
+  for(uint8_t j = 4; j < PANASONICQUERYSIZE; j++) {
+    if(state[j] != wanted[j]) {
+      r->mismatches++;
+    }
+  }
+}
+
+static void print(const char *name, result_t *r, unsigned long minutes) {
+  printf("%s %5lu commands, %4lu dropped, %5lu datagrams sent (%.2f per command, %.1f per scene), %lu urgent ones sent after %5.0f ms on average, %5lu ms at most, %lu bad checksums, %lu settings wrong at the end\n",
+    name, r->requested, r->dropped, r->sent, r->requested ? (double)r->sent / r->requested : 0.0, (double)r->scene / minutes,
+    r->urgent, r->urgent ? (double)r->urgentDelay / r->urgent : 0.0, r->urgentMax, r->badchk, r->mismatches);
+}
+
+int main(int argc, char **argv) {
+  unsigned long minutes = (argc > 1) ? strtoul(argv[1], NULL, 10) : 60;
+  result_t fifoResult, keyedResult, windowResult;
+
+  run(&fifoResult, false, 0, minutes);
+  run(&keyedResult, true, 0, minutes);
+  run(&windowResult, true, COMMANDQUEUE_WINDOW, minutes);
+
+  printf("%lu minutes of sliders and scenes, a datagram takes %u ms, polls every %u ms\n", minutes, BUS_TIME, POLL_TIME);
+  print("fifo:  ", &fifoResult, minutes);
+  print("keyed: ", &keyedResult, minutes);
+  print("window:", &windowResult, minutes);
+
+  /*
+   * An urgent command waits for the datagram on the bus and maybe
+   * a poll, but never for the other commands.
+   */
+  result_t *results[] = { &keyedResult, &windowResult };
+  for(uint8_t i = 0; i < 2; i++) {
+    result_t *r = results[i];
+    if(r->dropped > 0 || r->badchk > 0 || r->mismatches > 0 || r->sent > fifoResult.sent ||
+       r->urgent != 2 * minutes || r->urgentMax >= 3 * BUS_TIME) {
+      fprintf(stderr, "the keyed command queue dropped, damaged or lost settings\n");
+      return -1;
+    }
+  }
+  if(windowResult.scene > keyedResult.scene) {
+    fprintf(stderr, "the merge window sends scenes in more datagrams\n");
+    return -1;
+  }
+  return 0;
+}
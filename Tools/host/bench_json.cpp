@@ -0,0 +1,383 @@
+/*
+  Host benchmark of the /json topic output.
+
+  Fills the value caches from a captured datagram and writes the
+  topic arrays of /json with the previous handler, four topics per
+  webserver loop and a send call per fragment, and with the chunked
+  writer of decode.cpp. Checks both produce the same JSON and
+  compares the loop iterations, bytes per iteration, queued send
+  buffers and time. Also parses the /values.bin snapshot of the
+  same datagrams and checks its sequence and entity tag.
+
+  Usage: ./bench_json [frames.txt] [rounds]
+*/
+
+#include <time.h>
+#include <string>
+
+#include "Arduino.h"
+#include "alloc.h"
+#include "frames.h"
+
+#include "decode.h"
+#include "commands.h"
+
+#define MTU_SIZE 1460
+#define JSON_CHUNK_SIZE (MTU_SIZE - 16)
+
+byte optionalPCBQuery[OPTIONALPCBQUERYSIZE];
+const char *mqtt_topic_values = "main";
+const char *mqtt_topic_xvalues = "extra";
+const char *mqtt_topic_pcbvalues = "optional";
+
+void websocket_write_all(char *data, uint16_t data_len) {
+}
+
+uint8_t websocket_clients(void) {
+  return 0;
+}
+
+void rules_topic_cb(uint8_t table, uint16_t nr) {
+}
+
+static void log_message(char *msg) {
+}
+
+static unsigned long long now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * The webserver side, every call to the handler is a loop iteration
+ * and every send queues a buffer, copied to the heap like
+ * webserver_send_content does.
+ */
+typedef struct client_t {
+  uint16_t content;
+  std::string out;
+  unsigned long sends;
+} client_t;
+
+static void send_content(client_t *client, const char *buf, uint16_t len) {
+  char *cpy = (char *)malloc(len + 1);
+  memcpy(cpy, buf, len);
+  client->out.append(cpy, len);
+  client->sends++;
+  free(cpy);
+}
+
+#define send_content_P send_content
+
+/*
+ * handleJsonOutput as it was before, without the HTTP header
+ * and the 1wire, s0 and opentherm trailer.
+ */
+static void legacyJsonOutput(client_t *client, char* actData, char* actDataExtra, char* actOptData, bool optionalPCB, bool extraDataBlockAvailable) {
+  int extraTopics = extraDataBlockAvailable ? NUMBER_OF_TOPICS_EXTRA : 0;
+  int numOptTopics = optionalPCB ? NUMBER_OF_OPT_TOPICS : 0;
+  if (client->content == 0) {
+    send_content_P(client, PSTR("{\"heatpump\":["), 13);
+  } else if ((client->content - 1) < NUMBER_OF_TOPICS) {
+    uint8_t maxTopics =  client->content + 4;
+    for (uint8_t topic = client->content - 1; topic < NUMBER_OF_TOPICS && topic < maxTopics ; topic++) {
+      send_content_P(client, PSTR("{\"Topic\":\"TOP"), 13);
+      {
+        char str[12];
+        sprintf(str, "%d", topic);
+        send_content(client, str, strlen(str));
+      }
+      send_content_P(client, PSTR("\",\"Name\":\""), 10);
+      send_content_P(client, topics[topic], strlen_P(topics[topic]));
+      if ((topic != 44) && (topic != 92)) {
+        send_content_P(client, PSTR("\",\"Value\":"), 10);
+      } else {
+        send_content_P(client, PSTR("\",\"Value\":\""), 11);
+      }
+      {
+        char str[MAX_VALUE_LEN];
+        uint8_t len = formatValue(str, actData, &topicDecode[topic], topicCache[topic].value);
+        send_content(client, str, len);
+      }
+      if ((topic != 44) && (topic != 92)) {
+        send_content_P(client, PSTR(",\"Description\":\""), 16);
+      } else {
+        send_content_P(client, PSTR("\",\"Description\":\""), 17);
+      }
+      int maxvalue = atoi(topicDescription[topic][0]);
+      int value = actData[0] == '\0' ? 0 : topicCache[topic].value;
+      if (maxvalue == 0) {
+        value = 0;
+      }
+      if ((value < 0) || (value > maxvalue)) {
+        send_content_P(client, _unknown, strlen_P(_unknown));
+      } else {
+        send_content_P(client, topicDescription[topic][value + 1], strlen_P(topicDescription[topic][value + 1]));
+      }
+      send_content_P(client, PSTR("\"}"), 2);
+      if (topic < NUMBER_OF_TOPICS - 1) {
+        send_content_P(client, PSTR(","), 1);
+      }
+      client->content++;
+    }
+    client->content--;
+  } else if ((client->content - NUMBER_OF_TOPICS - 1) < extraTopics) {
+    if (client->content == NUMBER_OF_TOPICS + 1) {
+      send_content_P(client, PSTR("],\"heatpump extra\":["), 20);
+    }
+    uint8_t maxTopics =  client->content - NUMBER_OF_TOPICS + 4;
+    for (uint8_t topic = (client->content - NUMBER_OF_TOPICS - 1); topic < extraTopics && topic < maxTopics ; topic++) {
+      send_content_P(client, PSTR("{\"Topic\":\"XTOP"), 14);
+      {
+        char str[12];
+        sprintf(str, "%d", topic);
+        send_content(client, str, strlen(str));
+      }
+      send_content_P(client, PSTR("\",\"Name\":\""), 10);
+      send_content_P(client, xtopics[topic], strlen_P(xtopics[topic]));
+      send_content_P(client, PSTR("\",\"Value\":\""), 11);
+      {
+        char str[MAX_VALUE_LEN];
+        uint8_t len = formatValue(str, actDataExtra, &xtopicDecode[topic], xtopicCache[topic].value);
+        send_content(client, str, len);
+      }
+      send_content_P(client, PSTR("\",\"Description\":\""), 17);
+      int maxvalue = atoi(xtopicDescription[topic][0]);
+      int value = actDataExtra[0] == '\0' ? 0 : xtopicCache[topic].value;
+      if (maxvalue == 0) {
+        value = 0;
+      }
+      if ((value < 0) || (value > maxvalue)) {
+        send_content_P(client, _unknown, strlen_P(_unknown));
+      } else {
+        send_content_P(client, xtopicDescription[topic][value + 1], strlen_P(xtopicDescription[topic][value + 1]));
+      }
+      send_content_P(client, PSTR("\"}"), 2);
+      if (topic < (extraTopics - 1)) {
+        send_content_P(client, PSTR(","), 1);
+      }
+      client->content++;
+    }
+    client->content--;
+  } else if ((client->content - NUMBER_OF_TOPICS - extraTopics - 1) < numOptTopics) {
+    if (client->content == NUMBER_OF_TOPICS + extraTopics + 1) {
+      send_content_P(client, PSTR("],\"heatpump optional\":["), 23);
+    }
+    uint8_t maxTopics =  client->content - NUMBER_OF_TOPICS + extraTopics + 4;
+    for (uint8_t topic = (client->content - NUMBER_OF_TOPICS - extraTopics - 1); topic < numOptTopics && topic < maxTopics ; topic++) {
+      send_content_P(client, PSTR("{\"Topic\":\"OPT"), 13);
+      {
+        char str[12];
+        sprintf(str, "%d", topic);
+        send_content(client, str, strlen(str));
+      }
+      send_content_P(client, PSTR("\",\"Name\":\""), 10);
+      send_content_P(client, optTopics[topic], strlen_P(optTopics[topic]));
+      send_content_P(client, PSTR("\",\"Value\":\""), 11);
+      {
+        char str[MAX_VALUE_LEN];
+        uint8_t len = formatValue(str, actOptData, &optTopicDecode[topic], optTopicCache[topic].value);
+        send_content(client, str, len);
+      }
+      send_content_P(client, PSTR("\",\"Description\":\""), 17);
+      int maxvalue = atoi(opttopicDescription[topic][0]);
+      int value = actOptData[0] == '\0' ? 0 : optTopicCache[topic].value;
+      if (maxvalue == 0) {
+        value = 0;
+      }
+      if ((value < 0) || (value > maxvalue)) {
+        send_content_P(client, _unknown, strlen_P(_unknown));
+      } else {
+        send_content_P(client, opttopicDescription[topic][value + 1], strlen_P(opttopicDescription[topic][value + 1]));
+      }
+      send_content_P(client, PSTR("\"}"), 2);
+      if (topic < (numOptTopics - 1)) {
+        send_content_P(client, PSTR(","), 1);
+      }
+      client->content++;
+    }
+    client->content--;
+  } else if (client->content == (NUMBER_OF_TOPICS + extraTopics + numOptTopics + 1)) {
+    send_content_P(client, PSTR("]"), 1);
+  } else {
+    return;
+  }
+  client->content++;
+}
+
+typedef struct result_t {
+  unsigned long iterations;
+  unsigned long sends;
+  unsigned long long ns;
+  unsigned long allocs;
+  std::string out;
+} result_t;
+
+static void runLegacy(result_t *r, unsigned long rounds, char *actData, char *actDataExtra, char *actOptData, bool extra, bool optional) {
+  *r = result_t();
+  host_alloc_reset();
+  unsigned long long start = now_ns();
+  for(unsigned long i = 0; i < rounds; i++) {
+    client_t client;
+    client.content = 0;
+    client.sends = 0;
+    while(true) {
+      uint16_t content = client.content;
+      legacyJsonOutput(&client, actData, actDataExtra, actOptData, optional, extra);
+      if(client.content == content) {
+        break;
+      }
+      r->iterations++;
+    }
+    r->sends += client.sends;
+    r->out = client.out;
+  }
+  r->ns = now_ns() - start;
+  r->allocs = host_alloc.count;
+}
+
+static void runChunked(result_t *r, unsigned long rounds, char *actData, char *actDataExtra, char *actOptData, bool extra, bool optional) {
+  *r = result_t();
+  host_alloc_reset();
+  unsigned long long start = now_ns();
+  for(unsigned long i = 0; i < rounds; i++) {
+    std::string out;
+    uint16_t item = 0;
+    while(item < JSON_TOPICS_DONE) {
+      // the buffer is handed to the webserver without a copy
+      char *chunk = (char *)malloc(JSON_CHUNK_SIZE);
+      uint16_t len = jsonTopics(chunk, JSON_CHUNK_SIZE, &item, actData, actDataExtra, actOptData, extra, optional);
+      out.append(chunk, len);
+      free(chunk);
+      r->iterations++;
+      r->sends++;
+    }
+    r->out = out;
+  }
+  r->ns = now_ns() - start;
+  r->allocs = host_alloc.count;
+}
+
+/*
+ * Parses a /values.bin snapshot the way a collector
+ * would and checks it against the datagrams.
+ */
+static uint16_t get16(const uint8_t *p) {
+  return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p) {
+  return get16(p) | ((uint32_t)get16(&p[2]) << 16);
+}
+
+static int checkRaw(const char *actData, const char *actDataExtra, const char *actOptData, bool extra, bool optional) {
+  uint8_t buf[RAW_HEADER_SIZE + 2 * DATASIZE + OPTDATASIZE];
+  uint16_t len = rawValues(buf, actData, actDataExtra, actOptData, extra, optional);
+  uint16_t mainlen = get16(&buf[12]), extralen = get16(&buf[14]), optlen = get16(&buf[16]);
+
+  if(len != rawValuesSize(extra, optional) || len != RAW_HEADER_SIZE + mainlen + extralen + optlen ||
+     buf[0] != 'H' || buf[1] != 'M' || buf[2] != RAW_SCHEMA_VERSION ||
+     get32(&buf[4]) != rawBootId || get32(&buf[8]) != rawSequence ||
+     buf[3] != ((extra ? RAW_FLAG_EXTRA : 0) | (optional ? RAW_FLAG_OPTIONAL : 0)) ||
+     mainlen != DATASIZE || extralen != (extra ? DATASIZE : 0) || optlen != (optional ? OPTDATASIZE : 0) ||
+     memcmp(&buf[RAW_HEADER_SIZE], actData, mainlen) != 0 ||
+     memcmp(&buf[RAW_HEADER_SIZE + mainlen], actDataExtra, extralen) != 0 ||
+     memcmp(&buf[RAW_HEADER_SIZE + mainlen + extralen], actOptData, optlen) != 0) {
+    fprintf(stderr, "bad /values.bin snapshot (extra %d, optional %d)\n", extra, optional);
+    return 1;
+  }
+  return 0;
+}
+
+static int checkRawSequence(char *actData, char *actDataExtra, char *actOptData, PubSubClient &mqtt, char *base) {
+  char data[DATASIZE], etag[RAW_ETAG_LEN], etag1[RAW_ETAG_LEN];
+  int errors = 0;
+
+  rawBootId = 0x1234abcd;
+  rawETag(etag, true, false);
+  uint32_t seq = rawSequence;
+
+  // the same datagram again keeps the tag
+  memcpy(data, actData, DATASIZE);
+  decode_heatpump_data(data, actData, mqtt, log_message, base, 300);
+  rawETag(etag1, true, false);
+  if(rawSequence != seq || strcmp(etag, etag1) != 0) {
+    fprintf(stderr, "unchanged datagram changed the sequence\n");
+    errors++;
+  }
+  rawETag(etag1, true, true);
+  if(strcmp(etag, etag1) == 0 || strlen(etag1) >= RAW_ETAG_LEN - 1) {
+    fprintf(stderr, "tag does not follow the flags or is too long: %s\n", etag1);
+    errors++;
+  }
+
+  // a changed byte changes it
+  data[10] ^= 0x01;
+  decode_heatpump_data_extra(data, actDataExtra, mqtt, log_message, base, 300);
+  rawETag(etag1, true, false);
+  if(rawSequence == seq || strcmp(etag, etag1) == 0) {
+    fprintf(stderr, "changed datagram kept the sequence\n");
+    errors++;
+  }
+  return errors;
+}
+
+int main(int argc, char **argv) {
+  const char *file = (argc > 1) ? argv[1] : "frames.txt";
+  unsigned long rounds = (argc > 2) ? strtoul(argv[2], NULL, 10) : 2000;
+  static struct frame_t frames[MAX_FRAMES];
+  int nrframes = frames_load(file, frames, MAX_FRAMES), errors = 0;
+
+  uint8_t *main = NULL;
+  for(int i = 0; i < nrframes; i++) {
+    if(frames[i].len == DATASIZE && frames[i].data[3] == 0x10) {
+      main = frames[i].data;
+      break;
+    }
+  }
+  if(main == NULL) {
+    fprintf(stderr, "no 0x10 datagram found in %s\n", file);
+    return -1;
+  }
+
+  PubSubClient mqtt;
+  char base[] = "panasonic_heat_pump";
+  static char actData[DATASIZE], actDataExtra[DATASIZE], actOptData[OPTDATASIZE];
+  char data[DATASIZE];
+
+  // the same bytes serve as extra and optional datagram, only the values matter
+  memcpy(data, main, DATASIZE);
+  decode_heatpump_data(data, actData, mqtt, log_message, base, 300);
+  decode_heatpump_data_extra(data, actDataExtra, mqtt, log_message, base, 300);
+  decode_optional_heatpump_data(data, actOptData, mqtt, log_message, base, 300);
+
+  static const bool modes[][2] = { { false, false }, { true, false }, { false, true }, { true, true } };
+  for(unsigned int m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+    bool extra = modes[m][0], optional = modes[m][1];
+    errors += checkRaw(actData, actDataExtra, actOptData, extra, optional);
+  }
+  errors += checkRawSequence(actData, actDataExtra, actOptData, mqtt, base);
+
+  for(unsigned int m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+    result_t legacy, chunked;
+    bool extra = modes[m][0], optional = modes[m][1];
+
+    runLegacy(&legacy, rounds, actData, actDataExtra, actOptData, extra, optional);
+    runChunked(&chunked, rounds, actData, actDataExtra, actOptData, extra, optional);
+
+    if(legacy.out != chunked.out) {
+      fprintf(stderr, "output differs (extra %d, optional %d)\n%s\n%s\n", extra, optional, legacy.out.c_str(), chunked.out.c_str());
+      errors++;
+    }
+
+    unsigned long bytes = legacy.out.size();
+    printf("extra %d, optional %d: %lu bytes, /values.bin %u bytes\n", extra, optional, bytes, rawValuesSize(extra, optional));
+    printf("  per topic sends: %3lu iterations, %6.1f bytes/iteration, %4lu buffers, %6.0f ns, %4lu allocations\n",
+      legacy.iterations / rounds, (double)bytes * rounds / legacy.iterations, legacy.sends / rounds, (double)legacy.ns / rounds, legacy.allocs / rounds);
+    printf("  chunked writer:  %3lu iterations, %6.1f bytes/iteration, %4lu buffers, %6.0f ns, %4lu allocations\n",
+      chunked.iterations / rounds, (double)bytes * rounds / chunked.iterations, chunked.sends / rounds, (double)chunked.ns / rounds, chunked.allocs / rounds);
+  }
+
+  return errors > 0 ? -1 : 0;
+}
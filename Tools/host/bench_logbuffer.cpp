@@ -0,0 +1,190 @@
+/*
+  Host stress test and benchmark of the log buffer.
+
+  The stress test logs numbered messages of random length to random
+  sinks while every sink consumes at its own random pace, and checks
+  each sink sees its messages in order, intact, and that every
+  message it missed is counted as dropped. The benchmark compares
+  the cost of logging a message with the previous log_message, which
+  formatted the line on the heap before handing it to the sinks.
+
+  Usage: ./bench_logbuffer [messages]
+*/
+
+#include <time.h>
+
+#include "Arduino.h"
+#include "alloc.h"
+
+#include "logbuffer.h"
+#include "src/common/log.h"
+
+static unsigned long long now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * log_message as it was before the log buffer,
+ * without the actual writes to the sinks.
+ */
+static unsigned long legacy_bytes = 0;
+
+static void legacy_log_message(char *string) {
+  time_t rawtime;
+  rawtime = time(NULL);
+  struct tm *timeinfo = localtime(&rawtime);
+  char timestring[32];
+  strftime(timestring, 32, "%c", timeinfo);
+  size_t len = strlen(string) + strlen(timestring) + 32;
+  char *log_line = (char *)malloc(len);
+  snprintf(log_line, len, "%s (%lu): %s", timestring, millis(), string);
+  legacy_bytes += strlen(log_line);
+  snprintf(log_line, len+12, "{\"logMsg\":\"%s (%lu): %s\"}", timestring, millis(), string);
+  legacy_bytes += strlen(log_line);
+  free(log_line);
+}
+
+static uint16_t makeMessage(char *buf, unsigned long seq, uint16_t pad) {
+  int len = sprintf(buf, "msg %lu ", seq);
+  for(uint16_t i = 0; i < pad; i++) {
+    buf[len++] = 'a' + (seq + i) % 26;
+  }
+  buf[len] = '\0';
+  return len;
+}
+
+static int errors = 0;
+
+typedef struct sink_t {
+  unsigned long produced;
+  unsigned long received;
+  unsigned long dropped;
+  long last;
+} sink_t;
+
+static sink_t sinks[LOG_SINK_NR];
+
+static void consume(uint8_t sink, int nr) {
+  logRecord_t *rec = NULL;
+  char expect[LOGBUFFER_MAX_LEN + 64];
+
+  sinks[sink].dropped += logbufferDropped(sink);
+  while(nr-- > 0 && (rec = logbufferPeek(sink)) != NULL) {
+    unsigned long seq = strtoul(LOGRECORD_TEXT(rec) + 4, NULL, 10);
+    if(!(rec->sinks & (1 << sink))) {
+      fprintf(stderr, "sink %d got message %lu for sinks %x\n", sink, seq, rec->sinks);
+      errors++;
+    }
+    if((long)seq <= sinks[sink].last) {
+      fprintf(stderr, "sink %d got message %lu after %ld\n", sink, seq, sinks[sink].last);
+      errors++;
+    }
+    uint16_t len = makeMessage(expect, seq, 0);
+    makeMessage(expect, seq, strlen(LOGRECORD_TEXT(rec)) - len);
+    if(rec->len != strlen(LOGRECORD_TEXT(rec)) || strcmp(expect, LOGRECORD_TEXT(rec)) != 0) {
+      fprintf(stderr, "sink %d got a damaged message %lu\n", sink, seq);
+      errors++;
+    }
+    sinks[sink].last = seq;
+    sinks[sink].received++;
+    logbufferNext(sink);
+  }
+  sinks[sink].dropped += logbufferDropped(sink);
+}
+
+static void stress(unsigned long messages) {
+  char buf[LOGBUFFER_MAX_LEN + 64];
+
+  srand(4);
+  for(uint8_t i = 0; i < LOG_SINK_NR; i++) {
+    sinks[i].last = -1;
+  }
+  for(unsigned long seq = 0; seq < messages; seq++) {
+    uint16_t pad = (rand() % 8 == 0) ? rand() % (LOGBUFFER_MAX_LEN + 16) : rand() % 48;
+    uint16_t len = makeMessage(buf, seq, pad);
+    uint8_t to = 1 + rand() % LOG_TO_ALL;
+    if(len > LOGBUFFER_MAX_LEN) {
+      // too long messages are truncated, keep them out of the content check
+      len = makeMessage(buf, seq, LOGBUFFER_MAX_LEN - (len - pad));
+    }
+    logbufferAdd(buf, len, to);
+    for(uint8_t i = 0; i < LOG_SINK_NR; i++) {
+      if(to & (1 << i)) {
+        sinks[i].produced++;
+      }
+    }
+    // a slow, a bursty and a fast consumer
+    if(rand() % 4 == 0) {
+      consume(LOG_SINK_SERIAL, 1);
+    }
+    if(rand() % 64 == 0) {
+      consume(LOG_SINK_MQTT, 40);
+    }
+    consume(LOG_SINK_WEBSOCKET, rand() % 3);
+    if(errors > 10) {
+      return;
+    }
+  }
+  for(uint8_t i = 0; i < LOG_SINK_NR; i++) {
+    consume(i, 0x7FFFFFFF);
+    if(sinks[i].received + sinks[i].dropped != sinks[i].produced) {
+      fprintf(stderr, "sink %d: %lu received, %lu dropped, %lu logged\n", i, sinks[i].received, sinks[i].dropped, sinks[i].produced);
+      errors++;
+    }
+  }
+
+  // truncation of messages through the log.cpp functions
+  char longmsg[LOGBUFFER_MAX_LEN * 2];
+  memset(longmsg, 'x', sizeof(longmsg) - 1);
+  longmsg[sizeof(longmsg) - 1] = '\0';
+  logprintf_P(F("%s"), longmsg);
+  logRecord_t *rec = logbufferPeek(LOG_SINK_SERIAL);
+  if(rec == NULL || rec->len != LOGBUFFER_MAX_LEN || logbufferPeek(LOG_SINK_MQTT) != NULL) {
+    fprintf(stderr, "logprintf_P did not truncate or went to mqtt\n");
+    errors++;
+  }
+  for(uint8_t i = 0; i < LOG_SINK_NR; i++) {
+    logbufferSkip(i);
+    logbufferDropped(i);
+  }
+}
+
+int main(int argc, char **argv) {
+  unsigned long messages = (argc > 1) ? strtoul(argv[1], NULL, 10) : 500000;
+  char buf[LOGBUFFER_MAX_LEN + 64];
+
+  stress(messages);
+  printf("stress: %lu messages, serial %lu/%lu, mqtt %lu/%lu, websocket %lu/%lu received/dropped, %d errors\n",
+    messages, sinks[0].received, sinks[0].dropped, sinks[1].received, sinks[1].dropped, sinks[2].received, sinks[2].dropped, errors);
+
+  /*
+   * A decoded datagram logs a hexdump and a line per changed topic.
+   */
+  unsigned long long start = 0, legacy_ns = 0, buffer_ns = 0;
+  unsigned long legacy_allocs = 0, buffer_allocs = 0;
+
+  host_alloc_reset();
+  start = now_ns();
+  for(unsigned long seq = 0; seq < messages; seq++) {
+    makeMessage(buf, seq, seq % 64);
+    legacy_log_message(buf);
+  }
+  legacy_ns = now_ns() - start;
+  legacy_allocs = host_alloc.count;
+
+  host_alloc_reset();
+  start = now_ns();
+  for(unsigned long seq = 0; seq < messages; seq++) {
+    uint16_t len = makeMessage(buf, seq, seq % 64);
+    logbufferAdd(buf, len, LOG_TO_ALL);
+  }
+  buffer_ns = now_ns() - start;
+  buffer_allocs = host_alloc.count;
+
+  printf("heap formatted line: %8.1f ns/message, %.2f allocations/message\n", (double)legacy_ns / messages, (double)legacy_allocs / messages);
+  printf("log buffer:          %8.1f ns/message, %.2f allocations/message\n", (double)buffer_ns / messages, (double)buffer_allocs / messages);
+
+  return errors > 0 ? -1 : 0;
+}
@@ -0,0 +1,191 @@
+/*
+  Host benchmark of the topic and command name lookup.
+
+  Resolves every topic, extra topic, optional topic and command
+  name, in lower case as rules usually write them, with the linear
+  memcpy_P + strnicmp scan the rules parser used before and with the
+  hash indexes from lookup.cpp, and checks both find the same entry.
+
+  Usage: ./bench_lookup [rounds]
+*/
+
+#include <time.h>
+#include <ctype.h>
+
+#include "Arduino.h"
+#include "alloc.h"
+
+#include "decode.h"
+#include "commands.h"
+#include "lookup.h"
+
+#define NUMBER_OF_COMMANDS (sizeof(commands) / sizeof(commands[0]))
+#define NUMBER_OF_OPT_COMMANDS (sizeof(optionalCommands) / sizeof(optionalCommands[0]))
+
+#define TABLE_TOPIC 0
+#define TABLE_XTOPIC 1
+#define TABLE_OPTTOPIC 2
+#define TABLE_COMMAND 3
+#define TABLE_OPTCOMMAND 4
+
+typedef struct name_t {
+  char name[MAX_TOPIC_LEN];
+  uint8_t table;
+  int16_t index;
+} name_t;
+
+static unsigned long long now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * The scan as is_variable and vm_value_get did it
+ */
+static int16_t linearLookup(const char *text, uint16_t size, uint8_t *table) {
+  for(unsigned int x = 0; x < NUMBER_OF_COMMANDS; x++) {
+    cmdStruct cmd;
+    memcpy_P(&cmd, &commands[x], sizeof(cmd));
+    size_t len = strlen(cmd.name);
+    if(size == len && strncasecmp(text, cmd.name, len) == 0) {
+      *table = TABLE_COMMAND;
+      return x;
+    }
+  }
+  for(unsigned int x = 0; x < NUMBER_OF_OPT_COMMANDS; x++) {
+    optCmdStruct cmd;
+    memcpy_P(&cmd, &optionalCommands[x], sizeof(cmd));
+    size_t len = strlen(cmd.name);
+    if(size == len && strncasecmp(text, cmd.name, len) == 0) {
+      *table = TABLE_OPTCOMMAND;
+      return x;
+    }
+  }
+  for(unsigned int x = 0; x < NUMBER_OF_TOPICS; x++) {
+    char cpy[MAX_TOPIC_LEN];
+    memcpy_P(&cpy, topics[x], MAX_TOPIC_LEN);
+    size_t len = strlen(cpy);
+    if(size == len && strncasecmp(text, cpy, len) == 0) {
+      *table = TABLE_TOPIC;
+      return x;
+    }
+  }
+  for(unsigned int x = 0; x < NUMBER_OF_OPT_TOPICS; x++) {
+    char cpy[MAX_TOPIC_LEN];
+    memcpy_P(&cpy, optTopics[x], sizeof(optTopics[x]));
+    size_t len = strlen(cpy);
+    if(size == len && strncasecmp(text, cpy, len) == 0) {
+      *table = TABLE_OPTTOPIC;
+      return x;
+    }
+  }
+  for(unsigned int x = 0; x < NUMBER_OF_TOPICS_EXTRA; x++) {
+    char cpy[MAX_TOPIC_LEN];
+    memcpy_P(&cpy, xtopics[x], MAX_TOPIC_LEN);
+    size_t len = strlen(cpy);
+    if(size == len && strncasecmp(text, cpy, len) == 0) {
+      *table = TABLE_XTOPIC;
+      return x;
+    }
+  }
+  return -1;
+}
+
+static int16_t indexLookup(const char *text, uint16_t size, uint8_t *table) {
+  int16_t i = -1;
+  if((i = lookupCommand(text, size)) >= 0) {
+    *table = TABLE_COMMAND;
+  } else if((i = lookupOptCommand(text, size)) >= 0) {
+    *table = TABLE_OPTCOMMAND;
+  } else if((i = lookupTopic(text, size)) >= 0) {
+    *table = TABLE_TOPIC;
+  } else if((i = lookupOptTopic(text, size)) >= 0) {
+    *table = TABLE_OPTTOPIC;
+  } else if((i = lookupXTopic(text, size)) >= 0) {
+    *table = TABLE_XTOPIC;
+  }
+  return i;
+}
+
+static unsigned int addName(name_t *names, unsigned int nr, const char *name, uint8_t table, int16_t index) {
+  unsigned int i = 0;
+  for(i = 0; i < sizeof(names[nr].name) - 1 && name[i] != '\0'; i++) {
+    names[nr].name[i] = tolower(name[i]);
+  }
+  names[nr].name[i] = '\0';
+  names[nr].table = table;
+  names[nr].index = index;
+  return nr + 1;
+}
+
+int main(int argc, char **argv) {
+  unsigned long rounds = (argc > 1) ? strtoul(argv[1], NULL, 10) : 2000;
+  static name_t names[512];
+  unsigned int nr = 0;
+  int errors = 0;
+
+  for(unsigned int i = 0; i < NUMBER_OF_COMMANDS; i++) {
+    nr = addName(names, nr, commands[i].name, TABLE_COMMAND, i);
+  }
+  for(unsigned int i = 0; i < NUMBER_OF_OPT_COMMANDS; i++) {
+    nr = addName(names, nr, optionalCommands[i].name, TABLE_OPTCOMMAND, i);
+  }
+  for(unsigned int i = 0; i < NUMBER_OF_TOPICS; i++) {
+    nr = addName(names, nr, topics[i], TABLE_TOPIC, i);
+  }
+  for(unsigned int i = 0; i < NUMBER_OF_OPT_TOPICS; i++) {
+    nr = addName(names, nr, optTopics[i], TABLE_OPTTOPIC, i);
+  }
+  for(unsigned int i = 0; i < NUMBER_OF_TOPICS_EXTRA; i++) {
+    nr = addName(names, nr, xtopics[i], TABLE_XTOPIC, i);
+  }
+  // a few unknown names, these cost the linear scan the most
+  nr = addName(names, nr, "unknown_topic", 0xFF, -1);
+  nr = addName(names, nr, "heat_delta_", 0xFF, -1);
+  nr = addName(names, nr, "z1_heat_request_tem", 0xFF, -1);
+
+  /*
+   * Both must resolve every name to the entry the linear scan finds
+   * first, names defined in more than one table resolve to the same
+   * table because both check them in the same order.
+   */
+  for(unsigned int i = 0; i < nr; i++) {
+    uint8_t ta = 0xFF, tb = 0xFF;
+    int16_t a = linearLookup(names[i].name, strlen(names[i].name), &ta);
+    int16_t b = indexLookup(names[i].name, strlen(names[i].name), &tb);
+    if(a != b || (a >= 0 && ta != tb)) {
+      fprintf(stderr, "%s: linear %d/%d, index %d/%d\n", names[i].name, ta, a, tb, b);
+      errors++;
+    }
+  }
+  printf("verify: %u names, %d mismatches\n", nr, errors);
+
+  unsigned long long start = 0, linear_ns = 0, index_ns = 0;
+  unsigned long found = 0;
+
+  start = now_ns();
+  for(unsigned long r = 0; r < rounds; r++) {
+    for(unsigned int i = 0; i < nr; i++) {
+      uint8_t table = 0;
+      found += linearLookup(names[i].name, strlen(names[i].name), &table) >= 0;
+    }
+  }
+  linear_ns = now_ns() - start;
+
+  host_alloc_reset();
+  start = now_ns();
+  for(unsigned long r = 0; r < rounds; r++) {
+    for(unsigned int i = 0; i < nr; i++) {
+      uint8_t table = 0;
+      found += indexLookup(names[i].name, strlen(names[i].name), &table) >= 0;
+    }
+  }
+  index_ns = now_ns() - start;
+
+  printf("lookups: %lu, found: %lu\n", rounds * nr, found / 2);
+  printf("linear scan: %8.1f ns/lookup\n", (double)linear_ns / (rounds * nr));
+  printf("hash index:  %8.1f ns/lookup, %lu allocations\n", (double)index_ns / (rounds * nr), host_alloc.count);
+
+  return errors > 0 ? -1 : 0;
+}
@@ -0,0 +1,200 @@
+/*
+  Simulates a heat pump over a number of days and polls it at the
+  fixed interval and with the adaptive poll scheduler, and compares
+  the polls, MQTT publishes and how long it takes to see a compressor
+  start, defrost or three way valve switch.
+
+  The heat pump idles with slowly drifting temperatures, runs its
+  compressor for a while every hour with a defrost now and then, and
+  heats the tank a few times a day. The main datagram of the frames
+  file is the starting point.
+
+  Usage: ./bench_poll [frames.txt] [days] [min seconds] [max seconds]
+*/
+
+#include "Arduino.h"
+#include "frames.h"
+
+#include "decode.h"
+#include "commands.h"
+#include "pollscheduler.h"
+
+byte optionalPCBQuery[OPTIONALPCBQUERYSIZE];
+const char *mqtt_topic_values = "main";
+const char *mqtt_topic_xvalues = "extra";
+const char *mqtt_topic_pcbvalues = "optional";
+
+void websocket_write_all(char *data, uint16_t data_len) {
+}
+
+uint8_t websocket_clients(void) {
+  return 0;
+}
+
+void rules_topic_cb(uint8_t table, uint16_t nr) {
+}
+
+static void log_message(char *msg) {
+}
+
+// bytes of the main datagram
+#define BYTE_OPMODE 6
+#define BYTE_VALVES 111  // three way valve in bits 0-1, defrost in bits 2-3
+#define BYTE_COMPRESSOR 166
+
+typedef struct heatpump_t {
+  char data[DATASIZE];
+  unsigned long transitionAt;  // seconds, 0 when seen
+} heatpump_t;
+
+typedef struct delay_t {
+  unsigned long transitions;
+  unsigned long long delay;   // seconds from a transition to the poll that saw it
+  unsigned long maxDelay;
+} delay_t;
+
+typedef struct result_t {
+  unsigned long polls;
+  unsigned long published;
+  delay_t idle;               // the transitions of a heat pump seen idle, compressor starts mostly
+  delay_t running;
+} result_t;
+
+static void drift(heatpump_t *hp, uint8_t pos, int step) {
+  hp->data[pos] += step;
+}
+
+static void setValves(heatpump_t *hp, bool dhw, bool defrost, unsigned long t) {
+  uint8_t v = (hp->data[BYTE_VALVES] & 0xF0) | (dhw ? 2 : 1) | ((defrost ? 2 : 1) << 2);
+  if((uint8_t)hp->data[BYTE_VALVES] != v) {
+    hp->data[BYTE_VALVES] = v;
+    if(hp->transitionAt == 0) {
+      hp->transitionAt = t;
+    }
+  }
+}
+
+static void setCompressor(heatpump_t *hp, uint8_t hz, unsigned long t) {
+  bool was = (uint8_t)hp->data[BYTE_COMPRESSOR] > 1;
+  hp->data[BYTE_COMPRESSOR] = hz + 1;
+  if(was != (hz > 0) && hp->transitionAt == 0) {
+    hp->transitionAt = t;
+  }
+}
+
+/*
+ * Moves the heat pump one second ahead.
+ */
+static void step(heatpump_t *hp, unsigned long t) {
+  unsigned long hour = t % 3600;
+  unsigned long day = t % 86400;
+  bool dhw = (day % 28800) < 1800;
+  bool running = dhw || hour < 1200;
+  bool defrost = running && !dhw && hour >= 600 && hour < 780 && (t / 3600) % 3 == 0;
+
+  setValves(hp, dhw, defrost, t);
+  if(running) {
+    if(t % 15 == 0) {
+      setCompressor(hp, 30 + rand() % 40, t);
+    }
+    if(t % 20 == 0) {
+      drift(hp, 139, (rand() & 1) ? 1 : -1);
+      drift(hp, 140, (rand() & 1) ? 1 : -1);
+      drift(hp, 153, (rand() & 1) ? 1 : -1);
+    }
+  } else {
+    setCompressor(hp, 0, t);
+    if(t % 240 == 0) {
+      drift(hp, 143, (rand() & 1) ? 1 : -1);
+    }
+  }
+}
+
+static void run(result_t *r, struct frame_t *frame, unsigned long days, uint16_t minSeconds, uint16_t maxSeconds) {
+  static char actData[DATASIZE];
+  PubSubClient mqtt;
+  heatpump_t hp;
+  char base[] = "panasonic_heat_pump";
+
+  memcpy(hp.data, frame->data, DATASIZE);
+  hp.transitionAt = 0;
+  memset(actData, 0, sizeof(actData));
+  memset(r, 0, sizeof(result_t));
+  resetlastalldatatime();
+  pollSchedulerBegin(minSeconds, maxSeconds);
+
+  srand(7);
+  for(unsigned long t = 1; t <= days * 86400; t++) {
+    host_clock_advance(1000000);
+    step(&hp, t);
+    if(!pollSchedulerDue(POLL_MAIN, millis())) {
+      continue;
+    }
+    // the answer arrives within the second
+    r->polls++;
+    uint32_t state = heatpumpState(actData);
+    unsigned int changed = decode_heatpump_data(hp.data, actData, mqtt, log_message, base, 300);
+    uint32_t newState = heatpumpState(actData);
+    bool transition = newState != state;
+    pollSchedulerUpdate(POLL_MAIN, changed, transition, (newState & HEATPUMP_STATE_RUNNING) != 0, millis());
+    if(hp.transitionAt != 0 && transition) {
+      delay_t *d = (state & HEATPUMP_STATE_RUNNING) ? &r->running : &r->idle;
+      unsigned long delay = t - hp.transitionAt;
+      d->transitions++;
+      d->delay += delay;
+      if(delay > d->maxDelay) {
+        d->maxDelay = delay;
+      }
+      hp.transitionAt = 0;
+    }
+  }
+  r->published = mqtt.published;
+}
+
+static void print(const char *name, result_t *r, unsigned long days) {
+  printf("%s %6.0f polls/day, %7.0f publishes/day, transitions seen late on average/at most: %lu from idle %4.1f/%3lu s, %lu while running %4.1f/%3lu s\n",
+    name, (double)r->polls / days, (double)r->published / days,
+    r->idle.transitions, r->idle.transitions ? (double)r->idle.delay / r->idle.transitions : 0.0, r->idle.maxDelay,
+    r->running.transitions, r->running.transitions ? (double)r->running.delay / r->running.transitions : 0.0, r->running.maxDelay);
+}
+
+int main(int argc, char **argv) {
+  const char *file = (argc > 1) ? argv[1] : "frames.txt";
+  unsigned long days = (argc > 2) ? strtoul(argv[2], NULL, 10) : 7;
+  uint16_t minSeconds = (argc > 3) ? atoi(argv[3]) : 5;
+  uint16_t maxSeconds = (argc > 4) ? atoi(argv[4]) : 60;
+  static struct frame_t frames[MAX_FRAMES];
+  int nrframes = frames_load(file, frames, MAX_FRAMES);
+  struct frame_t *frame = NULL;
+
+  for(int f = 0; f < nrframes; f++) {
+    if(frames[f].len == DATASIZE && frames[f].data[3] == 0x10) {
+      frame = &frames[f];
+      break;
+    }
+  }
+  if(frame == NULL) {
+    fprintf(stderr, "no main datagram found in %s\n", file);
+    return -1;
+  }
+
+  result_t fixed, adaptive;
+  run(&fixed, frame, days, minSeconds, minSeconds);
+  run(&adaptive, frame, days, minSeconds, maxSeconds);
+
+  printf("%lu days, polling every %u s or between %u and %u s\n", days, minSeconds, minSeconds, maxSeconds);
+  print("fixed:   ", &fixed, days);
+  print("adaptive:", &adaptive, days);
+
+  /*
+   * A transition out of idle is seen at the next poll, up to the
+   * maximum interval late. While the compressor runs the interval
+   * stays close to the minimum.
+   */
+  if(adaptive.polls > fixed.polls || adaptive.idle.maxDelay > maxSeconds ||
+     adaptive.running.maxDelay > POLL_RUNNING_FACTOR * minSeconds) {
+    fprintf(stderr, "the adaptive scheduler polls more or reacts too late\n");
+    return -1;
+  }
+  return 0;
+}
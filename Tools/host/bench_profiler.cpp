@@ -0,0 +1,170 @@
+/*
+  Runs the loop profiler over simulated loop iterations with known
+  section times, and compares the min, avg, max and p99 it reports
+  for the last window with the ones of the samples themselves.
+
+  The webserver, mqtt and heat pump sections take a random time each
+  iteration, mqtt stalls on a reconnect now and then and so does the
+  webserver on a large upload, and the stats section runs every few
+  seconds. The iterations over budget have to be blamed on the stalled
+  section, and the ones that stalled while waiting for the heat pump
+  counted as serial stalls. It also measures the cost of a mark.
+
+  Usage: ./bench_profiler [minutes]
+*/
+
+#include <time.h>
+#include <vector>
+#include <algorithm>
+
+#include "Arduino.h"
+
+#include "profiler.h"
+
+static unsigned long long now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+typedef struct window_t {
+  std::vector<uint32_t> samples[PROFILE_NR + 1];
+  uint32_t stalls[PROFILE_NR];
+  uint32_t serialStalls;
+} window_t;
+
+static void clear(window_t *w) {
+  for(uint8_t i = 0; i <= PROFILE_NR; i++) {
+    w->samples[i].clear();
+  }
+  memset(w->stalls, 0, sizeof(w->stalls));
+  w->serialStalls = 0;
+}
+
+static uint32_t section(window_t *w, uint8_t id, uint32_t us) {
+  host_clock_advance(us);
+  profilerMark(id);
+  w->samples[id].push_back(us);
+  return us;
+}
+
+/*
+ * The profiler also sees the few microseconds the host takes
+ * itself, so allow a little slack.
+ */
+static int compare(window_t *w, const char *name, uint8_t id) {
+  std::vector<uint32_t> &s = w->samples[id];
+  const profileSummary_t *p = profilerSummary(id);
+  if(s.empty()) {
+    return 0;
+  }
+  std::sort(s.begin(), s.end());
+  unsigned long long sum = 0;
+  for(uint32_t v : s) {
+    sum += v;
+  }
+  uint32_t min = s.front(), max = s.back(), avg = sum / s.size();
+  uint32_t p99 = s[(s.size() * 99 + 99) / 100 - 1];
+  uint32_t slack = 100 + avg / 50;
+  printf("  %-9s %7zu runs: min %6u/%6u avg %6u/%6u max %6u/%6u p99 %6u/%6u us, %u/%u blamed\n", name, s.size(),
+    min, p->min, avg, p->avg, max, p->max, p99, p->p99, id < PROFILE_NR ? w->stalls[id] : 0, p->blamed);
+
+  if(p->count != s.size() || p->min + slack < min || p->min > min + slack || p->max + slack < max || p->max > max + slack ||
+     p->avg + slack < avg || p->avg > avg + slack || p->p99 + slack < p99 || p->p99 > 2 * p99 + 16 + slack ||
+     (id < PROFILE_NR && p->blamed != w->stalls[id])) {
+    fprintf(stderr, "the profile of %s is off\n", name);
+    return 1;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  unsigned long minutes = (argc > 1) ? strtoul(argv[1], NULL, 10) : 10;
+  static const char *names[] = { "webserver", "wifi", "ota", "mqtt", "opentherm", "heatpump", "dallas", "s0", "stats", "timers", "log", "loop" };
+  window_t w, closed;
+  unsigned long iterations = 0, lastStats = 0;
+  profileSummary_t before;
+  int errors = 0;
+
+  clear(&w);
+  clear(&closed);
+  srand(3);
+  while(millis() < minutes * 60000) {
+    bool serialBusy = (iterations / 300) % 2 == 0;
+    uint32_t took = 0;
+    uint8_t stalled = PROFILE_NR;
+
+    profilerLoopStart();
+    uint32_t web = section(&w, PROFILE_WEBSERVER, (iterations % 2000 == 1999) ? 400000 : 50 + rand() % 250);
+    took += web;
+    took += section(&w, PROFILE_WIFI, 5);
+    took += section(&w, PROFILE_OTA, 10);
+    uint32_t mqtt = section(&w, PROFILE_MQTT, (iterations % 500 == 499) ? 120000 : 100 + rand() % 1900);
+    took += mqtt;
+    took += section(&w, PROFILE_HEATPUMP, 20 + rand() % 480);
+    if(millis() - lastStats >= 5000) {
+      lastStats = millis();
+      took += section(&w, PROFILE_STATS, 8000);
+    }
+    took += section(&w, PROFILE_LOG, 30);
+    took += section(&w, PROFILE_TIMERS, 15);
+
+    if(web > mqtt && web > 100000) {
+      stalled = PROFILE_WEBSERVER;
+    } else if(mqtt > 100000) {
+      stalled = PROFILE_MQTT;
+    }
+    if(took > PROFILE_BUDGET_US && stalled < PROFILE_NR) {
+      w.stalls[stalled]++;
+    }
+    if(serialBusy && took > PROFILE_SERIAL_STALL_US) {
+      w.serialStalls++;
+    }
+    w.samples[PROFILE_LOOP].push_back(took);
+
+    memcpy(&before, profilerSummary(PROFILE_LOOP), sizeof(before));
+    profilerLoopEnd(serialBusy);
+    if(memcmp(&before, profilerSummary(PROFILE_LOOP), sizeof(before)) != 0) {
+      // the window closed with this iteration
+      closed = w;
+      clear(&w);
+    }
+    iterations++;
+  }
+
+  printf("%lu iterations in %lu minutes, the last complete window (profiled/actual):\n", iterations, minutes);
+  for(uint8_t i = 0; i <= PROFILE_NR; i++) {
+    errors += compare(&closed, names[i], i);
+  }
+
+  char json[PROFILE_JSON_SIZE];
+  profilerJson(json, sizeof(json));
+  printf("  %s\n", json);
+  uint32_t serialStalls = 0;
+  if(sscanf(strstr(json, "\"serial stalls\":"), "\"serial stalls\":%u", &serialStalls) != 1 || serialStalls != closed.serialStalls) {
+    fprintf(stderr, "%u serial stalls profiled, %u happened\n", serialStalls, closed.serialStalls);
+    errors++;
+  }
+
+  unsigned long marks = 10000000;
+  unsigned long long start = now_ns();
+  for(unsigned long i = 0; i < marks / PROFILE_NR; i++) {
+    profilerLoopStart();
+    for(uint8_t s = 0; s < PROFILE_NR; s++) {
+      profilerMark(s);
+    }
+    profilerLoopEnd(false);
+  }
+  printf("%.1f ns per mark, loop start and end included\n", (double)(now_ns() - start) / marks);
+
+  // the JSON has to fit with every figure at its maximum
+  for(uint8_t i = 0; i <= PROFILE_NR; i++) {
+    memset((profileSummary_t *)profilerSummary(i), 0xFF, sizeof(profileSummary_t));
+  }
+  size_t len = profilerJson(json, sizeof(json));
+  if(len + 1 >= sizeof(json) || json[len - 1] != '}') {
+    fprintf(stderr, "the profile does not fit PROFILE_JSON_SIZE: %s\n", json);
+    errors++;
+  }
+  return errors > 0 ? -1 : 0;
+}
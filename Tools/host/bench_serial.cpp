@@ -0,0 +1,418 @@
+/*
+  Host test and benchmark of the serial frame parser.
+
+  Every poll the heat pump answers with one of the datagrams of the
+  frames file, which now and then is preceded by line noise or by a
+  truncated datagram, or has a damaged byte. The answer arrives in
+  chunks of random size, as readSerial() finds it in the UART buffer,
+  and whatever is still pending at the end of the poll is dropped as
+  the read timeout does. The previous readSerial, which threw away
+  everything it had read on a bad header, and the ring buffer parser
+  get the same stream, and the intact datagrams each recovers are
+  compared, as is the time per byte, with and without the noise.
+
+  The command builders keep the checksum of the datagram up to date
+  as they set its bytes. Every command is built and checked to sum
+  to zero, and compared with summing the datagram again afterwards
+  as send_command did.
+
+  The latency histograms are fed answers that take a known time,
+  read by a loop that now and then stalls, and the response time
+  they estimate is compared with the one the heat pump took.
+
+  Usage: ./bench_serial [frames.txt] [polls]
+*/
+
+#include <time.h>
+
+#include "Arduino.h"
+#include "frames.h"
+
+#include "serialframe.h"
+#include "serialstats.h"
+#include "commands.h"
+
+static unsigned long long now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+typedef struct result_t {
+  unsigned long good;
+  unsigned long badheader;
+  unsigned long toolong;
+  unsigned long badcrc;
+  unsigned long recovered;  // good frames equal to the one sent
+  unsigned long accepted;   // good frames that were never sent
+  unsigned long long bytes;
+  unsigned long long ns;
+} result_t;
+
+static struct frame_t frames[MAX_FRAMES];
+static int nrframes = 0;
+
+static void check(result_t *r, const char *data, uint16_t len) {
+  for(int f = 0; f < nrframes; f++) {
+    if(frames[f].len == len && memcmp(frames[f].data, data, len) == 0) {
+      r->recovered++;
+      return;
+    }
+  }
+  r->accepted++;
+}
+
+/*
+ * readSerial as it was before the ring buffer,
+ * without the logging and the decoders.
+ */
+#define MAXDATASIZE 255
+static char data[MAXDATASIZE];
+static uint8_t data_length = 0;
+
+static bool isValidReceiveChecksum(char *check_data, uint8_t check_length) {
+  uint8_t chk = 0;
+  for(int i = 0; i < check_length; i++) {
+    chk += check_data[i];
+  }
+  return (chk == 0);
+}
+
+static size_t legacy_read(result_t *r, const uint8_t *in, size_t avail) {
+  int len = 0;
+  while(((size_t)len < avail) && ((data_length + len) < MAXDATASIZE)) {
+    data[data_length + len] = in[len];
+    len++;
+  }
+  data_length += len;
+
+  if(data_length > 3) {
+    if(((data[0] != 0x71) && (data[0] != 0x31)) || (data[2] != 0x01)) {
+      r->badheader++;
+      data_length = 0;
+      return len;
+    }
+    if((data_length > ((uint8_t)data[1] + 3)) || (data_length >= MAXDATASIZE)) {
+      data_length = 0;
+      r->toolong++;
+      return len;
+    }
+    if(data_length == ((uint8_t)data[1] + 3)) {
+      if(!isValidReceiveChecksum(data, data_length)) {
+        data_length = 0;
+        r->badcrc++;
+        return len;
+      }
+      r->good++;
+      check(r, data, data_length);
+      data_length = 0;
+    }
+  }
+  return len;
+}
+
+static void legacy_drop(void) {
+  data_length = 0;
+}
+
+static serialFrame_t serialFrame;
+
+static size_t ring_read(result_t *r, const uint8_t *in, size_t avail) {
+  size_t len = 0;
+  while((len < avail) && (serialFrameRoom(&serialFrame) > 0)) {
+    serialFramePut(&serialFrame, in[len++]);
+  }
+  uint8_t result = SERIALFRAME_NONE;
+  while((result = serialFrameParse(&serialFrame)) != SERIALFRAME_NONE) {
+    switch(result) {
+      case SERIALFRAME_OK:
+        r->good++;
+        check(r, serialFrame.frame, serialFrame.len);
+      break;
+      case SERIALFRAME_BADHEADER:
+        r->badheader++;
+      break;
+      case SERIALFRAME_TOOLONG:
+        r->toolong++;
+      break;
+      case SERIALFRAME_BADCRC:
+        r->badcrc++;
+      break;
+    }
+  }
+  return len;
+}
+
+static void ring_drop(void) {
+  serialFrameDrop(&serialFrame);
+}
+
+/*
+ * The answer of one poll, returns the number of bytes
+ * and whether it holds an intact datagram.
+ */
+static size_t answer(uint8_t *out, bool *intact, bool noise) {
+  size_t len = 0;
+  struct frame_t *f = &frames[rand() % nrframes];
+
+  *intact = true;
+  if(!noise) {
+    memcpy(out, f->data, f->len);
+    return f->len;
+  }
+  if(rand() % 5 == 0) {
+    int noise = 1 + rand() % 8;
+    while(noise-- > 0) {
+      out[len++] = rand();
+    }
+  }
+  if(rand() % 10 == 0) {
+    struct frame_t *t = &frames[rand() % nrframes];
+    int cut = 1 + rand() % (t->len - 1);
+    memcpy(&out[len], t->data, cut);
+    len += cut;
+  }
+  memcpy(&out[len], f->data, f->len);
+  if(rand() % 20 == 0) {
+    out[len + 3 + rand() % (f->len - 3)] ^= 1 << (rand() % 8);
+    *intact = false;
+  }
+  return len + f->len;
+}
+
+static void run(result_t *r, size_t (*reader)(result_t *, const uint8_t *, size_t), void (*drop)(void), unsigned long polls, unsigned long *intact, bool noise) {
+  uint8_t stream[2 * MAX_FRAME_SIZE + 8];
+
+  srand(6);
+  *intact = 0;
+  unsigned long long start = now_ns();
+  for(unsigned long p = 0; p < polls; p++) {
+    bool ok = false;
+    size_t len = answer(stream, &ok, noise), pos = 0;
+    if(ok) {
+      (*intact)++;
+    }
+    r->bytes += len;
+    while(pos < len) {
+      size_t chunk = 1 + rand() % 64;
+      if(chunk > len - pos) {
+        chunk = len - pos;
+      }
+      pos += reader(r, &stream[pos], chunk);
+    }
+    drop();
+  }
+  r->ns = now_ns() - start;
+}
+
+/*
+ * Builds every command and checks its datagram, the builder
+ * wrote the checksum while setting the bytes, the previous
+ * send_command summed the datagram again when sending it.
+ */
+static uint8_t calcChecksum(uint8_t *command, int length) {
+  uint8_t chk = 0;
+  for(int i = 0; i < length; i++) {
+    chk += command[i];
+  }
+  chk = (chk ^ 0xFF) + 01;
+  return chk;
+}
+
+static int commandChecksums(unsigned long rounds) {
+  static const char *values[] = { "0", "1", "3", "-5", "42", "{\"zone1\":{\"heat\":{\"target\":{\"high\":35,\"low\":25}}}}" };
+  uint8_t nrvalues = sizeof(values) / sizeof(values[0]);
+  uint8_t nrcommands = sizeof(commands) / sizeof(commands[0]);
+  unsigned char cmd[256];
+  char msg[128], log_msg[256];
+  int errors = 0;
+
+  uint8_t query[PANASONICQUERYSIZE];
+  memcpy(query, panasonicQuery, PANASONICQUERYSIZE);
+  query[3] = 0x10;
+  if(calcChecksum(query, PANASONICQUERYSIZE) != PANASONICQUERYCHK) {
+    fprintf(stderr, "PANASONICQUERYCHK is not the checksum of the query\n");
+    errors++;
+  }
+  query[3] = 0x21;
+  if(calcChecksum(query, PANASONICQUERYSIZE) != PANASONICEXTRAQUERYCHK) {
+    fprintf(stderr, "PANASONICEXTRAQUERYCHK is not the checksum of the extra query\n");
+    errors++;
+  }
+
+  for(uint8_t i = 0; i < nrcommands; i++) {
+    for(uint8_t v = 0; v < nrvalues; v++) {
+      strcpy(msg, values[v]);
+      unsigned int len = commands[i].func(msg, cmd, log_msg);
+      if(len == 0) {
+        continue;
+      }
+      if(calcChecksum(cmd, len - 1) != cmd[len - 1]) {
+        fprintf(stderr, "%s %s: checksum %02x, expected %02x\n", commands[i].name, values[v], cmd[len - 1], calcChecksum(cmd, len - 1));
+        errors++;
+      }
+    }
+  }
+
+  unsigned long long start = 0, built_ns = 0, summed_ns = 0;
+  unsigned long nr = 0;
+  volatile uint8_t sink = 0;
+
+  start = now_ns();
+  for(unsigned long r = 0; r < rounds / 100; r++) {
+    for(uint8_t i = 0; i < nrcommands; i++) {
+      strcpy(msg, values[r % 3]);
+      unsigned int len = commands[i].func(msg, cmd, log_msg);
+      sink = sink + cmd[len - 1];
+      nr++;
+    }
+  }
+  built_ns = now_ns() - start;
+
+  start = now_ns();
+  for(unsigned long r = 0; r < rounds / 100; r++) {
+    for(uint8_t i = 0; i < nrcommands; i++) {
+      strcpy(msg, values[r % 3]);
+      unsigned int len = commands[i].func(msg, cmd, log_msg);
+      sink = sink + calcChecksum(cmd, len - 1);
+    }
+  }
+  summed_ns = now_ns() - start;
+
+  printf("%lu commands, %d with a wrong checksum\n", nr, errors);
+  printf("checksum while building: %6.1f ns/command\n", (double)built_ns / nr);
+  printf("summed again when sent:  %6.1f ns/command\n", (double)summed_ns / nr);
+  return errors;
+}
+
+/*
+ * Every 5 seconds a request goes out, every tenth a set command,
+ * and the heat pump starts its answer 20 to 80 ms later, now and
+ * then only after 600 ms. The loop looks at the UART every 1 to
+ * 20 ms and stalls for 300 ms every 20 iterations.
+ */
+static int latencyHistograms(unsigned long polls) {
+  unsigned long long t = 0, response = 0, naive = 0, measured = 0;
+  int errors = 0;
+
+  srand(5);
+  for(unsigned long p = 0; p < polls; p++) {
+    unsigned long long sent = t;
+    unsigned long long first = sent + (20 + rand() % 60) * 1000ULL + ((rand() % 50 == 0) ? 600000ULL : 0);
+    uint16_t read = 0;
+
+    uint32_t stalled = serialStatsStalled();
+    serialStatsSent(p % 10 == 0, sent / 1000);
+    while(read < DATASIZE) {
+      t += (rand() % 20 == 0) ? 300000 : 1000 + rand() % 19000;
+      uint16_t avail = (t < first) ? 0 : (t - first) / SERIALSTATS_BYTE_US + 1;
+      if(avail > DATASIZE) {
+        avail = DATASIZE;
+      }
+      if(avail > read) {
+        if(read == 0) {
+          naive += (t - sent) / 1000;
+        }
+        serialStatsRead(avail - read, t / 1000);
+        read = avail;
+      }
+    }
+    serialStatsFrame(t / 1000);
+    response += (first - sent) / 1000;
+    if(serialStatsStalled() == stalled) {
+      measured += (first - sent) / 1000;
+    }
+    t = sent + 5000000;
+  }
+
+  const histogram_t *r = serialStatsGet(SERIALSTATS_RESPONSE);
+  const histogram_t *c = serialStatsGet(SERIALSTATS_COMMAND);
+  const histogram_t *b = serialStatsGet(SERIALSTATS_BACKLOG);
+  double took = r->count ? (double)measured / r->count : 0;
+  double estimated = r->count ? (double)r->sum / r->count : 0;
+  printf("%lu answers taking %.1f ms on average, seen %.1f ms after the request by the loop\n", polls, (double)response / polls, (double)naive / polls);
+  printf("histograms: %lu responses estimated at %.1f ms that took %.1f ms, %lu read in one go after a stall, %.1f ms backlog, %lu commands answered after %.1f ms\n",
+    (unsigned long)r->count, estimated, took, (unsigned long)serialStatsStalled(), b->count ? (double)b->sum / b->count : 0.0,
+    (unsigned long)c->count, c->count ? (double)c->sum / c->count : 0.0);
+  if(r->count + serialStatsStalled() != polls || c->count != (polls + 9) / 10 || estimated < took - 2 || estimated > took + 2) {
+    fprintf(stderr, "the response time histogram is off\n");
+    errors++;
+  }
+
+  // the JSON has to fit with every counter at its maximum
+  for(uint8_t i = 0; i < SERIALSTATS_NR; i++) {
+    histogram_t *h = (histogram_t *)serialStatsGet(i);
+    memset(h, 0xFF, sizeof(histogram_t));
+  }
+  char json[SERIALSTATS_JSON_SIZE];
+  size_t len = serialStatsJson(json, sizeof(json));
+  if(len + 1 >= sizeof(json) || json[len - 1] != '}') {
+    fprintf(stderr, "the latency histograms do not fit SERIALSTATS_JSON_SIZE: %s\n", json);
+    errors++;
+  }
+  return errors;
+}
+
+static void print(const char *name, result_t *r, unsigned long intact) {
+  printf("%s %lu/%lu intact datagrams, %lu never sent, %lu good, %lu bad header, %lu too long, %lu bad checksum, %5.1f ns/byte\n",
+    name, r->recovered, intact, r->accepted, r->good, r->badheader, r->toolong, r->badcrc, (double)r->ns / r->bytes);
+}
+
+int main(int argc, char **argv) {
+  const char *file = (argc > 1) ? argv[1] : "frames.txt";
+  unsigned long polls = (argc > 2) ? strtoul(argv[2], NULL, 10) : 200000;
+  int errors = 0;
+
+  nrframes = frames_load(file, frames, MAX_FRAMES);
+  if(nrframes <= 0) {
+    fprintf(stderr, "no datagrams found in %s\n", file);
+    return -1;
+  }
+
+  unsigned long intact = 0;
+  result_t legacy, ring;
+  memset(&legacy, 0, sizeof(legacy));
+  memset(&ring, 0, sizeof(ring));
+  serialFrameReset(&serialFrame);
+
+  run(&legacy, legacy_read, legacy_drop, polls, &intact, false);
+  run(&ring, ring_read, ring_drop, polls, &intact, false);
+
+  printf("%lu polls without noise, %llu bytes\n", polls, ring.bytes);
+  print("reset on error:", &legacy, intact);
+  print("ring buffer:   ", &ring, intact);
+  if(legacy.recovered != intact || ring.recovered != intact) {
+    fprintf(stderr, "datagrams lost on a clean line\n");
+    errors++;
+  }
+
+  memset(&legacy, 0, sizeof(legacy));
+  memset(&ring, 0, sizeof(ring));
+  serialFrameReset(&serialFrame);
+
+  run(&legacy, legacy_read, legacy_drop, polls, &intact, true);
+  run(&ring, ring_read, ring_drop, polls, &intact, true);
+
+  printf("%lu polls with noise, %llu bytes\n", polls, ring.bytes);
+  print("reset on error:", &legacy, intact);
+  print("ring buffer:   ", &ring, intact);
+
+  /*
+   * Every datagram the previous parser got, the ring buffer
+   * gets as well, and noise may only pass the checksum by
+   * chance.
+   */
+  if(ring.recovered < legacy.recovered || ring.recovered + ring.recovered / 1000 < intact) {
+    fprintf(stderr, "the ring buffer parser lost datagrams\n");
+    errors++;
+  }
+  if(ring.accepted > polls / 1000) {
+    fprintf(stderr, "the ring buffer parser accepted %lu datagrams that were never sent\n", ring.accepted);
+    errors++;
+  }
+
+  errors += commandChecksums(polls);
+  errors += latencyHistograms(polls / 10);
+
+  return errors > 0 ? -1 : 0;
+}
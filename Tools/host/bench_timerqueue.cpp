@@ -0,0 +1,321 @@
+/*
+  Host stress test and benchmark of the timer queue.
+
+  The stress test runs random inserts, restarts, cancels and
+  updates against the heap and a plain reference list and checks
+  both fire the same timers in deadline order. The benchmark keeps
+  the queue full with restarted timers, as rules with many
+  setTimer() calls do, and compares the heap with the previous
+  sorted array.
+
+  Usage: ./bench_timerqueue [operations]
+*/
+
+#include <time.h>
+
+#include "Arduino.h"
+#include "alloc.h"
+
+#include "src/common/timerqueue.h"
+
+static unsigned long long now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * The sorted array as it was before the heap, kept as
+ * reference for the benchmark.
+ */
+typedef struct legacy_timer_t {
+  int sec;
+  int usec;
+  int nr;
+  int remove;
+} legacy_timer_t;
+
+static struct legacy_timer_t **legacy_queue = NULL;
+static int legacy_size = 0;
+static unsigned int legacy_lasttime = 0;
+static unsigned int *legacy_calls = NULL;
+static unsigned int legacy_nrcalls = 0;
+static unsigned long legacy_fired = 0;
+
+static void legacy_sort() {
+  int matched = 1;
+  while(matched) {
+    int a = 0;
+    matched = 0;
+    for(a=0;a<legacy_size-1;a++) {
+      if(legacy_queue[a]->remove < legacy_queue[a+1]->remove ||
+         (legacy_queue[a]->remove == legacy_queue[a+1]->remove && legacy_queue[a]->sec > legacy_queue[a+1]->sec) ||
+         (legacy_queue[a]->remove == legacy_queue[a+1]->remove && legacy_queue[a]->sec == legacy_queue[a+1]->sec && legacy_queue[a]->usec > legacy_queue[a+1]->usec)) {
+        struct legacy_timer_t *node = legacy_queue[a+1];
+        legacy_queue[a+1] = legacy_queue[a];
+        legacy_queue[a] = node;
+        matched = 1;
+        break;
+      }
+    }
+  }
+}
+
+static struct legacy_timer_t *legacy_pop() {
+  if(legacy_size == 0) {
+    return NULL;
+  }
+  struct legacy_timer_t *x = legacy_queue[0];
+  legacy_queue[0] = legacy_queue[legacy_size-1];
+  legacy_size--;
+  if(legacy_size == 0) {
+    free(legacy_queue);
+    legacy_queue = NULL;
+  } else {
+    legacy_queue = (struct legacy_timer_t **)realloc(legacy_queue, sizeof(struct legacy_timer_t *)*legacy_size);
+  }
+  for(int a=0;a<legacy_size;a++) {
+    legacy_queue[a]->sec -= x->sec;
+    legacy_queue[a]->usec -= x->usec;
+    if(legacy_queue[a]->usec < 0) {
+      legacy_queue[a]->sec -= 1;
+      legacy_queue[a]->usec += 1000000;
+    }
+  }
+  legacy_sort();
+  return x;
+}
+
+static void legacy_insert(int sec, int usec, int nr) {
+  int a = 0, matched = 0;
+  for(a=0;a<legacy_size;a++) {
+    if(legacy_queue[a]->nr == nr) {
+      legacy_queue[a]->sec = sec;
+      legacy_queue[a]->usec = usec;
+      if(sec <= 0 && usec <= 0) {
+        legacy_queue[a]->remove = 1;
+      }
+      legacy_sort();
+      matched = 1;
+      break;
+    }
+  }
+  if(matched == 1) {
+    while(legacy_size > 0 && legacy_queue[0]->remove == 1) {
+      free(legacy_pop());
+    }
+    return;
+  } else if(sec == 0 && usec == 0) {
+    return;
+  }
+  legacy_queue = (struct legacy_timer_t **)realloc(legacy_queue, sizeof(struct legacy_timer_t *)*(legacy_size+1));
+  struct legacy_timer_t *node = (struct legacy_timer_t *)calloc(1, sizeof(struct legacy_timer_t));
+  node->sec = sec;
+  node->usec = usec;
+  node->nr = nr;
+  legacy_queue[legacy_size++] = node;
+  legacy_sort();
+}
+
+static void legacy_update(void) {
+  unsigned int curtime = micros();
+  unsigned int diff = curtime - legacy_lasttime;
+  unsigned int sec = diff / 1000000;
+  unsigned int usec = diff - ((diff / 1000000) * 1000000);
+  int a = 0;
+
+  legacy_lasttime = curtime;
+
+  for(a=0;a<legacy_size;a++) {
+    legacy_queue[a]->sec -= sec;
+    legacy_queue[a]->usec -= usec;
+    if(legacy_queue[a]->usec < 0) {
+      legacy_queue[a]->usec = 1000000 + legacy_queue[a]->usec;
+      legacy_queue[a]->sec -= 1;
+    }
+    if(legacy_queue[a]->sec < 0 || (legacy_queue[a]->sec == 0 && legacy_queue[a]->usec <= 0)) {
+      legacy_calls = (unsigned int *)realloc(legacy_calls, (legacy_nrcalls+1)*sizeof(unsigned int));
+      legacy_calls[legacy_nrcalls++] = legacy_queue[a]->nr;
+    }
+  }
+  for(a=0;a<legacy_size;a++) {
+    if(legacy_queue[a]->sec < 0 || (legacy_queue[a]->sec == 0 && legacy_queue[a]->usec == 0)) {
+      free(legacy_pop());
+      a--;
+    }
+  }
+  legacy_fired += legacy_nrcalls;
+  free(legacy_calls);
+  legacy_calls = NULL;
+  legacy_nrcalls = 0;
+}
+
+/*
+ * Reference model for the stress test
+ */
+#define MAX_NR 48
+
+typedef struct model_t {
+  bool active;
+  unsigned long long deadline;
+} model_t;
+
+static model_t model[MAX_NR];
+static unsigned long long model_now = 0;
+
+static int fired[TIMERQUEUE_SIZE * 2];
+static int nrfired = 0;
+static unsigned long long lastdeadline = 0;
+static int errors = 0;
+static unsigned long totalfired = 0;
+
+void timer_cb(int nr) {
+  if(nr < 0 || nr >= MAX_NR || !model[nr].active) {
+    fprintf(stderr, "timer %d fired but not running\n", nr);
+    errors++;
+    return;
+  }
+  if(model[nr].deadline < lastdeadline) {
+    fprintf(stderr, "timer %d fired out of order\n", nr);
+    errors++;
+  }
+  lastdeadline = model[nr].deadline;
+  if(nrfired < (int)(sizeof(fired)/sizeof(fired[0]))) {
+    fired[nrfired++] = nr;
+  }
+}
+
+static unsigned int model_count(void) {
+  unsigned int n = 0;
+  for(int i = 0; i < MAX_NR; i++) {
+    n += model[i].active;
+  }
+  return n;
+}
+
+static void stress(unsigned long ops) {
+  srand(2);
+  for(unsigned long op = 0; op < ops; op++) {
+    int nr = rand() % MAX_NR;
+    switch(rand() % 8) {
+      case 0: {
+        // cancel
+        timerqueue_insert(0, 0, nr);
+        model[nr].active = false;
+      } break;
+      case 1: case 2: case 3: case 4: {
+        // start or restart, only whole seconds so the real time
+        // passing between calls never crosses a deadline
+        int sec = 1 + rand() % 20;
+        bool full = !model[nr].active && model_count() >= TIMERQUEUE_SIZE;
+        int8_t ret = timerqueue_insert(sec, 0, nr);
+        if(full != (ret == -1)) {
+          fprintf(stderr, "insert of timer %d returned %d, queue full %d\n", nr, ret, full);
+          errors++;
+        }
+        if(ret == 0) {
+          model[nr].active = true;
+          model[nr].deadline = model_now + (unsigned long long)sec * 1000000;
+        }
+      } break;
+      default: {
+        unsigned long step = (rand() % 8) * 250000;
+        host_clock_advance(step);
+        model_now += step;
+
+        nrfired = 0;
+        lastdeadline = 0;
+        timerqueue_update();
+
+        int expected = 0;
+        for(int i = 0; i < MAX_NR; i++) {
+          if(model[i].active && model[i].deadline <= model_now) {
+            bool found = false;
+            for(int x = 0; x < nrfired; x++) {
+              found |= (fired[x] == i);
+            }
+            if(!found) {
+              fprintf(stderr, "timer %d expired but did not fire\n", i);
+              errors++;
+            }
+            model[i].active = false;
+            expected++;
+          }
+        }
+        totalfired += nrfired;
+        if(expected != nrfired) {
+          fprintf(stderr, "%d timers fired, %d expected\n", nrfired, expected);
+          errors++;
+        }
+      } break;
+    }
+    if(timerqueue_count() != model_count()) {
+      fprintf(stderr, "queue holds %d timers, %d expected\n", timerqueue_count(), model_count());
+      errors++;
+    }
+    if(errors > 10) {
+      return;
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  unsigned long ops = (argc > 1) ? strtoul(argv[1], NULL, 10) : 200000;
+
+  stress(ops);
+  printf("stress: %lu operations, %lu timers fired, %d errors\n", ops, totalfired, errors);
+
+  timerqueue_clear();
+  memset(model, 0, sizeof(model));
+  timerqueue_update();
+  legacy_update();
+
+  /*
+   * Keep the queue full and restart a random timer per
+   * operation, every 16 operations half a second passes.
+   */
+  unsigned long long start = 0, legacy_ns = 0, heap_ns = 0;
+  unsigned long legacy_allocs = 0, heap_allocs = 0;
+
+  for(int nr = 0; nr < TIMERQUEUE_SIZE; nr++) {
+    legacy_insert(1 + nr, 0, nr);
+  }
+  srand(3);
+  host_alloc_reset();
+  start = now_ns();
+  for(unsigned long op = 0; op < ops; op++) {
+    legacy_insert(1 + rand() % 30, 0, rand() % TIMERQUEUE_SIZE);
+    if((op % 16) == 0) {
+      host_clock_advance(500000);
+      legacy_update();
+    }
+  }
+  legacy_ns = now_ns() - start;
+  legacy_allocs = host_alloc.count;
+
+  for(int nr = 0; nr < TIMERQUEUE_SIZE; nr++) {
+    model[nr].active = true;
+    timerqueue_insert(1 + nr, 0, nr);
+  }
+  srand(3);
+  host_alloc_reset();
+  start = now_ns();
+  for(unsigned long op = 0; op < ops; op++) {
+    int nr = rand() % TIMERQUEUE_SIZE;
+    model[nr].active = true;
+    timerqueue_insert(1 + rand() % 30, 0, nr);
+    if((op % 16) == 0) {
+      host_clock_advance(500000);
+      lastdeadline = 0;
+      nrfired = 0;
+      timerqueue_update();
+    }
+  }
+  heap_ns = now_ns() - start;
+  heap_allocs = host_alloc.count;
+
+  printf("sorted array: %8.1f ns/operation, %.2f allocations/operation\n", (double)legacy_ns / ops, (double)legacy_allocs / ops);
+  printf("binary heap:  %8.1f ns/operation, %.2f allocations/operation\n", (double)heap_ns / ops, (double)heap_allocs / ops);
+
+  return errors > 0 ? -1 : 0;
+}
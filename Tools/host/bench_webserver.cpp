@@ -0,0 +1,298 @@
+/*
+  Serves the root page and /json to several webserver clients at
+  once, with a websocket client getting a stats frame now and then,
+  through the sync path of the webserver the way the sketch runs it.
+
+  The root page is written in flash pieces like handleRoot, /json in
+  MTU sized chunks of webserver_chunk and a last step of small copies
+  like the dallas and s0 output. Every response is de-chunked and
+  compared with what was queued, and every websocket frame with the
+  frame sent. It reports the heap allocations per response and how
+  many nodes and chunks had to come from the heap.
+
+  Built twice, bench_webserver with the pool sizes of the ESP8266
+  and bench_webserver_heap with no quota, which allocates every node
+  and copy on the heap as the webserver did before the pools.
+
+  Usage: ./bench_webserver [responses]
+*/
+
+#include <time.h>
+
+#include "Arduino.h"
+#include "alloc.h"
+
+#include "src/common/webserver.h"
+
+#define ROOT 1
+#define JSON 2
+
+#define SINK_SIZE 65536
+#define PIECES 7
+#define JSON_CHUNKS 6
+
+typedef struct sink_t {
+  char data[SINK_SIZE];
+  size_t len;
+  char expected[SINK_SIZE];
+  size_t expectedLen;
+} sink_t;
+
+static sink_t sinks[WEBSERVER_MAX_CLIENTS];
+static WiFiClient fakes[WEBSERVER_MAX_CLIENTS];
+static char pieces[PIECES][3][900];
+static unsigned long served = 0;
+static int errors = 0;
+
+static unsigned long long now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void append(char *to, size_t *len, const void *data, size_t size) {
+  if(*len + size > SINK_SIZE) {
+    fprintf(stderr, "sink overflow\n");
+    exit(-1);
+  }
+  memcpy(&to[*len], data, size);
+  *len += size;
+}
+
+template<int N> static int fakeWrite(const unsigned char *buf, int len) {
+  append(sinks[N].data, &sinks[N].len, buf, len);
+  return len;
+}
+
+template<int N> static int fakeWrite_P(const char *buf, int len) {
+  append(sinks[N].data, &sinks[N].len, buf, len);
+  return len;
+}
+
+static int fakeAvailable(void) {
+  return 0;
+}
+
+static int fakeConnected(void) {
+  return 1;
+}
+
+static void fakeStop(void) {
+}
+
+static int fakeRead(uint8_t *buf, int size) {
+  return 0;
+}
+
+template<int N> static void fake(void) {
+  fakes[N].write = fakeWrite<N>;
+  fakes[N].write_P = fakeWrite_P<N>;
+  fakes[N].available = fakeAvailable;
+  fakes[N].connected = fakeConnected;
+  fakes[N].stop = fakeStop;
+  fakes[N].read = fakeRead;
+  fake<N - 1>();
+}
+
+template<> void fake<-1>(void) {
+}
+
+static void queue_P(struct webserver_t *client, sink_t *s, const char *buf, uint16_t len) {
+  webserver_send_content_P(client, buf, len);
+  append(s->expected, &s->expectedLen, buf, len);
+}
+
+static void queue(struct webserver_t *client, sink_t *s, char *buf, uint16_t len) {
+  webserver_send_content(client, buf, len);
+  append(s->expected, &s->expectedLen, buf, len);
+}
+
+static int8_t callback(struct webserver_t *client, void *data) {
+  sink_t *s = &sinks[client - &clients[0].data];
+
+  if(client->step != WEBSERVER_CLIENT_WRITE && client->step != WEBSERVER_CLIENT_SENDING) {
+    return 0;
+  }
+  if(client->route == ROOT) {
+    // the flash pieces of handleRoot, with a value or two in between
+    if(client->content < PIECES) {
+      if(client->content == 0) {
+        webserver_send(client, 200, (char *)"text/html", 0);
+      }
+      for(uint8_t i = 0; i < 3; i++) {
+        queue_P(client, s, pieces[client->content][i], 300 * (i + 1));
+      }
+      char value[16];
+      queue(client, s, value, snprintf(value, sizeof(value), "%u", client->content * 7));
+    }
+  } else if(client->route == JSON) {
+    // the header goes out alone like in handleJsonOutput
+    if(client->content == 0) {
+      webserver_send(client, 200, (char *)"application/json", 0);
+    } else if(client->content <= JSON_CHUNKS) {
+      char *chunk = webserver_chunk(client);
+      uint16_t len = MTU_SIZE - 16 - client->content * 100;
+      memset(chunk, 'a' + client->content, len);
+      append(s->expected, &s->expectedLen, chunk, len);
+      webserver_send_content_nocopy(client, chunk, len);
+    } else if(client->content == JSON_CHUNKS + 1) {
+      for(uint8_t i = 0; i < 20; i++) {
+        char value[32];
+        queue(client, s, value, snprintf(value, sizeof(value), ",\"28-%02x\":%d.%d", i, 20 + i, i % 10));
+      }
+      queue_P(client, s, "}", 1);
+    }
+  }
+  return 0;
+}
+
+static void start(uint8_t i, uint8_t route) {
+  struct webserver_t *client = &clients[i].data;
+  client->client = &fakes[i];
+  client->callback = callback;
+  client->lastseen = millis();
+  client->route = route;
+  client->content = 0;
+  client->step = WEBSERVER_CLIENT_WRITE;
+  sinks[i].len = 0;
+  sinks[i].expectedLen = 0;
+}
+
+/*
+ * Strips the header and the chunk framing of a response
+ */
+static size_t dechunk(const char *in, size_t len, char *out) {
+  const char *p = (const char *)memmem(in, len, "\r\n\r\n", 4), *end = in + len;
+  size_t n = 0;
+  if(p == NULL) {
+    return 0;
+  }
+  p += 4;
+  while(p < end) {
+    char *q = NULL;
+    unsigned long size = strtoul(p, &q, 16);
+    if(q == NULL || q + 2 > end || size == 0) {
+      break;
+    }
+    p = q + 2;
+    memcpy(&out[n], p, size);
+    n += size;
+    p += size + 2;
+  }
+  return n;
+}
+
+static void check(uint8_t i) {
+  static char body[SINK_SIZE];
+  size_t len = dechunk(sinks[i].data, sinks[i].len, body);
+  if(len != sinks[i].expectedLen || memcmp(body, sinks[i].expected, len) != 0) {
+    if(errors++ < 5) {
+      fprintf(stderr, "client %u: got %zu bytes of the %zu queued\n", i, len, sinks[i].expectedLen);
+    }
+  }
+  served++;
+}
+
+/*
+ * The frames are compared as they arrive, the pings in between
+ * skipped, and taken out of the sink.
+ */
+static char frames[SINK_SIZE];
+static size_t framesLen = 0, checked = 0;
+
+static void checkFrames(uint8_t i) {
+  sink_t *s = &sinks[i];
+  size_t p = 0;
+  while(p + 2 <= s->len) {
+    uint8_t opcode = s->data[p] & 0x0f;
+    size_t len = (uint8_t)s->data[p + 1], hdr = 2;
+    if(len == 126) {
+      len = ((uint8_t)s->data[p + 2] << 8) | (uint8_t)s->data[p + 3];
+      hdr = 4;
+    }
+    if(p + hdr + len > s->len) {
+      break;
+    }
+    if(opcode == WEBSOCKET_OPCODE_TEXT) {
+      if(checked + len > framesLen || memcmp(&s->data[p + hdr], &frames[checked], len) != 0) {
+        if(errors++ < 5) {
+          fprintf(stderr, "websocket frame %zu bytes into the stream is damaged\n", checked);
+        }
+      }
+      checked += len;
+    }
+    p += hdr + len;
+  }
+  memmove(s->data, &s->data[p], s->len - p);
+  s->len -= p;
+  if(checked == framesLen) {
+    checked = framesLen = 0;
+  }
+}
+
+int main(int argc, char **argv) {
+  unsigned long responses = (argc > 1) ? strtoul(argv[1], NULL, 10) : 2000;
+  static const uint8_t routes[WEBSERVER_MAX_CLIENTS - 1] = { ROOT, ROOT, JSON, JSON };
+  unsigned long loops = 0, allocs = 0, misses = 0, frameNr = 0;
+  uint8_t ws = WEBSERVER_MAX_CLIENTS - 1;
+
+  fake<WEBSERVER_MAX_CLIENTS - 1>();
+  for(uint8_t p = 0; p < PIECES; p++) {
+    for(uint8_t i = 0; i < 3; i++) {
+      for(uint16_t x = 0; x < sizeof(pieces[p][i]); x++) {
+        pieces[p][i][x] = 'A' + (p * 3 + i + x) % 26;
+      }
+    }
+  }
+  for(uint8_t i = 0; i < ws; i++) {
+    start(i, routes[i]);
+  }
+  clients[ws].data.client = &fakes[ws];
+  clients[ws].data.callback = callback;
+  clients[ws].data.is_websocket = 1;
+  clients[ws].data.step = WEBSERVER_CLIENT_WEBSOCKET;
+
+  unsigned long long startNs = now_ns();
+  host_alloc_reset();
+  while(served < responses) {
+    if(loops % 25 == 0) {
+      char frame[512];
+      uint16_t len = snprintf(frame, sizeof(frame), "{\"data\": {\"stats\": {\"uptime\":%lu,\"loop\":%lu,\"pad\":\"%0*d\"}}}",
+        frameNr++, loops, (int)(loops % 300), 0);
+      websocket_write_all(frame, len);
+      append(frames, &framesLen, frame, len);
+    }
+    // the pongs keep the websocket from timing out
+    clients[ws].data.lastseen = millis();
+
+    webserver_loop();
+    checkFrames(ws);
+    for(uint8_t i = 0; i < ws; i++) {
+      if(clients[i].data.step == 0) {
+        check(i);
+        start(i, routes[i]);
+      }
+    }
+    host_clock_advance(1000);
+    loops++;
+  }
+  unsigned long long ns = now_ns() - startNs;
+  allocs = host_alloc.count;
+  misses = webserver_pool_misses();
+
+  if(framesLen > 0) {
+    fprintf(stderr, "%zu bytes of websocket frames did not arrive\n", framesLen - checked);
+    errors++;
+  }
+  printf("%s: %lu responses in %lu loops, %.0f ns/loop, %.2f heap allocations and %.2f pool misses per response, %lu websocket frames\n",
+    (WEBSERVER_CLIENT_CHUNKS > 0) ? "pools" : "heap", served, loops, (double)ns / loops, (double)allocs / served,
+    (double)misses / served, frameNr);
+
+#if WEBSERVER_CLIENT_CHUNKS > 0
+  if(allocs > 0 || misses > 0) {
+    fprintf(stderr, "%lu heap allocations and %lu pool misses while serving\n", allocs, misses);
+    errors++;
+  }
+#endif
+  return errors > 0 ? -1 : 0;
+}
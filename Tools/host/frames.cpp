@@ -0,0 +1,52 @@
+/*
+  Loads captured datagrams from a text file with one hex encoded
+  datagram per line. Lines starting with # are ignored.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+#include "frames.h"
+
+static int hexval(char c) {
+  if(c >= '0' && c <= '9') return c - '0';
+  if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+int frames_load(const char *file, struct frame_t *frames, int max) {
+  char line[1024];
+  int nr = 0;
+
+  FILE *fp = fopen(file, "r");
+  if(fp == NULL) {
+    fprintf(stderr, "cannot open %s\n", file);
+    return 0;
+  }
+
+  while(nr < max && fgets(line, sizeof(line), fp) != NULL) {
+    if(line[0] == '#') {
+      continue;
+    }
+    int len = 0, nibble = -1;
+    for(char *p = line; *p != '\0' && len < MAX_FRAME_SIZE; p++) {
+      int v = hexval(*p);
+      if(v < 0) {
+        continue;
+      }
+      if(nibble < 0) {
+        nibble = v;
+      } else {
+        frames[nr].data[len++] = (nibble << 4) | v;
+        nibble = -1;
+      }
+    }
+    if(len > 0) {
+      frames[nr++].len = len;
+    }
+  }
+  fclose(fp);
+  return nr;
+}
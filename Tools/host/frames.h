@@ -0,0 +1,21 @@
+/*
+  Loads captured datagrams from a text file with one hex encoded
+  datagram per line. Lines starting with # are ignored.
+*/
+
+#ifndef _HOST_FRAMES_H_
+#define _HOST_FRAMES_H_
+
+#include <stdint.h>
+
+#define MAX_FRAMES 64
+#define MAX_FRAME_SIZE 255
+
+struct frame_t {
+  uint8_t data[MAX_FRAME_SIZE];
+  uint8_t len;
+};
+
+int frames_load(const char *file, struct frame_t *frames, int max);
+
+#endif
@@ -0,0 +1,691 @@
+/*
+  Replays captured datagrams through the decoder, the rules engine,
+  the timer queue and the command encoders the way readSerial()
+  hands them over on the device, and reports the throughput, heap
+  allocations, MQTT publishes and commands per poll.
+
+  Every poll feeds each datagram of the frames file once, with a
+  few drifting temperature bytes in the main datagram, and moves
+  the host clock forward by the poll interval so rule timers fire
+  as they would on the device. The replay runs once without and
+  once with the rules file, so the difference is the cost of the
+  rules. At last the rules are booted from the image the parse
+  wrote, which has to run them the same, also when the rules of a
+  datagram are run once it is decoded, and the stats of every rule
+  have to add up to that run. A rule set with more source than fits
+  the mempool has to parse, and so do the rules after rules named
+  like the keywords. The image of a rule set may not depend on
+  where the heap put the names of its rules.
+
+  Usage: ./replay [frames.txt] [rules.txt] [polls] [interval ms]
+*/
+
+#include <time.h>
+#include <libgen.h>
+#include <unistd.h>
+#include <limits.h>
+
+#include "src/rules/rules.h"
+#include "Arduino.h"
+#include "alloc.h"
+#include "frames.h"
+#include "LittleFS.h"
+
+#include "decode.h"
+#include "commands.h"
+#include "rules.h"
+#include "webfunctions.h"
+#include "src/common/timerqueue.h"
+
+/*
+ * What the sketch and the hardware modules
+ * provide on the device.
+ */
+settingsStruct heishamonSettings;
+char actData[DATASIZE] = { '\0' };
+char actDataExtra[DATASIZE] = { '\0' };
+char actOptData[OPTDATASIZE] = { '\0' };
+
+int dallasDevicecount = 0;
+dallasDataStruct *actDallasData = NULL;
+volatile s0DataStruct actS0Data[NUM_S0_COUNTERS];
+volatile s0SettingsStruct actS0Settings[NUM_S0_COUNTERS];
+
+struct heishaOTDataStruct_t heishaOTDataStruct[] = {
+  { "roomTemp", TFLOAT, { .f = -99 }, 3 },
+  { "roomTempSet", TFLOAT, { .f = -99 }, 3 },
+  { NULL, 0, { .b = false }, 0 }
+};
+
+typedef struct stats_t {
+  unsigned long commands;
+  unsigned long commandBytes;
+  unsigned long timers;
+  unsigned long rules;
+} stats_t;
+
+static stats_t stats;
+
+bool send_setting(uint8_t command, byte *datagram, int length) {
+  stats.commands++;
+  stats.commandBytes += length;
+  return true;
+}
+
+void log_message(char *msg) {
+}
+
+void websocket_write_all(char *data, uint16_t data_len) {
+}
+
+uint8_t websocket_clients(void) {
+  return 0;
+}
+
+void timer_cb(int nr) {
+  stats.timers++;
+  if(nr > 0) {
+    rules_timer_cb(nr);
+  }
+}
+
+// there are no pins on the host
+int8_t rule_function_gpio_callback(void) {
+  return -1;
+}
+
+static void (*rule_done)(struct rules_t *obj) = NULL;
+
+static void count_rule(struct rules_t *obj) {
+  stats.rules++;
+  if(rule_done != NULL) {
+    rule_done(obj);
+  }
+}
+
+static unsigned long long now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+typedef struct result_t {
+  unsigned long frames;
+  unsigned long long ns;
+  unsigned long allocs;
+  unsigned long published;
+  unsigned long publishedBytes;
+  stats_t stats;
+} result_t;
+
+static void replay(result_t *r, struct frame_t *frames, int nrframes, unsigned long polls, unsigned long interval) {
+  static const uint8_t drifting[] = { 139, 140, 143, 144, 145, 146, 153, 166, 169, 170, 193, 194 };
+  PubSubClient mqtt;
+  char data[MAX_FRAME_SIZE];
+
+  memset(actData, 0, sizeof(actData));
+  memset(actDataExtra, 0, sizeof(actDataExtra));
+  memset(actOptData, 0, sizeof(actOptData));
+  memset(&stats, 0, sizeof(stats));
+  resetlastalldatatime();
+
+  srand(5);
+  host_alloc_reset();
+  unsigned long long start = now_ns();
+  for(unsigned long p = 0; p < polls; p++) {
+    for(int f = 0; f < nrframes; f++) {
+      if(frames[f].len == DATASIZE && frames[f].data[3] == 0x10) {
+        for(int x = 0; x < 2; x++) {
+          uint8_t b = drifting[rand() % sizeof(drifting)];
+          frames[f].data[b] += (rand() & 1) ? 1 : -1;
+        }
+      }
+      memcpy(data, frames[f].data, frames[f].len);
+      if(heishamonSettings.coalesceRules) {
+        rules_batch_begin();
+      }
+      if(frames[f].len == DATASIZE && data[3] == 0x10) {
+        decode_heatpump_data(data, actData, mqtt, log_message, heishamonSettings.mqtt_topic_base, heishamonSettings.updateAllTime);
+      } else if(frames[f].len == DATASIZE && data[3] == 0x21) {
+        decode_heatpump_data_extra(data, actDataExtra, mqtt, log_message, heishamonSettings.mqtt_topic_base, heishamonSettings.updateAllTime);
+      } else if(frames[f].len == OPTDATASIZE) {
+        decode_optional_heatpump_data(data, actOptData, mqtt, log_message, heishamonSettings.mqtt_topic_base, heishamonSettings.updateAllTime);
+      } else {
+        r->frames--;
+      }
+      rules_batch_end();
+      r->frames++;
+    }
+    host_clock_advance(interval * 1000);
+    timerqueue_update();
+  }
+  r->ns = now_ns() - start;
+  r->allocs = host_alloc.count;
+  r->published = mqtt.published;
+  r->publishedBytes = mqtt.publishedBytes;
+  r->stats = stats;
+}
+
+#ifdef MEM_TRACK
+#include <algorithm>
+#include <string>
+
+/*
+ * Lists the call sites by allocations per poll, and checks every
+ * tracked allocation was either freed or is still alive and the
+ * report writes valid parts.
+ */
+static int report(FILE *out, unsigned long polls) {
+  uint8_t order[MEM_TRACK_SITES], nr = mem_track_nrsites(), i = 0, x = 0;
+  int errors = 0;
+
+  for(i=0;i<nr;i++) {
+    order[i] = i;
+  }
+  std::sort(order, order + nr, [](uint8_t a, uint8_t b) { return mem_track_site(a)->allocs > mem_track_site(b)->allocs; });
+
+  fprintf(out, "allocations by call site, lifetimes up to 1/10/100/1000/10000 ms and longer:\n");
+  for(i=0;i<nr;i++) {
+    const struct mem_track_site_t *s = mem_track_site(order[i]);
+    fprintf(out, "  %-26s:%-5u %8.2f/poll %6.1f bytes avg, %3u live (%5lu bytes, peak %5lu), lifetimes",
+      (s->file != NULL) ? strstr(s->file, "HeishaMon/") + 10 : "other", s->line, (double)s->allocs / polls,
+      (double)s->bytes / s->allocs, s->live, (unsigned long)s->live_bytes, (unsigned long)s->peak_bytes);
+    for(x=0;x<MEM_TRACK_LIFETIMES;x++) {
+      fprintf(out, " %lu", (unsigned long)s->lifetimes[x]);
+    }
+    fprintf(out, "\n");
+    if(s->allocs != s->frees + s->live) {
+      fprintf(stderr, "%s:%u: %u allocations, %u freed and %u alive\n", s->file, s->line, s->allocs, s->frees, s->live);
+      errors++;
+    }
+  }
+
+  char json[MEM_TRACK_JSON_SIZE];
+  std::string all;
+  size_t len = 0;
+  for(x=0;(len = mem_track_json(x, json, sizeof(json))) > 0;x++) {
+    if(len + 1 >= sizeof(json)) {
+      fprintf(stderr, "part %u of the report does not fit MEM_TRACK_JSON_SIZE\n", x);
+      errors++;
+    }
+    all.append(json, len);
+  }
+  if(x != nr + 2 || all.back() != '}' || std::count(all.begin(), all.end(), '{') != std::count(all.begin(), all.end(), '}')) {
+    fprintf(stderr, "the report is broken: %s\n", all.c_str());
+    errors++;
+  }
+  return errors;
+}
+#endif
+
+static void print(FILE *out, const char *name, result_t *r, unsigned long polls) {
+  fprintf(out, "%s: %lu frames, %7.0f frames/s, %6.0f ns/frame, %5.1f allocations/poll\n",
+    name, r->frames, (double)r->frames * 1e9 / r->ns, (double)r->ns / r->frames, (double)r->allocs / polls);
+  fprintf(out, "  %.2f publishes/poll (%.0f bytes), %lu rule blocks, %lu timers, %lu commands (%lu bytes)\n",
+    (double)r->published / polls, (double)r->publishedBytes / polls, r->stats.rules, r->stats.timers, r->stats.commands, r->stats.commandBytes);
+}
+
+typedef struct boot_t {
+  unsigned long long ns;
+  unsigned long allocs;
+  unsigned long bytes;
+} boot_t;
+
+/*
+ * Writes a rule set laid out with a lot of white space, whose
+ * source alone is larger than the mempool while the bytecode
+ * fits. It only compiles when the source is staged a block at
+ * a time.
+ */
+static size_t writeLarge(const char *path, int blocks) {
+  File f = LittleFS.open(path, "w");
+  size_t len = 0;
+  char block[256];
+  for(int i = 0; i < blocks; i++) {
+    int n = snprintf(block, sizeof(block),
+      "on timer=%d then\n"
+      "\n"
+      "        if @Outside_Temp > %d then\n"
+      "\n"
+      "                #outsideTemperatureCopy = @Outside_Temp + 1;\n"
+      "\n"
+      "        else\n"
+      "\n"
+      "                #outsideTemperatureCopy = 0;\n"
+      "\n"
+      "        end\n"
+      "\n"
+      "end\n\n", i + 1, i % 20);
+    len += f.write((uint8_t *)block, n);
+  }
+  f.close();
+  return len;
+}
+
+/*
+ * The rules file with rules in front whose names start like the
+ * keywords, which may not be taken for them when the file is cut
+ * into blocks.
+ */
+#define KEYWORD_RULES 3
+
+static size_t writeKeywordNames(const char *path, const char *rulesfile) {
+  static const char *names =
+    "on Ontime then\n"
+    "  #keywordNames = 1;\n"
+    "end\n"
+    "\n"
+    "on iffy then\n"
+    "  if #keywordNames == 1 then\n"
+    "    #keywordNames = 2;\n"
+    "  end\n"
+    "end\n"
+    "\n"
+    "on endOfDay then\n"
+    "  #keywordNames = 3;\n"
+    "end\n"
+    "\n";
+  File in = LittleFS.open(rulesfile, "r");
+  File f = LittleFS.open(path, "w");
+  size_t len = f.write((uint8_t *)names, strlen(names));
+  char buf[128];
+  int n = 0;
+  while((n = in.readBytes(buf, sizeof(buf))) > 0) {
+    len += f.write((uint8_t *)buf, n);
+  }
+  in.close();
+  f.close();
+  return len;
+}
+
+static uint16_t countRules(void) {
+  char json[RULES_STATS_JSON_SIZE];
+  uint16_t part = 0;
+  while(rules_stats_json(part, json, sizeof(json)) > 0) {
+    part++;
+  }
+  // the opening and closing parts
+  return (part > 2) ? part - 2 : 0;
+}
+
+/*
+ * A rule set of functions called from System#Boot, the first
+ * one padded with statements so the rules after it move through
+ * the chunks the image is written in.
+ */
+#define SHIFTED_LAYOUTS 16
+
+static size_t writeShifted(const char *path, int pad, int functions) {
+  File f = LittleFS.open(path, "w");
+  size_t len = 0;
+  char block[128];
+  int i = 0;
+  for(i = 0; i < functions; i++) {
+    len += f.write((uint8_t *)block, snprintf(block, sizeof(block), "on shift%d then\n  #shifted = #shifted * 2;\n", i));
+    for(int x = 0; i == 0 && x < pad; x++) {
+      len += f.write((uint8_t *)block, snprintf(block, sizeof(block), "  #shifted = #shifted + %d;\n", x + 1));
+    }
+    len += f.write((uint8_t *)block, snprintf(block, sizeof(block), "end\n\n"));
+  }
+  len += f.write((uint8_t *)block, snprintf(block, sizeof(block), "on System#Boot then\n  #shifted = 1;\n"));
+  for(i = 0; i < functions; i++) {
+    len += f.write((uint8_t *)block, snprintf(block, sizeof(block), "  shift%d();\n", i));
+  }
+  len += f.write((uint8_t *)block, snprintf(block, sizeof(block), "end\n"));
+  f.close();
+  return len;
+}
+
+static int boot(boot_t *b, const char *path) {
+  host_alloc_reset();
+  unsigned long long start = now_ns();
+  int ret = rules_parse((char *)path);
+  b->ns = now_ns() - start;
+  b->allocs = host_alloc.count;
+  b->bytes = host_alloc.bytes;
+  return ret;
+}
+
+/*
+ * Takes the stats of the rules as written for /rules/stats, a
+ * part per line.
+ */
+static size_t takeRuleStats(char *buf, size_t size) {
+  char json[RULES_STATS_JSON_SIZE];
+  size_t len = 0, n = 0;
+  for(uint16_t part = 0; (n = rules_stats_json(part, json, sizeof(json))) > 0 && len + n + 2 < size; part++) {
+    len += snprintf(&buf[len], size - len, "%s\n", json);
+  }
+  return len;
+}
+
+/*
+ * The runs and commands of the rules have to add up to the ones
+ * the replay counted, with the run of System#Boot on top, and
+ * their times have to be in order.
+ */
+static int checkRuleStats(FILE *out, char *buf, result_t *r) {
+  unsigned long runs = 0, commands = 0;
+  int errors = 0;
+  char *line = strtok(buf, "\n");
+
+  for(; line != NULL; line = strtok(NULL, "\n")) {
+    char name[64];
+    unsigned long nr = 0, n = 0, total = 0, min = 0, avg = 0, max = 0, p95 = 0, steps = 0, stack = 0, cmds = 0;
+    if(strlen(line) + 1 >= RULES_STATS_JSON_SIZE) {
+      fprintf(stderr, "a rule does not fit RULES_STATS_JSON_SIZE: %s\n", line);
+      errors++;
+    }
+    if(strcmp(line, "[") == 0 || strcmp(line, "]") == 0) {
+      continue;
+    }
+    if(sscanf((line[0] == ',') ? &line[1] : line,
+         "{\"rule\":\"%63[^\"]\",\"nr\":%lu,\"runs\":%lu,\"total\":%lu,\"min\":%lu,\"avg\":%lu,\"max\":%lu,\"p95\":%lu,\"steps\":%lu,\"stack\":%lu,\"commands\":%lu}",
+         name, &nr, &n, &total, &min, &avg, &max, &p95, &steps, &stack, &cmds) != 11) {
+      fprintf(stderr, "the stats of a rule are broken: %s\n", line);
+      errors++;
+      continue;
+    }
+    if(n > 0 && (min > avg || avg > max || p95 < min || p95 > max || steps < n || stack < 4)) {
+      fprintf(stderr, "the stats of rule %s are off: %s\n", name, line);
+      errors++;
+    }
+    fprintf(out, "  %-18s %6lu runs, min/avg/p95/max %3lu/%3lu/%3lu/%3lu us, %5.1f steps/run, %2lu stack bytes, %lu commands\n",
+      name, n, min, avg, p95, max, (n > 0) ? (double)steps / n : 0, stack, cmds);
+    runs += n;
+    commands += cmds;
+  }
+  if(runs != r->stats.rules + 1 || commands != r->stats.commands) {
+    fprintf(stderr, "%lu runs and %lu commands in the stats of the rules, %lu and %lu replayed\n",
+      runs, commands, r->stats.rules + 1, r->stats.commands);
+    errors++;
+  }
+  return errors;
+}
+
+/*
+ * The summary for the websocket has to fit its buffer, count all
+ * runs and list the rules that took the most time first.
+ */
+static int checkRuleSummary(FILE *out, const char *summary, result_t *r) {
+  unsigned long nr = 0, runs = 0, total = 0, max = 0, last = ~0UL;
+  int busiest = 0;
+  const char *p = summary;
+  size_t len = strlen(summary);
+
+  if(len + 1 >= RULES_STATS_SUMMARY_SIZE || len < 2 || strcmp(&summary[len - 2], "]}") != 0 ||
+     sscanf(summary, "{\"rules\":%lu,\"runs\":%lu,\"total\":%lu,\"max\":%lu,", &nr, &runs, &total, &max) != 4 ||
+     runs != r->stats.rules + 1) {
+    fprintf(stderr, "the summary of the rules is off: %s\n", summary);
+    return 1;
+  }
+  while((p = strstr(p, "\"total\":")) != NULL) {
+    unsigned long t = strtoul(p + 8, NULL, 10);
+    if(p != strstr(summary, "\"total\":")) {
+      if(t > last || t > total) {
+        fprintf(stderr, "the busiest rules are not in order: %s\n", summary);
+        return 1;
+      }
+      last = t;
+      busiest++;
+    }
+    p += 8;
+  }
+  if(busiest > RULES_STATS_BUSIEST || (busiest == 0 && total > 0)) {
+    fprintf(stderr, "%d busiest rules in the summary: %s\n", busiest, summary);
+    return 1;
+  }
+  fprintf(out, "the websocket summary (%zu bytes): %s\n", len, summary);
+  return 0;
+}
+
+static size_t readImage(char *buf, size_t size) {
+  File f = LittleFS.open(RULES_IMAGE_FILE, "r");
+  if(!f) {
+    return 0;
+  }
+  size_t len = f.readBytes(buf, size);
+  f.close();
+  return len;
+}
+
+/*
+ * The image may not depend on where the heap put the names of
+ * the rules, not even when the pointer to one straddles two of
+ * the chunks the mempool is written in. Each layout is parsed
+ * twice, the second time with the heap shifted.
+ */
+static int checkShiftedImages(const char *path, int layouts) {
+  static char first[MEMPOOL_SIZE * 2], second[MEMPOOL_SIZE * 2];
+  int pad = 0;
+
+  for(pad = 0; pad < layouts; pad++) {
+    writeShifted(path, pad, 6);
+    LittleFS.remove(RULES_IMAGE_FILE);
+    if(rules_parse((char *)path) != 0) {
+      fprintf(stderr, "failed to parse the rule set padded with %d statements\n", pad);
+      return -1;
+    }
+    size_t len = readImage(first, sizeof(first));
+    void *shift = malloc(24 + 8 * pad);
+    LittleFS.remove(RULES_IMAGE_FILE);
+    int ret = rules_parse((char *)path);
+    free(shift);
+    if(ret != 0 || len == 0 || readImage(second, sizeof(second)) != len || memcmp(first, second, len) != 0) {
+      fprintf(stderr, "the image of the rule set padded with %d statements depends on the heap\n", pad);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static void writeImage(char *buf, size_t len) {
+  File f = LittleFS.open(RULES_IMAGE_FILE, "w");
+  f.write((uint8_t *)buf, len);
+  f.close();
+}
+
+// where the fields are in the header of the image, see rules_image_t
+#define IMAGE_POOLBYTES 24
+#define IMAGE_VARBYTES 28  // and varsize after it
+#define IMAGE_HEADER 32
+
+/*
+ * The image written with the bytes at offset replaced, it has
+ * to be turned down without the loader freeing what it did not
+ * allocate itself, parsed again and written anew.
+ */
+static int checkDamagedImage(const char *path, const char *image, size_t len, size_t offset, const void *bytes, size_t size, const char *what) {
+  static char damaged[MEMPOOL_SIZE * 2];
+  boot_t repaired;
+  memcpy(damaged, image, len);
+  memcpy(&damaged[offset], bytes, size);
+  writeImage(damaged, len);
+  if(boot(&repaired, path) != 0 || readImage(damaged, sizeof(damaged)) != len || memcmp(damaged, image, len) != 0) {
+    fprintf(stderr, "a %s with %s was not replaced\n", RULES_IMAGE_FILE, what);
+    return -1;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  const char *file = (argc > 1) ? argv[1] : "frames.txt";
+  const char *rulesfile = (argc > 2) ? argv[2] : "rules.txt";
+  unsigned long polls = (argc > 3) ? strtoul(argv[3], NULL, 10) : 20000;
+  unsigned long interval = (argc > 4) ? strtoul(argv[4], NULL, 10) : 5000;
+  static struct frame_t frames[MAX_FRAMES], copy[MAX_FRAMES];
+  int nrframes = frames_load(file, frames, MAX_FRAMES);
+
+  if(nrframes <= 0) {
+    fprintf(stderr, "no datagrams found in %s\n", file);
+    return -1;
+  }
+  /*
+   * The host path of the rules engine prints what it
+   * runs to stdout, keep that out of the report.
+   */
+  FILE *out = fdopen(dup(STDOUT_FILENO), "w");
+  if(out == NULL || freopen("/dev/null", "w", stdout) == NULL) {
+    return -1;
+  }
+
+  result_t plain, ruled;
+  memset(&plain, 0, sizeof(plain));
+  memset(&ruled, 0, sizeof(ruled));
+
+  memcpy(copy, frames, sizeof(frames));
+  replay(&plain, copy, nrframes, polls, interval);
+
+  /*
+   * The rules are read through the LittleFS shim,
+   * which looks in the directory of the file.
+   */
+  char dir[256], name[256], path[258];
+  snprintf(dir, sizeof(dir), "%s", rulesfile);
+  snprintf(name, sizeof(name), "%s", rulesfile);
+  setenv("HEISHAMON_FS", dirname(dir), 1);
+  snprintf(path, sizeof(path), "/%s", basename(name));
+
+  boot_t parsed, loaded;
+  LittleFS.remove(RULES_IMAGE_FILE);
+  if(boot(&parsed, path) != 0) {
+    fprintf(stderr, "failed to parse %s\n", rulesfile);
+    return -1;
+  }
+  uint16_t nrParsed = countRules();
+  rule_done = rule_options.done_cb;
+  rule_options.done_cb = count_rule;
+  rules_boot();
+
+  memcpy(copy, frames, sizeof(frames));
+  replay(&ruled, copy, nrframes, polls, interval);
+
+  /*
+   * Booting again loads the rules from the image written by the
+   * parse, they have to run the same. A damaged image is parsed
+   * again and written anew.
+   */
+  static char image[MEMPOOL_SIZE * 2], damaged[MEMPOOL_SIZE * 2];
+  size_t imageLen = readImage(image, sizeof(image));
+  result_t imaged;
+  memset(&imaged, 0, sizeof(imaged));
+  if(imageLen == 0 || boot(&loaded, path) != 0) {
+    fprintf(stderr, "failed to load %s\n", RULES_IMAGE_FILE);
+    return -1;
+  }
+  rules_boot();
+  memcpy(copy, frames, sizeof(frames));
+  replay(&imaged, copy, nrframes, polls, interval);
+
+  /*
+   * The same rules once more, run once each per datagram after
+   * it is decoded, have to run as often and send the same.
+   */
+  result_t coalesced;
+  boot_t again;
+  memset(&coalesced, 0, sizeof(coalesced));
+  if(boot(&again, path) != 0) {
+    fprintf(stderr, "failed to load %s\n", RULES_IMAGE_FILE);
+    return -1;
+  }
+  rules_boot();
+  heishamonSettings.coalesceRules = true;
+  memcpy(copy, frames, sizeof(frames));
+  replay(&coalesced, copy, nrframes, polls, interval);
+  heishamonSettings.coalesceRules = false;
+
+  static char ruleStats[RULES_STATS_JSON_SIZE * 16];
+  takeRuleStats(ruleStats, sizeof(ruleStats));
+  static char ruleSummary[RULES_STATS_SUMMARY_SIZE];
+  rules_stats_summary_json(ruleSummary, sizeof(ruleSummary));
+
+  /*
+   * A flipped bit is only found by the checksum. More variables
+   * than written pull their names into the nodes, and the first
+   * node is overwritten with a wrong type and a pointer of junk.
+   */
+  uint16_t poolbytes = 0, vars[2];
+  memcpy(&poolbytes, &image[IMAGE_POOLBYTES], sizeof(poolbytes));
+  memcpy(vars, &image[IMAGE_VARBYTES], sizeof(vars));
+  vars[0] += 96;
+  vars[1] = vars[0];
+  char flipped = image[imageLen / 2] ^ 0x10, junk[16];
+  memset(junk, 0x5A, sizeof(junk));
+  junk[0] = 0x7F;
+  if(checkDamagedImage(path, image, imageLen, imageLen / 2, &flipped, 1, "a flipped bit") != 0 ||
+     checkDamagedImage(path, image, imageLen, IMAGE_VARBYTES, vars, sizeof(vars), "more variables than written") != 0 ||
+     checkDamagedImage(path, image, imageLen, IMAGE_HEADER + poolbytes, junk, sizeof(junk), "a variable of junk") != 0) {
+    return -1;
+  }
+
+  char large[PATH_MAX];
+  snprintf(large, sizeof(large), "%s.large", path);
+  size_t largeLen = writeLarge(large, 96);
+  boot_t big;
+  if(boot(&big, large) != 0) {
+    fprintf(stderr, "failed to parse the large rule set\n");
+    return -1;
+  }
+  size_t largeImage = readImage(damaged, sizeof(damaged));
+  if(checkShiftedImages(large, SHIFTED_LAYOUTS) != 0) {
+    return -1;
+  }
+  LittleFS.remove(large);
+
+  char keywords[PATH_MAX];
+  snprintf(keywords, sizeof(keywords), "%s.keywords", path);
+  writeKeywordNames(keywords, path);
+  LittleFS.remove(RULES_IMAGE_FILE);
+  if(rules_parse(keywords) != 0 || countRules() != nrParsed + KEYWORD_RULES) {
+    fprintf(stderr, "the rules after names like the keywords were not all parsed, %u of %u\n", countRules(), nrParsed + KEYWORD_RULES);
+    return -1;
+  }
+  LittleFS.remove(keywords);
+  LittleFS.remove(RULES_IMAGE_FILE);
+  if(largeLen <= MEMPOOL_SIZE) {
+    fprintf(stderr, "the large rule set fits the mempool with its source\n");
+    return -1;
+  }
+
+  fprintf(out, "%lu polls every %lu ms\n", polls, interval);
+  print(out, "decode", &plain, polls);
+  print(out, "decode and rules", &ruled, polls);
+  print(out, "rules from image", &imaged, polls);
+  print(out, "coalesced rules", &coalesced, polls);
+  fprintf(out, "rules parsed in %.0f us with %lu allocations (%lu bytes), loaded from a %zu byte image in %.0f us with %lu allocations (%lu bytes)\n",
+    parsed.ns / 1e3, parsed.allocs, parsed.bytes, imageLen, loaded.ns / 1e3, loaded.allocs, loaded.bytes);
+  fprintf(out, "a %zu byte rule set with a %zu byte image parsed in %.0f us, the mempool is %d bytes\n",
+    largeLen, largeImage, big.ns / 1e3, MEMPOOL_SIZE);
+  fprintf(out, "%d layouts of a rule set gave the same image with the heap shifted\n", SHIFTED_LAYOUTS);
+  fprintf(out, "%u rules parsed with %d rules named like the keywords in front\n", nrParsed + KEYWORD_RULES, KEYWORD_RULES);
+  // the publishes of the decoder depend on the wall clock
+  if(memcmp(&imaged.stats, &ruled.stats, sizeof(stats_t)) != 0) {
+    fprintf(stderr, "the rules from the image did not run the same\n");
+    fclose(out);
+    return -1;
+  }
+  fprintf(out, "the rules in the coalesced replay:\n");
+  if(checkRuleStats(out, ruleStats, &coalesced) != 0 || checkRuleSummary(out, ruleSummary, &coalesced) != 0) {
+    fclose(out);
+    return -1;
+  }
+  if(memcmp(&coalesced.stats, &ruled.stats, sizeof(stats_t)) != 0) {
+    fprintf(stderr, "the coalesced rules did not run the same\n");
+    fclose(out);
+    return -1;
+  }
+  if(loaded.allocs >= parsed.allocs) {
+    fprintf(stderr, "the rules were parsed again instead of loaded\n");
+    fclose(out);
+    return -1;
+  }
+#ifdef MEM_TRACK
+  if(report(out, polls) != 0) {
+    fclose(out);
+    return -1;
+  }
+#endif
+  fclose(out);
+
+  return 0;
+}
@@ -0,0 +1,173 @@
+/*
+  Minimal Arduino shim so the HeishaMon core can be compiled and
+  benchmarked on a Linux host.
+*/
+
+#include <time.h>
+
+#include "Arduino.h"
+
+static unsigned long long clock_offset = 0;
+static unsigned long long clock_start = 0;
+
+static unsigned long long host_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  unsigned long long us = (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+  if(clock_start == 0) {
+    clock_start = us;
+  }
+  return us - clock_start + clock_offset;
+}
+
+unsigned long millis(void) {
+  return (unsigned long)(host_now() / 1000);
+}
+
+unsigned long micros(void) {
+  return (unsigned long)host_now();
+}
+
+void delay(unsigned long ms) {
+  host_clock_advance(ms * 1000);
+}
+
+void host_clock_advance(unsigned long us) {
+  clock_offset += us;
+}
+
+String::String(void) : buf(NULL), len(0) {
+}
+
+String::String(const char *str) : buf(NULL), len(0) {
+  if(str != NULL) {
+    assign(str, strlen(str));
+  }
+}
+
+String::String(const String &str) : buf(NULL), len(0) {
+  assign(str.c_str(), str.len);
+}
+
+String::String(char c) : buf(NULL), len(0) {
+  assign(&c, 1);
+}
+
+String::String(int value) : buf(NULL), len(0) {
+  char tmp[16];
+  assign(tmp, snprintf(tmp, sizeof(tmp), "%d", value));
+}
+
+String::String(unsigned int value) : buf(NULL), len(0) {
+  char tmp[16];
+  assign(tmp, snprintf(tmp, sizeof(tmp), "%u", value));
+}
+
+String::String(long value) : buf(NULL), len(0) {
+  char tmp[24];
+  assign(tmp, snprintf(tmp, sizeof(tmp), "%ld", value));
+}
+
+String::String(unsigned long value) : buf(NULL), len(0) {
+  char tmp[24];
+  assign(tmp, snprintf(tmp, sizeof(tmp), "%lu", value));
+}
+
+String::String(double value, unsigned char decimals) : buf(NULL), len(0) {
+  char tmp[48];
+  assign(tmp, snprintf(tmp, sizeof(tmp), "%.*f", decimals, value));
+}
+
+String::String(float value, unsigned char decimals) : String((double)value, decimals) {
+}
+
+String::~String(void) {
+  free(buf);
+}
+
+void String::assign(const char *str, unsigned int n) {
+  char *p = (char *)realloc(buf, n + 1);
+  if(p == NULL) {
+    fprintf(stderr, "out of memory\n");
+    exit(-1);
+  }
+  buf = p;
+  memmove(buf, str, n);
+  buf[n] = '\0';
+  len = n;
+}
+
+void String::append(const char *str, unsigned int n) {
+  char *p = (char *)realloc(buf, len + n + 1);
+  if(p == NULL) {
+    fprintf(stderr, "out of memory\n");
+    exit(-1);
+  }
+  buf = p;
+  memcpy(&buf[len], str, n);
+  len += n;
+  buf[len] = '\0';
+}
+
+String &String::operator=(const String &str) {
+  if(this != &str) {
+    assign(str.c_str(), str.len);
+  }
+  return *this;
+}
+
+String &String::operator=(const char *str) {
+  assign(str, strlen(str));
+  return *this;
+}
+
+String &String::operator+=(const String &str) {
+  append(str.c_str(), str.len);
+  return *this;
+}
+
+String &String::operator+=(const char *str) {
+  append(str, strlen(str));
+  return *this;
+}
+
+String &String::operator+=(char c) {
+  append(&c, 1);
+  return *this;
+}
+
+String operator+(const String &a, const String &b) {
+  String r(a);
+  r += b;
+  return r;
+}
+
+String operator+(const String &a, const char *b) {
+  String r(a);
+  r += b;
+  return r;
+}
+
+bool String::operator==(const String &str) const {
+  return len == str.len && strcmp(c_str(), str.c_str()) == 0;
+}
+
+bool String::operator!=(const String &str) const {
+  return !(*this == str);
+}
+
+bool String::operator==(const char *str) const {
+  return strcmp(c_str(), str) == 0;
+}
+
+bool String::operator!=(const char *str) const {
+  return !(*this == str);
+}
+
+long String::toInt(void) const {
+  return atol(c_str());
+}
+
+float String::toFloat(void) const {
+  return atof(c_str());
+}
@@ -0,0 +1,125 @@
+/*
+  Minimal Arduino shim so the HeishaMon core can be compiled and
+  benchmarked on a Linux host. Only what the sketch actually uses is
+  provided.
+*/
+
+#ifndef _HOST_ARDUINO_H_
+#define _HOST_ARDUINO_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define PROGMEM
+#define PGM_P const char *
+#define PSTR(a) (a)
+// the same as the host path of the rules engine
+#define F
+#define FPSTR(a) (a)
+
+#define memcpy_P memcpy
+#define strcpy_P strcpy
+#define strncpy_P strncpy
+#define strlen_P strlen
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define strcasecmp_P strcasecmp
+#define memcmp_P memcmp
+#define strstr_P strstr
+#define strncasecmp_P strncasecmp
+#define sprintf_P sprintf
+#define snprintf_P snprintf
+#define vsnprintf_P vsnprintf
+#define pgm_read_byte(a) (*(const uint8_t *)(a))
+#define pgm_read_word(a) (*(const uint16_t *)(a))
+
+typedef const char __FlashStringHelper;
+
+static inline uint16_t word(uint8_t h, uint8_t l) {
+  return (h << 8) | l;
+}
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+
+/*
+ * The host clock can be driven by the harness so replays
+ * run faster than real time.
+ */
+void host_clock_advance(unsigned long us);
+
+class String {
+  public:
+    String(void);
+    String(const char *str);
+    String(const String &str);
+    String(char c);
+    String(int value);
+    String(unsigned int value);
+    String(long value);
+    String(unsigned long value);
+    String(float value, unsigned char decimals = 2);
+    String(double value, unsigned char decimals = 2);
+    ~String(void);
+
+    String &operator=(const String &str);
+    String &operator=(const char *str);
+    String &operator+=(const String &str);
+    String &operator+=(const char *str);
+    String &operator+=(char c);
+    friend String operator+(const String &a, const String &b);
+    friend String operator+(const String &a, const char *b);
+
+    bool operator==(const String &str) const;
+    bool operator!=(const String &str) const;
+    bool operator==(const char *str) const;
+    bool operator!=(const char *str) const;
+
+    const char *c_str(void) const { return buf ? buf : ""; }
+    unsigned int length(void) const { return len; }
+    long toInt(void) const;
+    float toFloat(void) const;
+
+  private:
+    void assign(const char *str, unsigned int n);
+    void append(const char *str, unsigned int n);
+    char *buf;
+    unsigned int len;
+};
+
+class HardwareSerial {
+  public:
+    void begin(unsigned long baud) {}
+    int available(void) { return 0; }
+    int read(void) { return -1; }
+    size_t write(const uint8_t *buf, size_t len) { return len; }
+    size_t write(uint8_t c) { return 1; }
+    size_t print(const char *str) { return fputs(str, stderr); }
+    size_t print(const String &str) { return fputs(str.c_str(), stderr); }
+    size_t print(long n) { return fprintf(stderr, "%ld", n); }
+    size_t println(const char *str = "") { return fprintf(stderr, "%s\n", str); }
+    size_t println(const String &str) { return fprintf(stderr, "%s\n", str.c_str()); }
+    size_t println(long n) { return fprintf(stderr, "%ld\n", n); }
+    void flush(void) {}
+};
+
+class IPAddress {
+  public:
+    IPAddress(uint8_t a = 0, uint8_t b = 0, uint8_t c = 0, uint8_t d = 0) {
+      addr[0] = a; addr[1] = b; addr[2] = c; addr[3] = d;
+    }
+    uint8_t operator[](int i) const { return addr[i]; }
+
+  private:
+    uint8_t addr[4];
+};
+
+#endif
@@ -0,0 +1,31 @@
+/*
+  Host shim, the core code only includes ArduinoJson for its types.
+  Parsing always fails, so set_curves logs a decode error on the host.
+*/
+
+#ifndef _HOST_ARDUINOJSON_H_
+#define _HOST_ARDUINOJSON_H_
+
+#include "Arduino.h"
+
+class JsonVariant {
+  public:
+    JsonVariant operator[](const char *key) const { return JsonVariant(); }
+    bool isNull(void) const { return true; }
+    template <typename T> T as(void) const { return T(); }
+};
+
+class JsonDocument : public JsonVariant {
+};
+
+class DeserializationError {
+  public:
+    operator bool() const { return true; }
+    const char *c_str(void) const { return "NotSupported"; }
+};
+
+static inline DeserializationError deserializeJson(JsonDocument &doc, const char *json) {
+  return DeserializationError();
+}
+
+#endif
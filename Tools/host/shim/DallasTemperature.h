@@ -0,0 +1,12 @@
+/*
+  Host shim, the core code only includes DallasTemperature for its types.
+*/
+
+#ifndef _HOST_DALLASTEMPERATURE_H_
+#define _HOST_DALLASTEMPERATURE_H_
+
+#include "OneWire.h"
+
+typedef uint8_t DeviceAddress[8];
+
+#endif
@@ -0,0 +1,80 @@
+/*
+  LittleFS shim backed by files in the directory given by the
+  HEISHAMON_FS environment variable, or /tmp when unset.
+*/
+
+#ifndef _HOST_LITTLEFS_H_
+#define _HOST_LITTLEFS_H_
+
+#include <unistd.h>
+#include <limits.h>
+
+#include "Arduino.h"
+
+enum SeekMode {
+  SeekSet = SEEK_SET,
+  SeekCur = SEEK_CUR,
+  SeekEnd = SEEK_END
+};
+
+class File {
+  public:
+    File(FILE *fp = NULL) : fp(fp) {}
+    operator bool() const { return fp != NULL; }
+    size_t write(const uint8_t *buf, size_t len) { return fwrite(buf, 1, len, fp); }
+    size_t write(uint8_t c) { return fwrite(&c, 1, 1, fp); }
+    size_t print(const char *str) { return fputs(str, fp) < 0 ? 0 : strlen(str); }
+    size_t print(const String &str) { return print(str.c_str()); }
+    size_t read(uint8_t *buf, size_t len) { return fread(buf, 1, len, fp); }
+    size_t readBytes(char *buf, size_t len) { return fread(buf, 1, len, fp); }
+    int read(void) { return fgetc(fp); }
+    int available(void) {
+      long pos = ftell(fp);
+      fseek(fp, 0, SEEK_END);
+      long end = ftell(fp);
+      fseek(fp, pos, SEEK_SET);
+      return (int)(end - pos);
+    }
+    size_t size(void) {
+      long pos = ftell(fp);
+      fseek(fp, 0, SEEK_END);
+      long end = ftell(fp);
+      fseek(fp, pos, SEEK_SET);
+      return (size_t)end;
+    }
+    bool seek(uint32_t pos, SeekMode mode = SeekSet) { return fseek(fp, pos, mode) == 0; }
+    size_t position(void) { return (size_t)ftell(fp); }
+    void close(void) {
+      if(fp != NULL) {
+        fclose(fp);
+        fp = NULL;
+      }
+    }
+
+  private:
+    FILE *fp;
+};
+
+class LittleFSClass {
+  public:
+    bool begin(void) { return true; }
+    void end(void) {}
+    bool exists(const char *path) { return access(full(path), F_OK) == 0; }
+    bool remove(const char *path) { return unlink(full(path)) == 0; }
+    File open(const char *path, const char *mode) { return File(fopen(full(path), mode)); }
+
+  private:
+    const char *full(const char *path) {
+      const char *dir = getenv("HEISHAMON_FS");
+      if(snprintf(buf, sizeof(buf), "%s%s", dir != NULL ? dir : "/tmp", path) >= (int)sizeof(buf)) {
+        // a path that does not fit is not there
+        buf[0] = 0;
+      }
+      return buf;
+    }
+    char buf[PATH_MAX];
+};
+
+static LittleFSClass LittleFS;
+
+#endif
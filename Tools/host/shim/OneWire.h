@@ -0,0 +1,10 @@
+/*
+  Host shim, the core code only includes OneWire for its types.
+*/
+
+#ifndef _HOST_ONEWIRE_H_
+#define _HOST_ONEWIRE_H_
+
+#include "Arduino.h"
+
+#endif
@@ -0,0 +1,30 @@
+/*
+  Host shim of PubSubClient that only counts what would be published.
+*/
+
+#ifndef _HOST_PUBSUBCLIENT_H_
+#define _HOST_PUBSUBCLIENT_H_
+
+#include "Arduino.h"
+
+class PubSubClient {
+  public:
+    unsigned long published = 0;
+    unsigned long publishedBytes = 0;
+
+    bool publish(const char *topic, const char *payload, bool retained = false) {
+      published++;
+      publishedBytes += strlen(topic) + strlen(payload);
+      return true;
+    }
+    bool publish(const char *topic, const uint8_t *payload, unsigned int len, bool retained = false) {
+      published++;
+      publishedBytes += strlen(topic) + len;
+      return true;
+    }
+    bool connected(void) { return true; }
+    bool loop(void) { return true; }
+    void disconnect(void) {}
+};
+
+#endif
@@ -0,0 +1,34 @@
+/*
+  What the unit test harness of the webserver provides on a
+  Linux host, the lwip calls only matter to async clients and
+  the benchmarks only run sync ones.
+*/
+
+#ifndef _HOST_UNITTEST_H_
+#define _HOST_UNITTEST_H_
+
+#include "Arduino.h"
+
+#define TCP_WRITE_FLAG_COPY 0x01
+#define TCP_WRITE_FLAG_MORE 0x02
+
+static inline int tcp_write(void *pcb, const void *data, uint16_t len, uint8_t flags) {
+  return 0;
+}
+
+static inline int tcp_output(void *pcb) {
+  return 0;
+}
+
+static inline uint16_t tcp_sndbuf(void *pcb) {
+  return 0;
+}
+
+static inline void tcp_recved(void *pcb, uint16_t len) {
+}
+
+static inline uint8_t pbuf_free(void *p) {
+  return 0;
+}
+
+#endif